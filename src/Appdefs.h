@@ -45,7 +45,11 @@
 #define DATABASE_VERSION_NUMBER_TINY     2    // Some kind of intermediate version, we don't support it any more at all
 #define DATABASE_VERSION_NUMBER_BIN_DB   3    // Up until V3.12b
 #define DATABASE_VERSION_NUMBER_LOCKABLE 4    // V3.12b** onward, supports lockable databases (retain support for previous version too)
+#define DATABASE_VERSION_NUMBER_SLOW_MODE_V2 5 // Lockable, plus second generation CompressMoves slow mode, which older versions would silently
+                                               //  misread (only used if there are promotions, since slow mode can only happen after a promotion)
 #define DATABASE_LOCKABLE_LIMIT 10000         // Max number of restricted games we can write
+#define DATABASE_MINOR_VERSION_OFFSET_TABLE 1 // Minor version (in the FileHeader, not the compatibility header) adds a trailing table of
+                                              //  game offsets, older versions just ignore the table so the major version is unchanged
 #ifdef  USING_TARRASCH_BASE
 #define DEFAULT_DATABASE "tarrasch-base.tdb"
 #else
@@ -7,17 +7,24 @@
 #include <vector>
 #include <set>
 #include <map>
+#include <deque>
+#include <atomic>
 #include <time.h> // time_t
 #include <stdio.h>
 #include <stdarg.h>
 #include <wx/filename.h>
+#include <wx/utils.h>
+#include <wx/thread.h>
 #include "Objects.h"
 #include "Repository.h"
 #include "CompressMoves.h"
 #include "PgnRead.h"
+#include "PgnScanner.h"
 #include "CompactGame.h"
 #include "PackedGameBinDb.h"
+#include "GameTable.h"
 #include "ListableGameBinDb.h"
+#include "PieceSquareSignature.h"
 #include "BinDb.h"
 
 /*
@@ -96,6 +103,18 @@ uint32_t GameIdAllocateBottom(uint32_t count)
 
 
 static FILE         *bin_file;      //temp
+static std::string   bin_file_name;
+static bool          bin_file_slow_mode_v2;     // see DATABASE_VERSION_NUMBER_SLOW_MODE_V2
+static std::atomic<int>      bin_db_upgraded_games;     // see BinDbUpgradeSlowMode()
+static std::atomic<uint64_t> bin_db_upgraded_bytes;
+
+// Load games for searching without copying them - instead they point into a memory mapped file
+#define BIN_DB_LOAD_MAPPED
+
+// Loading a memory mapped file with an offset table is split across threads, an upper limit on
+//  threads and a lower limit on games per thread
+#define BIN_DB_LOAD_MAX_THREADS             8
+#define BIN_DB_LOAD_MIN_GAMES_PER_THREAD    50000
 
 // The 1200 byte compatibility header - Prepended to a BinDb formatted database file
 //  It makes such a file partially compatible to the original versions of TarraschDb
@@ -203,6 +222,8 @@ bool BinDbOpen( const char *db_file, std::string &error_msg )
         bin_file = NULL;
     }
     bin_file = fopen( db_file, "rb" );
+    bin_file_name = db_file;
+    bin_file_slow_mode_v2 = false;
     if( !bin_file )
     {
         error_msg = "Cannot open  " + std::string(db_file);
@@ -242,7 +263,13 @@ bool BinDbOpen( const char *db_file, std::string &error_msg )
                     lockable = true;
                     ok = true;
                 }
-                else if( version > DATABASE_VERSION_NUMBER_LOCKABLE )
+                else if( version == DATABASE_VERSION_NUMBER_SLOW_MODE_V2 )
+                {
+                    lockable = true;
+                    bin_file_slow_mode_v2 = true;
+                    ok = true;
+                }
+                else if( version > DATABASE_VERSION_NUMBER_SLOW_MODE_V2 )
                 {
                     error_msg = "Tarrasch database file " + std::string(db_file) + " expects a more recent version of Tarrasch (DB format =" + std::string(vtxt) + "), it is incompatible with this older version of Tarrasch";
                 }
@@ -317,8 +344,7 @@ void Pgn2Tdb( FILE *fin, FILE *fout )
             break;
     }
     #else
-    PgnRead pr('B',0);
-    pr.Process(fin);
+    BinDbPgnRead(fin);
     BinDbWriteOutToFile(fout,0,false);
     #endif
 }
@@ -598,13 +624,29 @@ uint8_t BinDbReadBegin()
     return cb_idx;
 }
 
-bool bin_db_append( const char *fen, const char *event, const char *site, const char *date, const char *round,
+// A game that has passed the filters in bin_db_prepare(), ready to go into the games vector
+struct BinDbPreparedGame
+{
+    std::string event;
+    std::string site;
+    std::string white;
+    std::string black;
+    uint32_t date_bin;
+    uint16_t round_bin;
+    uint8_t  result_bin;
+    uint16_t eco_bin;
+    int elo_w;
+    int elo_b;
+    std::string compressed_moves;
+};
+
+// Filter and compress a game, this is most of the work of appending a game (apart from parsing
+//  it in the first place) and it doesn't touch the games vector, so is safe to run on any thread.
+//  Returns false if the game is not to be inserted (not an error)
+static bool bin_db_prepare( const char *fen, const char *event, const char *site, const char *date, const char *round,
                   const char *white, const char *black, const char *result, const char *white_elo, const char *black_elo, const char *eco,
-                  int nbr_moves, thc::Move *moves )
+                  int nbr_moves, thc::Move *moves, BinDbPreparedGame &pg )
 {
-    bool aborted = false;
-    if( (++game_counter % 10000) == 0 )
-        cprintf( "%d games read from input .pgn so far\n", game_counter );
     if( fen )
         return false;
     if( nbr_moves < 3 )    // skip 'games' with zero, one or two moves
@@ -681,33 +723,293 @@ bool bin_db_append( const char *fen, const char *event, const char *site, const
 
     CompressMoves press;
     std::vector<thc::Move> v(moves,moves+nbr_moves);
-    std::string compressed_moves = press.Compress(v);
-    std::string sevent(event);
-    std::string ssite(site);
-    std::string swhite(white);
-    if( swhite.length()>5 && swhite.substr(swhite.length()-5)==" (wh)" )
-        swhite = swhite.substr( 0, swhite.length()-5 );
-    std::string sblack(black);
-    if( sblack.length()>5 && sblack.substr(sblack.length()-5)==" (bl)" )
-        sblack = sblack.substr( 0, sblack.length()-5 );
+    pg.compressed_moves = press.Compress(v);
+    pg.event = event;
+    pg.site  = site;
+    pg.white = white;
+    if( pg.white.length()>5 && pg.white.substr(pg.white.length()-5)==" (wh)" )
+        pg.white = pg.white.substr( 0, pg.white.length()-5 );
+    pg.black = black;
+    if( pg.black.length()>5 && pg.black.substr(pg.black.length()-5)==" (bl)" )
+        pg.black = pg.black.substr( 0, pg.black.length()-5 );
+    pg.date_bin   = (yyyy==0 ? Date2Bin(date) : date_bin);
+    pg.round_bin  = Round2Bin(round);
+    pg.result_bin = Result2Bin(result);
+    pg.eco_bin    = Eco2Bin(eco);
+    pg.elo_w = elo_w;
+    pg.elo_b = elo_b;
+    return true;
+}
+
+// Append a prepared game to the games vector
+static void bin_db_append_prepared( BinDbPreparedGame &pg )
+{
     ListableGameBinDb gb
     (
         bin_db_append_cb_idx,
         games.size(),
-        sevent,
-        ssite,
-        swhite,
-        sblack,
-        yyyy==0 ? Date2Bin(date) : date_bin,
-        Round2Bin(round),
-        Result2Bin(result),
-        Eco2Bin(eco),
-        elo_w,
-        elo_b,
-        compressed_moves
+        pg.event,
+        pg.site,
+        pg.white,
+        pg.black,
+        pg.date_bin,
+        pg.round_bin,
+        pg.result_bin,
+        pg.eco_bin,
+        pg.elo_w,
+        pg.elo_b,
+        pg.compressed_moves
     );
     make_smart_ptr( ListableGameBinDb, new_gb, gb );
     games.push_back( std::move(new_gb) );
+}
+
+bool bin_db_append( const char *fen, const char *event, const char *site, const char *date, const char *round,
+                  const char *white, const char *black, const char *result, const char *white_elo, const char *black_elo, const char *eco,
+                  int nbr_moves, thc::Move *moves )
+{
+    bool aborted = false;
+    if( (++game_counter % 10000) == 0 )
+        cprintf( "%d games read from input .pgn so far\n", game_counter );
+    BinDbPreparedGame pg;
+    if( bin_db_prepare( fen, event, site, date, round, white, black, result, white_elo, black_elo, eco, nbr_moves, moves, pg ) )
+        bin_db_append_prepared( pg );
+    return aborted;
+}
+
+// Reading .pgn files into the games vector. Parsing the games (mainly resolving SAN moves)
+//  is by far the biggest job, so it's spread over several worker threads. The calling thread
+//  splits the .pgn file into batches of games at game boundaries (with a PgnScanner), queues
+//  the batches for the workers, and appends the parsed and compressed games to the games
+//  vector, batch by batch in file order. So the games vector ends up exactly as if the file
+//  was read on one thread
+#define BIN_DB_PGN_MAX_THREADS          16
+#define BIN_DB_PGN_BATCH_GAMES          1000    // games per batch
+#define BIN_DB_PGN_BATCHES_PER_THREAD   4       // limits the batches in flight (and so memory use)
+
+// A batch of games, split off from the .pgn file
+struct PgnBatch
+{
+    std::vector<std::string> tags;              // for each game, its tag lines
+    std::vector<std::string> moves;             // for each game, its moves
+    std::vector<BinDbPreparedGame> prepared;    // the parsed games that are to be inserted
+    bool done;                                  // set by worker, protected by mutex
+};
+
+// Batches waiting for a worker
+struct PgnBatchQueue
+{
+    wxMutex mutex;
+    std::deque<PgnBatch *> todo;
+    bool reading_done;          // no more batches coming
+    std::atomic<bool> abort;
+};
+
+// A PgnRead that keeps the games it parses, rather than passing them to hook_gameover()
+class PgnReadPrepare : public PgnRead
+{
+public:
+    PgnReadPrepare() : PgnRead('B') { batch = NULL; }
+    PgnBatch *batch;
+
+protected:
+    virtual bool GameOverHook( const char *fen, const char *event, const char *site, const char *date, const char *round,
+                   const char *white, const char *black, const char *result, const char *white_elo, const char *black_elo, const char *eco,
+                   int nbr_moves, thc::Move *moves, uint64_t *UNUSED(hashes) )
+    {
+        BinDbPreparedGame pg;
+        if( bin_db_prepare( fen, event, site, date, round, white, black, result, white_elo, black_elo, eco, nbr_moves, moves, pg ) )
+            batch->prepared.push_back( std::move(pg) );
+        return false;
+    }
+};
+
+// A worker thread parses batches of games until there are no more
+class BinDbPgnThread : public wxThread
+{
+public:
+    BinDbPgnThread() : wxThread(wxTHREAD_JOINABLE) {}
+    PgnBatchQueue *queue;
+    bool started;
+
+    // thread execution starts here
+    virtual void *Entry()
+    {
+        for(;;)
+        {
+            PgnBatch *batch = NULL;
+            bool finished = false;
+            {
+                wxMutexLocker lock(queue->mutex);
+                if( queue->abort )
+                    finished = true;
+                else if( !queue->todo.empty() )
+                {
+                    batch = queue->todo.front();
+                    queue->todo.pop_front();
+                }
+                else if( queue->reading_done )
+                    finished = true;
+            }
+            if( finished )
+                break;
+            if( !batch )
+            {
+                wxMilliSleep(1);
+                continue;
+            }
+            pr.batch = batch;
+            for( unsigned int i=0; i<batch->tags.size() && !queue->abort; i++ )
+                pr.ProcessGame( batch->tags[i], batch->moves[i] );
+            wxMutexLocker lock(queue->mutex);
+            batch->done = true;
+        }
+        return NULL;
+    }
+
+private:
+    PgnReadPrepare pr;
+};
+
+// Read a .pgn file into the games vector, returns true if aborted
+bool BinDbPgnRead( FILE *infile, ProgressBar *pb )
+{
+    int nbr_threads = wxThread::GetCPUCount();
+    if( nbr_threads > BIN_DB_PGN_MAX_THREADS )
+        nbr_threads = BIN_DB_PGN_MAX_THREADS;
+    PgnBatchQueue queue;
+    queue.reading_done = false;
+    queue.abort = false;
+    std::vector<BinDbPgnThread *> threads;
+    for( int t=0; nbr_threads>=2 && t<nbr_threads; t++ )
+    {
+        BinDbPgnThread *thread = new BinDbPgnThread;
+        thread->queue = &queue;
+        thread->started = false;
+        if( thread->Create()==wxTHREAD_NO_ERROR && thread->Run()==wxTHREAD_NO_ERROR )
+        {
+            thread->started = true;
+            threads.push_back( thread );
+        }
+        else
+        {
+            cprintf( "BinDbPgnRead(), cannot start thread %d\n", t );
+            delete thread;
+        }
+    }
+
+    // No workers, read the file on this thread
+    if( threads.size() == 0 )
+    {
+        PgnRead pr('B',pb);
+        return pr.Process(infile);
+    }
+
+    // Split the file into batches and append the parsed batches, until all batches are appended
+    AutoTimer at("Parallel .pgn read");
+    unsigned int max_in_flight = threads.size() * BIN_DB_PGN_BATCHES_PER_THREAD;
+    std::deque<PgnBatch *> in_flight;
+    bool aborted = false;
+    int typ;
+    PgnScanner scanner( infile );
+    std::string tags;
+    std::string moves;
+    bool done = false;
+    int nbr_games = 0;
+    while( !aborted )
+    {
+        // Read another batch, unless enough are in flight already
+        bool busy = false;
+        if( !done && in_flight.size()<max_in_flight )
+        {
+            busy = true;
+            PgnBatch *batch = new PgnBatch;
+            batch->done = false;
+            batch->tags.reserve( BIN_DB_PGN_BATCH_GAMES );
+            batch->moves.reserve( BIN_DB_PGN_BATCH_GAMES );
+            while( !done && !aborted && batch->tags.size()<BIN_DB_PGN_BATCH_GAMES )
+            {
+                done = scanner.Next( typ );
+                switch( typ )
+                {
+                    default:
+                    {
+                        break;
+                    }
+                    case 'T':
+                    case 't':
+                    {
+                        tags += std::string(scanner.Line());
+                        if( tags[tags.length()-1] != '\n' )
+                            tags += '\n';
+                        break;
+                    }
+                    case 'M':
+                    case 'm':
+                    {
+                        moves += std::string(scanner.Line());
+                        moves += '\n';
+                        break;
+                    }
+                    case 'G':
+                    {
+                        batch->tags.push_back( tags );
+                        batch->moves.push_back( moves );
+                        tags.clear();
+                        moves.clear();
+                        if( pb && pb->ProgressFile() )
+                            aborted = true;
+                        break;
+                    }
+                }
+            }
+            in_flight.push_back( batch );
+            wxMutexLocker lock(queue.mutex);
+            queue.todo.push_back( batch );
+            if( done )
+                queue.reading_done = true;
+        }
+
+        // Append finished batches, oldest first, stopping at the first unfinished batch
+        while( !aborted && in_flight.size()>0 )
+        {
+            PgnBatch *batch = in_flight.front();
+            {
+                wxMutexLocker lock(queue.mutex);
+                if( !batch->done )
+                    break;
+            }
+            busy = true;
+            int nbr_batch_games = batch->tags.size();
+            if( (nbr_games+nbr_batch_games)/10000 > nbr_games/10000 )
+                cprintf( "%d games read from input .pgn so far\n", nbr_games+nbr_batch_games );
+            nbr_games += nbr_batch_games;
+            for( unsigned int i=0; i<batch->prepared.size(); i++ )
+                bin_db_append_prepared( batch->prepared[i] );
+            in_flight.pop_front();
+            delete batch;
+        }
+        if( done && in_flight.size()==0 )
+            break;
+        if( !busy )
+            wxMilliSleep(1);
+    }
+
+    // Stop the workers and clean up
+    {
+        wxMutexLocker lock(queue.mutex);
+        queue.reading_done = true;
+        if( aborted )
+            queue.abort = true;
+    }
+    for( unsigned int t=0; t<threads.size(); t++ )
+    {
+        threads[t]->Wait();     // joinable threads must be waited for, even if already finished
+        delete threads[t];
+    }
+    for( unsigned int i=0; i<in_flight.size(); i++ )
+        delete in_flight[i];
+    cprintf( "Finished %d total games\n", nbr_games );
     return aborted;
 }
 
@@ -719,6 +1021,21 @@ struct FileHeader
     int nbr_sites;
     int nbr_games;
     int locked;         // added with DATABASE_VERSION_NUMBER_LOCKABLE
+    int minor_version;  // added with DATABASE_MINOR_VERSION_OFFSET_TABLE
+};
+#define FILE_HEADER_LEN_LOCKABLE (6*sizeof(int))   // length of FileHeader before minor_version was added
+
+// The optional table of game offsets follows the last game. The offset (from the start of the
+//  file) of every BIN_DB_OFFSET_TABLE_STRIDE th game, as uint64_t, then this trailer. Readers
+//  that predate the table stop reading after the last game, so never see it
+#define BIN_DB_OFFSET_TABLE_STRIDE  4096
+#define BIN_DB_OFFSET_TABLE_MAGIC   "TDB offsets"
+struct OffsetTableTrailer
+{
+    uint32_t stride;        // offsets[n] is the offset of game n*stride
+    uint32_t nbr_offsets;
+    uint32_t nbr_games;
+    char     magic[12];
 };
 
 bool TestBinaryBlock()
@@ -957,10 +1274,8 @@ static int lev_distance( const std::string source, const std::string target )
 }
 
 
-static bool IsPlayerMatch( const char *player, std::vector<std::string> &tokens )
+static bool IsPlayerMatch( const std::vector<std::string> &tokens, const std::vector<std::string> &tokens2 )
 {
-    std::vector<std::string> tokens2;
-    Split( player, tokens2 );
     int len=tokens.size();
     int len2=tokens2.size();
     for( int i=0; i<len; i++ )
@@ -979,19 +1294,12 @@ static bool IsPlayerMatch( const char *player, std::vector<std::string> &tokens
     return false;
 }
 
-//  match only if years are present and match
-static bool IsYearMatch( const char *date1, const char *date2 )
+//  match only if years match. This used to compare the first four characters of the Date() strings,
+//   but Date() isn't thread safe (it uses a shared pool of strings). Comparing the year bits is
+//   equivalent, Bin2Date() always formats four characters of year ("????" if there is no year)
+static bool IsYearMatch( int date_bin1, int date_bin2 )
 {
-    if( !date1 || !date2 )
-        return false;
-    for( int i=0; i<4; i++ )
-    {
-        if( *date1=='\0' || *date2=='\0' )
-            return false;
-        if( *date1++ != *date2++ )
-            return false;
-    }
-    return true;
+    return ((date_bin1>>9)&0x3ff) == ((date_bin2>>9)&0x3ff);
 }
 
 uint32_t BinDbGetGamesSize()
@@ -1051,20 +1359,257 @@ void BinDbNormaliseOrder( uint32_t begin, uint32_t end )
     }
 }
 
-static bool DupDetect( smart_ptr<ListableGame> p1, std::vector<std::string> &white_tokens1, std::vector<std::string> &black_tokens1, smart_ptr<ListableGame> p2 )
+// Player name tokens, Split() out once per game rather than once per comparison
+struct DupTokens
+{
+    bool split;
+    std::vector<std::string> white;
+    std::vector<std::string> black;
+    DupTokens() : split(false) {}
+    void Calculate( ListableGame *p )
+    {
+        if( !split )
+        {
+            Split( p->White(), white );
+            Split( p->Black(), black );
+            split = true;
+        }
+    }
+};
+
+static bool DupDetect( ListableGame *p1, DupTokens &tokens1, ListableGame *p2, DupTokens &tokens2 )
 {
     bool white_match = (0 == strcmp(p1->White(),p2->White()) );
-    if( !white_match )
-        white_match = IsPlayerMatch(p2->White(),white_tokens1);
     bool black_match = (0 == strcmp(p1->Black(),p2->Black()) );
-    if( !black_match )
-        black_match = IsPlayerMatch(p2->Black(),black_tokens1);
+    if( !white_match || !black_match )
+    {
+        tokens1.Calculate(p1);
+        tokens2.Calculate(p2);
+        if( !white_match )
+            white_match = IsPlayerMatch(tokens1.white,tokens2.white);
+        if( !black_match )
+            black_match = IsPlayerMatch(tokens1.black,tokens2.black);
+    }
     bool result_match = (p1->ResultBin() == p2->ResultBin() );
-    bool year_match = IsYearMatch( p1->Date(),  p2->Date() );   // best by test - require a yyyy match, but not an exact yyyy-mm-dd match
+    bool year_match = IsYearMatch( p1->DateBin(),  p2->DateBin() );   // best by test - require a yyyy match, but not an exact yyyy-mm-dd match
     bool dup = (white_match && black_match && year_match && result_match);
     return dup;
 }
 
+// Duplicate removal is split across threads. First each thread hashes the moves of a slice of the games,
+//  then each thread looks for duplicates amongst the games whose hashes fall into its partition
+#define BIN_DB_DEDUP_MAX_THREADS    8
+#define BIN_DB_DEDUP_MIN_GAMES      100000  // below this just use one thread
+
+// 64 bit FNV-1a hash of a game's compressed moves
+static uint64_t DupHash( const char *moves )
+{
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    while( *moves )
+    {
+        hash ^= static_cast<unsigned char>(*moves++);
+        hash *= 0x100000001b3ULL;
+    }
+    return hash;
+}
+
+struct DupEntry
+{
+    uint64_t hash;
+    uint32_t idx;
+    bool operator < (const DupEntry &rhs) const
+    {
+        if( hash != rhs.hash )
+            return hash < rhs.hash;
+        return idx < rhs.idx;
+    }
+};
+
+class DupThread : public wxThread
+{
+public:
+    DupThread() : wxThread(wxTHREAD_JOINABLE) {}
+    std::vector<uint64_t> *hashes;
+    bool hashing;               // first pass, else second pass
+    int  part;                  // this thread's slice (first pass) or partition (second pass)
+    int  nbr_parts;
+    std::atomic<bool> *abort;
+    std::atomic<int> nbr_done;
+    std::atomic<bool> finished;
+    bool started;
+    std::vector<uint32_t> dup_log;  // for each game with duplicates; game idx, nbr of dups, dup idxs
+
+    // thread execution starts here
+    virtual void *Entry()
+    {
+        Work();
+        return NULL;
+    }
+    void Work()
+    {
+        if( hashing )
+            Hash();
+        else
+            Detect();
+        finished = true;
+    }
+
+private:
+    void Hash()
+    {
+        size_t nbr = hashes->size();
+        size_t begin = (nbr*part) / nbr_parts;
+        size_t end   = (nbr*(part+1)) / nbr_parts;
+        for( size_t i=begin; i<end && !*abort; i++ )
+        {
+            (*hashes)[i] = DupHash( games[i]->CompressedMoves() );
+            if( (i&0x3ff) == 0 )
+                nbr_done = i-begin;
+        }
+        nbr_done = end-begin;
+    }
+
+    void Detect()
+    {
+        std::vector<DupEntry> entries;
+        size_t nbr = hashes->size();
+        for( size_t i=0; i<nbr; i++ )
+        {
+            uint64_t hash = (*hashes)[i];
+            if( hash%nbr_parts == static_cast<uint64_t>(part) )
+            {
+                DupEntry e;
+                e.hash = hash;
+                e.idx  = i;
+                entries.push_back(e);
+            }
+        }
+        std::sort( entries.begin(), entries.end() );
+
+        // Games with the same hash (in idx order)
+        size_t len = entries.size();
+        std::vector<uint32_t> same_hash;
+        std::vector<uint32_t> same_moves;
+        std::vector<uint32_t> others;
+        for( size_t i=0; i<len && !*abort; )
+        {
+            size_t j = i+1;
+            while( j<len && entries[j].hash==entries[i].hash )
+                j++;
+            if( j-i > 1 )
+            {
+                same_hash.clear();
+                for( size_t k=i; k<j; k++ )
+                    same_hash.push_back( entries[k].idx );
+
+                // Almost always the moves are all the same, but in case of hash collisions
+                //  peel off groups of games with exactly the same moves
+                while( same_hash.size() > 1 )
+                {
+                    const char *moves = games[same_hash[0]]->CompressedMoves();
+                    same_moves.clear();
+                    others.clear();
+                    for( size_t k=0; k<same_hash.size(); k++ )
+                    {
+                        if( 0 == strcmp(moves,games[same_hash[k]]->CompressedMoves()) )
+                            same_moves.push_back( same_hash[k] );
+                        else
+                            others.push_back( same_hash[k] );
+                    }
+                    if( same_moves.size() > 1 )
+                        DetectInGroup( same_moves );
+                    same_hash.swap( others );
+                }
+            }
+            nbr_done = j;
+            i = j;
+        }
+        nbr_done = len;
+    }
+
+    // Found a group of (potential) duplicates. So far we only know that the moves are identical. We
+    //  have more work to do to identify the real duplicates. Real duplicates are marked with
+    //  id = GAME_ID_SENTINEL. The group is in id order (idx order is id order)
+    void DetectInGroup( const std::vector<uint32_t> &group )
+    {
+        int n = group.size();
+        std::vector<DupTokens> tokens(n);
+
+        // For each game in group of duplicates
+        for( int a=0; a<n; a++ )
+        {
+            ListableGame *p = games[group[a]].get();
+
+            // If the game hasn't already been marked as a dup (note first of the group is never marked as a dup)
+            if( p->game_id != GAME_ID_SENTINEL )
+            {
+
+                // Sweep through the rest of the group and mark each game in turn a dup if it matches
+                //  Note that this is a O(2) type algorithm sadly, we loop through a group of games for each
+                //  game in main loop
+                size_t log_idx = dup_log.size();
+                for( int b=a+1; b<n; b++ )
+                {
+                    ListableGame *q = games[group[b]].get();
+                    if( q->game_id!=GAME_ID_SENTINEL && DupDetect(p,tokens[a],q,tokens[b]) )
+                    {
+                        q->game_id = GAME_ID_SENTINEL;
+                        if( dup_log.size() == log_idx )
+                        {
+                            dup_log.push_back( group[a] );
+                            dup_log.push_back( 0 );
+                        }
+                        dup_log[log_idx+1]++;
+                        dup_log.push_back( group[b] );
+                    }
+                }
+            }
+        }
+    }
+};
+
+// Start the threads (or if that's not possible do the work here), wait for them to finish
+//  and delete them. Returns false if aborted
+static bool DupRunThreads( std::vector<DupThread *> &threads, int total, ProgressBar *pb, std::atomic<bool> &abort )
+{
+    for( unsigned int t=0; t<threads.size(); t++ )
+    {
+        DupThread *thread = threads[t];
+        thread->nbr_done = 0;
+        thread->finished = false;
+        thread->started = false;
+        thread->abort = &abort;
+        if( threads.size()>1 && thread->Create()==wxTHREAD_NO_ERROR && thread->Run()==wxTHREAD_NO_ERROR )
+            thread->started = true;
+        else
+            thread->Work();
+    }
+
+    // Only this thread touches the progress bar
+    for(;;)
+    {
+        bool all_finished = true;
+        int total_done = 0;
+        for( unsigned int t=0; t<threads.size(); t++ )
+        {
+            total_done += threads[t]->nbr_done;
+            if( !threads[t]->finished )
+                all_finished = false;
+        }
+        if( all_finished )
+            break;
+        if( pb->Perfraction(total_done,total) )
+            abort = true;
+        wxMilliSleep(10);
+    }
+    for( unsigned int t=0; t<threads.size(); t++ )
+    {
+        if( threads[t]->started )
+            threads[t]->Wait();     // joinable threads must be waited for, even if already finished
+    }
+    return !abort;
+}
+
 static const uint32_t NBR_STEPS=1000;   // if this isn't 1000, then sort_scan() won't return permill
 static uint64_t predicate_count;
 static uint64_t predicate_nbr_expected;
@@ -1162,15 +1707,6 @@ static bool predicate_sorts_by_id( const smart_ptr<ListableGame> &e1, const smar
     return ret;
 }
 
-static bool predicate_sorts_by_game_moves( const smart_ptr<ListableGame> &e1, const smart_ptr<ListableGame> &e2 )
-{
-    bool ret = std::string(e1->CompressedMoves()) < std::string(e2->CompressedMoves());
-    predicate_count++;
-    if( (predicate_count & 0xffff) == 0 )
-        sort_progress_probe();
-    return ret;
-}
-
 static bool predicate_sorts_by_player( const smart_ptr<ListableGame> &e1, const smart_ptr<ListableGame> &e2 )
 {
     bool ret;
@@ -1305,156 +1841,76 @@ bool BinDbRemoveDuplicatesAndWrite( std::string &title, int step, FILE *ofile, b
     sprintf( buf, "%s, step %d of %d", title.c_str(), step+2, step+2 );
     std::string optional_title(buf);
     {
+        // Duplicates have identical moves, so only games with the same hash need to be compared. This
+        //  finds exactly the duplicates that sorting by moves then comparing neighbours used to find
         BinDbShowDebugOrder( games, "Duplicate Removal - phase 1 before");
-        std::string desc("Duplicate Removal - phase 1");
-        ProgressBar progress_bar( dup_title, desc, true, window );
-        progress_bar.DrawNow();
-        sort_before( games.begin(), games.end(), predicate_sorts_by_game_moves, &progress_bar );
-        std::sort( games.begin(), games.end(), predicate_sorts_by_game_moves );
-        sort_after();
-        BinDbShowDebugOrder( games, "Duplicate Removal - phase 1 after");
-    }
-    {
-        BinDbShowDebugOrder( games, "Duplicate Removal - phase 2 before");
-        std::string desc("Duplicate Removal - phase 2");
-        ProgressBar progress_bar( dup_title, desc, true, window );
-        progress_bar.DrawNow();
-        ProgressBar *pb = &progress_bar;
-        int nbr_games = games.size();
-
-        // State variable - true when traversing duplicates
-        bool in_dups=false;
-
-        // State variable - points to first of group of duplicates
-        int start=0;
-        for( int i=0; i<nbr_games-1; i++ )    // note we stop at second last element
+        int nbr_threads = wxThread::GetCPUCount();
+        if( nbr_threads > BIN_DB_DEDUP_MAX_THREADS )
+            nbr_threads = BIN_DB_DEDUP_MAX_THREADS;
+        if( nbr_threads<1 || nbr<BIN_DB_DEDUP_MIN_GAMES )
+            nbr_threads = 1;
+        std::vector<uint64_t> hashes(nbr);
+        std::vector<DupThread *> threads;
+        for( int t=0; t<nbr_threads; t++ )
         {
-            if( pb->Perfraction( i,nbr_games) )
-                return false;   // abort
-
-            // Does this element match the next element? (there's always another element because
-            //  remember we stop at second to last element not last element)
-            bool next_matches = (0 == strcmp(games[i]->CompressedMoves(),games[i+1]->CompressedMoves()) );
-
-            // end will point beyond end of a group of duplicates if we identify such a group this time
-            //  through the loop
-            int end = i;
-
-            // State machine to maintain in_dups and start state variables
-            if( in_dups )
-            {
-                if( !next_matches )
-                {
-                    in_dups = false;
-                    end = i+1;  // Leaving a group of duplicates, evaluate them
-                }
-            }
-            else
-            {
-                if( next_matches )
-                {
-                    in_dups = true;
-                    start = i;
-                }
-            }
-
-            // One special case - a group of duplicates at the end
-            bool last = (i+1 >= nbr_games-1);  // is this the last time thru loop?
-            if( last && in_dups )
-                end = i+2;  // i points at second last element, end should point beyond last element
-
-            // Found a group of (potential) duplicates. So far we only know that the moves are
-            //  identical. We have more work to do to identify the real duplicates. Real duplicates
-            //  are marked with id = GAME_ID_SENTINEL so that they group together when we do a final
-            //  sort by id.
-            if( end > i )
-            {
-
-                // First reorder the group by id
-                std::sort( games.begin()+start, games.begin()+end, predicate_sorts_by_id );
-#if 0
-                {
-                    cprintf( "Eval Dups in\n" );
-                    for( int idx=start; idx<end; idx++ )
-                    {
-                        smart_ptr<ListableGame> p = games[idx];
-                        cprintf( "%d: %s-%s, %s %d ply\n", p->game_id, p->White(), p->Black(), p->Event(), strlen(p->CompressedMoves()) );
-                    }
-                }
-#endif
-
-                // For each game in group of duplicates
-                for( int idx=start; idx<end; idx++ )
-                {
-                    smart_ptr<ListableGame> p = games[idx];
-
-                    // If the game hasn't already been marked as a dup (note first of the group is never marked as a dup)
-                    if( p->game_id != GAME_ID_SENTINEL )
-                    {
-
-                        // Sweep through the rest of the group and mark each game in turn a dup if it matches
-                        std::vector<std::string> white_tokens;
-                        Split(p->White(),white_tokens);
-                        std::vector<std::string> black_tokens;
-                        Split(p->Black(),black_tokens);
-
-                        // Note that this is a O(2) type algorithm sadly, we loop through a group of games for each
-                        //  game in main loop
-#ifdef EXTRA_DEDUP_DIAGNOSTIC_FILE
-                        int nbr_dups=0;
-#endif
-                        std::string str_dup_games;
-                        for( int j=idx+1; j<end; j++ )
-                        {
-                            smart_ptr<ListableGame> q = games[j];
-                            if( q->game_id!=GAME_ID_SENTINEL && DupDetect(p,white_tokens,black_tokens,q) )
-                            {
-                                q->game_id = GAME_ID_SENTINEL;
-#ifdef EXTRA_DEDUP_DIAGNOSTIC_FILE
-                                GameDocument the_game;
-                                CompactGame pact;
-                                std::string str;
-                                if( nbr_dups == 0 )
-                                {
-                                    p->GetCompactGame( pact );
-                                    pact.Upscale(the_game);
-                                    the_game.ToFileTxtGameDetails( str );
-                                    str_dup_games += str;
-                                    the_game.ToFileTxtGameBody( str );
-                                    str_dup_games += str;
-                                }
-                                nbr_dups++;
-                                q->GetCompactGame( pact );
-                                pact.Upscale(the_game);
-                                the_game.ToFileTxtGameDetails( str );
-                                    str_dup_games += str;
-                                the_game.ToFileTxtGameBody( str );
-                                str_dup_games += str;
-#endif
-                            }
-                        }
+            DupThread *thread = new DupThread;
+            thread->hashes = &hashes;
+            thread->part = t;
+            thread->nbr_parts = nbr_threads;
+            threads.push_back( thread );
+        }
+        std::atomic<bool> abort( false );
+        {
+            std::string desc("Duplicate Removal - phase 1");
+            ProgressBar progress_bar( dup_title, desc, true, window );
+            progress_bar.DrawNow();
+            for( int t=0; t<nbr_threads; t++ )
+                threads[t]->hashing = true;
+            DupRunThreads( threads, nbr, &progress_bar, abort );
+            BinDbShowDebugOrder( games, "Duplicate Removal - phase 1 after");
+        }
+        if( !abort )
+        {
+            BinDbShowDebugOrder( games, "Duplicate Removal - phase 2 before");
+            std::string desc("Duplicate Removal - phase 2");
+            ProgressBar progress_bar( dup_title, desc, true, window );
+            progress_bar.DrawNow();
+            for( int t=0; t<nbr_threads; t++ )
+                threads[t]->hashing = false;
+            DupRunThreads( threads, nbr, &progress_bar, abort );
+        }
 #ifdef EXTRA_DEDUP_DIAGNOSTIC_FILE
-                        if( pgn_dup2 && nbr_dups>0 )
-                        {
-                            if( nbr_dups > 1 )
-                                replace_once( str_dup_games, "[White \"", "[White \"MORE-THAN-2- " );
-                            fwrite(str_dup_games.c_str(),1,str_dup_games.length(),pgn_dup2);
-                        }
-#endif
-                    }
-                }
-#if 0
+        for( int t=0; !abort && pgn_dup2 && t<nbr_threads; t++ )
+        {
+            std::vector<uint32_t> &dup_log = threads[t]->dup_log;
+            for( size_t k=0; k+1<dup_log.size(); )
+            {
+                int nbr_dups = dup_log[k+1];
+                std::string str_dup_games;
+                for( int d=0; d<=nbr_dups; d++ )
                 {
-                    cprintf( "Eval Dups out\n" );
-                    for( int idx=start; idx<end; idx++ )
-                    {
-                        smart_ptr<ListableGame> p = games[idx];
-                        cprintf( "%d: %s-%s, %s %d ply\n", p->game_id, p->White(), p->Black(), p->Event(), strlen(p->CompressedMoves()) );
-                    }
+                    smart_ptr<ListableGame> p = games[ d==0 ? dup_log[k] : dup_log[k+1+d] ];
+                    GameDocument the_game;
+                    CompactGame pact;
+                    std::string str;
+                    p->GetCompactGame( pact );
+                    pact.Upscale(the_game);
+                    the_game.ToFileTxtGameDetails( str );
+                    str_dup_games += str;
+                    the_game.ToFileTxtGameBody( str );
+                    str_dup_games += str;
                 }
-#endif
+                if( nbr_dups > 1 )
+                    replace_once( str_dup_games, "[White \"", "[White \"MORE-THAN-2- " );
+                fwrite(str_dup_games.c_str(),1,str_dup_games.length(),pgn_dup2);
+                k += 2+nbr_dups;
             }
         }
+#endif
+        for( int t=0; t<nbr_threads; t++ )
+            delete threads[t];
+        if( abort )
+            return false;
         BinDbShowDebugOrder( games, "Duplicate Removal - phase 2 after");
     }
     int nbr_deleted=0;
@@ -1553,7 +2009,20 @@ bool BinDbWriteOutToFile( FILE *ofile, int nbr_to_omit_from_end, bool locked, Pr
     std::map<std::string,int> map_player;
     std::map<std::string,int> map_event;
     std::map<std::string,int> map_site;
-    if( locked )
+
+    // Slow mode moves (second generation, see DATABASE_VERSION_NUMBER_SLOW_MODE_V2) can only
+    //  occur after a promotion, only games with promotions stop older versions reading the file
+    bool promotions = false;
+    int nbr_games = games.size() - nbr_to_omit_from_end;
+    for( int i=0; !promotions && i<nbr_games; i++ )
+        promotions = games[i]->TestPromotion();
+    if( promotions )
+    {
+        fwrite( &compatibility_header, sizeof(compatibility_header)-1, 1, ofile );
+        uint8_t ver=DATABASE_VERSION_NUMBER_SLOW_MODE_V2;
+        fwrite( &ver, 1, 1, ofile );
+    }
+    else if( locked )
         fwrite( &compatibility_header, sizeof(compatibility_header), 1, ofile );
     else
     {
@@ -1572,13 +2041,15 @@ bool BinDbWriteOutToFile( FILE *ofile, int nbr_to_omit_from_end, bool locked, Pr
     fh.nbr_players = std::distance( set_player.begin(), set_player.end() );
     fh.nbr_events  = std::distance( set_event.begin(),  set_event.end() );
     fh.nbr_sites   = std::distance( set_site.begin(),   set_site.end() );
-    fh.nbr_games   = games.size() - nbr_to_omit_from_end;
+    fh.nbr_games   = nbr_games;
     fh.locked      = locked;
+    fh.minor_version = DATABASE_MINOR_VERSION_OFFSET_TABLE;
     cprintf( "%d games, %d players, %d events, %d sites\n", fh.nbr_games, fh.nbr_players, fh.nbr_events, fh.nbr_sites );
     int nbr_bits_player = BitsRequired(fh.nbr_players);
     int nbr_bits_event  = BitsRequired(fh.nbr_events);
     int nbr_bits_site   = BitsRequired(fh.nbr_sites);
     cprintf( "%d player bits, %d event bits, %d site bits\n", nbr_bits_player, nbr_bits_event, nbr_bits_site );
+    long file_start = ftell(ofile) - sizeof(compatibility_header);
     fwrite( &fh, sizeof(fh), 1, ofile );
     int idx=0;
     int total_strings = fh.nbr_players + fh.nbr_events + fh.nbr_sites + fh.nbr_games;
@@ -1642,30 +2113,74 @@ bool BinDbWriteOutToFile( FILE *ofile, int nbr_to_omit_from_end, bool locked, Pr
     bb.Next(12);                // BlackElo
     int bb_sz = bb.Size();
     cprintf( "bb_sz=%d\n", bb_sz );
+
+    // Normally all the games use the strings in our control block, so a game table gives us each
+    //  game's fields without unpacking it, and its string indexes translate directly to the
+    //  indexes written, without looking up each string
+    GameTable table;
+    table.Build( games, nbr_games, false );
+    bool use_table = table.IsValid(nbr_games) && table.ControlBlockIdx()==cb_idx;
+    std::vector<int> player_remap(players.size());
+    std::vector<int> event_remap(events.size());
+    std::vector<int> site_remap(sites.size());
+    if( use_table )
+    {
+        for( size_t j=0; j<players.size(); j++ )
+            player_remap[j] = map_player[players[j]];
+        for( size_t j=0; j<events.size(); j++ )
+            event_remap[j] = map_event[events[j]];
+        for( size_t j=0; j<sites.size(); j++ )
+            site_remap[j] = map_site[sites[j]];
+    }
+    std::vector<uint64_t> offsets;
     for( int i=0; i<fh.nbr_games; i++ )
     {
-        smart_ptr<ListableGame> ptr = games[i];
-        int white_offset = map_player[std::string(ptr->White())];
-        int black_offset = map_player[std::string(ptr->Black())];
-        int event_offset = map_event[std::string(ptr->Event())];
-        int site_offset = map_site[std::string(ptr->Site())];
-        bb.Write(0,event_offset);           // Event
-        bb.Write(1,site_offset);            // Site
-        bb.Write(2,white_offset);           // White
-        bb.Write(3,black_offset);           // Black
-        bb.Write(4,ptr->DateBin());         // Date 19 bits, format yyyyyyyyyymmmmddddd, (year values have 1500 offset)
-        bb.Write(5,ptr->RoundBin());        // Round for now 16 bits -> rrrrrrbbbbbbbbbb   rr=round (0-63), bb=board(0-1023)
-        uint16_t eco_bin = ptr->EcoBin();   // ECO 500 codes (9 bits) 0-499 is (A..E)(00..99), 500 is empty
-        if( eco_bin >= 500 )                // Sadly older versions cannot cope with 500 = empty
-            eco_bin = 0;
-        bb.Write(6,eco_bin);                // ECO For now 500 codes (9 bits) 0-499 is (A..E)(00..99), sadly A00 indistinguishable from empty
-        bb.Write(7,ptr->ResultBin());       // Result (2 bits)
-        bb.Write(8,ptr->WhiteEloBin());     // WhiteElo 12 bits (range 0..4095)
-        bb.Write(9,ptr->BlackEloBin());     // BlackElo
-        fwrite( bb.GetPtr(), bb_sz, 1, ofile );
-        int n = strlen(ptr->CompressedMoves()) + 1;
-        const char *cstr = ptr->CompressedMoves();
-        fwrite( cstr, n, 1, ofile );
+        if( (i % BIN_DB_OFFSET_TABLE_STRIDE) == 0 )
+            offsets.push_back( ftell(ofile) - file_start );
+        if( use_table )
+        {
+            bb.Write(0,event_remap[table.EventBin(i)]);     // Event
+            bb.Write(1,site_remap[table.SiteBin(i)]);       // Site
+            bb.Write(2,player_remap[table.WhiteBin(i)]);    // White
+            bb.Write(3,player_remap[table.BlackBin(i)]);    // Black
+            bb.Write(4,table.DateBin(i));                   // Date 19 bits, format yyyyyyyyyymmmmddddd, (year values have 1500 offset)
+            bb.Write(5,table.RoundBin(i));                  // Round for now 16 bits -> rrrrrrbbbbbbbbbb   rr=round (0-63), bb=board(0-1023)
+            uint16_t eco_bin = table.EcoBin(i);             // ECO 500 codes (9 bits) 0-499 is (A..E)(00..99), 500 is empty
+            if( eco_bin >= 500 )                            // Sadly older versions cannot cope with 500 = empty
+                eco_bin = 0;
+            bb.Write(6,eco_bin);
+            bb.Write(7,table.ResultBin(i));                 // Result (2 bits)
+            bb.Write(8,table.WhiteEloBin(i));               // WhiteElo 12 bits (range 0..4095)
+            bb.Write(9,table.BlackEloBin(i));               // BlackElo
+            fwrite( bb.GetPtr(), bb_sz, 1, ofile );
+            const char *cstr = table.CompressedMoves(i);
+            fwrite( cstr, strlen(cstr)+1, 1, ofile );
+        }
+        else
+        {
+            smart_ptr<ListableGame> ptr = games[i];
+            int white_offset = map_player[std::string(ptr->White())];
+            int black_offset = map_player[std::string(ptr->Black())];
+            int event_offset = map_event[std::string(ptr->Event())];
+            int site_offset = map_site[std::string(ptr->Site())];
+            bb.Write(0,event_offset);           // Event
+            bb.Write(1,site_offset);            // Site
+            bb.Write(2,white_offset);           // White
+            bb.Write(3,black_offset);           // Black
+            bb.Write(4,ptr->DateBin());         // Date 19 bits, format yyyyyyyyyymmmmddddd, (year values have 1500 offset)
+            bb.Write(5,ptr->RoundBin());        // Round for now 16 bits -> rrrrrrbbbbbbbbbb   rr=round (0-63), bb=board(0-1023)
+            uint16_t eco_bin = ptr->EcoBin();   // ECO 500 codes (9 bits) 0-499 is (A..E)(00..99), 500 is empty
+            if( eco_bin >= 500 )                // Sadly older versions cannot cope with 500 = empty
+                eco_bin = 0;
+            bb.Write(6,eco_bin);                // ECO For now 500 codes (9 bits) 0-499 is (A..E)(00..99), sadly A00 indistinguishable from empty
+            bb.Write(7,ptr->ResultBin());       // Result (2 bits)
+            bb.Write(8,ptr->WhiteEloBin());     // WhiteElo 12 bits (range 0..4095)
+            bb.Write(9,ptr->BlackEloBin());     // BlackElo
+            fwrite( bb.GetPtr(), bb_sz, 1, ofile );
+            int n = strlen(ptr->CompressedMoves()) + 1;
+            const char *cstr = ptr->CompressedMoves();
+            fwrite( cstr, n, 1, ofile );
+        }
         if( (i % 10000) == 0 )
             cprintf( "%d games written to compressed file so far\n", i );
         nbr_strings_so_far++;
@@ -1673,6 +2188,15 @@ bool BinDbWriteOutToFile( FILE *ofile, int nbr_to_omit_from_end, bool locked, Pr
             if( pb->Perfraction( nbr_strings_so_far, total_strings ) )
                 return false;   // abort
     }
+    OffsetTableTrailer trailer;
+    memset( &trailer, 0, sizeof(trailer) );
+    trailer.stride = BIN_DB_OFFSET_TABLE_STRIDE;
+    trailer.nbr_offsets = offsets.size();
+    trailer.nbr_games = fh.nbr_games;
+    strcpy( trailer.magic, BIN_DB_OFFSET_TABLE_MAGIC );
+    if( offsets.size() > 0 )
+        fwrite( &offsets[0], sizeof(offsets[0]), offsets.size(), ofile );
+    fwrite( &trailer, sizeof(trailer), 1, ofile );
     cprintf( "%d games written to compressed file\n", fh.nbr_games );
     return true;
 }
@@ -1694,11 +2218,247 @@ void ReadStrings( FILE *fin, int nbr_strings, std::vector<std::string> &strings
     }
 }
 
+// Progress accounting common to both ways of loading games
+static void BinDbLoadProgress( uint32_t i, uint32_t game_count, uint32_t &nbr_games, uint32_t &nbr_promotion_games, bool promotion, int &background_load_permill )
+{
+    int num = i;
+    int den = game_count?game_count:1;
+    if( den > 1000000 )
+        background_load_permill = num / (den/1000);
+    else
+        background_load_permill = (num*1000) / den;
+    nbr_games++;
+    if( promotion )
+        nbr_promotion_games++;
+    if(
+#ifdef _DEBUG
+        (nbr_games<10000 && (nbr_games%100)==0) ||
+#endif
+        ((nbr_games%10000) == 0 ) /* ||
+                                    (
+                                    (nbr_games < 100) &&
+                                    ((nbr_games%10) == 0 )
+                                    ) */
+        )
+    {
+        cprintf( "%d games (%d include promotion)\n", nbr_games, nbr_promotion_games );
+    }
+}
+
+// Databases written before DATABASE_VERSION_NUMBER_SLOW_MODE_V2 use the original slow mode scheme,
+//  upgrade their games as they are loaded so every game in memory uses the same scheme. Slow mode
+//  can only happen after a promotion, so only games with promotions need to be checked. An
+//  upgraded game is copied rather than pointing into the memory mapped file. This happens on
+//  every load until the file is rewritten (appending to the database rewrites it with the
+//  new scheme), so the cost is counted and reported at the end of the load
+static void BinDbUpgradeSlowMode( ListableGameBinDb &info, uint8_t cb_idx, uint32_t game_id, const char *game, int bb_sz )
+{
+    std::string moves( game+bb_sz );
+    if( CompressMoves::UpgradeSlowMode(moves) )
+    {
+        info = ListableGameBinDb( cb_idx, game_id, std::string(game,bb_sz) + moves );
+        bin_db_upgraded_games++;
+        bin_db_upgraded_bytes += bb_sz + moves.length() + 1;
+    }
+}
+
+// A worker thread decodes a range of games from a memory mapped .tdb file
+class BinDbLoadThread : public wxThread
+{
+public:
+    BinDbLoadThread() : wxThread(wxTHREAD_JOINABLE) {}
+    const char *rover;          // first game in range
+    const char *end;            // limit of the range
+    int bb_sz;
+    uint8_t cb_idx;
+    bool locked;
+    uint32_t base;
+    uint32_t game_count;        // in the whole file, for calculating game_ids
+    uint32_t begin_idx;         // range is games [begin_idx,end_idx)
+    uint32_t end_idx;
+    std::atomic<bool> *abort;
+    std::vector< smart_ptr<ListableGame> > games;
+    std::atomic<int> nbr_done;
+    std::atomic<bool> finished;
+    bool complete;
+    bool started;
+
+    // thread execution starts here
+    virtual void *Entry()
+    {
+        Decode();
+        return NULL;
+    }
+
+    void Decode()
+    {
+        games.reserve( end_idx-begin_idx );
+        for( uint32_t i=begin_idx; i<end_idx && !*abort; i++ )
+        {
+            const char *game_moves = rover + bb_sz;
+            const char *nul = game_moves<end ? static_cast<const char *>(memchr(game_moves,'\0',end-game_moves)) : NULL;
+            if( !nul )
+            {
+                cprintf( "Whoops\n" );
+                break;
+            }
+            uint32_t game_id = base + game_count-1-i;
+            ListableGameBinDb info( cb_idx, game_id, rover );
+            if( !bin_file_slow_mode_v2 && info.TestPromotion() )
+                BinDbUpgradeSlowMode( info, cb_idx, game_id, rover, bb_sz );
+            rover = nul+1;
+            make_smart_ptr( ListableGameBinDb, new_info, info );
+            new_info->SetLocked( locked );
+            new_info->piece_square_signature = PieceSquareSignatureGame( new_info->CompressedMoves() );
+            games.push_back( std::move(new_info) );
+            nbr_done = games.size();
+        }
+        complete = (games.size() == end_idx-begin_idx);
+        finished = true;
+    }
+};
+
+// Load a memory mapped .tdb file (always in reverse, for searching) using its offset table to split
+//  the games between threads. Returns false, having done nothing, if that isn't possible
+static bool BinDbLoadMappedParallel( const MappedFile &mf, const char *first_game, int bb_sz, uint8_t cb_idx, bool locked,
+                                     uint32_t base, uint32_t game_count, std::vector< smart_ptr<ListableGame> > &mega_cache,
+                                     int &background_load_permill, bool &kill_background_load, ProgressBar *pb,
+                                     bool &killed, uint32_t &nbr_games, uint32_t &nbr_promotion_games )
+{
+    // Find and check the offset table
+    OffsetTableTrailer trailer;
+    if( mf.Size() < sizeof(trailer) )
+        return false;
+    const char *trailer_ptr = mf.Data() + mf.Size() - sizeof(trailer);
+    if( first_game > trailer_ptr )
+        return false;
+    memcpy( &trailer, trailer_ptr, sizeof(trailer) );
+    if( 0 != memcmp(trailer.magic,BIN_DB_OFFSET_TABLE_MAGIC,sizeof(BIN_DB_OFFSET_TABLE_MAGIC)) ||
+        trailer.nbr_games != game_count || trailer.stride == 0 ||
+        trailer.nbr_offsets != (game_count+trailer.stride-1) / trailer.stride ||
+        static_cast<uint64_t>(trailer.nbr_offsets)*sizeof(uint64_t) > static_cast<uint64_t>(trailer_ptr-first_game) )
+    {
+        cprintf( "Offset table not valid\n" );
+        return false;
+    }
+    const char *table_ptr = trailer_ptr - trailer.nbr_offsets*sizeof(uint64_t);
+    std::vector<uint64_t> offsets( trailer.nbr_offsets );
+    if( trailer.nbr_offsets > 0 )
+        memcpy( &offsets[0], table_ptr, trailer.nbr_offsets*sizeof(uint64_t) );
+    uint64_t limit = table_ptr - mf.Data();
+    for( uint32_t k=0; k<trailer.nbr_offsets; k++ )
+    {
+        if( (k==0 && offsets[k]!=static_cast<uint64_t>(first_game-mf.Data())) ||
+            (k>0  && offsets[k]<=offsets[k-1]) || offsets[k]>=limit )
+        {
+            cprintf( "Offset table not valid\n" );
+            return false;
+        }
+    }
+
+    // Worthwhile ?
+    int nbr_threads = wxThread::GetCPUCount();
+    if( nbr_threads > BIN_DB_LOAD_MAX_THREADS )
+        nbr_threads = BIN_DB_LOAD_MAX_THREADS;
+    if( nbr_threads > static_cast<int>(trailer.nbr_offsets) )
+        nbr_threads = trailer.nbr_offsets;
+    if( nbr_threads<2 || game_count<BIN_DB_LOAD_MIN_GAMES_PER_THREAD*2 )
+        return false;
+
+    // Each thread gets a whole number of strides
+    AutoTimer at("Parallel load");
+    std::atomic<bool> abort( false );
+    std::vector<BinDbLoadThread *> threads;
+    for( int t=0; t<nbr_threads; t++ )
+    {
+        uint32_t k_begin = static_cast<uint32_t>( (static_cast<uint64_t>(trailer.nbr_offsets)*t) / nbr_threads );
+        uint32_t k_end   = static_cast<uint32_t>( (static_cast<uint64_t>(trailer.nbr_offsets)*(t+1)) / nbr_threads );
+        BinDbLoadThread *thread = new BinDbLoadThread;
+        thread->rover = mf.Data() + offsets[k_begin];
+        thread->end   = k_end<trailer.nbr_offsets ? mf.Data()+offsets[k_end] : table_ptr;
+        thread->bb_sz = bb_sz;
+        thread->cb_idx = cb_idx;
+        thread->locked = locked;
+        thread->base = base;
+        thread->game_count = game_count;
+        thread->begin_idx = k_begin * trailer.stride;
+        thread->end_idx = k_end<trailer.nbr_offsets ? k_end*trailer.stride : game_count;
+        thread->abort = &abort;
+        thread->nbr_done = 0;
+        thread->finished = false;
+        thread->complete = false;
+        thread->started = false;
+        if( thread->Create()==wxTHREAD_NO_ERROR && thread->Run()==wxTHREAD_NO_ERROR )
+            thread->started = true;
+        else
+        {
+            cprintf( "BinDbLoadMappedParallel(), cannot start thread %d\n", t );
+            thread->Decode();
+        }
+        threads.push_back( thread );
+    }
+
+    // Only this thread reports progress and responds to kill requests
+    for(;;)
+    {
+        bool all_finished = true;
+        int total_done = 0;
+        for( unsigned int t=0; t<threads.size(); t++ )
+        {
+            total_done += threads[t]->nbr_done;
+            if( !threads[t]->finished )
+                all_finished = false;
+        }
+        if( all_finished )
+            break;
+        if( !abort && (kill_background_load || (pb && pb->Perfraction(total_done,game_count))) )
+        {
+            abort = true;
+            killed = true;
+        }
+        int num = total_done;
+        int den = game_count;
+        if( den > 1000000 )
+            background_load_permill = num / (den/1000);
+        else
+            background_load_permill = (num*1000) / den;
+        wxMilliSleep(10);
+    }
+
+    // Put the ranges together in file order, a range that didn't complete means the games beyond it
+    //  are left out, so the loaded games are always a prefix of the file (like a sequential load)
+    mega_cache.reserve( mega_cache.size() + game_count );
+    bool truncated = false;
+    for( unsigned int t=0; t<threads.size(); t++ )
+    {
+        BinDbLoadThread *thread = threads[t];
+        if( thread->started )
+            thread->Wait();     // joinable threads must be waited for, even if already finished
+        if( !truncated )
+        {
+            for( unsigned int j=0; j<thread->games.size(); j++ )
+            {
+                if( thread->games[j]->TestPromotion() )
+                    nbr_promotion_games++;
+                mega_cache.push_back( std::move(thread->games[j]) );
+            }
+            nbr_games += thread->games.size();
+            if( !thread->complete )
+                truncated = true;
+        }
+        delete thread;
+    }
+    cprintf( "%d games (%d include promotion) loaded by %d threads\n", nbr_games, nbr_promotion_games, nbr_threads );
+    return true;
+}
+
 // Returns bool killed;
 bool BinDbLoadAllGames( bool &locked, bool for_append, std::vector< smart_ptr<ListableGame> > &mega_cache, int &background_load_permill, bool &kill_background_load, ProgressBar *pb )
 {
     bool killed=false;
     locked = false;
+    bin_db_upgraded_games = 0;
+    bin_db_upgraded_bytes = 0;
 
     // When loading the system database for searches, reverse order so most recent games come first
     bool do_reverse = !for_append;
@@ -1719,10 +2479,13 @@ bool BinDbLoadAllGames( bool &locked, bool for_append, std::vector< smart_ptr<Li
     int nbr_bits_site   = BitsRequired(fh.nbr_sites);
     cprintf( "%d player bits, %d event bits, %d site bits\n", nbr_bits_player, nbr_bits_event, nbr_bits_site );
     int hdr_len = fh.hdr_len;   // future compatibility feature - if FileHeader gets longer so will fh.hdr_len
-    if( hdr_len >= sizeof(FileHeader) )  // we support VERSION_NUMBER_BIN_DB which predates VERSION_NUMBER_BIN_LOCKABLE
-    {                                    //  databases of that version have a smaller header without lockable
+    if( hdr_len >= FILE_HEADER_LEN_LOCKABLE )   // we support VERSION_NUMBER_BIN_DB which predates VERSION_NUMBER_BIN_LOCKABLE
+    {                                           //  databases of that version have a smaller header without lockable
         locked = static_cast<bool>(fh.locked);
     }
+    int minor_version = 0;
+    if( hdr_len >= sizeof(FileHeader) )
+        minor_version = fh.minor_version;
     if( hdr_len != sizeof(FileHeader) )
     {
         fseek(fin,compatibility_header_size+hdr_len,SEEK_SET);  // if necessary skip to a different point than
@@ -1767,7 +2530,36 @@ bool BinDbLoadAllGames( bool &locked, bool for_append, std::vector< smart_ptr<Li
     uint32_t nbr_games=0;
     uint32_t nbr_promotion_games=0;
     uint32_t base = GameIdAllocateTop(game_count);
-    for( uint32_t i=0; i<game_count; i++ )
+
+    // Map the whole file into memory if possible, the games then point directly into the mapped file
+    //  rather than each having their own copy. The mapping stays alive as long as the control block
+    bool mapped = false;
+    const char *mapped_rover = NULL;
+    const char *mapped_end = NULL;
+#ifdef BIN_DB_LOAD_MAPPED
+    if( !translate_to_24_bit )
+    {
+        std::shared_ptr<MappedFile> mf( new MappedFile );
+        long offset = ftell(fin);
+        if( mf->Open(bin_file_name.c_str()) && offset>=0 && static_cast<size_t>(offset)<=mf->Size() )
+        {
+            mapped = true;
+            mapped_rover = mf->Data() + offset;
+            mapped_end   = mf->Data() + mf->Size();
+            cb.mapped_file = mf;
+        }
+    }
+#endif
+
+    // If the file has an offset table, the mapped games can be decoded by several threads at once
+    bool loaded_in_parallel = false;
+    if( mapped && minor_version>=DATABASE_MINOR_VERSION_OFFSET_TABLE )
+    {
+        loaded_in_parallel = BinDbLoadMappedParallel( *cb.mapped_file, mapped_rover, bb_sz, cb_idx, locked, base, game_count,
+                                                      mega_cache, background_load_permill, kill_background_load, pb,
+                                                      killed, nbr_games, nbr_promotion_games );
+    }
+    for( uint32_t i=0; !loaded_in_parallel && i<game_count; i++ )
     {
         if( kill_background_load )
         {
@@ -1779,6 +2571,31 @@ bool BinDbLoadAllGames( bool &locked, bool for_append, std::vector< smart_ptr<Li
             killed = true;
             break;
         }
+        uint32_t game_id = base;
+        game_id += (do_reverse ? game_count-1-i : i);
+
+        // Memory mapped, the game header and '\0' terminated moves are used where they lie
+        if( mapped )
+        {
+            const char *game_moves = mapped_rover + bb_sz;
+            const char *nul = game_moves<mapped_end ? static_cast<const char *>(memchr(game_moves,'\0',mapped_end-game_moves)) : NULL;
+            if( !nul )
+            {
+                cprintf( "Whoops\n" );
+                break;
+            }
+            ListableGameBinDb info( cb_idx, game_id, mapped_rover );
+            if( !bin_file_slow_mode_v2 && info.TestPromotion() )
+                BinDbUpgradeSlowMode( info, cb_idx, game_id, mapped_rover, bb_sz );
+            mapped_rover = nul+1;
+            make_smart_ptr( ListableGameBinDb, new_info, info );
+            new_info->SetLocked( locked );
+            new_info->piece_square_signature = PieceSquareSignatureGame( new_info->CompressedMoves() );
+            bool promotion = info.TestPromotion();
+            mega_cache.push_back( std::move(new_info) );
+            BinDbLoadProgress( i, game_count, nbr_games, nbr_promotion_games, promotion, background_load_permill );
+            continue;
+        }
         char buf[sizeof(cb.bb)];
 
         // Read the game header into a std::string
@@ -1813,35 +2630,19 @@ bool BinDbLoadAllGames( bool &locked, bool for_append, std::vector< smart_ptr<Li
             game_header = std::string( cb_ptr, cb_sz );
         }
 
-        uint32_t game_id = base;
-        game_id += (do_reverse ? game_count-1-i : i);
         std::string blob = game_header + game_moves;
         ListableGameBinDb info( cb_idx, game_id, blob );
+        if( !bin_file_slow_mode_v2 && info.TestPromotion() )
+            BinDbUpgradeSlowMode( info, cb_idx, game_id, blob.c_str(), game_header.length() );
         make_smart_ptr( ListableGameBinDb, new_info, info );
         new_info->SetLocked( locked );
+
+        // When loading for searches, calculate the signature that lets searches skip games quickly
+        if( !for_append )
+            new_info->piece_square_signature = PieceSquareSignatureGame( new_info->CompressedMoves() );
+        bool promotion = info.TestPromotion();
         mega_cache.push_back( std::move(new_info) );
-        int num = i;
-        int den = game_count?game_count:1;
-        if( den > 1000000 )
-            background_load_permill = num / (den/1000);
-        else
-            background_load_permill = (num*1000) / den;
-        nbr_games++;
-        if( info.TestPromotion() )
-            nbr_promotion_games++;
-        if(
-#ifdef _DEBUG
-            (nbr_games<10000 && (nbr_games%100)==0) ||
-#endif
-            ((nbr_games%10000) == 0 ) /* ||
-                                        (
-                                        (nbr_games < 100) &&
-                                        ((nbr_games%10) == 0 )
-                                        ) */
-            )
-        {
-            cprintf( "%d games (%d include promotion)\n", nbr_games, nbr_promotion_games );
-        }
+        BinDbLoadProgress( i, game_count, nbr_games, nbr_promotion_games, promotion, background_load_permill );
     }
     if( do_reverse )
         std::reverse( mega_cache.begin(), mega_cache.end() );
@@ -1853,6 +2654,12 @@ bool BinDbLoadAllGames( bool &locked, bool for_append, std::vector< smart_ptr<Li
         cprintf( "First: game_id=%lu, %s-%s %s\n", p1->game_id, p1->White(), p1->Black(), p1->Date() );
         cprintf( "Last:  game_id=%lu, %s-%s %s\n", p2->game_id, p2->White(), p2->Black(), p2->Date() );
     }
+    if( bin_db_upgraded_games > 0 )
+    {
+        cprintf( "%d games with promotions upgraded to the new slow mode scheme, %lu bytes copied out of the file. "
+                 "This is repeated on every load until the database is appended to, which rewrites it\n",
+                 static_cast<int>(bin_db_upgraded_games), static_cast<unsigned long>(bin_db_upgraded_bytes) );
+    }
     return killed;
 }
 
@@ -20,6 +20,7 @@ std::vector< smart_ptr<ListableGame> > &BinDbLoadAllGamesGetVector();
 bool bin_db_append( const char *fen, const char *event, const char *site, const char *date, const char *round,
                   const char *white, const char *black, const char *result, const char *white_elo, const char *black_elo, const char *eco,
                   int nbr_moves, thc::Move *moves );
+bool BinDbPgnRead( FILE *infile, ProgressBar *pb=NULL );
 
 bool TestBinaryBlock();
 void BinDbCreationEnd();
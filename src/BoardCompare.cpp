@@ -0,0 +1,78 @@
+/****************************************************************************
+ * Board compare - compare whole 64 square boards, using SSE2/AVX2 vector
+ *  instructions where the CPU has them
+ *  Author:  Bill Forster
+ *  License: MIT license. Full text of license is in associated file LICENSE
+ *  Copyright 2010-2016, Bill Forster <billforsternz at gmail dot com>
+ ****************************************************************************/
+#include "BoardCompare.h"
+
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86)
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#define AVX2_TARGET         // MSVC allows AVX2 intrinsics in any function
+#else
+#define AVX2_TARGET __attribute__((target("avx2")))
+#endif
+
+static bool CpuHasAvx2()
+{
+#ifdef _MSC_VER
+    int info[4];
+    __cpuid( info, 0 );
+    if( info[0] < 7 )
+        return false;
+    __cpuid( info, 1 );
+    bool osxsave = (info[2] & (1<<27)) != 0;
+    bool avx     = (info[2] & (1<<28)) != 0;
+    if( !osxsave || !avx )
+        return false;
+    if( (_xgetbv(0) & 6) != 6 )     // OS saves the YMM registers ?
+        return false;
+    __cpuidex( info, 7, 0 );
+    return (info[1] & (1<<5)) != 0;
+#else
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx2") != 0;
+#endif
+}
+
+// The board is two 256 bit lanes, so each target is tested without branching
+AVX2_TARGET unsigned int BoardCompareMaskedAvx2( const char *squares, const char *masks, const char *targets, int nbr_targets )
+{
+    __m256i lo = _mm256_loadu_si256( reinterpret_cast<const __m256i *>(squares) );
+    __m256i hi = _mm256_loadu_si256( reinterpret_cast<const __m256i *>(squares+32) );
+    unsigned int bits = 0;
+    for( int i=0; i<nbr_targets; i++ )
+    {
+        const __m256i *mask   = reinterpret_cast<const __m256i *>(masks   + i*64);
+        const __m256i *target = reinterpret_cast<const __m256i *>(targets + i*64);
+        __m256i eq_lo = _mm256_cmpeq_epi8( _mm256_and_si256(lo,_mm256_loadu_si256(mask)),   _mm256_loadu_si256(target) );
+        __m256i eq_hi = _mm256_cmpeq_epi8( _mm256_and_si256(hi,_mm256_loadu_si256(mask+1)), _mm256_loadu_si256(target+1) );
+        unsigned int match = (_mm256_movemask_epi8( _mm256_and_si256(eq_lo,eq_hi) ) == -1);
+        bits |= (match<<i);
+    }
+    return bits;
+}
+
+#else
+
+static bool CpuHasAvx2()
+{
+    return false;
+}
+
+unsigned int BoardCompareMaskedAvx2( const char *, const char *, const char *, int )
+{
+    return 0;   // never called
+}
+
+#endif
+
+static bool avx2 = CpuHasAvx2();
+
+bool BoardCompareAvx2Available()
+{
+    return avx2;
+}
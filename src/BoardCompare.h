@@ -0,0 +1,45 @@
+/****************************************************************************
+ * Board compare - compare whole 64 square boards, using SSE2/AVX2 vector
+ *  instructions where the CPU has them
+ *  Author:  Bill Forster
+ *  License: MIT license. Full text of license is in associated file LICENSE
+ *  Copyright 2010-2016, Bill Forster <billforsternz at gmail dot com>
+ ****************************************************************************/
+#ifndef BOARD_COMPARE_H
+#define BOARD_COMPARE_H
+#include <string.h>
+
+// SSE2 is part of the x64 baseline, so when the compiler targets it we can use it
+//  without a runtime check
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP>=2)
+#define BOARD_COMPARE_SSE2
+#include <emmintrin.h>
+#endif
+
+// Is board a[64] identical to board b[64] ? This is the test made before every move
+//  in the fast position search, so it is inline rather than an AVX2 kernel selected at
+//  runtime - the indirect call costs more than the wider compare saves
+inline bool BoardEqual( const char *a, const char *b )
+{
+#ifdef BOARD_COMPARE_SSE2
+    __m128i x0 = _mm_cmpeq_epi8( _mm_loadu_si128(reinterpret_cast<const __m128i *>(a)),    _mm_loadu_si128(reinterpret_cast<const __m128i *>(b))    );
+    __m128i x1 = _mm_cmpeq_epi8( _mm_loadu_si128(reinterpret_cast<const __m128i *>(a+16)), _mm_loadu_si128(reinterpret_cast<const __m128i *>(b+16)) );
+    __m128i x2 = _mm_cmpeq_epi8( _mm_loadu_si128(reinterpret_cast<const __m128i *>(a+32)), _mm_loadu_si128(reinterpret_cast<const __m128i *>(b+32)) );
+    __m128i x3 = _mm_cmpeq_epi8( _mm_loadu_si128(reinterpret_cast<const __m128i *>(a+48)), _mm_loadu_si128(reinterpret_cast<const __m128i *>(b+48)) );
+    return _mm_movemask_epi8( _mm_and_si128(_mm_and_si128(x0,x1),_mm_and_si128(x2,x3)) ) == 0xffff;
+#else
+    return memcmp(a,b,64) == 0;
+#endif
+}
+
+// Does this CPU (and OS) support AVX2 ? Checked once at startup
+bool BoardCompareAvx2Available();
+
+// Masked compare of one board against nbr_targets (at most 4) targets in one pass. Bit i
+//  of the result is set if (squares[j] & masks[i*64+j]) == targets[i*64+j] for all 64
+//  squares j. Only call this if BoardCompareAvx2Available() - otherwise use the one rank
+//  at a time (uint64_t) compare
+#define BOARD_COMPARE_MAX_TARGETS 4
+unsigned int BoardCompareMaskedAvx2( const char *squares, const char *masks, const char *targets, int nbr_targets );
+
+#endif // BOARD_COMPARE_H
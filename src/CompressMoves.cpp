@@ -7,6 +7,7 @@
 #include <algorithm>
 #include <vector>
 #include <stdlib.h>
+#include <string.h>
 #include "CompressMoves.h"
 #include "DebugPrintf.h"
 
@@ -173,6 +174,85 @@ void CompressMovesDiagEnd()
 #define N_HI                8     // CODE_KNIGHT encodes 8 vectors for each of 2 knights (HI and LO)
 #define N_LO                0
 
+// Fast mode decode tables. For each type of moving piece, the destination square
+//  indexed by source square and the low nibble of the code, so that uncompressing
+//  a fast mode move needs no arithmetic or case analysis to find the destination
+enum DecodeType { DECODE_KING, DECODE_KNIGHT, DECODE_ROOK, DECODE_BISHOP, DECODE_WPAWN, DECODE_BPAWN, NBR_DECODE_TYPES };
+struct DecodeTables
+{
+    int8_t dst[NBR_DECODE_TYPES][64][16];
+    thc::SPECIAL pawn_special[2][16];       // [0] for white, [1] for black
+    DecodeTables()
+    {
+        int king_delta[16];
+        memset( king_delta, 0, sizeof(king_delta) );
+        king_delta[K_VECTOR_N]   = -8;
+        king_delta[K_VECTOR_NE]  = -7;
+        king_delta[K_VECTOR_E]   =  1;
+        king_delta[K_VECTOR_SE]  =  9;
+        king_delta[K_VECTOR_S]   =  8;
+        king_delta[K_VECTOR_SW]  =  7;
+        king_delta[K_VECTOR_W]   = -1;
+        king_delta[K_VECTOR_NW]  = -9;
+        king_delta[K_K_CASTLING] =  2;
+        king_delta[K_Q_CASTLING] = -2;
+        int knight_delta[8];
+        knight_delta[N_VECTOR_NNE] = -15;
+        knight_delta[N_VECTOR_NEE] = -6;
+        knight_delta[N_VECTOR_SEE] = 10;
+        knight_delta[N_VECTOR_SSE] = 17;
+        knight_delta[N_VECTOR_SSW] = 15;
+        knight_delta[N_VECTOR_SWW] = 6;
+        knight_delta[N_VECTOR_NWW] = -10;
+        knight_delta[N_VECTOR_NNW] = -17;
+
+        // White pawn vectors, and specials, black is the mirror image
+        int pawn_delta[16];
+        pawn_delta[P_DOUBLE] = -16;
+        pawn_delta[P_SINGLE] = -8;
+        pawn_delta[P_LEFT]   = -9;
+        pawn_delta[P_RIGHT]  = -7;
+        pawn_special[0][P_DOUBLE] = thc::SPECIAL_WPAWN_2SQUARES;
+        pawn_special[1][P_DOUBLE] = thc::SPECIAL_BPAWN_2SQUARES;
+        pawn_special[0][P_SINGLE] = pawn_special[1][P_SINGLE] = thc::NOT_SPECIAL;
+        pawn_special[0][P_LEFT]   = pawn_special[0][P_RIGHT]  = thc::SPECIAL_WEN_PASSANT;  // if dst is empty
+        pawn_special[1][P_LEFT]   = pawn_special[1][P_RIGHT]  = thc::SPECIAL_BEN_PASSANT;
+        for( int lo=4; lo<16; lo++ )    // promotions
+        {
+            pawn_delta[lo] = pawn_delta[lo>>2];
+            thc::SPECIAL special = thc::SPECIAL_PROMOTION_QUEEN;
+            switch( lo&3 )
+            {
+                case P_QUEEN:      special = thc::SPECIAL_PROMOTION_QUEEN;    break;
+                case P_ROOK:       special = thc::SPECIAL_PROMOTION_ROOK;     break;
+                case P_BISHOP:     special = thc::SPECIAL_PROMOTION_BISHOP;   break;
+                case P_KNIGHT:     special = thc::SPECIAL_PROMOTION_KNIGHT;   break;
+            }
+            pawn_special[0][lo] = pawn_special[1][lo] = special;
+        }
+        for( int src=0; src<64; src++ )
+        {
+            for( int lo=0; lo<16; lo++ )
+            {
+                int file_delta = (lo&7) - (src&7);
+                dst[DECODE_KING][src][lo]   = src + king_delta[lo];
+                dst[DECODE_KNIGHT][src][lo] = src + knight_delta[lo&7];
+                if( lo & R_RANK )                  // code encodes rank ?
+                    dst[DECODE_ROOK][src][lo] = ((lo<<3)&0x38) | (src&7);   // same file as src, rank from code
+                else
+                    dst[DECODE_ROOK][src][lo] = (src&0x38) | (lo&7);        // same rank as src, file from code
+                if( lo & B_FALL )                  // FALL\ + file
+                    dst[DECODE_BISHOP][src][lo] = src + 9*file_delta;
+                else                                // RISE/ + file
+                    dst[DECODE_BISHOP][src][lo] = src - 7*file_delta;
+                dst[DECODE_WPAWN][src][lo]  = src + pawn_delta[lo];
+                dst[DECODE_BPAWN][src][lo]  = src - pawn_delta[lo];
+            }
+        }
+    }
+};
+static DecodeTables decode_tables;
+
 // Pawns for each side are assigned logical numbers from 0 to nbr_pawns-1
 //  The ordering of the numbers is determined by consulting this table...
 static int pawn_ordering[64] =
@@ -202,9 +282,49 @@ static thc::Square traverse_order[64] =
     thc::h1, thc::h2, thc::h3, thc::h4, thc::h5, thc::h6, thc::h7, thc::h8
 };
 
+// Most games start from the standard starting position, so calculate fast mode
+//  for that position once, at startup
+struct StartingSides
+{
+    bool ready;
+    thc::ChessPosition cp;
+    Side sides[2];
+    StartingSides()
+    {
+        ready = false;
+        CompressMoves press;
+        sides[0].white = true;
+        sides[1].white = false;
+        press.TryFastMode( &sides[0] );
+        press.TryFastMode( &sides[1] );
+        ready = true;
+    }
+};
+static StartingSides starting_sides;
+
+// Make both sides retry fast mode, unless the result is already known
+void CompressMoves::ResetSides()
+{
+    if( starting_sides.ready && 0 == memcmp(cr.squares,starting_sides.cp.squares,64) )
+    {
+        sides[0] = starting_sides.sides[0];     // no move from the starting position can capture,
+        sides[1] = starting_sides.sides[1];     //  so this is exactly what TryFastMode() would find
+    }
+    else
+    {
+        sides[0].fast_mode=false;
+        sides[1].fast_mode=false;
+    }
+}
+
 // Try to set fast mode, return bool okay
 bool CompressMoves::TryFastMode( Side *side )
 {
+    if( starting_sides.ready && 0 == memcmp(cr.squares,starting_sides.cp.squares,64) )
+    {
+        *side = starting_sides.sides[side->white?0:1];
+        return true;
+    }
     bool okay = true;
     side->nbr_pawns   = 0;
     side->nbr_knights = 0;
@@ -342,32 +462,28 @@ std::vector<thc::Move> CompressMoves::Uncompress( thc::ChessPosition &cp, std::s
 std::vector<thc::Move> CompressMoves::Uncompress( std::string &moves_in )
 {
     std::vector<thc::Move> ret;
-    sides[0].fast_mode=false;
-    sides[1].fast_mode=false;
+    Uncompress( moves_in, ret );
+    return ret;
+}
+
+void CompressMoves::Uncompress( const std::string &moves_in, std::vector<thc::Move> &moves_out )
+{
     int len = moves_in.size();
+    moves_out.resize(len);
+    if( len > 0 )
+        Uncompress( moves_in.c_str(), len, &moves_out[0] );
+}
+
+int CompressMoves::Uncompress( const char *moves_in, int len, thc::Move *moves_out )
+{
+    ResetSides();
     for( int i=0; i<len; i++ )
     {
-        Side *side  = cr.white ? &sides[0] : &sides[1];
-        Side *other = cr.white ? &sides[1] : &sides[0];
-        char code = moves_in[i];
-        thc::Move mv;
-        if( side->fast_mode )
-        {
-            mv = UncompressFastMode(code,side,other);
-        }
-        else if( TryFastMode(side) )
-        {
-            mv = UncompressFastMode(code,side,other);
-        }
-        else
-        {
-            mv = UncompressSlowMode(code);
-            other->fast_mode = false;   // force other side to reset and retry
-        }
-        cr.PlayMove(mv);
-        ret.push_back(mv);
+        thc::Move mv = UncompressMoveNoPlay( moves_in[i] );
+        PlayMovePositionOnly(mv);
+        moves_out[i] = mv;
     }
-    return ret;
+    return len;
 }
 
 #ifdef _WINDOWS
@@ -494,6 +610,21 @@ char CompressMoves::CompressMove( thc::Move mv )
 }
 
 thc::Move CompressMoves::UncompressMove( char c )
+{
+    thc::Move mv = UncompressMoveNoPlay(c);
+    cr.PlayMove(mv);
+    return mv;
+}
+
+thc::Move CompressMoves::UncompressMovePositionOnly( char c )
+{
+    thc::Move mv = UncompressMoveNoPlay(c);
+    PlayMovePositionOnly(mv);
+    return mv;
+}
+
+// Uncompress a move, but leave it to the caller to play it
+thc::Move CompressMoves::UncompressMoveNoPlay( char c )
 {
     Side *side  = cr.white ? &sides[0] : &sides[1];
     Side *other = cr.white ? &sides[1] : &sides[0];
@@ -511,10 +642,82 @@ thc::Move CompressMoves::UncompressMove( char c )
         mv = UncompressSlowMode(c);
         other->fast_mode = false;   // force other side to reset and retry
     }
-    cr.PlayMove(mv);
     return mv;
 }
 
+// A cut down ChessRules::PlayMove(), just enough to keep the position the
+//  uncompress algorithms look at (squares, side to move, en passant target,
+//  king squares) up to date. Castling flags aren't needed because slow mode
+//  always acts as if the kings and rooks haven't moved (see
+//  ALLOW_CASTLING_EVEN_AFTER_KING_AND_ROOK_MOVES above)
+void CompressMoves::PlayMovePositionOnly( thc::Move mv )
+{
+    char *squares = cr.squares;
+    int src = mv.src;
+    int dst = mv.dst;
+    bool white = cr.white;
+    cr.enpassant_target = thc::SQUARE_INVALID;
+    switch( mv.special )
+    {
+        default:
+            squares[dst] = squares[src];
+            break;
+        case thc::SPECIAL_KING_MOVE:
+            squares[dst] = squares[src];
+            if( white )
+                cr.wking_square = mv.dst;
+            else
+                cr.bking_square = mv.dst;
+            break;
+        case thc::SPECIAL_PROMOTION_QUEEN:  squares[dst] = (white?'Q':'q');   break;
+        case thc::SPECIAL_PROMOTION_ROOK:   squares[dst] = (white?'R':'r');   break;
+        case thc::SPECIAL_PROMOTION_BISHOP: squares[dst] = (white?'B':'b');   break;
+        case thc::SPECIAL_PROMOTION_KNIGHT: squares[dst] = (white?'N':'n');   break;
+        case thc::SPECIAL_WEN_PASSANT:
+            squares[dst]   = 'P';
+            squares[dst+8] = ' ';
+            break;
+        case thc::SPECIAL_BEN_PASSANT:
+            squares[dst]   = 'p';
+            squares[dst-8] = ' ';
+            break;
+        case thc::SPECIAL_WPAWN_2SQUARES:
+            squares[dst] = 'P';
+            cr.enpassant_target = static_cast<thc::Square>(dst+8);
+            break;
+        case thc::SPECIAL_BPAWN_2SQUARES:
+            squares[dst] = 'p';
+            cr.enpassant_target = static_cast<thc::Square>(dst-8);
+            break;
+        case thc::SPECIAL_WK_CASTLING:
+            squares[thc::f1] = 'R';
+            squares[thc::g1] = 'K';
+            squares[thc::h1] = ' ';
+            cr.wking_square = thc::g1;
+            break;
+        case thc::SPECIAL_WQ_CASTLING:
+            squares[thc::d1] = 'R';
+            squares[thc::c1] = 'K';
+            squares[thc::a1] = ' ';
+            cr.wking_square = thc::c1;
+            break;
+        case thc::SPECIAL_BK_CASTLING:
+            squares[thc::f8] = 'r';
+            squares[thc::g8] = 'k';
+            squares[thc::h8] = ' ';
+            cr.bking_square = thc::g8;
+            break;
+        case thc::SPECIAL_BQ_CASTLING:
+            squares[thc::d8] = 'r';
+            squares[thc::c8] = 'k';
+            squares[thc::a8] = ' ';
+            cr.bking_square = thc::c8;
+            break;
+    }
+    squares[src] = ' ';     // src is never dst, and for castling src is the king's square
+    cr.white = !white;
+}
+
 // A slow method of compressing a move into one byte
 //  Scheme is;
 //  1) Make a list of all legal moves in UCI text format, sorted alphabetically
@@ -534,6 +737,211 @@ thc::Move CompressMoves::UncompressMove( char c )
 //
 //  "R6R/3Q4/1Q4Q1/4Q3/2Q4Q/Q4Q2/pp1Q4/kBNN1KB1 w - - 0 1"
 //
+// The original scheme generates and sorts all the legal moves for every slow mode
+//  move, which makes endgame and study databases (with lots of promotions) slow to build
+//  and search. The second generation scheme avoids that;
+//  1) List the pseudo legal moves (including moves that leave the king in check) piece
+//     by piece, in square order (a8,b8..h8,a7..h1). List each piece's moves in order of
+//     destination square, and promotions in the order queen, rook, bishop, knight
+//  2) Castling is listed if the king and rook are on their home squares and the squares
+//     between them are empty (i.e. ALLOW_CASTLING_EVEN_AFTER_KING_AND_ROOK_MOVES again)
+//  3) Encode the move as one byte, value is 255 - list index, as for the original scheme
+//  4) If there are more than 254 moves in the list, which needs lots of promoted pieces,
+//     use the original scheme instead
+//
+//  Databases written before the second generation scheme (see
+//  DATABASE_VERSION_NUMBER_SLOW_MODE_V2) are upgraded with UpgradeSlowMode() as they
+//  are loaded
+#define SLOW_MODE_V2_MAX_MOVES          254     // codes 0xff-0x02, 0x01 is an error
+#define SLOW_MODE_V2_MAX_PIECE_MOVES    28      // a queen has at most 27
+
+static inline bool SlowModeV2Own( char c, bool white )
+{
+    return white ? (c>='A' && c<='Z') : (c>='a' && c<='z');
+}
+
+static inline void SlowModeV2Add( thc::Move *moves, int &n, int src, int dst, thc::SPECIAL special, char capture )
+{
+    thc::Move *m = &moves[n++];
+    m->src     = static_cast<thc::Square>(src);
+    m->dst     = static_cast<thc::Square>(dst);
+    m->special = special;
+    m->capture = capture;
+}
+
+static inline void SlowModeV2AddPawn( thc::Move *moves, int &n, int src, int dst, thc::SPECIAL special, char capture, bool promotion )
+{
+    if( !promotion )
+        SlowModeV2Add( moves, n, src, dst, special, capture );
+    else
+    {
+        SlowModeV2Add( moves, n, src, dst, thc::SPECIAL_PROMOTION_QUEEN,  capture );
+        SlowModeV2Add( moves, n, src, dst, thc::SPECIAL_PROMOTION_ROOK,   capture );
+        SlowModeV2Add( moves, n, src, dst, thc::SPECIAL_PROMOTION_BISHOP, capture );
+        SlowModeV2Add( moves, n, src, dst, thc::SPECIAL_PROMOTION_KNIGHT, capture );
+    }
+}
+
+// The pseudo legal moves of the piece on square src, in second generation slow mode order
+static int SlowModeV2PieceMoves( const thc::ChessRules &cr, int src, thc::Move *moves )
+{
+    static const int king_steps[8][2]   = { {-1,-1}, {0,-1}, {1,-1}, {-1,0}, {1,0}, {-1,1}, {0,1}, {1,1} };
+    static const int knight_steps[8][2] = { {-1,-2}, {1,-2}, {-2,-1}, {2,-1}, {-2,1}, {2,1}, {-1,2}, {1,2} };
+    static const int slider_steps[8][2] = { {0,-1}, {-1,0}, {1,0}, {0,1},       // rook
+                                            {-1,-1}, {1,-1}, {-1,1}, {1,1} };   // bishop
+    const char *squares = cr.squares;
+    bool white = cr.white;
+    int file = src&7;
+    int rank = src>>3;      // 0 is the eighth rank
+    int n = 0;
+    char piece = squares[src]|0x20;
+    if( piece == 'p' )
+    {
+        int r = white ? rank-1 : rank+1;
+        if( r<0 || r>7 )
+            return 0;
+        bool promotion = (r==0 || r==7);
+        for( int f=file-1; f<=file+1; f+=2 )
+        {
+            if( f<0 || f>7 )
+                continue;
+            int dst = r*8 + f;
+            char capture = squares[dst];
+            if( capture!=' ' && !SlowModeV2Own(capture,white) )
+                SlowModeV2AddPawn( moves, n, src, dst, thc::NOT_SPECIAL, capture, promotion );
+            else if( capture==' ' && dst==cr.enpassant_target )
+                SlowModeV2Add( moves, n, src, dst, white?thc::SPECIAL_WEN_PASSANT:thc::SPECIAL_BEN_PASSANT, white?'p':'P' );
+        }
+        int dst = r*8 + file;
+        if( squares[dst] == ' ' )
+        {
+            SlowModeV2AddPawn( moves, n, src, dst, thc::NOT_SPECIAL, ' ', promotion );
+            int dst2 = white ? dst-8 : dst+8;
+            if( rank==(white?6:1) && squares[dst2]==' ' )
+                SlowModeV2Add( moves, n, src, dst2, white?thc::SPECIAL_WPAWN_2SQUARES:thc::SPECIAL_BPAWN_2SQUARES, ' ' );
+        }
+    }
+    else
+    {
+        const int (*steps)[2] = slider_steps;
+        int first=0, last=8;
+        bool slide = true;
+        thc::SPECIAL special = thc::NOT_SPECIAL;
+        switch( piece )
+        {
+            case 'k':   steps = king_steps;     slide = false;  special = thc::SPECIAL_KING_MOVE;   break;
+            case 'n':   steps = knight_steps;   slide = false;  break;
+            case 'r':   last  = 4;              break;
+            case 'b':   first = 4;              break;
+            case 'q':   break;
+            default:    return 0;
+        }
+        for( int i=first; i<last; i++ )
+        {
+            int f = file + steps[i][0];
+            int r = rank + steps[i][1];
+            while( 0<=f && f<=7 && 0<=r && r<=7 )
+            {
+                int dst = r*8 + f;
+                char capture = squares[dst];
+                if( SlowModeV2Own(capture,white) )
+                    break;
+                SlowModeV2Add( moves, n, src, dst, special, capture );
+                if( capture!=' ' || !slide )
+                    break;
+                f += steps[i][0];
+                r += steps[i][1];
+            }
+        }
+        if( piece == 'k' )
+        {
+            if( white && src==thc::e1 )
+            {
+                if( squares[thc::h1]=='R' && squares[thc::f1]==' ' && squares[thc::g1]==' ' )
+                    SlowModeV2Add( moves, n, src, thc::g1, thc::SPECIAL_WK_CASTLING, ' ' );
+                if( squares[thc::a1]=='R' && squares[thc::b1]==' ' && squares[thc::c1]==' ' && squares[thc::d1]==' ' )
+                    SlowModeV2Add( moves, n, src, thc::c1, thc::SPECIAL_WQ_CASTLING, ' ' );
+            }
+            else if( !white && src==thc::e8 )
+            {
+                if( squares[thc::h8]=='r' && squares[thc::f8]==' ' && squares[thc::g8]==' ' )
+                    SlowModeV2Add( moves, n, src, thc::g8, thc::SPECIAL_BK_CASTLING, ' ' );
+                if( squares[thc::a8]=='r' && squares[thc::b8]==' ' && squares[thc::c8]==' ' && squares[thc::d8]==' ' )
+                    SlowModeV2Add( moves, n, src, thc::c8, thc::SPECIAL_BQ_CASTLING, ' ' );
+            }
+        }
+    }
+
+    // Put the moves in order of destination square, a stable insertion sort leaves
+    //  promotions in the order they were added
+    for( int i=1; i<n; i++ )
+    {
+        thc::Move mv = moves[i];
+        int j = i;
+        for( ; j>0 && moves[j-1].dst>mv.dst; j-- )
+            moves[j] = moves[j-1];
+        moves[j] = mv;
+    }
+    return n;
+}
+
+// Returns the code, or 0 if the list is too long (so the original scheme must be used)
+static int SlowModeV2Encode( const thc::ChessRules &cr, thc::Move mv )
+{
+    thc::Move moves[SLOW_MODE_V2_MAX_PIECE_MOVES];
+    int total = 0;
+    int idx = -1;
+    for( int src=0; src<64; src++ )
+    {
+        if( !SlowModeV2Own(cr.squares[src],cr.white) )
+            continue;
+        int n = SlowModeV2PieceMoves( cr, src, moves );
+        if( src == mv.src )
+        {
+            for( int i=0; i<n; i++ )
+            {
+                thc::Move m = moves[i];
+                bool promotion = (m.special>=thc::SPECIAL_PROMOTION_QUEEN && m.special<=thc::SPECIAL_PROMOTION_KNIGHT);
+                if( m.dst==mv.dst && (!promotion || m.special==mv.special) )
+                {
+                    idx = total+i;
+                    break;
+                }
+            }
+        }
+        total += n;
+    }
+    if( total > SLOW_MODE_V2_MAX_MOVES )
+        return 0;
+    if( idx < 0 )
+        return 1;   // error
+    return 255-idx;
+}
+
+// Returns false if the list is too long (so the original scheme must be used)
+static bool SlowModeV2Decode( const thc::ChessRules &cr, char code, thc::Move &mv )
+{
+    thc::Move moves[SLOW_MODE_V2_MAX_PIECE_MOVES];
+    int idx = 255 - (code&0xff);   // 255->0, 254->1 etc.
+    int total = 0;
+    bool found = false;
+    mv.Invalid();
+    for( int src=0; src<64; src++ )
+    {
+        if( !SlowModeV2Own(cr.squares[src],cr.white) )
+            continue;
+        int n = SlowModeV2PieceMoves( cr, src, moves );
+        if( total==0 && n>0 )
+            mv = moves[0];      // all errors resolve to this - take first move from list
+        if( !found && idx<total+n )
+        {
+            mv = moves[idx-total];
+            found = true;
+        }
+        total += n;
+    }
+    return total <= SLOW_MODE_V2_MAX_MOVES;
+}
 
 
 char CompressMoves::CompressSlowMode( thc::Move mv )
@@ -546,6 +954,15 @@ char CompressMoves::CompressSlowMode( thc::Move mv )
     cr.wqueen = 1;
     cr.bking = 1;
     cr.bqueen = 1;
+    if( slow_mode_v2 )
+    {
+        code = SlowModeV2Encode( cr, mv );
+        if( code )
+        {
+            DIAG_ONLY( nbr_slow_moves++; )
+            return static_cast<char>(code);
+        }
+    }
 
     // Generate a list of all legal moves, in string form, sorted
     std::vector<thc::Move> moves;
@@ -917,6 +1334,14 @@ thc::Move CompressMoves::UncompressSlowMode( char code )
     cr.wqueen = 1;
     cr.bking = 1;
     cr.bqueen = 1;
+    return UncompressSlowMode( cr, code, slow_mode_v2 );
+}
+
+thc::Move CompressMoves::UncompressSlowMode( thc::ChessRules &cr, char code, bool v2 )
+{
+    thc::Move mv;
+    if( v2 && SlowModeV2Decode(cr,code,mv) )
+        return mv;
 
     // Generate a list of all legal moves, in string form, sorted
     std::vector<thc::Move> moves;
@@ -943,7 +1368,6 @@ thc::Move CompressMoves::UncompressSlowMode( char code )
     if( idx >= len )
         idx = 0;    // all errors resolve to this - take first move from list
     std::string the_move = moves_alpha[idx];
-    thc::Move mv;
     #ifdef TERSE
     mv.TerseIn( &cr, the_move.c_str() );
     #else
@@ -952,12 +1376,28 @@ thc::Move CompressMoves::UncompressSlowMode( char code )
     return mv;
 }
 
+// Only slow mode moves change, so a game without them comes back unchanged
+bool CompressMoves::UpgradeSlowMode( std::string &moves )
+{
+    CompressMoves original;
+    original.slow_mode_v2 = false;
+    std::vector<thc::Move> unpacked;
+    original.Uncompress( moves, unpacked );
+    CompressMoves press;
+    std::string upgraded = press.Compress( unpacked );
+    if( upgraded == moves )
+        return false;
+    moves = upgraded;
+    return true;
+}
+
 thc::Move CompressMoves::UncompressFastMode( char code, Side *side, Side *other )
 {
     DIAG_ONLY( nbr_uncompress_fast++ );
     int src=0;
     int dst=0;
     int hi_nibble = code&0xf0;
+    int lo_nibble = code&0x0f;
     thc::SPECIAL special = thc::NOT_SPECIAL;
     switch( hi_nibble )
     {
@@ -965,38 +1405,22 @@ thc::Move CompressMoves::UncompressFastMode( char code, Side *side, Side *other
         {
             special = thc::SPECIAL_KING_MOVE;
             src = side->king;
-            int delta=0;
-            switch( code&0x0f )     // 0, 1, 2
-            {                       // 8, 9, 10
-                                    // 16,17,18
-                case K_VECTOR_NW:    delta = -9; break;  // 0-9
-                case K_VECTOR_N:     delta = -8; break;  // 1-9
-                case K_VECTOR_NE:    delta = -7; break;  // 2-9
-                case K_VECTOR_W:     delta = -1; break;  // 8-9
-                case K_VECTOR_E:     delta =  1; break;  // 10-9
-                case K_VECTOR_SW:    delta =  7; break;  // 16-9
-                case K_VECTOR_S:     delta =  8; break;  // 17-9
-                case K_VECTOR_SE:    delta =  9; break;  // 18-9
-                case K_K_CASTLING:
-                {
-                    special = cr.white ? thc::SPECIAL_WK_CASTLING : thc::SPECIAL_BK_CASTLING;
-                    delta = 2;
-                    int rook_offset = (side->rooks[0]==src+3 ? 0 : 1);  // a rook will be 3 squares to right of king
-                    side->rooks[rook_offset] = src+1;                   // that rook ends up 1 square right of king
-                    // note that there is no way the rooks ordering can swap during castling
-                    break;
-                }
-                case K_Q_CASTLING:
-                {
-                    special = cr.white ? thc::SPECIAL_WQ_CASTLING : thc::SPECIAL_BQ_CASTLING;
-                    delta = -2;
-                    int rook_offset = (side->rooks[0]==src-4 ? 0 : 1);  // a rook will be 4 squares to left of king
-                    side->rooks[rook_offset] = src-1;                   // that rook ends up 1 square left of king
-                    // note that there is no way the rooks ordering can swap during castling
-                    break;
-                }
+            dst = decode_tables.dst[DECODE_KING][src][lo_nibble];
+            if( lo_nibble == K_K_CASTLING )
+            {
+                special = cr.white ? thc::SPECIAL_WK_CASTLING : thc::SPECIAL_BK_CASTLING;
+                int rook_offset = (side->rooks[0]==src+3 ? 0 : 1);  // a rook will be 3 squares to right of king
+                side->rooks[rook_offset] = src+1;                   // that rook ends up 1 square right of king
+                // note that there is no way the rooks ordering can swap during castling
             }
-            side->king = dst = src+delta;
+            else if( lo_nibble == K_Q_CASTLING )
+            {
+                special = cr.white ? thc::SPECIAL_WQ_CASTLING : thc::SPECIAL_BQ_CASTLING;
+                int rook_offset = (side->rooks[0]==src-4 ? 0 : 1);  // a rook will be 4 squares to left of king
+                side->rooks[rook_offset] = src-1;                   // that rook ends up 1 square left of king
+                // note that there is no way the rooks ordering can swap during castling
+            }
+            side->king = dst;
             break;
         }
 
@@ -1005,14 +1429,7 @@ thc::Move CompressMoves::UncompressFastMode( char code, Side *side, Side *other
         {
             int rook_offset = (hi_nibble==CODE_ROOK_LO ? 0 : 1 );
             src = side->rooks[rook_offset];
-            if( code & R_RANK )                // code encodes rank ?
-            {
-                dst = ((code<<3)&0x38) | (src&7);   // same file as src, rank from code
-            }
-            else
-            {
-                dst = (src&0x38) | (code&7);        // same rank as src, file from code
-            }
+            dst = decode_tables.dst[DECODE_ROOK][src][lo_nibble];
             side->rooks[rook_offset] = dst;
 
             // swap ?
@@ -1028,11 +1445,7 @@ thc::Move CompressMoves::UncompressFastMode( char code, Side *side, Side *other
         case CODE_BISHOP_DARK:
         {
             src = side->bishop_dark;
-            int file_delta = (code&7) - (src&7);
-            if( code & B_FALL )  // FALL\ + file
-                dst = src + 9*file_delta;   // eg src=b8(1), dst=h2(55), file_delta=6  -> 9*6 =54
-            else                  // RISE/ + file
-                dst = src - 7*file_delta;   // eg src=h8(7), dst=a1(56), file_delta=7  -> 7*7 =49
+            dst = decode_tables.dst[DECODE_BISHOP][src][lo_nibble];
             side->bishop_dark = dst;
             break;
         }
@@ -1040,11 +1453,7 @@ thc::Move CompressMoves::UncompressFastMode( char code, Side *side, Side *other
         case CODE_BISHOP_LIGHT:
         {
             src = side->bishop_light;
-            int file_delta = (code&7) - (src&7);
-            if( code & B_FALL )  // FALL\ + file
-                dst = src + 9*file_delta;   // eg src=a8(0), dst=h1(63), file_delta=7  -> 9*7 =63
-            else                  // RISE/ + file
-                dst = src - 7*file_delta;   // eg src=g8(6), dst=a2(48), file_delta=6  -> 7*6 =42
+            dst = decode_tables.dst[DECODE_BISHOP][src][lo_nibble];
             side->bishop_light = dst;
             break;
         }
@@ -1052,10 +1461,7 @@ thc::Move CompressMoves::UncompressFastMode( char code, Side *side, Side *other
         case CODE_QUEEN_ROOK:
         {
             src = side->queens[0];
-            if( code & R_RANK )                // code encodes rank ?
-                dst = ((code<<3)&0x38) | (src&7);   // same file as src, rank from code
-            else
-                dst = (src&0x38) | (code&7);        // same rank as src, file from code
+            dst = decode_tables.dst[DECODE_ROOK][src][lo_nibble];
             side->queens[0] = dst;
 
             // swap ?
@@ -1071,11 +1477,7 @@ thc::Move CompressMoves::UncompressFastMode( char code, Side *side, Side *other
         case CODE_QUEEN_BISHOP:
         {
             src = side->queens[0];
-            int file_delta = (code&7) - (src&7);
-            if( code & B_FALL )  // FALL\ + file
-                dst = src + 9*file_delta;   // eg src=a8(0), dst=h1(63), file_delta=7  -> 9*7 =63
-            else                  // RISE/ + file
-                dst = src - 7*file_delta;   // eg src=h8(7), dst=a1(56), file_delta=7  -> 7*7 =49
+            dst = decode_tables.dst[DECODE_BISHOP][src][lo_nibble];
             side->queens[0] = dst;
 
             // swap ?
@@ -1092,21 +1494,7 @@ thc::Move CompressMoves::UncompressFastMode( char code, Side *side, Side *other
         {
             int knight_offset = ((code&N_HI) ? 1 : 0 );
             src = side->knights[knight_offset];
-            int delta=0;
-            switch(code&7)          // 0, 1, 2, 3
-            {                       // 8, 9, 10,11
-                                    // 16,17,18,19
-                                    // 24,25,26,27
-                case N_VECTOR_NNE:   delta = -15;   break; // 2-17
-                case N_VECTOR_NEE:   delta = -6;    break; // 11-17
-                case N_VECTOR_SEE:   delta = 10;    break; // 27-17
-                case N_VECTOR_SSE:   delta = 17;    break; // 27-10
-                case N_VECTOR_SSW:   delta = 15;    break; // 25-10
-                case N_VECTOR_SWW:   delta = 6;     break; // 16-10
-                case N_VECTOR_NWW:   delta = -10;   break; // 0-10
-                case N_VECTOR_NNW:   delta = -17;   break; // 0-17
-            }
-            dst = src+delta;
+            dst = decode_tables.dst[DECODE_KNIGHT][src][lo_nibble];
             side->knights[knight_offset] = dst;
 
             // swap ?
@@ -1126,10 +1514,7 @@ thc::Move CompressMoves::UncompressFastMode( char code, Side *side, Side *other
             else
             {
                 src = side->queens[1];
-                if( code & R_RANK )                // code encodes rank ?
-                    dst = ((code<<3)&0x38) | (src&7);   // same file as src, rank from code
-                else
-                    dst = (src&0x38) | (code&7);        // same rank as src, file from code
+                dst = decode_tables.dst[DECODE_ROOK][src][lo_nibble];
                 side->queens[1] = dst;
 
                 // swap ?
@@ -1150,11 +1535,7 @@ thc::Move CompressMoves::UncompressFastMode( char code, Side *side, Side *other
             else
             {
                 src = side->queens[1];
-                int file_delta = (code&7) - (src&7);
-                if( code & B_FALL )  // FALL\ + file
-                    dst = src + 9*file_delta;   // eg src=a8(0), dst=h1(63), file_delta=7  -> 9*7 =63
-                else                  // RISE/ + file
-                    dst = src - 7*file_delta;   // eg src=h8(7), dst=a1(56), file_delta=7  -> 7*7 =49
+                dst = decode_tables.dst[DECODE_BISHOP][src][lo_nibble];
                 side->queens[1] = dst;
 
                 // swap ?
@@ -1172,52 +1553,14 @@ thc::Move CompressMoves::UncompressFastMode( char code, Side *side, Side *other
         default:
         {
             int pawn_offset = (code>>4)&0x07;
-            bool promoting = false;
             src = side->pawns[pawn_offset];
-            bool reordering_possible = false;
-            bool white = cr.white;
-            int delta=0;
-            switch( code&0x0f )
-            {
-                case P_DOUBLE:      special = white ? thc::SPECIAL_WPAWN_2SQUARES : thc::SPECIAL_BPAWN_2SQUARES;
-                                    delta = white?-16:16; break;
-                case P_SINGLE:      delta = white?-8:8;   break;
-                case P_LEFT:
-                {
-                    reordering_possible = true;
-                    delta = white?-9:9;
-                    if( !isalpha(cr.squares[src+delta]) )
-                        special = (white ? thc::SPECIAL_WEN_PASSANT : thc::SPECIAL_BEN_PASSANT);
-                    break;
-                }
-                case P_RIGHT:
-                {
-                    reordering_possible = true;
-                    delta = white?-7:7;
-                    if( !isalpha(cr.squares[src+delta]) )
-                        special = (white ? thc::SPECIAL_WEN_PASSANT : thc::SPECIAL_BEN_PASSANT);
-                    break;
-                }
-                default:
-                {
-                    promoting = true;
-                    switch( (code>>2)&3 )
-                    {
-                        case P_SINGLE:     delta = white?-8:8;   break;
-                        case P_LEFT:       delta = white?-9:9;   break;
-                        case P_RIGHT:      delta = white?-7:7;   break;
-                    }
-                    switch( code&3 )
-                    {
-                        case P_QUEEN:      special = thc::SPECIAL_PROMOTION_QUEEN;    break;
-                        case P_ROOK:       special = thc::SPECIAL_PROMOTION_ROOK;     break;
-                        case P_BISHOP:     special = thc::SPECIAL_PROMOTION_BISHOP;   break;
-                        case P_KNIGHT:     special = thc::SPECIAL_PROMOTION_KNIGHT;   break;
-                    }
-                    break;
-                }
-            }
-            side->pawns[pawn_offset] = dst = src+delta;
+            dst = decode_tables.dst[cr.white?DECODE_WPAWN:DECODE_BPAWN][src][lo_nibble];
+            special = decode_tables.pawn_special[cr.white?0:1][lo_nibble];
+            bool promoting = (lo_nibble > P_RIGHT);
+            bool reordering_possible = (lo_nibble==P_LEFT || lo_nibble==P_RIGHT);
+            if( reordering_possible && cr.squares[dst]!=' ' )
+                special = thc::NOT_SPECIAL;     // a normal capture, not en passant
+            side->pawns[pawn_offset] = dst;
 
             // If promoting piece, force a reset and retry next time for this side. This
             //  way we accommodate our pawn disappearing, and a new piece appearing in
@@ -1259,10 +1602,10 @@ thc::Move CompressMoves::UncompressFastMode( char code, Side *side, Side *other
     else if( special == thc::SPECIAL_BEN_PASSANT )
         capture_location = dst-8;
     char capture = cr.squares[capture_location];
-    bool making_capture = (isalpha(capture) ? true : false);
+    bool making_capture = (capture != ' ');
     if( making_capture && other->fast_mode )
     {
-        switch( tolower(capture) )
+        switch( capture|0x20 )  // to lower case, without a library call
         {
             case 'n':
             {
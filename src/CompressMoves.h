@@ -43,6 +43,7 @@ public:
         sides[1].fast_mode=false;
         is_interesting = 0;
         nbr_slow_moves = 0;
+        slow_mode_v2 = true;
     }
     CompressMoves( thc::ChessPosition &cp )
     {
@@ -50,18 +51,43 @@ public:
         sides[1].white=false;
         is_interesting = 0;
         nbr_slow_moves = 0;
+        slow_mode_v2 = true;
         Init(cp);
     }
     bool TryFastMode( Side *side );
     std::string Compress( std::vector<thc::Move> &moves_in );
     std::string Compress( thc::ChessPosition &cp, std::vector<thc::Move> &moves_in );
+
+    // Uncompress a whole game, only the position in cr is maintained (as for
+    //  UncompressMovePositionOnly() below). The last two versions don't allocate,
+    //  they fill a caller supplied buffer with room for len moves (returning the
+    //  number of moves), or a caller supplied vector (reusing its storage)
     std::vector<thc::Move> Uncompress( std::string &moves_in );
     std::vector<thc::Move> Uncompress( thc::ChessPosition &cp, std::string &moves_in );
+    int  Uncompress( const char *moves_in, int len, thc::Move *moves_out );
+    void Uncompress( const std::string &moves_in, std::vector<thc::Move> &moves_out );
+
     std::string ToNaturalMoves( const std::string& moves_in, const std::string& result );
     char      CompressMove( thc::Move mv );
     thc::Move UncompressMove( char c );
-    CompressMoves( const CompressMoves& copy_from_me ) { cr=copy_from_me.cr; sides[0]=copy_from_me.sides[0]; sides[1]=copy_from_me.sides[1]; }
-    CompressMoves & operator= (const CompressMoves & copy_from_me ) { cr=copy_from_me.cr; sides[0]=copy_from_me.sides[0]; sides[1]=copy_from_me.sides[1]; return *this; }
+
+    // Faster UncompressMove() for bulk operations, updates the position in cr (squares, side
+    //  to move, en passant target, king squares) but not the history, move counts or castling
+    //  flags, so cr isn't suitable for ChessRules::PlayMove() etc. afterwards
+    thc::Move UncompressMovePositionOnly( char c );
+
+    // Slow mode for a position with the castling flags already forced (see
+    //  ALLOW_CASTLING_EVEN_AFTER_KING_AND_ROOK_MOVES), so other implementations of the
+    //  scheme (eg MemoryPositionSearch) can share it
+    static thc::Move UncompressSlowMode( thc::ChessRules &cr, char code, bool v2 );
+
+    // Rewrite a game from the standard starting position, compressed with the original
+    //  slow mode scheme, using the second generation scheme. Returns false if it has
+    //  no slow mode moves (so no change is needed)
+    static bool UpgradeSlowMode( std::string &moves );
+
+    CompressMoves( const CompressMoves& copy_from_me ) { cr=copy_from_me.cr; sides[0]=copy_from_me.sides[0]; sides[1]=copy_from_me.sides[1]; slow_mode_v2=copy_from_me.slow_mode_v2; }
+    CompressMoves & operator= (const CompressMoves & copy_from_me ) { cr=copy_from_me.cr; sides[0]=copy_from_me.sides[0]; sides[1]=copy_from_me.sides[1]; slow_mode_v2=copy_from_me.slow_mode_v2; return *this; }
     void Init() { TryFastMode( &sides[0]); TryFastMode( &sides[1]); }
     void Init( thc::ChessPosition &cp ) { cr = cp; Init(); }
 
@@ -69,10 +95,14 @@ public:
     thc::ChessRules cr;
     int is_interesting;
     int nbr_slow_moves;
+    bool slow_mode_v2;      // false for the original slow mode scheme, see DATABASE_VERSION_NUMBER_SLOW_MODE_V2
 private:
     Side sides[2];
     char CompressSlowMode( thc::Move mv );
     char CompressFastMode( thc::Move mv, Side *side, Side *other );
+    void ResetSides();
+    thc::Move UncompressMoveNoPlay( char c );
+    void PlayMovePositionOnly( thc::Move mv );
     thc::Move UncompressSlowMode( char code );
     thc::Move UncompressFastMode( char code, Side *side, Side *other );
     thc::Move UncompressFastMode( char code, Side *side, Side *other, std::string &san_move );
@@ -10,6 +10,7 @@
 #include "wx/file.h"
 #include "wx/filename.h"
 #include "wx/filepicker.h"
+#include "wx/thread.h"
 #include "DebugPrintf.h"
 #include "Portability.h"
 #include "Appdefs.h"
@@ -20,6 +21,8 @@
 #include "DbPrimitives.h"
 #include "PackedGameBinDb.h"
 #include "BinDb.h"
+#include "GameLogic.h"
+#include "Objects.h"
 #include "CreateDatabaseDialog.h"
 
 // CreateDatabaseDialog type definition
@@ -397,8 +400,7 @@ void CreateDatabaseDialog::OnCreateDatabase()
             desc += buf;
             ProgressBar progress_bar( title, desc, true, this, ifile );
             uint32_t begin = BinDbGetGamesSize();
-            PgnRead pgn('B',&progress_bar);
-            bool aborted = pgn.Process(ifile);
+            bool aborted = BinDbPgnRead(ifile,&progress_bar);
             uint32_t end = BinDbGetGamesSize();
             BinDbNormaliseOrder( begin, end );
             if( aborted )
@@ -517,6 +519,12 @@ void CreateDatabaseDialog::OnAppendDatabase()
     FILE *ofile=NULL;
     if( ok )
     {
+        // The file is likely the current database, whose games may point into it. If so it
+        //  must be released before it is overwritten
+        extern wxMutex *WaitForWorkerThread( const char *title );
+        wxMutex *ptr_mutex_tiny_database = WaitForWorkerThread( "Appending to database" );
+        wxMutexLocker lock(*ptr_mutex_tiny_database);
+        objs.gl->ReleaseMappedFile( db_name.c_str() );
         ofile = fopen( db_name.c_str(), "wb" );
         if( ofile )
             created_new_db_file = true;
@@ -545,8 +553,7 @@ void CreateDatabaseDialog::OnAppendDatabase()
             desc2 += buf;
             ProgressBar progress_bar2( title2, desc2, true, this, ifile );
             uint32_t begin = BinDbGetGamesSize();
-            PgnRead pgn('B',&progress_bar2);
-            bool aborted = pgn.Process(ifile);
+            bool aborted = BinDbPgnRead(ifile,&progress_bar2);
             uint32_t end = BinDbGetGamesSize();
             BinDbNormaliseOrder( begin, end );
             if( aborted )
@@ -65,88 +65,6 @@ static void LoadInBackground( Database *ptr1 )
 
 wxMutex s_mutex_tiny_database;
 
-// Some experiments on indexing the database for more speed - eg if searching for a position with a
-//  White Knight on f3, don't bother searching the 10% or so of games where no white knight ever lands
-//  on f3. The experiments are aimed at finding the best 8,16,32 or 64 piece square combos (like white
-//  knight on f3 - likely a good one because many positions will have a white knight on f3, but a useful
-//  proportion of games will never see a white knight there)
-//
-//#define DATABASE_EXPERIMENTS
-#ifndef DURING_DEVELOPMENT
-#undef  DATABASE_EXPERIMENTS    // Never unless during development
-#endif
-#ifdef DATABASE_EXPERIMENTS
-
-// pieces 'B','K','N','P','Q','R','b','k','n','p','q','r'
-static int piece_to_idx[128] =
-{
-    0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,    // 0x00
-    0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,    // 0x10
-    0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,    // 0x20
-    0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,    // 0x30
-    0,0,1,0,0,0,0,0,0,0,0,2,0,0,3,0,    // 0x40, 0x41='A'
-    4,5,6,0,0,0,0,0,0,0,0,0,0,0,0,0,    // 0x50='P'
-    0,0,7,0,0,0,0,0,0,0,0,8,0,0,9,0,    // 0x60, 0x61='a'
-    10,11,12,0,0,0,0,0,0,0,0,0,0,0,0,0  // 0x70='p'
-};
-static int idx_to_piece[16] =
-{
-    0,'B','K','N','P','Q','R','b','k','n','p','q','r'
-};
-
-struct PieceSquareCombo
-{
-    char piece;
-    char file;
-    char rank;
-    bool hit;
-    bool always_hit;
-    unsigned long game_count;
-    unsigned long ply_array[100];
-    double hit_rate;
-    double search_frequency;
-    double effectiveness;
-};
-static PieceSquareCombo stats[16][64];
-static int nbr_games_this_long[100];
-static const int PLY_MIN = 4;
-static const int PLY_MAX = 30;
-
-int func_E( const void *q1, const void *q2 )
-{
-    const PieceSquareCombo *p1 = (PieceSquareCombo *)q1;
-    const PieceSquareCombo *p2 = (PieceSquareCombo *)q2;
-    if( p2->effectiveness > p1->effectiveness )
-        return 1;
-    if( p2->effectiveness < p1->effectiveness )
-        return -1;
-    return 0;
-}
-
-int func_H( const void *q1, const void *q2 )
-{
-    const PieceSquareCombo *p1 = (PieceSquareCombo *)q1;
-    const PieceSquareCombo *p2 = (PieceSquareCombo *)q2;
-    if( p2->hit_rate > p1->hit_rate )
-        return 1;
-    if( p2->hit_rate < p1->hit_rate )
-        return -1;
-    return 0;
-}
-
-int func_S( const void *q1, const void *q2 )
-{
-    const PieceSquareCombo *p1 = (PieceSquareCombo *)q1;
-    const PieceSquareCombo *p2 = (PieceSquareCombo *)q2;
-    if( p2->search_frequency > p1->search_frequency )
-        return 1;
-    if( p2->search_frequency < p1->search_frequency )
-        return -1;
-    return 0;
-}
-
-#endif
-
 void * WorkerThread::Entry()
 {
     static int count;
@@ -157,281 +75,6 @@ void * WorkerThread::Entry()
         {
             cprintf( "... if we waited for mutex, wait is over (%d)\n", temp );
             the_database->LoadAllGamesForPositionSearch( the_database->tiny_db.in_memory_game_cache );
-
-            // put investigation stuff here
-#ifdef DATABASE_EXPERIMENTS
-            for( int i=1; i<=12; i++ )
-            {
-                char piece = idx_to_piece[i];
-                for( int sq=0; sq<64; sq++ )
-                {
-                    PieceSquareCombo *p = &stats[i][sq];
-                    p->piece = piece;
-                    p->file = 'a' + (sq%8);
-                    p->rank = '8' - ((sq>>3)&7);
-                    if( piece=='p' && 8<=sq && sq<16 )
-                        p->always_hit = true;
-                    if( piece=='P' && 48<=sq && sq<56 )
-                        p->always_hit = true;
-                    if( piece=='r' && (sq==0||sq==7) )
-                        p->always_hit = true;
-                    if( piece=='n' && (sq==1||sq==6) )
-                        p->always_hit = true;
-                    if( piece=='b' && (sq==2||sq==5) )
-                        p->always_hit = true;
-                    if( piece=='q' && sq==3 )
-                        p->always_hit = true;
-                    if( piece=='k' && sq==4 )
-                        p->always_hit = true;
-                    if( piece=='R' && (sq==56||sq==63) )
-                        p->always_hit = true;
-                    if( piece=='N' && (sq==57||sq==62) )
-                        p->always_hit = true;
-                    if( piece=='B' && (sq==58||sq==61) )
-                        p->always_hit = true;
-                    if( piece=='Q' && sq==59 )
-                        p->always_hit = true;
-                    if( piece=='K' && sq==60 )
-                        p->always_hit = true;
-                }
-            }
-            int nbr_games = the_database->tiny_db.in_memory_game_cache.size();
-            for( int i=0; i<nbr_games; i++ )
-            {
-                int modulo = i<10000 ? 1000 : (i<10000?10000:100000);
-                if( i%modulo == 0 )
-                    cprintf( "Investigation %d games\n", i );
-                for( int j=0; j<16; j++ )
-                {
-                    for( int k=0; k<64; k++ )
-                    {
-                        PieceSquareCombo *p = &stats[j][k];
-                        p->hit = p->always_hit;
-                        if( p->hit )
-                            p->game_count++;
-                    }
-                }
-                smart_ptr<ListableGame> ptr = the_database->tiny_db.in_memory_game_cache[i];
-                CompactGame pact;
-                ptr->GetCompactGame( pact );
-                int nbr_moves = pact.moves.size();
-                thc::ChessRules cr;
-                for( int ply=0; ply<nbr_moves; ply++ )
-                {
-                    thc::Move mv = pact.moves[ply];
-                    unsigned int src = static_cast<unsigned int>(mv.src);
-                    char piece = cr.squares[src];
-                    switch( mv.special )
-                    {
-                        default: break;
-                        case thc::SPECIAL_PROMOTION_BISHOP: piece = (piece=='p'?'b':'B'); break;
-                        case thc::SPECIAL_PROMOTION_KNIGHT: piece = (piece=='p'?'n':'N'); break;
-                        case thc::SPECIAL_PROMOTION_ROOK:   piece = (piece=='p'?'r':'R'); break;
-                        case thc::SPECIAL_PROMOTION_QUEEN:  piece = (piece=='p'?'q':'Q'); break;
-                        case thc::SPECIAL_WK_CASTLING:
-                        case thc::SPECIAL_BK_CASTLING:
-                        case thc::SPECIAL_WQ_CASTLING:
-                        case thc::SPECIAL_BQ_CASTLING:
-                        {
-                            thc::Square castling_sq=thc::f1;
-                            char castling_rook='R';
-                            switch( mv.special )
-                            {
-                                case thc::SPECIAL_WQ_CASTLING:  castling_sq=thc::c1; break;
-                                case thc::SPECIAL_BK_CASTLING:  castling_sq=thc::f8; castling_rook='r'; break;
-                                case thc::SPECIAL_BQ_CASTLING:  castling_sq=thc::c8; castling_rook='r'; break;
-                            }
-                            int piece_idx = piece_to_idx[castling_rook];
-                            unsigned int sq = static_cast<unsigned int>(castling_sq);
-                            PieceSquareCombo *p = &stats[piece_idx][sq];
-                            if( !p->hit )
-                            {
-                                p->hit = true;
-                                p->game_count++;
-                            }
-                        }
-                    }
-                    int piece_idx = piece_to_idx[piece];
-
-                    // A piece lands on a square - indicate that for this is a game where piece hit that square
-                    unsigned int sq = static_cast<unsigned int>(mv.dst);
-                    PieceSquareCombo *p = &stats[piece_idx][sq];
-                    if( !p->hit )
-                    {
-                        p->hit = true;
-                        p->game_count++;
-                    }
-                    cr.PlayMove(mv);
-
-                    // After every move, update a ply indexed array for every piece/square combination
-                    if( ply < 100 )
-                    {
-                        nbr_games_this_long[ply]++;
-                        for( int jj=1; jj<=12; jj++ )
-                        {
-                            char rover_piece = idx_to_piece[jj];
-                            for( int kk=0; kk<64; kk++ )
-                            {
-                                if( cr.squares[kk] == rover_piece )
-                                {
-                                    PieceSquareCombo *pp = &stats[jj][kk];
-                                    pp->ply_array[ply]++;
-                                }
-                            }
-                        }
-                    }
-                }
-            }
-
-            // Display stats
-            cprintf( "Investigation complete %d games\n", nbr_games );
-            cprintf( "Stats for each piece/square combo\n", nbr_games );
-            for( int i=1; i<=12; i++ )
-            {
-                char piece = idx_to_piece[i];
-                const char *name="?";
-                switch(piece)
-                {
-                    case 'r': name="Black Rook";        break;
-                    case 'n': name="Black Knight";      break;
-                    case 'b': name="Black Bishop";      break;
-                    case 'q': name="Black Queen";       break;
-                    case 'k': name="Black King";        break;
-                    case 'p': name="Black Pawn";        break;
-                    case 'R': name="White Rook";        break;
-                    case 'N': name="White Knight";      break;
-                    case 'B': name="White Bishop";      break;
-                    case 'Q': name="White Queen";       break;
-                    case 'K': name="White King";        break;
-                    case 'P': name="White Pawn";        break;
-                }
-                cprintf( "\n%s\n", name );
-                for( int r=0; r<8; r++ )
-                {
-                    for( int f=0; f<8; f++ )
-                    {
-                        PieceSquareCombo *p = &stats[i][r*8+f];
-
-                        // Calculate H = hit rate
-                        p->hit_rate = (double)(p->game_count) / (double)(nbr_games);
-
-                        // Calculate S = search frequency
-                        double sum = 0.0;
-                        for( int ply=PLY_MIN; ply<=PLY_MAX; ply++ )
-                        {
-                            double ply_hit_rate = 0.0;
-                            if( nbr_games_this_long[ply] > 0 )
-                                ply_hit_rate =  (double)(p->ply_array[ply]) / (double)(nbr_games_this_long[ply]);
-                            sum += ply_hit_rate;
-                        }
-                        p->search_frequency = sum / (PLY_MAX-PLY_MIN+1);   // Average rate at which piece/square combo
-                                                                           //  appears in position between PLY_MIN and PLY_MAX
-
-                        // Calculate E = effectiveness,  E = S*(1-H)
-                        // If search position contains the combo, then no need to search games where combo not hit
-                        // So EFFECTIVENESS = AVG * proportion of games where combo not hit
-                        //  eg if Nf3 appears in 40% of positions, and is hit somewhere in 90% of games
-                        //  effectiveness = 40% * 10% = 4% speedup if we know which games Nf3 hits somewhere
-                        double effectiveness = p->search_frequency * (double)(nbr_games - p->game_count)  / (double)(nbr_games);
-                        p->effectiveness = effectiveness;
-                    }
-                    for( int f=0; f<8; f++ )
-                    {
-                        PieceSquareCombo *p = &stats[i][r*8+f];
-                        char buf[100];
-                        sprintf( buf, "   %c", r==0 ? p->file : ' ' );
-                        if( f == 0 )
-                            cprintf( "   " );
-                        cprintf( "%-8s%c", buf, f==7 ? '\n' : ' ' );
-                    }
-                    for( int f=0; f<8; f++ )
-                    {
-                        PieceSquareCombo *p = &stats[i][r*8+f];
-                        char buf[100];
-                        sprintf( buf, "H=%2.2f%%", p->hit_rate*100.0 );
-                        if( 0==strcmp(buf+2,"100.00%") )
-                            strcpy(buf+2,"100%");
-                        if( f == 0 )
-                            cprintf( "   " );
-                        cprintf( "%-8s%c", buf, f==7 ? '\n' : ' ' );
-                    }
-                    for( int f=0; f<8; f++ )
-                    {
-                        PieceSquareCombo *p = &stats[i][r*8+f];
-                        char buf[100];
-                        sprintf( buf, "S=%2.2f%%", p->search_frequency*100.0 );
-                        if( 0==strcmp(buf+2,"100.00%") )
-                            strcpy(buf+2,"100%");
-                        if( f == 0 )
-                            cprintf( " %c ", p->rank );
-                        cprintf( "%-8s%c", buf, f==7 ? '\n' : ' ' );
-                    }
-                    for( int f=0; f<8; f++ )
-                    {
-                        PieceSquareCombo *p = &stats[i][r*8+f];
-                        char buf[100];
-                        sprintf( buf, "E=%2.2f%%", p->effectiveness*100.0 );
-                        if( 0==strcmp(buf+2,"100.00%") )
-                            strcpy(buf+2,"100%");
-                        if( f == 0 )
-                            cprintf( "   " );
-                        cprintf( "%-8s%c", buf, f==7 ? '\n' : ' ' );
-                    }
-                }
-            }
-
-            for( int i=0; i<3; i++ )
-            {
-                switch(i)
-                {
-                    case 0: qsort( &stats[1][0], 12*64, sizeof(PieceSquareCombo), func_E );
-                            cprintf( "\nSorting in order of effectiveness E\n" );
-                            break;
-                    case 1: qsort( &stats[1][0], 12*64, sizeof(PieceSquareCombo), func_H );
-                            cprintf( "\nSorting in order of hit rate H\n" );
-                            break;
-                    case 2: qsort( &stats[1][0], 12*64, sizeof(PieceSquareCombo), func_S );
-                            cprintf( "\nSorting in order of search frequency S\n" );
-                            break;
-                }
-
-                PieceSquareCombo *p = &stats[1][0];
-                double cumulative = 1.0;
-                for( int j=0; j<32; )
-                {
-                    if( !p->always_hit )
-                    {
-                        const char *name="?";
-                        switch(p->piece)
-                        {
-                            case 'r': name="Black Rook";        break;
-                            case 'n': name="Black Knight";      break;
-                            case 'b': name="Black Bishop";      break;
-                            case 'q': name="Black Queen";       break;
-                            case 'k': name="Black King";        break;
-                            case 'p': name="Black Pawn";        break;
-                            case 'R': name="White Rook";        break;
-                            case 'N': name="White Knight";      break;
-                            case 'B': name="White Bishop";      break;
-                            case 'Q': name="White Queen";       break;
-                            case 'K': name="White King";        break;
-                            case 'P': name="White Pawn";        break;
-                        }
-                        if( i!=0 )
-                            cprintf( "%s %c%c, H=%2.2f%%, S=%2.2f%%, E=%2.2f%%\n", name, p->file, p->rank, p->hit_rate*100.0, p->search_frequency*100.0, p->effectiveness*100.0 );
-                        else
-                        {
-                            cumulative *= (1.0 - p->effectiveness);
-                            cprintf( "%s %c%c, E=%2.2f%% cumulative E=%2.2f%% with %d bit%s, H=%2.2f%%, S=%2.2f%%\n", name, p->file, p->rank,
-                                            p->effectiveness*100.0, (1.0-cumulative)*100.0, j+1, j+1>1?"s":"", p->hit_rate*100.0, p->search_frequency*100.0 );
-                        }
-                        j++;
-                    }
-                    p++;
-                }
-            }
-
-#endif
         }
     }
     return 0;
@@ -481,9 +124,106 @@ wxMutex *DontWaitForWorkerThread()
     return &s_mutex_tiny_database;
 }
 
+// Use a worker thread to search the tiny database, so that the games found can be shown as
+//  they arrive (through an MpsStream). This extends the s_mutex_tiny_database scheme rather
+//  than taking the mutex itself; The search is started by a thread that is holding the mutex
+//  (eg CmdDatabase() holds it while the database dialog is open), so the background load is
+//  complete and Reopen() can't happen. That thread must call FinishSearchThread() before it
+//  releases the mutex
+class SearchThread : public wxThread
+{
+public:
+    SearchThread() : wxThread(wxTHREAD_JOINABLE) {}
+    MemoryPositionSearch *mps;
+    MpsStream *stream;
+    thc::ChessPosition cp;
+    PatternMatch *pm;           // NULL for a position search
+    PATTERN_STATS *stats;
+    bool complete_narrowed;     // complete a narrowed search, instead of a new search
+    std::vector<thc::ChessPosition> targets;                    // for a multi target search
+    std::vector< std::vector<DoSearchFoundGame> > *found;      // NULL unless a multi target search
+    int game_count;
+
+    // thread execution starts here
+    virtual void *Entry()
+    {
+        mps->SetStream( stream );
+        if( found )
+            game_count = mps->DoSearchMulti( targets, *found, NULL );
+        else if( pm )
+            game_count = mps->DoPatternSearch( *pm, NULL, *stats );
+        else if( complete_narrowed )
+            game_count = mps->CompleteNarrowedSearch( NULL );
+        else
+            game_count = mps->DoSearch( cp, NULL );
+        mps->SetStream( NULL );
+        stream->finished = true;
+        return 0;
+    }
+};
+
+// Search for position cp, or pattern pm, or if neither complete the narrowed search already
+//  started (see DoSearchNarrowed()). Returns NULL if the search can't be run in the background,
+//  in which case the caller should do the search itself
+wxThread *StartSearchThread( MemoryPositionSearch *mps, MpsStream *stream, const thc::ChessPosition *cp, PatternMatch *pm, PATTERN_STATS *stats )
+{
+    SearchThread *thread = new SearchThread;
+    thread->mps = mps;
+    thread->stream = stream;
+    if( cp )
+        thread->cp = *cp;
+    thread->pm = pm;
+    thread->stats = stats;
+    thread->complete_narrowed = (!cp && !pm);
+    thread->found = NULL;
+    thread->game_count = 0;
+    if( thread->Create()!=wxTHREAD_NO_ERROR || thread->Run()!=wxTHREAD_NO_ERROR )
+    {
+        cprintf( "StartSearchThread(), cannot run thread\n" );
+        delete thread;
+        return NULL;
+    }
+    return thread;
+}
+
+// Search for all the target positions in one pass (see DoSearchMulti()), found must stay put
+//  until FinishSearchThread(). Returns NULL if the search can't be run in the background
+wxThread *StartMultiSearchThread( MemoryPositionSearch *mps, MpsStream *stream, const std::vector<thc::ChessPosition> &targets,
+                                  std::vector< std::vector<DoSearchFoundGame> > *found )
+{
+    SearchThread *thread = new SearchThread;
+    thread->mps = mps;
+    thread->stream = stream;
+    thread->pm = NULL;
+    thread->stats = NULL;
+    thread->complete_narrowed = false;
+    thread->targets = targets;
+    thread->found = found;
+    thread->game_count = 0;
+    if( thread->Create()!=wxTHREAD_NO_ERROR || thread->Run()!=wxTHREAD_NO_ERROR )
+    {
+        cprintf( "StartMultiSearchThread(), cannot run thread\n" );
+        delete thread;
+        return NULL;
+    }
+    return thread;
+}
+
+// Wait for the search to finish (ask it to stop first by setting the stream's kill flag), and
+//  return the number of games found
+int FinishSearchThread( wxThread *thread )
+{
+    SearchThread *search_thread = static_cast<SearchThread *>(thread);
+    search_thread->Wait();
+    int game_count = search_thread->game_count;
+    delete search_thread;
+    return game_count;
+}
+
 Database::Database( const char *db_file, bool another_instance_running )
 {
     is_open = false;
+    top_game_id = 0;
     is_suspended = another_instance_running;
     if( is_suspended )
         database_error_msg = "Database is not open, database is not automatically loaded if another instance of Tarrasch is running";
@@ -526,6 +266,9 @@ void Database::Reopen( const char *db_file )
     kill_background_load = false;
     player_search_in_progress = false;
     tiny_db.Init();
+    position_index.Clear();
+    pawn_index.Clear();
+    opening_tree.Clear();
 
     // Access the database.
     cprintf( "Database startup %s\n", db_file );
@@ -558,6 +301,8 @@ int Database::SetDbPosition( DB_REQ db_req_ )
     this->db_req = db_req_;
     extern void BinDbDatabaseInitialSort( std::vector< smart_ptr<ListableGame> > &games, bool sort_by_player_name );
     BinDbDatabaseInitialSort( objs.db->tiny_db.in_memory_game_cache, db_req_==REQ_PLAYERS );
+    tiny_db.game_table.Reorder( tiny_db.in_memory_game_cache );
+    tiny_db.ClearResultCache();     // cached results are indexes into the old order
     int nbr = tiny_db.in_memory_game_cache.size();
     if( nbr )
     {
@@ -599,6 +344,7 @@ bool Database::LoadAllGamesForPositionSearch( std::vector< smart_ptr<ListableGam
     background_load_permill = 0;
     kill_background_load = false;
     mega_cache.clear();
+    tiny_db.game_table.Clear();
     is_partial_load = false;
     bool locked = false;
     bool killed = BinDbLoadAllGames( locked, false, mega_cache, background_load_permill, kill_background_load );
@@ -606,6 +352,28 @@ bool Database::LoadAllGamesForPositionSearch( std::vector< smart_ptr<ListableGam
     BinDbClose();
     int cache_nbr = mega_cache.size();
     cprintf( "Number of games = %d\n", cache_nbr );
+
+    // Games are loaded in reverse order, so (for now) the last game is the first game in the file
+    top_game_id = cache_nbr>0 ? mega_cache[cache_nbr-1]->game_id : 0;
+    if( &mega_cache == &tiny_db.in_memory_game_cache )
+    {
+        tiny_db.game_table.Build( mega_cache );
+        tiny_db.ClearResultCache();
+    }
+    if( !killed && cache_nbr>0 )
+    {
+        std::string error_msg;
+        if( position_index.Load( db_filename, cache_nbr, error_msg ) )
+            tiny_db.SetPositionIndex( &position_index, top_game_id );
+        else
+            cprintf( "%s\n", error_msg.c_str() );
+        if( pawn_index.Load( db_filename, cache_nbr, error_msg ) )
+            tiny_db.SetPawnIndex( &pawn_index, top_game_id );
+        else
+            cprintf( "%s\n", error_msg.c_str() );
+        if( !opening_tree.Load( db_filename, cache_nbr, error_msg ) )
+            cprintf( "%s\n", error_msg.c_str() );
+    }
     if( cache_nbr > 0 )
     {
         smart_ptr<ListableGame> p = mega_cache[0];
@@ -614,6 +382,50 @@ bool Database::LoadAllGamesForPositionSearch( std::vector< smart_ptr<ListableGam
     return cache_nbr>0;
 }
 
+// Build the optional position index for the current database and save it alongside the database
+bool Database::BuildPositionIndex( std::string &error_msg )
+{
+    if( !is_open || is_partial_load || tiny_db.in_memory_game_cache.size()==0 )
+    {
+        error_msg = "Database not fully loaded";
+        return false;
+    }
+    tiny_db.SetPositionIndex( NULL, 0 );
+    ProgressBar progress("Building position index","Building position index",true);
+    bool ok = position_index.Build( tiny_db.in_memory_game_cache, top_game_id, db_filename, error_msg, &progress );
+    if( ok )
+        tiny_db.SetPositionIndex( &position_index, top_game_id );
+    return ok;
+}
+
+// Build the optional pawn structure index for the current database and save it alongside the database
+bool Database::BuildPawnIndex( std::string &error_msg )
+{
+    if( !is_open || is_partial_load || tiny_db.in_memory_game_cache.size()==0 )
+    {
+        error_msg = "Database not fully loaded";
+        return false;
+    }
+    tiny_db.SetPawnIndex( NULL, 0 );
+    ProgressBar progress("Building pawn structure index","Building pawn structure index",true);
+    bool ok = pawn_index.Build( tiny_db.in_memory_game_cache, top_game_id, db_filename, error_msg, &progress );
+    if( ok )
+        tiny_db.SetPawnIndex( &pawn_index, top_game_id );
+    return ok;
+}
+
+// Build the optional opening tree for the current database and save it alongside the database
+bool Database::BuildOpeningTree( int max_ply, std::string &error_msg )
+{
+    if( !is_open || is_partial_load || tiny_db.in_memory_game_cache.size()==0 )
+    {
+        error_msg = "Database not fully loaded";
+        return false;
+    }
+    ProgressBar progress("Building opening tree","Building opening tree",true);
+    return opening_tree.Build( tiny_db.in_memory_game_cache, max_ply, db_filename, error_msg, &progress );
+}
+
 // Transform to lower case, collapse multiple spaces to 1, remove spaces after comma
 void Normalise( std::string &in, std::string &out )
 {
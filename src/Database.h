@@ -15,6 +15,9 @@
 #include "thc.h"
 #include "GameDocument.h"
 #include "MemoryPositionSearch.h"
+#include "PositionIndex.h"
+#include "PawnIndex.h"
+#include "OpeningTree.h"
 #include "GamesCache.h"
 
 enum DB_REQ
@@ -40,6 +43,10 @@ public:
     bool kill_background_load;
     std::string GetStatus();
     bool GetFile( std::string &filename );  //returns true if database is operational and fully loaded
+    bool BuildPositionIndex( std::string &error_msg );
+    bool BuildPawnIndex( std::string &error_msg );
+    bool BuildOpeningTree( int max_ply, std::string &error_msg );
+    OpeningTree *GetOpeningTree() { return opening_tree.IsLoaded() ? &opening_tree : NULL; }
 
 private:
     std::string db_filename;
@@ -47,6 +54,10 @@ private:
     bool is_open;
     bool is_suspended;
     bool is_partial_load;
+    PositionIndex position_index;   // optional, speeds up position searches if present
+    PawnIndex pawn_index;           // optional, speeds up pawn structure searches if present
+    OpeningTree opening_tree;       // optional, move statistics without searching if present
+    uint32_t top_game_id;           // game_id of the first game in the file
     std::string database_error_msg; // explanation if is_open is false
     bool player_search_in_progress;
 
@@ -50,6 +50,12 @@ DbDialog::DbDialog
     activated_at_least_once = false;
     transpo_activated = false;
     white_player_search = true;
+    explorer_mode = false;
+    narrow_next_search = false;
+    background_thread = NULL;
+    background_stream = NULL;
+    background_timer.SetOwner( this, ID_DB_TIMER );
+    background_successors = false;
 }
 
 void DbDialog::GdvEnumerateGames()
@@ -157,6 +163,13 @@ wxSizer *DbDialog::GdvAddExtraControls( bool WXUNUSED(big_display) )
     gdr.RegisterPanelWindow( filter_ctrl );
     vsiz_panel_buttons->Add(filter_ctrl, 0, wxALIGN_CENTER_VERTICAL|wxALL, 5);
     filter_ctrl->SetValue( objs.gl->db_clipboard );
+    if( db_req!=REQ_PLAYERS && db_req!=REQ_PATTERN && objs.db->GetOpeningTree() )
+    {
+        wxCheckBox *explorer_ctrl = new wxCheckBox( this, ID_DB_CHECKBOX3, "&Explorer (opening tree)", wxDefaultPosition, wxDefaultSize, 0 );
+        gdr.RegisterPanelWindow( explorer_ctrl );
+        vsiz_panel_buttons->Add(explorer_ctrl, 0, wxALIGN_CENTER_VERTICAL|wxALL, 5);
+        explorer_ctrl->SetValue( explorer_mode );
+    }
     wxStaticText* spacer1 = new wxStaticText( this, wxID_ANY, wxT(""),
                                         wxDefaultPosition, wxDefaultSize, 0 );
     gdr.RegisterPanelWindow( spacer1 );
@@ -275,7 +288,7 @@ int DbDialog::GetBasePositionIdx( CompactGame &pact, bool receiving_focus )
             unsigned short offset1;
             unsigned short offset2;
             bool reverse;
-            bool found = objs.db->tiny_db.PatternSearchGameSlowPromotionAllowed( pm, reverse, moves, offset1, offset2 );
+            bool found = objs.db->tiny_db.PatternSearchGameSlowPromotionAllowed( pm, reverse, moves.c_str(), offset1, offset2 );
             if( found )
                 idx = offset1;
         }
@@ -310,7 +323,8 @@ void DbDialog::GdvListColClick( int compare_col_ )
 {
     if( db_req == REQ_PLAYERS )
         return; // not supported
-    ColumnSort( compare_col_, gc_db_displayed_games.gds );
+    StopBackgroundSearch(true);   // it would list the games in search order again when it finished
+    ColumnSort( compare_col_, gc_db_displayed_games.gds, objs.gl->db_clipboard ? NULL : &objs.db->tiny_db );   // the tiny database mutex is held while we're open
 }
 
 // Games Dialog Override - Search feature
@@ -354,6 +368,7 @@ void DbDialog::GdvSaveAllToAFile()
 // Games Dialog Override - Cancel
 void DbDialog::GdvOnCancel()
 {
+    StopBackgroundSearch(false);
 }
 
 // Games Dialog Override - Help
@@ -512,6 +527,14 @@ void DbDialog::GdvCheckBox( bool checked )
     }
 }
 
+// ID_DB_CHECKBOX3 is Explorer
+void DbDialog::GdvCheckBox3( bool checked )
+{
+    explorer_mode = checked;
+    StatsCalculate();
+    Goto(0);
+}
+
 // Copy to clipboard if clear_clipboard is true
 // Add to clipboard if clear_clipboard is false
 //
@@ -599,6 +622,7 @@ void DbDialog::CopyOrAdd( bool clear_clipboard )
 //  No real need for this to be overridable - it only occurs in this leaf class
 void DbDialog::GdvNextMove( int idx )
 {
+    StopBackgroundSearch(false);  // don't wait for the transpositions to the old position
     dirty = true;
     if( idx==0 && moves_from_base_position.size()>0 )
     {
@@ -608,6 +632,7 @@ void DbDialog::GdvNextMove( int idx )
     {
         thc::Move this_one = moves_in_this_position[idx];
         moves_from_base_position.push_back(this_one);
+        narrow_next_search = true;  // playing forward, the games found so far are the best place to start
     }
 
     thc::ChessRules cr_to_match = this->cr;
@@ -647,6 +672,7 @@ std::multimap<B,A> flip_and_sort_map(const std::map<A,B> &src)
 // Heart and soul of DbDialog() - do the search and calculate the stats
 void DbDialog::StatsCalculate()
 {
+    StopBackgroundSearch(false);
     wxString save_title = GetTitle();
     SetTitle("Searching...");
 
@@ -655,7 +681,12 @@ void DbDialog::StatsCalculate()
     int total_draws = 0;
     transpositions.clear();
     stats.clear();
+    successors.clear();
     dirty = true;
+    bool narrow = narrow_next_search;
+    narrow_next_search = false;
+    bool search_cancelled = false;
+    bool complete_in_background = false;
     GamesCache temp;
     temp.gds.clear();
     cprintf( "Remove focus %d\n", track->focus_idx );
@@ -679,6 +710,15 @@ void DbDialog::StatsCalculate()
         cr_to_match.PlayMove(mv);
     }
 
+    // In explorer mode the stats come straight from the opening tree, there's no search at all
+    if( explorer_mode && !objs.gl->db_clipboard && objs.db->GetOpeningTree() )
+    {
+        ExplorerCalculate( cr_to_match, add_go_back, go_back_string );
+        Goto(0);
+        SetTitle(save_title);
+        return;
+    }
+
     // hash to match
     uint64_t gbl_hash = cr_to_match.Hash64Calculate();
     CompressMoves press_to_match(cr_to_match);
@@ -715,11 +755,17 @@ void DbDialog::StatsCalculate()
     {
         bool search_needed = !mps->IsThisSearchPosition(cr_to_match);
         cprintf( "search_needed = %s\n", search_needed?"true":"false" );
-        if( search_needed )
+        if( search_needed && narrow && mps->IsNarrowingPossible() )
         {
-            ProgressBar progress2("Searching Database", "Searching",false);
-            //progress2.DrawNow();
-            game_count = mps->DoSearch(cr_to_match,&progress2);
+            // First pass of a narrowing search, just the games found by the last search, for
+            //  immediate results. Then look for transpositions in the other games, in the background
+            //  once the stats are calculated, see StartCompletion()
+            game_count = mps->DoSearchNarrowed(cr_to_match,NULL);
+            complete_in_background = mps->IsNarrowedSearch(cr_to_match);
+        }
+        else if( search_needed )
+        {
+            game_count = SearchInBackground( mps, &cr_to_match, NULL, search_cancelled );
         }
     }
 
@@ -864,6 +910,14 @@ void DbDialog::StatsCalculate()
             cprintf( "%s\n", buf );
             wxString wstr(buf);
             strings_stats.Add(wstr);
+            SUCCESSOR succ;
+            succ.list_idx = strings_stats.size()-1;
+            succ.nbr_games = nbr_games;
+            succ.text = buf;
+            thc::ChessRules cr_successor = cr_to_match;
+            cr_successor.PlayMove(mv);
+            succ.cp = cr_successor;
+            successors.push_back(succ);
         }
 
         // Print the transpositions in order
@@ -906,26 +960,19 @@ void DbDialog::StatsCalculate()
         double percent_score=0.0;
         if( total_games )
             percent_score= ((1.0*total_white_wins + 0.5*total_draws_plus_no_result) * 100.0) / total_games;
-        sprintf( buf, "%s%d %s, white scores %.1f%% +%d -%d =%d",
+        sprintf( buf, "%s%d %s, white scores %.1f%% +%d -%d =%d%s",
                 objs.gl->db_clipboard ? "Clipboard search: " : "",
                 total_games,
                 total_games==1 ? "game" : "games",
                 percent_score,
-                total_white_wins, total_black_wins, total_draws );
+                total_white_wins, total_black_wins, total_draws,
+                search_cancelled ? " (search cancelled)" : "" );
+        background_title = buf;
+        if( complete_in_background )
+            strcat( buf, " (searching for transpositions...)" );
         cprintf( "Got here #5, %s\n", buf );
         title_ctrl->SetLabel( buf );
-        if( !list_ctrl_stats )
-        {
-            //wxSize sz4 = mini_board->GetSize();
-            //sz4.x = (sz4.x*50)/100;
-            //sz4.y = (sz4.y*50)/100;
-
-            list_ctrl_stats   = new wxListBox( notebook, ID_DB_LISTBOX_STATS, wxDefaultPosition, wxDefaultSize, 0, NULL, wxLB_HSCROLL );
-            list_ctrl_transpo = new wxListBox( notebook, ID_DB_LISTBOX_TRANSPO, wxDefaultPosition, wxDefaultSize, 0, NULL, wxLB_HSCROLL );
-            notebook->AddPage(list_ctrl_stats,"Next Move",true);
-            notebook->AddPage(list_ctrl_transpo,"Transpositions",false);
-        }
-
+        CreateStatsLists();
         list_ctrl_stats->Clear();
         list_ctrl_transpo->Clear();
         if( !strings_stats.IsEmpty() )
@@ -943,11 +990,308 @@ void DbDialog::StatsCalculate()
     }
     Goto(0);
     SetTitle(save_title);
+    if( complete_in_background )
+        StartCompletion( mps );
+    else if( !do_partial_search && mps->IsThisSearchPosition(cr_to_match) )
+        StartSuccessorSearch( mps );
+}
+
+static bool predicate_found_by_idx( const DoSearchFoundGame &left, const DoSearchFoundGame &right )
+{
+    return left.idx < right.idx;
+}
+
+// Search the tiny database on a worker thread, listing the games found as they arrive. The user
+//  can cancel the search, leaving just the games found so far. Set stats for a pattern search (pm),
+//  or cp for a position search
+int DbDialog::SearchInBackground( MemoryPositionSearch *mps, const thc::ChessPosition *cp, PATTERN_STATS *stats, bool &cancelled )
+{
+    extern wxThread *StartSearchThread( MemoryPositionSearch *mps, MpsStream *stream, const thc::ChessPosition *cp, PatternMatch *pm, PATTERN_STATS *stats );
+    extern int FinishSearchThread( wxThread *thread );
+    cancelled = false;
+    std::vector<DoSearchFoundGame> listed;     // games listed so far, in idx order like the final results
+    MpsStream stream;
+    wxThread *thread = StartSearchThread( mps, &stream, cp, stats?&pm:NULL, stats );
+    if( !thread )
+    {
+        ProgressBar progress2("Searching Database", "Searching",false);
+        if( stats )
+            return mps->DoPatternSearch(pm,&progress2,*stats);
+        return mps->DoSearch(*cp,&progress2);
+    }
+
+    // The search thread owns mps until it finishes, we only touch the stream
+    std::vector< smart_ptr<ListableGame> > &db_games = objs.db->tiny_db.in_memory_game_cache;
+    gc_db_displayed_games.gds.clear();
+    ProgressBar progress("Searching Database", "Searching (games found so far are listed)",true);
+    for(;;)
+    {
+        wxMilliSleep(10);
+        bool done = stream.finished;    // check before Pop(), so that the last batch isn't dropped
+        size_t nbr_listed = listed.size();
+        stream.Pop( listed );
+        if( listed.size() > nbr_listed )
+        {
+            // Games usually arrive in idx order, but not if the game table is out of order
+            //  with the games. Keep the list in the same order as the final results, so that
+            //  it doesn't reshuffle when the search completes
+            bool in_order = std::is_sorted( listed.begin()+nbr_listed, listed.end(), predicate_found_by_idx ) &&
+                            (nbr_listed==0 || listed[nbr_listed-1].idx < listed[nbr_listed].idx);
+            if( !in_order )
+            {
+                std::sort( listed.begin()+nbr_listed, listed.end(), predicate_found_by_idx );
+                std::inplace_merge( listed.begin(), listed.begin()+nbr_listed, listed.end(), predicate_found_by_idx );
+                nbr_listed = 0;
+                gc_db_displayed_games.gds.clear();
+            }
+            for( size_t i=nbr_listed; i<listed.size(); i++ )
+                gc_db_displayed_games.gds.push_back( db_games[listed[i].idx] );
+            nbr_games_in_list_ctrl = gc_db_displayed_games.gds.size();
+            dirty = true;
+            list_ctrl->SetItemCount(nbr_games_in_list_ctrl);
+            list_ctrl->RefreshItems( 0, nbr_games_in_list_ctrl-1 );
+            char buf[200];
+            sprintf( buf, "Searching... %d %s found so far", nbr_games_in_list_ctrl, nbr_games_in_list_ctrl==1 ? "game" : "games" );
+            title_ctrl->SetLabel( buf );
+        }
+        if( !cancelled && progress.Permill(stream.permill) )
+        {
+            cancelled = true;
+            stream.kill = true;     // the thread will stop soon, and finished will be set
+        }
+        if( done )
+            break;
+        wxSafeYield();
+    }
+    return FinishSearchThread( thread );
+}
+
+// Complete a narrowed search on a worker thread, while the user carries on (usually playing
+//  forward through the opening, which stops the search, see StopBackgroundSearch()). The list and
+//  stats are recalculated with the transpositions once the search finishes, see GdvTimer()
+void DbDialog::StartCompletion( MemoryPositionSearch *mps )
+{
+    extern wxThread *StartSearchThread( MemoryPositionSearch *mps, MpsStream *stream, const thc::ChessPosition *cp, PatternMatch *pm, PATTERN_STATS *stats );
+    background_stream = new MpsStream;
+    background_thread = StartSearchThread( mps, background_stream, NULL, NULL, NULL );
+    if( !background_thread )
+    {
+        delete background_stream;
+        background_stream = NULL;
+        {
+            ProgressBar progress2("Searching Database", "Searching for transpositions",false);
+            mps->CompleteNarrowedSearch(&progress2);
+        }
+        StatsCalculate();   // no search this time, just the stats
+        return;
+    }
+    background_timer.Start( 200 );
+}
+
+// Once the search for this position is complete, search for the position after each of the
+//  next moves, all in one pass (see MemoryPositionSearch::DoSearchMulti()), on a worker thread.
+//  The results are cached, so playing one of the next moves doesn't need a search at all. And
+//  the games that reach those positions by transposition are added to the next move list, see
+//  ListSuccessorTranspositions()
+void DbDialog::StartSuccessorSearch( MemoryPositionSearch *mps )
+{
+    extern wxThread *StartMultiSearchThread( MemoryPositionSearch *mps, MpsStream *stream, const std::vector<thc::ChessPosition> &targets,
+                                             std::vector< std::vector<DoSearchFoundGame> > *found );
+    if( successors.empty() )
+        return;
+    std::vector<thc::ChessPosition> targets;
+    for( size_t i=0; i<successors.size(); i++ )
+        targets.push_back( successors[i].cp );
+    background_stream = new MpsStream;
+    background_thread = StartMultiSearchThread( mps, background_stream, targets, &successors_found );
+    if( !background_thread )
+    {
+        delete background_stream;   // it's only a look ahead, do without it
+        background_stream = NULL;
+        return;
+    }
+    background_successors = true;
+    background_timer.Start( 200 );
+}
+
+// Stop the background search. If it was completing a narrowed search, the games found so far
+//  stay in the list, the search results are marked incomplete (see MemoryPositionSearch::
+//  CompleteNarrowedSearch()), but the next search can still be narrowed from them
+void DbDialog::StopBackgroundSearch( bool update_title )
+{
+    extern int FinishSearchThread( wxThread *thread );
+    if( !background_thread )
+        return;
+    background_timer.Stop();
+    background_stream->kill = true;
+    FinishSearchThread( background_thread );
+    background_thread = NULL;
+    delete background_stream;
+    background_stream = NULL;
+    if( update_title )
+    {
+        std::string s = background_title;
+        if( !background_successors )
+            s += " (search for transpositions stopped)";
+        title_ctrl->SetLabel( s.c_str() );
+    }
+    background_successors = false;
+}
+
+// Games Dialog Override - Timer, check on the background search
+void DbDialog::GdvTimer()
+{
+    if( !background_thread )
+        return;
+    if( !background_stream->finished )
+    {
+        char buf[200];
+        sprintf( buf, background_successors ? " (looking ahead to the next moves, %d%% done)"
+                                            : " (searching for transpositions, %d%% done)", background_stream->permill/10 );
+        std::string s = background_title + buf;
+        title_ctrl->SetLabel( s.c_str() );
+        return;
+    }
+    bool successors_done = background_successors;
+    StopBackgroundSearch(false);    // just tidies up, the search is over
+    if( successors_done )
+        ListSuccessorTranspositions();
+    else
+        StatsCalculate();           // no search this time, just the stats
+}
+
+// Add the games that reach the position after each next move by transposition to the next
+//  move list
+void DbDialog::ListSuccessorTranspositions()
+{
+    for( size_t i=0; i<successors.size() && i<successors_found.size(); i++ )
+    {
+        SUCCESSOR &succ = successors[i];
+        int nbr_transpositions = static_cast<int>(successors_found[i].size()) - succ.nbr_games;
+        if( nbr_transpositions > 0 )
+        {
+            char buf[300];
+            sprintf( buf, "%s, %d more by transposition", succ.text.c_str(), nbr_transpositions );
+            list_ctrl_stats->SetString( succ.list_idx, buf );
+        }
+    }
+    successors_found.clear();
+    title_ctrl->SetLabel( background_title.c_str() );
+}
+
+// Create the next move and transpositions lists, the first time they are needed
+void DbDialog::CreateStatsLists()
+{
+    if( !list_ctrl_stats )
+    {
+        //wxSize sz4 = mini_board->GetSize();
+        //sz4.x = (sz4.x*50)/100;
+        //sz4.y = (sz4.y*50)/100;
+
+        list_ctrl_stats   = new wxListBox( notebook, ID_DB_LISTBOX_STATS, wxDefaultPosition, wxDefaultSize, 0, NULL, wxLB_HSCROLL );
+        list_ctrl_transpo = new wxListBox( notebook, ID_DB_LISTBOX_TRANSPO, wxDefaultPosition, wxDefaultSize, 0, NULL, wxLB_HSCROLL );
+        notebook->AddPage(list_ctrl_stats,"Next Move",true);
+        notebook->AddPage(list_ctrl_transpo,"Transpositions",false);
+    }
+}
+
+// Explorer mode - the next move stats for a position read from the opening tree, no games are listed
+void DbDialog::ExplorerCalculate( thc::ChessRules &cr_to_match, bool add_go_back, const std::string &go_back_string )
+{
+    OpeningTree *tree = objs.db->GetOpeningTree();
+    std::vector<OpeningTreeMove> tree_moves;
+    bool in_tree = tree->Lookup( cr_to_match, tree_moves );
+
+    // Play through the current game, and find the last instance of a user move in this position
+    CompactGame pact;
+    objs.gl->gd.GetCompactGame( pact );
+    thc::Move user_move;
+    user_move.Invalid();
+    thc::ChessRules scan(pact.start_position);
+    for( size_t i=0; i<pact.moves.size(); i++ )
+    {
+        if( scan == cr_to_match )
+            user_move = pact.moves[i];
+        scan.PlayMove( pact.moves[i] );
+    }
+
+    moves_in_this_position.clear();
+    wxArrayString strings_stats;
+    if( add_go_back )
+    {
+        wxString wstr( go_back_string.c_str() );
+        strings_stats.Add(wstr);
+        thc::Move dummy;
+        dummy.Invalid();
+        moves_in_this_position.push_back(dummy);    // GdvNextMove() treats item 0 as go back
+    }
+    int total_games = 0;
+    int total_white_wins = 0;
+    int total_black_wins = 0;
+    int total_draws = 0;
+    for( size_t i=0; i<tree_moves.size(); i++ )
+    {
+        OpeningTreeMove &otm = tree_moves[i];
+        total_games      += otm.nbr_games;
+        total_white_wins += otm.white_wins;
+        total_black_wins += otm.black_wins;
+        total_draws      += otm.draws;
+        int draws_plus_no_result = otm.nbr_games - otm.white_wins - otm.black_wins;
+        double percentage_score = 0.0;
+        if( otm.nbr_games )
+            percentage_score = ((1.0*otm.white_wins + 0.5*draws_plus_no_result) * 100.0) / otm.nbr_games;
+        moves_in_this_position.push_back(otm.mv);
+        std::string s = otm.mv.NaturalOut(&cr_to_match);
+        LangOut(s);
+        if( !cr_to_match.white )
+            s = "..." + s;
+        char elo[100] = "";
+        if( otm.average_elo )
+            sprintf( elo, ", average Elo %d", otm.average_elo );
+        char buf[200];
+        sprintf( buf, "%s%s: %d %s, white scores %.1f%% +%d -%d =%d%s",
+                otm.mv==user_move ? ">" : " ",
+                s.c_str(),
+                otm.nbr_games,
+                otm.nbr_games==1 ? "game" : "games",
+                percentage_score,
+                otm.white_wins, otm.black_wins, otm.draws,
+                elo );
+        wxString wstr(buf);
+        strings_stats.Add(wstr);
+    }
+
+    char buf[1000];
+    if( !in_tree )
+        sprintf( buf, "Explorer: position not in opening tree (first %d half moves of each game only)", tree->MaxPly() );
+    else
+    {
+        int total_draws_plus_no_result = total_games - total_white_wins - total_black_wins;
+        double percent_score = ((1.0*total_white_wins + 0.5*total_draws_plus_no_result) * 100.0) / total_games;
+        sprintf( buf, "Explorer: %d %s, white scores %.1f%% +%d -%d =%d",
+                total_games,
+                total_games==1 ? "game" : "games",
+                percent_score,
+                total_white_wins, total_black_wins, total_draws );
+    }
+    title_ctrl->SetLabel( buf );
+    CreateStatsLists();
+    list_ctrl_stats->Clear();
+    list_ctrl_transpo->Clear();
+    if( !strings_stats.IsEmpty() )
+        list_ctrl_stats->InsertItems( strings_stats, 0 );
+    transpositions.clear();
+    gc_db_displayed_games.gds.clear();
+    nbr_games_in_list_ctrl = 0;
+    dirty = true;
+    list_ctrl->SetItemCount(0);
+    GdvEnableControlsIfGamesFound( false );
 }
 
 // Search for patterns
 void DbDialog::PatternSearch()
 {
+    StopBackgroundSearch(false);
     gc_db_displayed_games.gds.clear();
     cprintf( "Remove focus %d\n", track->focus_idx );
     list_ctrl->SetItemState( track->focus_idx, 0, wxLIST_STATE_FOCUSED );
@@ -973,6 +1317,7 @@ void DbDialog::PatternSearch()
     //  latter types of search we are calling 'partial' search because they aren't of an entire, (albeit
     //  tiny) in memory database
     PATTERN_STATS stats_;
+    bool search_cancelled = false;
     if( do_partial_search )
     {
 
@@ -984,8 +1329,7 @@ void DbDialog::PatternSearch()
     }
     else
     {
-        ProgressBar progress2("Searching", "Searching",false);
-        game_count = mps->DoPatternSearch(pm,&progress2,stats_);
+        game_count = SearchInBackground( mps, NULL, &stats_, search_cancelled );
     }
 
     std::vector< smart_ptr<ListableGame> >  &db_games    = mps->GetVectorSourceGames();
@@ -1018,6 +1362,8 @@ void DbDialog::PatternSearch()
             total_games==1 ? "game" : "games",
             percent_score,
             stats_.white_wins, stats_.black_wins, stats_.draws );
+    if( search_cancelled )
+        strcat( base, " (search cancelled)" );
     if( !pm.parm.include_reverse_colours )
     {
         sprintf( buf, "%s", base );
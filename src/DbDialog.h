@@ -50,6 +50,15 @@ struct PATH_TO_POSITION
     bool operator == (const PATH_TO_POSITION& ptp) const { return frequency == ptp.frequency; }
 };
 
+// The position after each move in the next move list, see DbDialog::StartSuccessorSearch()
+struct SUCCESSOR
+{
+    int list_idx;       // in the next move listbox
+    int nbr_games;      // games with this move in this position
+    std::string text;   // as listed
+    thc::ChessPosition cp;
+};
+
 // DbDialog class declaration
 class DbDialog : public GamesDialog
 {
@@ -66,7 +75,7 @@ public:
         const wxPoint& pos = wxDefaultPosition,
         const wxSize& size = wxDefaultSize
     );
-    virtual ~DbDialog() {}
+    virtual ~DbDialog() { StopBackgroundSearch(false); }
 
     // We calculate a vector of all blobs in the games that leading to the search position
     std::vector< PATH_TO_POSITION > transpositions;
@@ -84,6 +93,7 @@ public:
     virtual void GdvHelpClick();
     virtual void GdvCheckBox( bool checked );
     virtual void GdvCheckBox2( bool checked );
+    virtual void GdvCheckBox3( bool checked );
     virtual void GdvSearch();
     virtual void GdvButton1();
     virtual void GdvButton2();
@@ -92,13 +102,21 @@ public:
     virtual void GdvButton5();
     virtual void GdvOnCancel();
     virtual void GdvNextMove( int idx );
+    virtual void GdvTimer();
     virtual int  CalculateTranspo( const char *blob, int &transpo );
     virtual int  GetBasePositionIdx( CompactGame &pact, bool receiving_focus );
 
     // Helpers
     void CopyOrAdd( bool clear_clipboard );
     void StatsCalculate();
+    void ExplorerCalculate( thc::ChessRules &cr_to_match, bool add_go_back, const std::string &go_back_string );
+    void CreateStatsLists();
     void PatternSearch();
+    int  SearchInBackground( MemoryPositionSearch *mps, const thc::ChessPosition *cp, PATTERN_STATS *stats, bool &cancelled );
+    void StartCompletion( MemoryPositionSearch *mps );
+    void StartSuccessorSearch( MemoryPositionSearch *mps );
+    void StopBackgroundSearch( bool update_title );
+    void ListSuccessorTranspositions();
 
     // Sets the help text for the dialog controls
     void SetDialogHelp();
@@ -107,6 +125,15 @@ public:
 private:
     std::map< char, MOVE_STATS > stats; // map each compressed move in the position to move stats
     bool white_player_search;
+    bool explorer_mode;     // if true, stats come from the opening tree without searching
+    bool narrow_next_search;    // if true, the next search starts with the games found by the last search
+    wxThread  *background_thread;   // if not NULL, completing a narrowed search (see StartCompletion())
+    MpsStream *background_stream;   //  or searching for the successors (see StartSuccessorSearch())
+    wxTimer    background_timer;
+    std::string background_title;   // title, without the background search progress
+    bool       background_successors;   // which of the two
+    std::vector<SUCCESSOR> successors;
+    std::vector< std::vector<DoSearchFoundGame> > successors_found;
     std::vector<thc::Move> moves_in_this_position;
     std::vector<thc::Move> moves_from_base_position;
     GamesCache gc_db_displayed_games;
@@ -5,12 +5,17 @@
  *  Copyright 2010-2014, Bill Forster <billforsternz at gmail dot com>
  ****************************************************************************/
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include <map>
+#include <vector>
 #include "thc.h"
 #include "DebugPrintf.h"
 #include "BinDb.h"
 #include "PgnRead.h"
 #include "CompressMoves.h"
+#include "CompactGame.h"
+#include "ListableGame.h"
 #include "DbPrimitives.h"
 #include "DbMaintenance.h"
 
@@ -991,3 +996,309 @@ static void players_database( const char *event, const char *site, const char *d
 }
 
 
+
+// Statistics to choose the piece/square combos for the piece square signature (see
+//  PieceSquareSignature.h). eg if searching for a position with a White Knight on f3,
+//  don't bother searching the 10% or so of games where no white knight ever lands on f3.
+//  The aim is to find the best 64 piece square combos (like white knight on f3 - likely
+//  a good one because many positions will have a white knight on f3, but a useful
+//  proportion of games will never see a white knight there)
+
+// pieces 'B','K','N','P','Q','R','b','k','n','p','q','r'
+static int piece_to_idx[128] =
+{
+    0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,    // 0x00
+    0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,    // 0x10
+    0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,    // 0x20
+    0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,    // 0x30
+    0,0,1,0,0,0,0,0,0,0,0,2,0,0,3,0,    // 0x40, 0x41='A'
+    4,5,6,0,0,0,0,0,0,0,0,0,0,0,0,0,    // 0x50='P'
+    0,0,7,0,0,0,0,0,0,0,0,8,0,0,9,0,    // 0x60, 0x61='a'
+    10,11,12,0,0,0,0,0,0,0,0,0,0,0,0,0  // 0x70='p'
+};
+static int idx_to_piece[16] =
+{
+    0,'B','K','N','P','Q','R','b','k','n','p','q','r'
+};
+
+struct PieceSquareCombo
+{
+    char piece;
+    char file;
+    char rank;
+    bool hit;
+    bool always_hit;
+    unsigned long game_count;
+    unsigned long ply_array[100];
+    double hit_rate;
+    double search_frequency;
+    double effectiveness;
+};
+static PieceSquareCombo stats[16][64];
+static int nbr_games_this_long[100];
+static const int PLY_MIN = 4;
+static const int PLY_MAX = 30;
+
+static int func_E( const void *q1, const void *q2 )
+{
+    const PieceSquareCombo *p1 = (PieceSquareCombo *)q1;
+    const PieceSquareCombo *p2 = (PieceSquareCombo *)q2;
+    if( p2->effectiveness > p1->effectiveness )
+        return 1;
+    if( p2->effectiveness < p1->effectiveness )
+        return -1;
+    return 0;
+}
+
+static int func_H( const void *q1, const void *q2 )
+{
+    const PieceSquareCombo *p1 = (PieceSquareCombo *)q1;
+    const PieceSquareCombo *p2 = (PieceSquareCombo *)q2;
+    if( p2->hit_rate > p1->hit_rate )
+        return 1;
+    if( p2->hit_rate < p1->hit_rate )
+        return -1;
+    return 0;
+}
+
+static int func_S( const void *q1, const void *q2 )
+{
+    const PieceSquareCombo *p1 = (PieceSquareCombo *)q1;
+    const PieceSquareCombo *p2 = (PieceSquareCombo *)q2;
+    if( p2->search_frequency > p1->search_frequency )
+        return 1;
+    if( p2->search_frequency < p1->search_frequency )
+        return -1;
+    return 0;
+}
+
+static const char *piece_name( char piece )
+{
+    const char *name="?";
+    switch(piece)
+    {
+        case 'r': name="Black Rook";        break;
+        case 'n': name="Black Knight";      break;
+        case 'b': name="Black Bishop";      break;
+        case 'q': name="Black Queen";       break;
+        case 'k': name="Black King";        break;
+        case 'p': name="Black Pawn";        break;
+        case 'R': name="White Rook";        break;
+        case 'N': name="White Knight";      break;
+        case 'B': name="White Bishop";      break;
+        case 'Q': name="White Queen";       break;
+        case 'K': name="White King";        break;
+        case 'P': name="White Pawn";        break;
+    }
+    return name;
+}
+
+// Mark a piece landing on a square in this game
+static void piece_square_hit( char piece, unsigned int sq )
+{
+    PieceSquareCombo *p = &stats[piece_to_idx[piece&0x7f]][sq];
+    if( !p->hit )
+    {
+        p->hit = true;
+        p->game_count++;
+    }
+}
+
+void db_maintenance_piece_square_statistics( std::vector< smart_ptr<ListableGame> > &games )
+{
+    memset( stats, 0, sizeof(stats) );
+    memset( nbr_games_this_long, 0, sizeof(nbr_games_this_long) );
+    thc::ChessPosition start;
+    for( int i=1; i<=12; i++ )
+    {
+        char piece = idx_to_piece[i];
+        for( int sq=0; sq<64; sq++ )
+        {
+            PieceSquareCombo *p = &stats[i][sq];
+            p->piece = piece;
+            p->file = 'a' + (sq%8);
+            p->rank = '8' - ((sq>>3)&7);
+            if( start.squares[sq] == piece )
+                p->always_hit = true;   // pieces needn't land on their start squares, so useless for signatures
+        }
+    }
+    int nbr_games = games.size();
+    for( int i=0; i<nbr_games; i++ )
+    {
+        int modulo = i<10000 ? 1000 : (i<100000?10000:100000);
+        if( i%modulo == 0 )
+            cprintf( "Piece square statistics %d games\n", i );
+        for( int j=0; j<16; j++ )
+        {
+            for( int k=0; k<64; k++ )
+            {
+                PieceSquareCombo *p = &stats[j][k];
+                p->hit = p->always_hit;
+                if( p->hit )
+                    p->game_count++;
+            }
+        }
+        smart_ptr<ListableGame> ptr = games[i];
+        CompactGame pact;
+        ptr->GetCompactGame( pact );
+        int nbr_moves = pact.moves.size();
+        thc::ChessRules cr;
+        for( int ply=0; ply<nbr_moves; ply++ )
+        {
+            thc::Move mv = pact.moves[ply];
+            cr.PlayMove(mv);
+
+            // A piece lands on a square - indicate that for this is a game where piece hit that square
+            //  (the piece is on the destination square after the move, this takes care of promotions)
+            unsigned int dst = static_cast<unsigned int>(mv.dst);
+            piece_square_hit( cr.squares[dst], dst );
+            switch( mv.special )
+            {
+                default: break;
+                case thc::SPECIAL_WK_CASTLING:  piece_square_hit( 'R', thc::f1 );   break;
+                case thc::SPECIAL_WQ_CASTLING:  piece_square_hit( 'R', thc::d1 );   break;
+                case thc::SPECIAL_BK_CASTLING:  piece_square_hit( 'r', thc::f8 );   break;
+                case thc::SPECIAL_BQ_CASTLING:  piece_square_hit( 'r', thc::d8 );   break;
+            }
+
+            // After every move, update a ply indexed array for every piece/square combination
+            if( ply < 100 )
+            {
+                nbr_games_this_long[ply]++;
+                for( int kk=0; kk<64; kk++ )
+                {
+                    int jj = piece_to_idx[cr.squares[kk]&0x7f];
+                    if( jj )
+                        stats[jj][kk].ply_array[ply]++;
+                }
+            }
+        }
+    }
+
+    // Display stats
+    cprintf( "Piece square statistics complete %d games\n", nbr_games );
+    cprintf( "Stats for each piece/square combo\n" );
+    for( int i=1; i<=12; i++ )
+    {
+        char piece = idx_to_piece[i];
+        cprintf( "\n%s\n", piece_name(piece) );
+        for( int r=0; r<8; r++ )
+        {
+            for( int f=0; f<8; f++ )
+            {
+                PieceSquareCombo *p = &stats[i][r*8+f];
+
+                // Calculate H = hit rate
+                p->hit_rate = nbr_games ? (double)(p->game_count) / (double)(nbr_games) : 0.0;
+
+                // Calculate S = search frequency
+                double sum = 0.0;
+                for( int ply=PLY_MIN; ply<=PLY_MAX; ply++ )
+                {
+                    double ply_hit_rate = 0.0;
+                    if( nbr_games_this_long[ply] > 0 )
+                        ply_hit_rate =  (double)(p->ply_array[ply]) / (double)(nbr_games_this_long[ply]);
+                    sum += ply_hit_rate;
+                }
+                p->search_frequency = sum / (PLY_MAX-PLY_MIN+1);   // Average rate at which piece/square combo
+                                                                   //  appears in position between PLY_MIN and PLY_MAX
+
+                // Calculate E = effectiveness,  E = S*(1-H)
+                // If search position contains the combo, then no need to search games where combo not hit
+                // So EFFECTIVENESS = AVG * proportion of games where combo not hit
+                //  eg if Nf3 appears in 40% of positions, and is hit somewhere in 90% of games
+                //  effectiveness = 40% * 10% = 4% speedup if we know which games Nf3 hits somewhere
+                p->effectiveness = p->search_frequency * (1.0 - p->hit_rate);
+            }
+            for( int f=0; f<8; f++ )
+            {
+                PieceSquareCombo *p = &stats[i][r*8+f];
+                char buf[100];
+                sprintf( buf, "   %c", r==0 ? p->file : ' ' );
+                if( f == 0 )
+                    cprintf( "   " );
+                cprintf( "%-8s%c", buf, f==7 ? '\n' : ' ' );
+            }
+            for( int f=0; f<8; f++ )
+            {
+                PieceSquareCombo *p = &stats[i][r*8+f];
+                char buf[100];
+                sprintf( buf, "H=%2.2f%%", p->hit_rate*100.0 );
+                if( 0==strcmp(buf+2,"100.00%") )
+                    strcpy(buf+2,"100%");
+                if( f == 0 )
+                    cprintf( "   " );
+                cprintf( "%-8s%c", buf, f==7 ? '\n' : ' ' );
+            }
+            for( int f=0; f<8; f++ )
+            {
+                PieceSquareCombo *p = &stats[i][r*8+f];
+                char buf[100];
+                sprintf( buf, "S=%2.2f%%", p->search_frequency*100.0 );
+                if( 0==strcmp(buf+2,"100.00%") )
+                    strcpy(buf+2,"100%");
+                if( f == 0 )
+                    cprintf( " %c ", p->rank );
+                cprintf( "%-8s%c", buf, f==7 ? '\n' : ' ' );
+            }
+            for( int f=0; f<8; f++ )
+            {
+                PieceSquareCombo *p = &stats[i][r*8+f];
+                char buf[100];
+                sprintf( buf, "E=%2.2f%%", p->effectiveness*100.0 );
+                if( 0==strcmp(buf+2,"100.00%") )
+                    strcpy(buf+2,"100%");
+                if( f == 0 )
+                    cprintf( "   " );
+                cprintf( "%-8s%c", buf, f==7 ? '\n' : ' ' );
+            }
+        }
+    }
+
+    // Sort in order of S and H for information, finally E to choose the combos
+    for( int i=0; i<3; i++ )
+    {
+        switch(i)
+        {
+            case 0: qsort( &stats[1][0], 12*64, sizeof(PieceSquareCombo), func_H );
+                    cprintf( "\nSorting in order of hit rate H\n" );
+                    break;
+            case 1: qsort( &stats[1][0], 12*64, sizeof(PieceSquareCombo), func_S );
+                    cprintf( "\nSorting in order of search frequency S\n" );
+                    break;
+            case 2: qsort( &stats[1][0], 12*64, sizeof(PieceSquareCombo), func_E );
+                    cprintf( "\nSorting in order of effectiveness E\n" );
+                    break;
+        }
+        PieceSquareCombo *p = &stats[1][0];
+        double cumulative = 1.0;
+        for( int j=0; j<64 && p<&stats[13][0]; p++ )
+        {
+            if( !p->always_hit )
+            {
+                if( i != 2 )
+                    cprintf( "%s %c%c, H=%2.2f%%, S=%2.2f%%, E=%2.2f%%\n", piece_name(p->piece), p->file, p->rank, p->hit_rate*100.0, p->search_frequency*100.0, p->effectiveness*100.0 );
+                else
+                {
+                    cumulative *= (1.0 - p->effectiveness);
+                    cprintf( "%s %c%c, E=%2.2f%% cumulative E=%2.2f%% with %d bit%s, H=%2.2f%%, S=%2.2f%%\n", piece_name(p->piece), p->file, p->rank,
+                                    p->effectiveness*100.0, (1.0-cumulative)*100.0, j+1, j+1>1?"s":"", p->hit_rate*100.0, p->search_frequency*100.0 );
+                }
+                j++;
+            }
+        }
+    }
+
+    // Finally print the best 64 combos in the form of a replacement for the table in PieceSquareSignature.cpp
+    cprintf( "\nconst char *piece_square_signature_combos[64] =\n{\n" );
+    PieceSquareCombo *p = &stats[1][0];
+    for( int j=0; j<64 && p<&stats[13][0]; p++ )
+    {
+        if( !p->always_hit )
+        {
+            cprintf( "%s\"%c%c%c\"%s", j%8==0?"    ":" ", p->piece, p->file, p->rank, j==63 ? "\n" : (j%8==7 ? ",\n" : ",") );
+            j++;
+        }
+    }
+    cprintf( "};\n" );
+}
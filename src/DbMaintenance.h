@@ -6,8 +6,11 @@
  ****************************************************************************/
 #ifndef DB_MAINTENANCE_H
 #define DB_MAINTENANCE_H
+#include <vector>
+#include "ListableGame.h"
 
 void db_maintenance_create_player_database();
 void db_maintenance_verify_compression();
+void db_maintenance_piece_square_statistics( std::vector< smart_ptr<ListableGame> > &games );
 
 #endif // DB_MAINTENANCE_H
@@ -1303,6 +1303,56 @@ bool GameLogic::ProbeControlBlocks()
     return okay;
 }
 
+// Games loaded from a database file can point directly into it (it's memory mapped, see
+//  BIN_DB_LOAD_MAPPED). Before the file is rewritten (eg appended to), copy such games out of
+//  the file and release the mapping. Same approach to finding all the games in memory as
+//  ProbeControlBlocks(). Caller must hold the tiny database mutex
+void GameLogic::ReleaseMappedFile( const char *filename )
+{
+    bool mapped[256];
+    bool any = false;
+    wxFileName target(filename);
+    for( int i=0; i<256; i++ )
+    {
+        const MappedFile *mf = PackedGameBinDb::GetMappedFile(i);
+        mapped[i] = (mf && target.SameAs(wxFileName(mf->Filename().c_str())));
+        if( mapped[i] )
+            any = true;
+    }
+    if( !any )
+        return;
+    std::vector< smart_ptr<ListableGame> > ref = BinDbLoadAllGamesGetVector();
+    std::vector< smart_ptr<ListableGame> > *v = &ref;
+    for( int i=0; i<6; i++ )
+    {
+        switch(i)
+        {
+            case 0: v = &gc_clipboard.gds;                          break;
+            case 1: v = &gc_pgn.gds;                                break;
+            case 2: v = &gc_database.gds;                           break;
+            case 3: v = &gc_session.gds;                            break;
+            case 4: v = &objs.db->tiny_db.in_memory_game_cache;     break;
+            case 5: v = &ref;                                       break;
+        }
+        for( size_t j=0; j<v->size(); j++ )
+        {
+            smart_ptr<ListableGame> p = (*v)[j];
+            uint8_t idx;
+            if( p->UsesControlBlock(idx) && mapped[idx] )
+                p->Unmap();
+        }
+    }
+    objs.db->tiny_db.game_table.RefreshMoves( objs.db->tiny_db.in_memory_game_cache );
+    for( int i=0; i<256; i++ )
+    {
+        if( mapped[i] )
+        {
+            cprintf( "Releasing memory mapped file %s, control block %d\n", filename, i );
+            PackedGameBinDb::ReleaseMappedFile(i);
+        }
+    }
+}
+
 
 void GameLogic::CmdDatabaseSelect()
 {
@@ -94,6 +94,7 @@ public:
     void CmdDatabaseShowAll();
     void CmdDatabasePlayers();
     bool ProbeControlBlocks();
+    void ReleaseMappedFile( const char *filename );
     void CmdDatabaseSelect();
     void CmdDatabaseOpen( std::string filename );
     void CmdDatabaseCreate();
@@ -0,0 +1,171 @@
+/****************************************************************************
+ * Game table - a compact, columnar view of a vector of database games
+ *  for the code that scans every game (eg position searches, column sorts)
+ *  Author:  Bill Forster
+ *  License: MIT license. Full text of license is in associated file LICENSE
+ *  Copyright 2010-2016, Bill Forster <billforsternz at gmail dot com>
+ ****************************************************************************/
+#include "DebugPrintf.h"
+#include "AutoTimer.h"
+#include "MaterialSignature.h"
+#include "GameTable.h"
+
+// Empty a vector and give back its memory
+template <class T> static void Release( std::vector<T> &v )
+{
+    std::vector<T> empty;
+    v.swap( empty );
+}
+
+void GameTable::Clear()
+{
+    valid = false;
+    for_search = false;
+    in_games_order = true;
+    base_game_id = 0;
+    cb_idx = 0;
+    Release( game_ids );
+    Release( games_idx );
+    Release( moves );
+    Release( event_bins );
+    Release( site_bins );
+    Release( white_bins );
+    Release( black_bins );
+    Release( date_bins );
+    Release( round_bins );
+    Release( eco_bins );
+    Release( result_bins );
+    Release( white_elo_bins );
+    Release( black_elo_bins );
+    Release( signatures );
+    Release( attributes );
+    Release( material_offsets );
+    Release( material );
+}
+
+void GameTable::Build( std::vector< smart_ptr<ListableGame> > &games, size_t nbr, bool for_search )
+{
+    AutoTimer at("Build game table");
+    Clear();
+    if( nbr==0 || nbr>games.size() )
+        return;
+    if( !games[0]->UsesControlBlock(cb_idx) )
+    {
+        cprintf( "Game table not built, games aren't database games\n" );
+        return;
+    }
+    game_ids.resize(nbr);
+    games_idx.resize(nbr);
+    moves.resize(nbr);
+    event_bins.resize(nbr);
+    site_bins.resize(nbr);
+    white_bins.resize(nbr);
+    black_bins.resize(nbr);
+    date_bins.resize(nbr);
+    round_bins.resize(nbr);
+    eco_bins.resize(nbr);
+    result_bins.resize(nbr);
+    white_elo_bins.resize(nbr);
+    black_elo_bins.resize(nbr);
+    if( for_search )
+    {
+        signatures.resize(nbr);
+        attributes.resize(nbr);
+        material_offsets.resize(nbr+1);
+    }
+    base_game_id = games[0]->game_id;
+    for( size_t i=0; i<nbr; i++ )
+    {
+        ListableGame *p = games[i].get();
+        uint8_t idx;
+        if( !p->UsesControlBlock(idx) || idx!=cb_idx )
+        {
+            cprintf( "Game table not built, games don't share a control block\n" );
+            Clear();
+            return;
+        }
+        if( for_search && p->game_id != base_game_id+i )
+        {
+            cprintf( "Game table not built, game_ids are not contiguous\n" );
+            Clear();
+            return;
+        }
+        game_ids[i] = p->game_id;
+        games_idx[i] = i;
+        moves[i] = p->CompressedMoves();
+        event_bins[i]     = p->EventBin();
+        site_bins[i]      = p->SiteBin();
+        white_bins[i]     = p->WhiteBin();
+        black_bins[i]     = p->BlackBin();
+        date_bins[i]      = p->DateBin();
+        round_bins[i]     = static_cast<uint16_t>(p->RoundBin());
+        eco_bins[i]       = static_cast<uint16_t>(p->EcoBin());
+        result_bins[i]    = static_cast<uint8_t>(p->ResultBin());
+        white_elo_bins[i] = static_cast<uint16_t>(p->WhiteEloBin());
+        black_elo_bins[i] = static_cast<uint16_t>(p->BlackEloBin());
+        if( !for_search )
+            continue;
+        signatures[i] = p->piece_square_signature;
+        const char *fen = p->Fen();
+        attributes[i] = (p->TestPromotion() ? GAME_TABLE_PROMOTION : 0) |
+                        ((fen && *fen) ? GAME_TABLE_PARTIAL : 0);
+
+        // Material summaries, so that material balance searches can rule out most games
+        //  without playing through them
+        material_offsets[i] = static_cast<uint32_t>(material.size());
+        if( (attributes[i]&GAME_TABLE_PARTIAL) || !MaterialSummaryGame(moves[i],material) )
+            attributes[i] |= GAME_TABLE_NO_MATERIAL;
+    }
+    if( for_search )
+    {
+        material_offsets[nbr] = static_cast<uint32_t>(material.size());
+        material.shrink_to_fit();
+    }
+    this->for_search = for_search;
+    valid = true;
+    cprintf( "Game table built, %lu games, %lu bytes of material summaries\n",
+                (unsigned long)nbr, (unsigned long)(material.size()*sizeof(uint16_t)) );
+}
+
+// The games' compressed moves have moved (eg copied out of a memory mapped file that is to be
+//  released), point at them again
+void GameTable::RefreshMoves( std::vector< smart_ptr<ListableGame> > &games )
+{
+    if( !valid )
+        return;
+    size_t nbr = moves.size();
+    if( games.size() < nbr )
+    {
+        Clear();
+        return;
+    }
+    for( size_t row=0; row<nbr; row++ )
+        moves[row] = games[games_idx[row]]->CompressedMoves();
+}
+
+// The games have been sorted (or otherwise reordered), find each row's new idx
+void GameTable::Reorder( std::vector< smart_ptr<ListableGame> > &games )
+{
+    if( !valid )
+        return;
+    size_t nbr = games.size();
+    if( !for_search || nbr != game_ids.size() )
+    {
+        Clear();
+        return;
+    }
+    in_games_order = true;
+    for( size_t i=0; i<nbr; i++ )
+    {
+        uint32_t row = games[i]->game_id - base_game_id;
+        if( row >= nbr )
+        {
+            cprintf( "Game table out of date, discarded\n" );
+            Clear();
+            return;
+        }
+        games_idx[row] = i;
+        if( row != i )
+            in_games_order = false;
+    }
+}
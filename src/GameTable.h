@@ -0,0 +1,106 @@
+/****************************************************************************
+ * Game table - a compact, columnar view of a vector of database games
+ *  for the code that scans every game (eg position searches, column sorts)
+ *  Author:  Bill Forster
+ *  License: MIT license. Full text of license is in associated file LICENSE
+ *  Copyright 2010-2016, Bill Forster <billforsternz at gmail dot com>
+ ****************************************************************************/
+#ifndef GAME_TABLE_H
+#define GAME_TABLE_H
+#include <stdint.h>
+#include <vector>
+#include "ListableGame.h"
+
+// Each ListableGame is a separate heap object reached through a smart_ptr and a
+//  vtable. Scanning millions of them means millions of cache misses and virtual
+//  calls. The table keeps what a scan needs in parallel arrays, one row per game.
+//  The compressed moves aren't copied, each row points at its game's moves where
+//  they already lie (in the memory mapped file or the game's packed fields). The
+//  header columns are the game's bins, the string columns (event, site and
+//  players) index the strings of the control block all the games share
+//
+// Rows are in the order of the games when the table is built. If the games are
+//  later sorted, Reorder() updates the row to games idx mapping rather than
+//  rebuilding the table. If the games' moves move (see ListableGame::Unmap()),
+//  RefreshMoves() must be called
+#define GAME_TABLE_PROMOTION    1       // game has at least one promotion
+#define GAME_TABLE_PARTIAL      2       // game doesn't start from the standard position
+#define GAME_TABLE_NO_MATERIAL  4       // game has no material summary (partial, or very long)
+
+class GameTable
+{
+public:
+    GameTable() { Clear(); }
+    void Clear();
+
+    // Build from the first nbr games. For searching, games must be in game_id order with
+    //  contiguous game_ids, and the signature, attribute and material columns are built too
+    void Build( std::vector< smart_ptr<ListableGame> > &games ) { Build( games, games.size(), true ); }
+    void Build( std::vector< smart_ptr<ListableGame> > &games, size_t nbr, bool for_search );
+    void Reorder( std::vector< smart_ptr<ListableGame> > &games );
+    void RefreshMoves( std::vector< smart_ptr<ListableGame> > &games );
+
+    // The table is only usable if it's (still) in step with the games
+    bool IsValid( size_t nbr_games ) const  { return valid && game_ids.size()==nbr_games; }
+    bool InGamesOrder() const               { return in_games_order; }
+    int  Size() const                       { return game_ids.size(); }
+    int  Row( uint32_t game_id ) const      // -1 if the game isn't in a table built for searching
+    {
+        uint32_t row = game_id - base_game_id;
+        return (valid && for_search && row<game_ids.size()) ? static_cast<int>(row) : -1;
+    }
+    uint8_t     ControlBlockIdx() const     { return cb_idx; }
+
+    // Columns
+    uint32_t    GameId( int row ) const     { return game_ids[row]; }
+    uint64_t    Signature( int row ) const  { return signatures[row]; }
+    bool        TestPromotion( int row ) const { return (attributes[row]&GAME_TABLE_PROMOTION) != 0; }
+    bool        TestPartial( int row ) const   { return (attributes[row]&GAME_TABLE_PARTIAL) != 0; }
+    const char *CompressedMoves( int row ) const { return moves[row]; }
+    int         GamesIdx( int row ) const   { return games_idx[row]; }
+
+    // Header columns, same encoding as the ListableGame ...Bin() functions
+    uint32_t    EventBin( int row ) const   { return event_bins[row]; }
+    uint32_t    SiteBin( int row ) const    { return site_bins[row]; }
+    uint32_t    WhiteBin( int row ) const   { return white_bins[row]; }
+    uint32_t    BlackBin( int row ) const   { return black_bins[row]; }
+    uint32_t    DateBin( int row ) const    { return date_bins[row]; }
+    uint16_t    RoundBin( int row ) const   { return round_bins[row]; }
+    uint16_t    EcoBin( int row ) const     { return eco_bins[row]; }
+    uint8_t     ResultBin( int row ) const  { return result_bins[row]; }
+    uint16_t    WhiteEloBin( int row ) const { return white_elo_bins[row]; }
+    uint16_t    BlackEloBin( int row ) const { return black_elo_bins[row]; }
+
+    // Material summary, see MaterialSummaryGame()
+    bool        TestMaterial( int row ) const  { return (attributes[row]&GAME_TABLE_NO_MATERIAL) == 0; }
+    const uint16_t *MaterialSummary( int row ) const { return material.data() + material_offsets[row]; }
+    int         MaterialSummaryLen( int row ) const { return material_offsets[row+1] - material_offsets[row]; }
+
+private:
+    bool valid;
+    bool for_search;
+    bool in_games_order;        // games_idx[row] == row for all rows
+    uint32_t base_game_id;      // if for_search, game_ids are contiguous from here (checked by Build())
+    uint8_t  cb_idx;            // control block shared by all the games
+    std::vector<uint32_t> game_ids;
+    std::vector<int>      games_idx;        // row -> idx in games
+    std::vector<const char *> moves;        // into the games' own storage, each '\0' terminated
+    std::vector<uint32_t> event_bins;
+    std::vector<uint32_t> site_bins;
+    std::vector<uint32_t> white_bins;
+    std::vector<uint32_t> black_bins;
+    std::vector<uint32_t> date_bins;
+    std::vector<uint16_t> round_bins;
+    std::vector<uint16_t> eco_bins;
+    std::vector<uint8_t>  result_bins;
+    std::vector<uint16_t> white_elo_bins;
+    std::vector<uint16_t> black_elo_bins;
+
+    // For searching only
+    std::vector<uint64_t> signatures;
+    std::vector<uint8_t>  attributes;
+    std::vector<uint32_t> material_offsets; // into material, one extra at the end
+    std::vector<uint16_t> material;         // all material summaries
+};
+
+#endif  // GAME_TABLE_H
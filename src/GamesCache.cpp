@@ -24,6 +24,7 @@
 #include "Lang.h"
 #include "ListableGamePgn.h"
 #include "PgnRead.h"
+#include "PgnScanner.h"
 #include "ProgressBar.h"
 #include "Log.h"
 #include "Eco.h"
@@ -61,6 +62,154 @@ static bool operator < (const smart_ptr<GameDocument>& left,
 #endif
 
 
+// A sidecar index file (the .pgn filename + ".idx") records the file position and main header
+//  fields of each game in a large .pgn file, so reopening the file needn't rescan it. The index
+//  is only used if the .pgn file's length and modification time match those recorded in it,
+//  otherwise it's rebuilt
+#define PGN_INDEX_MAGIC         "Tarrasch pgn idx"
+#define PGN_INDEX_VERSION       1
+#define PGN_INDEX_MIN_FILE_LEN  10000000    // smaller files are quick enough to scan
+struct PgnIndexHeader
+{
+    char     magic[16];
+    int32_t  version;
+    uint32_t nbr_games;
+    int64_t  filelen;
+    int64_t  mtime;
+};
+
+// Then for each game, the file position (int64_t) then ten '\0' terminated strings, white, black,
+//  event, site, result, round, date, eco, white_elo, black_elo
+static bool PgnIndexRead( const std::string &filename, long filelen, time_t mtime, int pgn_handle, std::vector< smart_ptr<ListableGame> > &gds )
+{
+    std::string idx_filename = filename + ".idx";
+    FILE *idx_file = fopen( idx_filename.c_str(), "rb" );
+    if( !idx_file )
+        return false;
+    PgnIndexHeader hdr;
+    bool ok = (1 == fread( &hdr, sizeof(hdr), 1, idx_file ));
+    if( ok )
+    {
+        ok = ( 0 == memcmp(hdr.magic,PGN_INDEX_MAGIC,sizeof(hdr.magic)) &&
+               hdr.version == PGN_INDEX_VERSION &&
+               hdr.filelen == filelen &&
+               hdr.mtime   == static_cast<int64_t>(mtime)
+             );
+    }
+    std::vector<char> buf;
+    if( ok )
+    {
+        long posn = ftell(idx_file);
+        fseek(idx_file,0,SEEK_END);
+        long len = ftell(idx_file) - posn;
+        fseek(idx_file,posn,SEEK_SET);
+        ok = (len > 0);
+        if( ok )
+        {
+            buf.resize(len);
+            ok = (1 == fread( &buf[0], len, 1, idx_file ));
+        }
+    }
+    fclose(idx_file);
+    if( !ok )
+    {
+        cprintf( "Index %s not available or out of date\n", idx_filename.c_str() );
+        return false;
+    }
+    gds.reserve( hdr.nbr_games );
+    const char *p   = &buf[0];
+    const char *end = p + buf.size();
+    int64_t previous = -1;
+    for( uint32_t i=0; ok && i<hdr.nbr_games; i++ )
+    {
+        int64_t fposn;
+        ok = (end-p >= static_cast<long>(sizeof(fposn)));
+        if( ok )
+        {
+            memcpy( &fposn, p, sizeof(fposn) );
+            p += sizeof(fposn);
+            ok = (previous<fposn && fposn<filelen);
+            previous = fposn;
+        }
+        std::string *fields[10];
+        Roster r;
+        fields[0] = &r.white;
+        fields[1] = &r.black;
+        fields[2] = &r.event;
+        fields[3] = &r.site;
+        fields[4] = &r.result;
+        fields[5] = &r.round;
+        fields[6] = &r.date;
+        fields[7] = &r.eco;
+        fields[8] = &r.white_elo;
+        fields[9] = &r.black_elo;
+        for( int j=0; ok && j<10; j++ )
+        {
+            const char *nul = static_cast<const char *>( memchr(p,'\0',end-p) );
+            ok = (nul != NULL);
+            if( ok )
+            {
+                fields[j]->assign( p, nul-p );
+                p = nul+1;
+            }
+        }
+        if( ok )
+        {
+            ListableGamePgn pgn_document(pgn_handle,static_cast<long>(fposn),r);
+            make_smart_ptr( ListableGamePgn, new_doc, pgn_document );
+            gds.push_back( std::move(new_doc) );
+        }
+    }
+    if( !ok || p!=end )
+    {
+        cprintf( "Index %s is corrupt\n", idx_filename.c_str() );
+        gds.clear();
+        return false;
+    }
+    cprintf( "Index %s read, %u games\n", idx_filename.c_str(), hdr.nbr_games );
+    return true;
+}
+
+static void PgnIndexWrite( const std::string &filename, long filelen, time_t mtime, std::vector< smart_ptr<ListableGame> > &gds )
+{
+    std::string idx_filename = filename + ".idx";
+    FILE *idx_file = fopen( idx_filename.c_str(), "wb" );
+    if( !idx_file )
+        return;     // not an error, the index is optional
+    PgnIndexHeader hdr;
+    memset( &hdr, 0, sizeof(hdr) );
+    memcpy( hdr.magic, PGN_INDEX_MAGIC, sizeof(hdr.magic) );
+    hdr.version   = PGN_INDEX_VERSION;
+    hdr.nbr_games = gds.size();
+    hdr.filelen   = filelen;
+    hdr.mtime     = static_cast<int64_t>(mtime);
+    bool ok = (1 == fwrite( &hdr, sizeof(hdr), 1, idx_file ));
+    for( unsigned int i=0; ok && i<gds.size(); i++ )
+    {
+        ListableGame *p = gds[i].get();
+        int64_t fposn = p->GetFposn();
+        ok = (1 == fwrite( &fposn, sizeof(fposn), 1, idx_file ));
+        const char *fields[10];
+        fields[0] = p->White();
+        fields[1] = p->Black();
+        fields[2] = p->Event();
+        fields[3] = p->Site();
+        fields[4] = p->Result();
+        fields[5] = p->Round();
+        fields[6] = p->Date();
+        fields[7] = p->Eco();
+        fields[8] = p->WhiteElo();
+        fields[9] = p->BlackElo();
+        for( int j=0; ok && j<10; j++ )
+            ok = (1 == fwrite( fields[j], strlen(fields[j])+1, 1, idx_file ));
+    }
+    fclose(idx_file);
+    if( ok )
+        cprintf( "Index %s written, %u games\n", idx_filename.c_str(), hdr.nbr_games );
+    else
+        remove( idx_filename.c_str() );     // don't leave a partial index behind
+}
+
 bool GamesCache::Load(std::string &filename )
 {
     file_irrevocably_modified = false;
@@ -69,7 +218,30 @@ bool GamesCache::Load(std::string &filename )
     FILE *pgn_file = objs.gl->pf.OpenRead( filename, pgn_handle );
     if( pgn_file )
     {
-        loaded = Load(pgn_file);
+        long fposn = ftell(pgn_file);   // after any Unicode BOM
+        fseek(pgn_file,0,SEEK_END);
+        long filelen = ftell(pgn_file);
+        fseek(pgn_file,fposn,SEEK_SET);
+        wxString wx_filename = filename.c_str();
+        time_t mtime = ::wxFileModificationTime(wx_filename);
+        bool use_index = (filelen >= PGN_INDEX_MIN_FILE_LEN);
+        gds.clear();
+        if( use_index && PgnIndexRead(filename,filelen,mtime,pgn_handle,gds) )
+        {
+            uint32_t game_id = GameIdAllocateBottom( gds.size() );
+            for( std::vector<smart_ptr<ListableGame>>::iterator iter = gds.begin();
+                 iter != gds.end(); iter++ )
+            {
+                (*iter)->game_id = game_id++;
+            }
+            loaded = true;
+        }
+        else
+        {
+            loaded = Load(pgn_file);
+            if( loaded && use_index )
+                PgnIndexWrite(filename,filelen,mtime,gds);
+        }
         if( loaded )
             pgn_filename = filename;
         objs.gl->pf.Close();
@@ -86,12 +258,12 @@ static GamesCache *gc_fixme;
 
 bool PgnStateMachine( FILE *pgn_file, int &typ, char *buf, int buflen )
 {
-    static enum {INIT,PREFIX,TAGLINES,PRE_MOVES,MOVES,SEARCH} state;
+    static PgnLineClassifier classifier;
     bool done=false;
     typ = ' ';  // no-op
     if( pgn_file == NULL )
     {
-        state = INIT;
+        classifier.Init();
     }
     else
     {
@@ -99,134 +271,11 @@ bool PgnStateMachine( FILE *pgn_file, int &typ, char *buf, int buflen )
         if( null_if_eof == NULL )
         {
             done = true;
-            if( state==MOVES )
-                typ = 'G';  // completed game;
+            typ = classifier.Eof();
         }
         else
         {
-            const char *p = buf;
-            while( *p==' ' || *p=='\t' )
-                p++;
-            bool blank   = (*p=='\n'||*p=='\r');
-            bool tagline = (*p=='[');
-
-            // Check that it really is a tagline
-            if( tagline )
-            {
-                tagline = false;  // unless all checks pass
-
-                // Skip '['
-                p++;
-
-                // Skip whitespace
-                while( *p==' ' || *p=='\t' )
-                    p++;
-
-                // Is there a tag before a leading " ?
-                bool tag=false;
-                while( *p && *p!=']' && *p!=' ' && *p!='\t' && *p!='\"' )
-                {
-                    tag = true;    // at least 1 non-whitespace
-                    p++;
-                }
-                if( tag )
-                {
-
-                    // Make sure there is whitespace, but skip it
-                    tag = false;
-                    while( *p==' ' || *p=='\t' )
-                    {
-                        tag = true;  // at least 1 whitespace
-                        p++;
-                    }
-                }
-
-                // If there is a tag, then whitespace, then a leading "
-                if( tag && *p=='\"')
-                {
-                    p++;
-
-                    // Skip to 2nd " or end of string
-                    while( *p && *p!='\"' )
-                        p++;
-
-                    // If we have a 2nd " then we have a tag and a val, i.e. a header
-                    if( *p == '\"' )
-                    {
-                        tagline = true;
-                    }
-                }
-            }
-            switch( state )
-            {
-                case INIT:
-                case SEARCH:
-                {
-                    if( tagline )
-                    {
-                        state = TAGLINES;
-                        typ = 'T';   // first tagline
-                    }
-                    else if( !blank )
-                    {
-                        state = PREFIX;
-                        typ = 'P';  // first prefix line
-                    }
-                    break;
-                }
-                case PREFIX:
-                {
-                    if( tagline )
-                    {
-                        state = TAGLINES;
-                        typ = 'T';   // first tagline
-                    }
-                    else
-                    {
-                        typ = 'p';  // next prefix line
-                    }
-                    break;
-                }
-                case TAGLINES:
-                {
-                    if( tagline )
-                    {
-                        typ = 't';   // next tagline
-                    }
-                    else if( blank )
-                    {
-                        state = PRE_MOVES;
-                    }
-                    else
-                    {
-                        state = MOVES;
-                        typ = 'M';    // first line of moves, (a pity there wasn't a blank line before them)
-                    }
-                    break;
-                }
-                case PRE_MOVES:
-                {
-                    if( !blank )
-                    {
-                        state = MOVES;
-                        typ = 'M';  // first line of moves, after one or more blank lines
-                    }
-                    break;
-                }
-                case MOVES:
-                {
-                    if( blank )
-                    {
-                        state = SEARCH;
-                        typ = 'G';  // completed game
-                    }
-                    else
-                    {
-                        typ = 'm';  // next line of moves
-                    }
-                    break;
-                }
-            }
+            typ = classifier.Classify( buf );
         }
     }
     return done;
@@ -242,24 +291,30 @@ bool GamesCache::Load( FILE *pgn_file )
     int typ;
     std::string str;
     long fposn = ftell(pgn_file);
-    char buf[2048];
     std::string title("Scanning .pgn file for games");
     std::string desc("Reading .pgn file");
     bool abortable=false;
     wxWindow *parent=NULL;
     ProgressBar pb( title, desc, abortable, parent, pgn_file );
-    bool done = PgnStateMachine( NULL, typ,  buf, sizeof(buf) );
+    PgnScanner scanner( pgn_file );
+    GameDocument gd;    // collects the header fields as we go, so the games needn't be read to list them
+    bool done = false;
     while( !done )
     {
-        done = PgnStateMachine( pgn_file, typ, buf, sizeof(buf) );
-        if( typ == 'G' )
+        done = scanner.Next( typ );
+        if( typ=='T' || typ=='t' )
+            Tagline( gd, scanner.Line() );
+        else if( typ == 'G' )
         {
-            ListableGamePgn pgn_document(pgn_handle,fposn);
+            ListableGamePgn pgn_document(pgn_handle,fposn,gd.r);
             make_smart_ptr( ListableGamePgn, new_doc, pgn_document );
             gds.push_back( std::move(new_doc) );
             if( !done )
-                fposn = ftell(pgn_file);
+                fposn = scanner.Posn();
             game_count++;
+            Roster empty;
+            gd.r = empty;
+            gd.extra_tags.clear();
         }
         pb.ProgressFile();
     }
@@ -30,6 +30,7 @@
 #include "Lang.h"
 #include "GamesDialog.h"
 #include "Database.h"
+#include "PackedGameBinDb.h"
 #include <iostream>
 #include <fstream>
 #include <string>
@@ -75,8 +76,10 @@ BEGIN_EVENT_TABLE( GamesDialog, wxDialog )
     EVT_RADIOBUTTON( ID_DB_RADIO,       GamesDialog::OnRadio )
     EVT_CHECKBOX   ( ID_DB_CHECKBOX,    GamesDialog::OnCheckBox )
     EVT_CHECKBOX   ( ID_DB_CHECKBOX2,   GamesDialog::OnCheckBox2 )
+    EVT_CHECKBOX   ( ID_DB_CHECKBOX3,   GamesDialog::OnCheckBox3 )
     EVT_COMBOBOX   ( ID_DB_COMBO,       GamesDialog::OnComboBox )
     EVT_LISTBOX(ID_DB_LISTBOX_STATS, GamesDialog::OnNextMove)
+    EVT_TIMER( ID_DB_TIMER, GamesDialog::OnTimer )
 
     EVT_LIST_ITEM_FOCUSED(ID_PGN_LISTBOX, GamesDialog::OnListFocused)
     EVT_LIST_ITEM_ACTIVATED(ID_PGN_LISTBOX, GamesDialog::OnListSelected)
@@ -1052,6 +1055,17 @@ void GamesDialog::GdvCheckBox2( bool WXUNUSED(checked) )
 {
 }
 
+void GamesDialog::OnCheckBox3( wxCommandEvent& event )
+{
+    bool checked = event.IsChecked();
+    GdvCheckBox3( checked );
+}
+
+// overide
+void GamesDialog::GdvCheckBox3( bool WXUNUSED(checked) )
+{
+}
+
 void GamesDialog::OnRadio( wxCommandEvent& WXUNUSED(event))
 {
 }
@@ -1164,6 +1178,12 @@ void GamesDialog::OnNextMove( wxCommandEvent &event )
     temp_fixme = false;
 }
 
+// A timer owned by a derived class (with id ID_DB_TIMER) has expired
+void GamesDialog::OnTimer( wxTimerEvent& WXUNUSED(event) )
+{
+    GdvTimer();
+}
+
 
 // overide
 void GamesDialog::GdvNextMove( int WXUNUSED(idx) )
@@ -1698,14 +1718,11 @@ static void sort_before( std::vector< smart_ptr<ListableGame> >::iterator begin,
     cprintf( "Sorting: nbr_to_sort=%u, nbr_expected=%u, initial permill=%u\n", (unsigned int)dist,  (unsigned int)predicate_nbr_expected, (unsigned int)permill_initial );
 }
 
-static void sort_before_mc( std::vector< MoveColCompareElement >::iterator begin,
-                   std::vector< MoveColCompareElement >::iterator end,
-                   ProgressBar *pb
-                 )
+// Progress accounting for a sort of dist elements, without scanning them first
+static void sort_before_dist( unsigned int dist, ProgressBar *pb )
 {
     predicate_count = 0;
     predicate_pb = pb;
-    unsigned int dist = std::distance( begin, end );
     predicate_dist = dist;
 
     // The following formula is based on experiment - std::sort() called the predicate function approx
@@ -1720,6 +1737,14 @@ static void sort_before_mc( std::vector< MoveColCompareElement >::iterator begin
     cprintf( "Sorting: nbr_to_sort=%u, nbr_expected=%u, initial permill=%u\n", (unsigned int)dist,  (unsigned int)predicate_nbr_expected, (unsigned int)permill_initial );
 }
 
+static void sort_before_mc( std::vector< MoveColCompareElement >::iterator begin,
+                   std::vector< MoveColCompareElement >::iterator end,
+                   ProgressBar *pb
+                 )
+{
+    sort_before_dist( std::distance( begin, end ), pb );
+}
+
 static void sort_after()
 {
     cprintf( "Sorting: nbr_expected=%u, nbr_actual=%u\n", (unsigned int)predicate_nbr_expected, (unsigned int)predicate_count );
@@ -2575,7 +2600,145 @@ void GamesDialog::MoveColCompare( std::vector< smart_ptr<ListableGame> > &displa
 
 */
 
-void GamesDialog::ColumnSort( int compare_col_, std::vector< smart_ptr<ListableGame> > &displayed_games )
+// Games from the in memory database can be sorted through its game table instead, comparing
+//  columns rather than unpacking each game's fields through its vtable, over and over
+struct TableSortElement
+{
+    uint32_t row;       // in the game table
+    uint32_t idx;       // in the games being sorted
+};
+static const GameTable *predicate_table;
+static std::vector<uint32_t> predicate_player_ranks;    // strcmp() order of the player strings
+static std::vector<uint32_t> predicate_event_ranks;     // same for the event (or site) strings
+
+static const std::vector<std::string> *predicate_names;
+static bool predicate_name_order( uint32_t i1, uint32_t i2 )
+{
+    return strcmp( (*predicate_names)[i1].c_str(), (*predicate_names)[i2].c_str() ) < 0;
+}
+
+// Rank strings in strcmp() order, equal strings have equal rank
+static void name_ranks( const std::vector<std::string> &names, std::vector<uint32_t> &ranks )
+{
+    uint32_t nbr = names.size();
+    std::vector<uint32_t> order(nbr);
+    for( uint32_t i=0; i<nbr; i++ )
+        order[i] = i;
+    predicate_names = &names;
+    std::sort( order.begin(), order.end(), predicate_name_order );
+    ranks.resize(nbr);
+    uint32_t rank = 0;
+    for( uint32_t i=0; i<nbr; i++ )
+    {
+        if( i>0 && 0!=strcmp(names[order[i-1]].c_str(),names[order[i]].c_str()) )
+            rank++;
+        ranks[order[i]] = rank;
+    }
+}
+
+// Same order as master_predicate()
+static bool master_predicate_table( const TableSortElement &e1, const TableSortElement &e2 )
+{
+    predicate_count++;
+    if( (predicate_count & 0xffff) == 0 )
+        sort_progress_probe();
+    const GameTable *t = predicate_table;
+    int r1 = e1.row;
+    int r2 = e2.row;
+    bool lt=false; bool eq=true;
+    for( int i=0; eq && i<NBR_COLUMNS; i++ )  // tie break loop
+    {
+        int col = sort_order[i];
+        if( col == -1 )
+            return( t->GameId(r1) < t->GameId(r2) );  // Use game_id as ultimate tie-breaker
+        bool forward = sort_forward[i];
+        bool reverse_bin=false;
+        int bin1=0;
+        int bin2=0;
+        switch( col )
+        {
+            case 0:  bin1 = t->GameId(r1);  bin2 = t->GameId(r2);   break;
+            case 1:  bin1 = predicate_player_ranks[t->WhiteBin(r1)];
+                     bin2 = predicate_player_ranks[t->WhiteBin(r2)];    break;
+            case 2:  reverse_bin = true;
+                     bin1 = t->WhiteEloBin(r1); bin2 = t->WhiteEloBin(r2);  break;
+            case 3:  bin1 = predicate_player_ranks[t->BlackBin(r1)];
+                     bin2 = predicate_player_ranks[t->BlackBin(r2)];    break;
+            case 4:  reverse_bin = true;
+                     bin1 = t->BlackEloBin(r1); bin2 = t->BlackEloBin(r2);  break;
+            case 5:  reverse_bin = true;
+                     bin1 = t->DateBin(r1); bin2 = t->DateBin(r2);  break;
+            case 6:  bin1 = predicate_event_ranks[ objs.repository->nv.m_event_not_site ? t->EventBin(r1) : t->SiteBin(r1) ];
+                     bin2 = predicate_event_ranks[ objs.repository->nv.m_event_not_site ? t->EventBin(r2) : t->SiteBin(r2) ];
+                     break;
+            case 7:  bin1 = t->RoundBin(r1); bin2 = t->RoundBin(r2);    break;
+            case 8:
+            {
+                static int xform[] = {3,0,1,2};     // transform order to 1-0, 0-1, 1/2-1/2, *
+                bin1 = xform[t->ResultBin(r1) & 3];
+                bin2 = xform[t->ResultBin(r2) & 3];
+                break;
+            }
+            case 9:
+            {
+                bin1 = t->EcoBin(r1);
+                if( bin1 >= 500 )
+                    bin1 = -1;  // allows empty to sort differently to A00
+                bin2 = t->EcoBin(r2);
+                if( bin2 >= 500 )
+                    bin2 = -1;
+                break;
+            }
+            case 10: // Ply
+            {
+                bin1 = strlen(t->CompressedMoves(r1));
+                bin2 = strlen(t->CompressedMoves(r2));
+                break;
+            }
+        }
+        if( reverse_bin )   // big numbers first when you first click on the column, eg elo
+            lt = forward ? (bin2 < bin1) : (bin1 < bin2);
+        else
+            lt = forward ? (bin1 < bin2) : (bin2 < bin1);
+        eq = (bin1 == bin2);
+    }
+    return lt;
+}
+
+// Sort with the in memory database's game table, returns false (and leaves the games unsorted) if
+//  any of the games aren't in the table
+static bool table_sort( MemoryPositionSearch *mps, std::vector< smart_ptr<ListableGame> > &displayed_games, ProgressBar *pb )
+{
+    GameTable &table = mps->game_table;
+    std::vector< smart_ptr<ListableGame> > &db_games = mps->in_memory_game_cache;
+    if( !table.IsValid(db_games.size()) )
+        return false;
+    uint32_t nbr = displayed_games.size();
+    std::vector<TableSortElement> elements(nbr);
+    for( uint32_t i=0; i<nbr; i++ )
+    {
+        ListableGame *p = displayed_games[i].get();
+        int row = table.Row(p->game_id);
+        if( row<0 || db_games[table.GamesIdx(row)].get()!=p )
+            return false;
+        elements[i].row = row;
+        elements[i].idx = i;
+    }
+    PackedGameBinDbControlBlock &cb = PackedGameBinDb::GetControlBlock( table.ControlBlockIdx() );
+    name_ranks( cb.players, predicate_player_ranks );
+    name_ranks( objs.repository->nv.m_event_not_site ? cb.events : cb.sites, predicate_event_ranks );
+    predicate_table = &table;
+    sort_before_dist( nbr, pb );
+    std::sort( elements.begin(), elements.end(), master_predicate_table );
+    sort_after();
+    std::vector< smart_ptr<ListableGame> > sorted(nbr);
+    for( uint32_t i=0; i<nbr; i++ )
+        sorted[i] = std::move( displayed_games[elements[i].idx] );
+    displayed_games.swap( sorted );
+    return true;
+}
+
+void GamesDialog::ColumnSort( int compare_col_, std::vector< smart_ptr<ListableGame> > &displayed_games, MemoryPositionSearch *mps )
 {
     dirty = true;
     uint32_t sz = displayed_games.size();
@@ -2696,14 +2859,17 @@ void GamesDialog::ColumnSort( int compare_col_, std::vector< smart_ptr<ListableG
             //AutoTimer at("Move column not included");
             //DebugPrintfTime dpt;
             ProgressBar pb("Column sort" , "Sorting...", false );
-            predicate_displayed_games = &displayed_games;
-            sort_before( displayed_games.begin(),
-                   displayed_games.end(),
-                   master_predicate,
-                   &pb
-                 );
-            std::sort( displayed_games.begin(), displayed_games.end(), master_predicate );
-            sort_after();
+            if( !mps || !table_sort(mps,displayed_games,&pb) )
+            {
+                predicate_displayed_games = &displayed_games;
+                sort_before( displayed_games.begin(),
+                       displayed_games.end(),
+                       master_predicate,
+                       &pb
+                     );
+                std::sort( displayed_games.begin(), displayed_games.end(), master_predicate );
+                sort_after();
+            }
         }
         nbr_games_in_list_ctrl = displayed_games.size();
         list_ctrl->SetItemCount(nbr_games_in_list_ctrl);
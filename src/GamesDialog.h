@@ -24,6 +24,7 @@ enum
 {
     ID_DB_CHECKBOX  = 10000,
     ID_DB_CHECKBOX2,
+    ID_DB_CHECKBOX3,
     ID_DB_RADIO ,
     ID_DB_COMBO ,
     ID_DB_SEARCH,
@@ -32,6 +33,7 @@ enum
     ID_DB_LISTBOX_GAMES,
     ID_DB_LISTBOX_STATS,
     ID_DB_LISTBOX_TRANSPO,
+    ID_DB_TIMER,
     ID_BUTTON_1,
     ID_BUTTON_2,
     ID_BUTTON_3,
@@ -192,6 +194,7 @@ public:
     void OnListColClick( wxListEvent &event );
     void OnTabSelected( wxBookCtrlEvent &event );
     void OnNextMove( wxCommandEvent &event );
+    void OnTimer( wxTimerEvent &event );
 
     // wxEVT_COMMAND_BUTTON_CLICKED event handler for wxID_OK
     void OnOkClick( wxCommandEvent& event );
@@ -227,11 +230,12 @@ public:
     void OnComboBox( wxCommandEvent& event );
     void OnCheckBox( wxCommandEvent& event );
     void OnCheckBox2( wxCommandEvent& event );
+    void OnCheckBox3( wxCommandEvent& event );
     void OnListSelected( int idx );
 
     void Goto( int idx );
     void ReadItemWithSingleLineCache( int item, CompactGame &info );
-    void ColumnSort( int compare_col, std::vector< smart_ptr<ListableGame> > &displayed_games );
+    void ColumnSort( int compare_col, std::vector< smart_ptr<ListableGame> > &displayed_games, MemoryPositionSearch *mps=NULL );    // mps, if the games are from its in memory database
 
     // Overrides - Gdv = Games Dialog Override
     virtual void GdvOnActivate();
@@ -247,6 +251,7 @@ public:
     virtual void GdvHelpClick();
     virtual void GdvCheckBox( bool checked );
     virtual void GdvCheckBox2( bool checked );
+    virtual void GdvCheckBox3( bool checked );
     virtual void GdvSearch();
     virtual void GdvUtility();
     virtual void GdvButton1();
@@ -255,6 +260,7 @@ public:
     virtual void GdvButton4();
     virtual void GdvButton5();
     virtual void GdvNextMove( int idx );
+    virtual void GdvTimer() {}
     virtual int  CalculateTranspo( const char *blob, int &transpo );
     virtual int  GetBasePositionIdx( CompactGame &WXUNUSED(pact), bool WXUNUSED(receiving_focus) ) { return 0; }
 
@@ -13,6 +13,7 @@
 #include "CompressMoves.h"
 #include "CompactGame.h"
 #include "BinaryConversions.h"
+#include "PieceSquareSignature.h"
 
 #define smart_ptr std::shared_ptr //std::unique_ptr
 #define make_smart_ptr(T,to,from) smart_ptr<T> to; to.reset(new T(from))
@@ -26,7 +27,7 @@ class GameDocument;
 class ListableGame
 {
 public:
-    ListableGame() { /*transpo_nbr=0;*/ game_attributes=0; game_id=0; }
+    ListableGame() { /*transpo_nbr=0;*/ game_attributes=0; game_id=0; piece_square_signature=PIECE_SQUARE_SIGNATURE_ALL; }
     virtual ~ListableGame() {}
     virtual GameDocument *IsGameDocument()  { return NULL; }        // return ptr to this if and only if this is type GameDocument
     virtual void ConvertToGameDocument(GameDocument &UNUSED(gd)) {}
@@ -85,6 +86,7 @@ private:
 public:
     uint32_t game_id;
     bool     saved;
+    uint64_t piece_square_signature;    // see PieceSquareSignature.h, by default can't rule out any position
     bool TestPromotion() { return (game_attributes&1) ? true : false; }
     void SetPromotion( bool has_promotion ) { if( has_promotion ) game_attributes |= 1; else game_attributes &= (~1); }
     bool TestLocked() { return (game_attributes&2) ? true : false; }
@@ -127,6 +129,7 @@ public:
         SetPromotion( has_promotion );
     }
     virtual bool UsesControlBlock( uint8_t & ) { return false; }
+    virtual void Unmap() {}     // stop pointing into a memory mapped file, see PackedGameBinDb
 
 };
 
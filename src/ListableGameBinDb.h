@@ -25,6 +25,14 @@ public:
         CalculatePromotionAttribute();
     }
 
+    // A game that points into a memory mapped .tdb file (kept alive by the control block)
+    ListableGameBinDb( int cb_idx, uint32_t game_id, const char *mapped_game )
+        : pack( cb_idx, mapped_game )
+    {
+        this->game_id = game_id;
+        CalculatePromotionAttribute();
+    }
+
     ListableGameBinDb(
         uint8_t cb_idx,
         uint32_t game_id,
@@ -129,6 +137,7 @@ public:
     virtual int WhiteEloBin()       { return pack.WhiteEloBin(); }
     virtual int BlackEloBin()       { return pack.BlackEloBin(); }
     virtual bool UsesControlBlock( uint8_t &control_block_idx ) { control_block_idx=pack.GetControlBlockIdx(); return true; }
+    virtual void Unmap() { pack.Unmap(); }
 };
 
 
@@ -21,9 +21,24 @@ private:
     int  pgn_handle;
     long fposn;
     PackedGame pack;
+    PackedGame headers;     // optional, the main header fields only (see GamesCache::Load())
     bool in_memory;
+
+    // The header fields, from headers if available, so there's no need to read the game
+    PackedGame &Headers()
+    {
+        if( !in_memory && headers.Empty() )
+            LoadIntoMemory(NULL,true);
+        return in_memory ? pack : headers;
+    }
 public:
     ListableGamePgn( int pgn_handle, long fposn ) { this->pgn_handle=pgn_handle, this->fposn = fposn; in_memory=false;  }
+    ListableGamePgn( int pgn_handle, long fposn, Roster &r )
+    {
+        this->pgn_handle=pgn_handle, this->fposn = fposn; in_memory=false;
+        std::string no_moves;
+        headers.Pack( r, no_moves );
+    }
     virtual long GetFposn() { return fposn; }
     virtual void SetFposn( long posn ) { fposn=posn; }
     virtual bool GetPgnHandle( int &pgn_handle_ ) { pgn_handle_=this->pgn_handle; return true; }
@@ -88,16 +103,16 @@ public:
     // For now at least, the following are used for fast sorting on column headings
     //  (only available after LoadInMemory() called - games are loaded from file
     //   when user clicks on a column heading
-    virtual const char *White()     { if(!in_memory) LoadIntoMemory(NULL,true); return pack.White();    }
-    virtual const char *Black()     { if(!in_memory) LoadIntoMemory(NULL,true); return pack.Black();    }
-    virtual const char *Event()     { if(!in_memory) LoadIntoMemory(NULL,true); return pack.Event();    }
-    virtual const char *Site()      { if(!in_memory) LoadIntoMemory(NULL,true); return pack.Site();     }
-    virtual const char *Result()    { if(!in_memory) LoadIntoMemory(NULL,true); return pack.Result();   }
-    virtual const char *Round()     { if(!in_memory) LoadIntoMemory(NULL,true); return pack.Round() ;   }
-    virtual const char *Date()      { if(!in_memory) LoadIntoMemory(NULL,true); return pack.Date();     }
-    virtual const char *Eco()       { if(!in_memory) LoadIntoMemory(NULL,true); return pack.Eco();      }
-    virtual const char *WhiteElo()  { if(!in_memory) LoadIntoMemory(NULL,true); return pack.WhiteElo(); }
-    virtual const char *BlackElo()  { if(!in_memory) LoadIntoMemory(NULL,true); return pack.BlackElo(); }
+    virtual const char *White()     { return Headers().White();    }
+    virtual const char *Black()     { return Headers().Black();    }
+    virtual const char *Event()     { return Headers().Event();    }
+    virtual const char *Site()      { return Headers().Site();     }
+    virtual const char *Result()    { return Headers().Result();   }
+    virtual const char *Round()     { return Headers().Round() ;   }
+    virtual const char *Date()      { return Headers().Date();     }
+    virtual const char *Eco()       { return Headers().Eco();      }
+    virtual const char *WhiteElo()  { return Headers().WhiteElo(); }
+    virtual const char *BlackElo()  { return Headers().BlackElo(); }
     virtual const char *Fen()       { if(!in_memory) LoadIntoMemory(NULL,true); return pack.Fen();      }
     virtual const char *CompressedMoves() { if(!in_memory) LoadIntoMemory(NULL,true); return pack.Blob();  }
 };
@@ -9,11 +9,14 @@
 #include "wx/valgen.h"
 #include "wx/filename.h"
 #include "wx/filepicker.h"
+#include "wx/numdlg.h"
 #include "DebugPrintf.h"
 #include "Portability.h"
 #include "Appdefs.h"
 #include "DbPrimitives.h"
 #include "DbMaintenance.h"
+#include "Objects.h"
+#include "Database.h"
 #include "MaintenanceDialog.h"
 
 // MaintenanceDialog type definition
@@ -28,6 +31,10 @@ EVT_BUTTON( ID_MAINTENANCE_CMD_1, MaintenanceDialog::OnMaintenanceSpeed )
 EVT_BUTTON( ID_MAINTENANCE_CMD_4, MaintenanceDialog::OnMaintenanceVerify )
 EVT_BUTTON( ID_MAINTENANCE_CMD_5, MaintenanceDialog::OnMaintenanceCreate )
 EVT_BUTTON( ID_CREATE_DB_APPEND, MaintenanceDialog::OnMaintenanceIndexes )
+EVT_BUTTON( ID_MAINTENANCE_CMD_7, MaintenanceDialog::OnMaintenanceSignature )
+EVT_BUTTON( ID_MAINTENANCE_CMD_8, MaintenanceDialog::OnMaintenancePositionIndex )
+EVT_BUTTON( ID_MAINTENANCE_CMD_9, MaintenanceDialog::OnMaintenanceOpeningTree )
+EVT_BUTTON( ID_MAINTENANCE_CMD_10, MaintenanceDialog::OnMaintenancePawnIndex )
 
 EVT_BUTTON( wxID_HELP, MaintenanceDialog::OnHelpClick )
 EVT_FILEPICKER_CHANGED( ID_TEMP_ENGINE_PICKER, MaintenanceDialog::OnFilePicked )
@@ -275,6 +282,18 @@ void MaintenanceDialog::CreateControls()
     wxButton* button_cmd_6 = new wxButton( this, ID_CREATE_DB_APPEND, wxT("&DANGER database create indexes"),
                                           wxDefaultPosition, wxDefaultSize, 0 );
     db_vert->Add( button_cmd_6, 0, wxALL, 5);
+    wxButton* button_cmd_7 = new wxButton( this, ID_MAINTENANCE_CMD_7, wxT("&Piece square signature statistics"),
+                                          wxDefaultPosition, wxDefaultSize, 0 );
+    db_vert->Add( button_cmd_7, 0, wxALL, 5);
+    wxButton* button_cmd_8 = new wxButton( this, ID_MAINTENANCE_CMD_8, wxT("&Build position index for current database"),
+                                          wxDefaultPosition, wxDefaultSize, 0 );
+    db_vert->Add( button_cmd_8, 0, wxALL, 5);
+    wxButton* button_cmd_9 = new wxButton( this, ID_MAINTENANCE_CMD_9, wxT("Build &opening tree for current database"),
+                                          wxDefaultPosition, wxDefaultSize, 0 );
+    db_vert->Add( button_cmd_9, 0, wxALL, 5);
+    wxButton* button_cmd_10 = new wxButton( this, ID_MAINTENANCE_CMD_10, wxT("Build p&awn structure index for current database"),
+                                          wxDefaultPosition, wxDefaultSize, 0 );
+    db_vert->Add( button_cmd_10, 0, wxALL, 5);
 
 
     // A dividing line before the OK and Cancel buttons
@@ -395,6 +414,58 @@ void MaintenanceDialog::OnMaintenanceIndexes( wxCommandEvent& WXUNUSED(event) )
 {
 }
 
+// wxEVT_COMMAND_BUTTON_CLICKED event handler for ID_MAINTENANCE_CMD_7
+void MaintenanceDialog::OnMaintenanceSignature( wxCommandEvent& WXUNUSED(event) )
+{
+    extern wxMutex *WaitForWorkerThread( const char *title );
+    wxMutex *ptr_mutex_tiny_database = WaitForWorkerThread( "Completing Initial Database Load" );
+    wxMutexLocker lock(*ptr_mutex_tiny_database);
+    db_maintenance_piece_square_statistics( objs.db->tiny_db.in_memory_game_cache );
+}
+
+// wxEVT_COMMAND_BUTTON_CLICKED event handler for ID_MAINTENANCE_CMD_8
+void MaintenanceDialog::OnMaintenancePositionIndex( wxCommandEvent& WXUNUSED(event) )
+{
+    extern wxMutex *WaitForWorkerThread( const char *title );
+    wxMutex *ptr_mutex_tiny_database = WaitForWorkerThread( "Completing Initial Database Load" );
+    wxMutexLocker lock(*ptr_mutex_tiny_database);
+    std::string error_msg;
+    if( objs.db->BuildPositionIndex(error_msg) )
+        wxMessageBox( "Position index built", "Position index", wxOK|wxICON_INFORMATION, this );
+    else
+        wxMessageBox( error_msg.c_str(), "Position index not built", wxOK|wxICON_ERROR, this );
+}
+
+// wxEVT_COMMAND_BUTTON_CLICKED event handler for ID_MAINTENANCE_CMD_9
+void MaintenanceDialog::OnMaintenanceOpeningTree( wxCommandEvent& WXUNUSED(event) )
+{
+    long max_ply = wxGetNumberFromUser( "Positions up to this many half moves (ply) into each game are included",
+                                        "Maximum ply", "Build opening tree", OPENING_TREE_DEFAULT_MAX_PLY, 1, 200, this );
+    if( max_ply < 0 )
+        return;     // cancelled
+    extern wxMutex *WaitForWorkerThread( const char *title );
+    wxMutex *ptr_mutex_tiny_database = WaitForWorkerThread( "Completing Initial Database Load" );
+    wxMutexLocker lock(*ptr_mutex_tiny_database);
+    std::string error_msg;
+    if( objs.db->BuildOpeningTree(max_ply,error_msg) )
+        wxMessageBox( "Opening tree built", "Opening tree", wxOK|wxICON_INFORMATION, this );
+    else
+        wxMessageBox( error_msg.c_str(), "Opening tree not built", wxOK|wxICON_ERROR, this );
+}
+
+// wxEVT_COMMAND_BUTTON_CLICKED event handler for ID_MAINTENANCE_CMD_10
+void MaintenanceDialog::OnMaintenancePawnIndex( wxCommandEvent& WXUNUSED(event) )
+{
+    extern wxMutex *WaitForWorkerThread( const char *title );
+    wxMutex *ptr_mutex_tiny_database = WaitForWorkerThread( "Completing Initial Database Load" );
+    wxMutexLocker lock(*ptr_mutex_tiny_database);
+    std::string error_msg;
+    if( objs.db->BuildPawnIndex(error_msg) )
+        wxMessageBox( "Pawn structure index built", "Pawn structure index", wxOK|wxICON_INFORMATION, this );
+    else
+        wxMessageBox( error_msg.c_str(), "Pawn structure index not built", wxOK|wxICON_ERROR, this );
+}
+
 // ID_TEMP_ENGINE_PICKER
 void MaintenanceDialog::OnFilePicked( wxFileDirPickerEvent& event )
 {
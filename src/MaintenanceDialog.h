@@ -36,7 +36,10 @@ enum
     ID_TEMP_CUSTOM3A        = 10016,
     ID_TEMP_CUSTOM3B        = 10017,
     ID_TEMP_CUSTOM4A        = 10018,
-    ID_TEMP_CUSTOM4B        = 10019
+    ID_TEMP_CUSTOM4B        = 10019,
+    ID_MAINTENANCE_CMD_8    = 10020,
+    ID_MAINTENANCE_CMD_9    = 10021,
+    ID_MAINTENANCE_CMD_10   = 10022
 };
 
 // MaintenanceDialog class declaration
@@ -98,6 +101,18 @@ public:
     // wxEVT_COMMAND_BUTTON_CLICKED event handler for ID_CREATE_DB_APPEND
     void OnMaintenanceIndexes( wxCommandEvent& event );
 
+    // wxEVT_COMMAND_BUTTON_CLICKED event handler for ID_MAINTENANCE_CMD_7
+    void OnMaintenanceSignature( wxCommandEvent& event );
+
+    // wxEVT_COMMAND_BUTTON_CLICKED event handler for ID_MAINTENANCE_CMD_8
+    void OnMaintenancePositionIndex( wxCommandEvent& event );
+
+    // wxEVT_COMMAND_BUTTON_CLICKED event handler for ID_MAINTENANCE_CMD_9
+    void OnMaintenanceOpeningTree( wxCommandEvent& event );
+
+    // wxEVT_COMMAND_BUTTON_CLICKED event handler for ID_MAINTENANCE_CMD_10
+    void OnMaintenancePawnIndex( wxCommandEvent& event );
+
     // wxEVT_COMMAND_BUTTON_CLICKED event handler for wxID_HELP
     void OnHelpClick( wxCommandEvent& event );
 
@@ -0,0 +1,112 @@
+/****************************************************************************
+ * Read only memory mapped file
+ *  Author:  Bill Forster
+ *  License: MIT license. Full text of license is in associated file LICENSE
+ *  Copyright 2010-2016, Bill Forster <billforsternz at gmail dot com>
+ ****************************************************************************/
+#include "Portability.h"
+#ifndef THC_WINDOWS
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+#include "MappedFile.h"
+
+MappedFile::MappedFile()
+{
+    data = NULL;
+    size = 0;
+    file_handle = NULL;
+    mapping_handle = NULL;
+}
+
+MappedFile::~MappedFile()
+{
+    Close();
+}
+
+#ifdef THC_WINDOWS
+
+bool MappedFile::Open( const char *filename )
+{
+    Close();
+    HANDLE hfile = CreateFileA( filename, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL );
+    if( hfile == INVALID_HANDLE_VALUE )
+        return false;
+    LARGE_INTEGER len;
+    if( !GetFileSizeEx(hfile,&len) || len.QuadPart==0 || static_cast<unsigned long long>(len.QuadPart) > static_cast<size_t>(-1) )
+    {
+        CloseHandle(hfile);
+        return false;
+    }
+    HANDLE hmapping = CreateFileMappingA( hfile, NULL, PAGE_READONLY, 0, 0, NULL );
+    if( hmapping == NULL )
+    {
+        CloseHandle(hfile);
+        return false;
+    }
+    void *p = MapViewOfFile( hmapping, FILE_MAP_READ, 0, 0, 0 );
+    if( p == NULL )
+    {
+        CloseHandle(hmapping);
+        CloseHandle(hfile);
+        return false;
+    }
+    file_handle = hfile;
+    mapping_handle = hmapping;
+    data = static_cast<const char *>(p);
+    size = static_cast<size_t>(len.QuadPart);
+    this->filename = filename;
+    return true;
+}
+
+void MappedFile::Close()
+{
+    if( data )
+        UnmapViewOfFile( data );
+    if( mapping_handle )
+        CloseHandle( static_cast<HANDLE>(mapping_handle) );
+    if( file_handle )
+        CloseHandle( static_cast<HANDLE>(file_handle) );
+    data = NULL;
+    size = 0;
+    filename.clear();
+    file_handle = NULL;
+    mapping_handle = NULL;
+}
+
+#else
+
+bool MappedFile::Open( const char *filename )
+{
+    Close();
+    int fd = open( filename, O_RDONLY );
+    if( fd < 0 )
+        return false;
+    struct stat st;
+    if( fstat(fd,&st)!=0 || st.st_size==0 )
+    {
+        close(fd);
+        return false;
+    }
+    void *p = mmap( NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0 );
+    close(fd);  // the mapping remains valid after the file is closed
+    if( p == MAP_FAILED )
+        return false;
+    data = static_cast<const char *>(p);
+    size = st.st_size;
+    this->filename = filename;
+    return true;
+}
+
+void MappedFile::Close()
+{
+    if( data )
+        munmap( const_cast<char *>(data), size );
+    data = NULL;
+    size = 0;
+    filename.clear();
+}
+
+#endif
@@ -0,0 +1,35 @@
+/****************************************************************************
+ * Read only memory mapped file
+ *  Author:  Bill Forster
+ *  License: MIT license. Full text of license is in associated file LICENSE
+ *  Copyright 2010-2016, Bill Forster <billforsternz at gmail dot com>
+ ****************************************************************************/
+#ifndef MAPPED_FILE_H
+#define MAPPED_FILE_H
+#include <stddef.h>
+#include <string>
+
+class MappedFile
+{
+public:
+    MappedFile();
+    ~MappedFile();
+    bool Open( const char *filename );     // returns bool ok
+    void Close();
+    const char *Data() const { return data; }
+    size_t      Size() const { return size; }
+    const std::string &Filename() const { return filename; }
+
+private:
+    const char *data;
+    size_t      size;
+    std::string filename;
+    void       *file_handle;        // Windows only
+    void       *mapping_handle;     // Windows only
+
+    // Not copyable
+    MappedFile( const MappedFile & );
+    MappedFile & operator= ( const MappedFile & );
+};
+
+#endif  // MAPPED_FILE_H
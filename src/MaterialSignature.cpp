@@ -0,0 +1,89 @@
+/****************************************************************************
+ * Material signature - the material in a position packed into one integer,
+ *  and a compact per game summary of how a game's material changes
+ *  Author:  Bill Forster
+ *  License: MIT license. Full text of license is in associated file LICENSE
+ *  Copyright 2010-2016, Bill Forster <billforsternz at gmail dot com>
+ ****************************************************************************/
+#include <ctype.h>
+#include "CompressMoves.h"
+#include "MaterialSignature.h"
+
+// Piece is 'P','N','B','D','R','Q' or lower case, 'D'/'d' being a dark squared bishop (a 'B'/'b'
+//  is light or dark according to sq). Returns -1 for anything else (kings and empty squares)
+int MaterialSignaturePiece( char piece, int sq )
+{
+    int ret = -1;
+    switch( piece )
+    {
+        case 'P':   ret = MS_WP;    break;
+        case 'N':   ret = MS_WN;    break;
+        case 'B':   ret = is_dark(sq) ? MS_WDB : MS_WLB;    break;
+        case 'D':   ret = MS_WDB;   break;
+        case 'R':   ret = MS_WR;    break;
+        case 'Q':   ret = MS_WQ;    break;
+        case 'p':   ret = MS_BP;    break;
+        case 'n':   ret = MS_BN;    break;
+        case 'b':   ret = is_dark(sq) ? MS_BDB : MS_BLB;    break;
+        case 'd':   ret = MS_BDB;   break;
+        case 'r':   ret = MS_BR;    break;
+        case 'q':   ret = MS_BQ;    break;
+    }
+    return ret;
+}
+
+// Calculate the signature of a position
+uint64_t MaterialSignaturePosition( const char *squares )
+{
+    uint64_t signature = 0;
+    for( int sq=0; sq<64; sq++ )
+    {
+        int piece = MaterialSignaturePiece( squares[sq], sq );
+        if( piece>=0 && MaterialSignatureCount(signature,piece)<15 )
+            signature += (1ULL << (4*piece));
+    }
+    return signature;
+}
+
+// Append a game's summary, from its ('\0' terminated) compressed moves (standard start position
+//  only). Returns false (appending nothing) if the game is too long to summarise
+bool MaterialSummaryGame( const char *compressed_moves, std::vector<uint16_t> &summary )
+{
+    size_t base = summary.size();
+    CompressMoves press;
+    unsigned int ply = 0;
+    while( *compressed_moves )
+    {
+        bool white = press.cr.white;
+        thc::Move mv = press.UncompressMovePositionOnly( *compressed_moves++ );
+        ply++;
+        if( ply > MATERIAL_SUMMARY_MAX_PLY )
+        {
+            summary.resize( base );
+            return false;
+        }
+        if( isalpha(mv.capture) )
+        {
+            int piece = MaterialSignaturePiece( static_cast<char>(mv.capture), mv.dst );    // en passant captures a pawn, so dst is okay
+            if( piece >= 0 )
+                summary.push_back( static_cast<uint16_t>( (piece<<11) | ply ) );
+        }
+        char promoted = 0;
+        switch( mv.special )
+        {
+            default: break;
+            case thc::SPECIAL_PROMOTION_QUEEN:  promoted = 'Q';   break;
+            case thc::SPECIAL_PROMOTION_ROOK:   promoted = 'R';   break;
+            case thc::SPECIAL_PROMOTION_BISHOP: promoted = 'B';   break;
+            case thc::SPECIAL_PROMOTION_KNIGHT: promoted = 'N';   break;
+        }
+        if( promoted )
+        {
+            int pawn  = white ? MS_WP : MS_BP;
+            int piece = MaterialSignaturePiece( white ? promoted : static_cast<char>(tolower(promoted)), mv.dst );
+            summary.push_back( static_cast<uint16_t>( (pawn<<11) | ply ) );
+            summary.push_back( static_cast<uint16_t>( 0x8000 | (piece<<11) | ply ) );
+        }
+    }
+    return true;
+}
@@ -0,0 +1,54 @@
+/****************************************************************************
+ * Material signature - the material in a position packed into one integer,
+ *  and a compact per game summary of how a game's material changes
+ *  Author:  Bill Forster
+ *  License: MIT license. Full text of license is in associated file LICENSE
+ *  Copyright 2010-2016, Bill Forster <billforsternz at gmail dot com>
+ ****************************************************************************/
+#ifndef MATERIAL_SIGNATURE_H
+#define MATERIAL_SIGNATURE_H
+#include <stdint.h>
+#include <vector>
+#include "thc.h"
+
+// A signature has a 4 bit count for each type of piece (not kings). Bishops are split into
+//  light and dark squared bishops
+enum
+{
+    MS_WP, MS_WN, MS_WLB, MS_WDB, MS_WR, MS_WQ,
+    MS_BP, MS_BN, MS_BLB, MS_BDB, MS_BR, MS_BQ,
+    MS_NBR_PIECES
+};
+inline int MaterialSignatureCount( uint64_t signature, int piece )
+{
+    return static_cast<int>( (signature>>(4*piece)) & 0x0f );
+}
+
+// Piece is 'P','N','B','D','R','Q' or lower case, 'D'/'d' being a dark squared bishop (a 'B'/'b'
+//  is light or dark according to sq). Returns -1 for anything else (kings and empty squares)
+int MaterialSignaturePiece( char piece, int sq );
+
+// Calculate the signature of a position
+uint64_t MaterialSignaturePosition( const char *squares );
+
+// Material only decreases, apart from promotions, so a game's material can be summarised as a
+//  short list of changes from the standard starting position. Each change is a 16 bit value,
+//  a piece is removed from (or, for promotions, added to) the signature at a given ply (the
+//  position after that many half moves). A promotion is two changes at the same ply
+#define MATERIAL_SUMMARY_PLY(delta)     ((delta)&0x7ff)
+#define MATERIAL_SUMMARY_PIECE(delta)   (((delta)>>11)&0x0f)
+#define MATERIAL_SUMMARY_ADD(delta)     (((delta)&0x8000) != 0)
+#define MATERIAL_SUMMARY_MAX_PLY        0x7ff
+
+// Append a game's summary, from its ('\0' terminated) compressed moves (standard start position
+//  only). Returns false (appending nothing) if the game is too long to summarise
+bool MaterialSummaryGame( const char *compressed_moves, std::vector<uint16_t> &summary );
+
+// Apply one change to a signature
+inline uint64_t MaterialSummaryApply( uint64_t signature, uint16_t delta )
+{
+    uint64_t one = 1ULL << (4*MATERIAL_SUMMARY_PIECE(delta));
+    return MATERIAL_SUMMARY_ADD(delta) ? signature+one : signature-one;
+}
+
+#endif  // MATERIAL_SIGNATURE_H
@@ -8,10 +8,13 @@
 #include <vector>
 #include <stdlib.h>
 #include <wx/utils.h>
+#include <wx/thread.h>
 #include "AutoTimer.h"
 #include "ProgressBar.h"
 #include "MemoryPositionSearch.h"
-#include "CompressMoves.h"  //temp testing
+#include "BoardCompare.h"
+#include "MaterialSignature.h"
+#include "CompressMoves.h"
 
 // Note that much of this code duplicates the algorithms implemented
 // in class CompressMoves - This is because we want to play through games
@@ -107,8 +110,19 @@
 void MemoryPositionSearch::Init()
 {
     in_memory_game_cache.clear();
+    game_table.Clear();
+    search_table = NULL;
     search_position_set=false;
+    search_narrowed = false;
+    skip_games = NULL;
+    stream = NULL;
+    target_signature = 0;
+    pattern_ply_begin = 0;
+    pattern_ply_end   = 0xffff;
     search_source = &in_memory_game_cache;
+    SetPositionIndex( NULL, 0 );
+    SetPawnIndex( NULL, 0 );
+    ClearResultCache();
     thc::ChessPosition *cp = static_cast<thc::ChessPosition *>(&msi.cr);
     cp->Init();
     msi.cr.squares[ thc::c1 ] = 'D';     // Impose the distinct dark squared bishop = 'd'/'D' convention over the top
@@ -125,6 +139,13 @@ void MemoryPositionSearch::Init()
     msi.sides[0] = sides[0];
     msi.sides[1] = sides[0];
     memcpy( mqi_init.squares, START_POSITION, 64 );
+    BindRankPointers();
+}
+
+// The rank pointers point into this object's own boards, so they need to be
+//  set up again whenever the search state is copied into another object
+void MemoryPositionSearch::BindRankPointers()
+{
     mq.rank8_ptr = reinterpret_cast<uint64_t*>(&mqi.squares[ 0]);
     mq.rank7_ptr = reinterpret_cast<uint64_t*>(&mqi.squares[ 8]);
     mq.rank6_ptr = reinterpret_cast<uint64_t*>(&mqi.squares[16]);
@@ -260,6 +281,11 @@ bool MemoryPositionSearch::TryFastMode( MpsSide *side )
     return okay;
 }
 
+static bool predicate_sorts_by_idx( const DoSearchFoundGame &left, const DoSearchFoundGame &right )
+{
+    return left.idx < right.idx;
+}
+
 int  MemoryPositionSearch::DoSearch( const thc::ChessPosition &cp, ProgressBar *progress )
 {
     return DoSearch(cp,progress,&in_memory_game_cache);
@@ -270,8 +296,39 @@ int  MemoryPositionSearch::DoSearch( const thc::ChessPosition &cp, ProgressBar *
     games_found.clear();
     search_position = cp;
     search_position_set = true;
+    search_narrowed = false;
+    narrowed_skip.clear();
     search_source = source;
 
+    // Searches of the whole in memory database are cached, and can be answered from the position
+    //  index, if there is one
+    uint64_t key = 0;
+    if( source == &in_memory_game_cache )
+    {
+        key = CacheKey( cp );
+        if( CacheLookup( cp, key ) )
+            return games_found.size();
+        if( DoSearchIndexed(cp) )
+        {
+            CacheInsert( cp, key, games_found );
+            return games_found.size();
+        }
+    }
+
+    SearchTargetInit( cp );
+    SearchSource( source, progress );
+    if( stream && stream->kill )
+        search_position_set = false;    // incomplete
+    else if( source == &in_memory_game_cache )
+        CacheInsert( cp, key, games_found );
+    return games_found.size();
+}
+
+// Set up the target position for DoSearch() and friends
+void MemoryPositionSearch::SearchTargetInit( const thc::ChessPosition &cp )
+{
+    target_signature = PieceSquareSignatureTarget( cp );
+
     // Set up counts of total pieces, and individual pieces in the target position
     ms.total_count_target = 64;     // reverse count non-pieces from 64
     ms.black_count_target = 0;
@@ -440,54 +497,916 @@ int  MemoryPositionSearch::DoSearch( const thc::ChessPosition &cp, ProgressBar *
     mq.rank8_target = *mq.rank8_target_ptr;
     mq.rank1_target = *mq.rank1_target_ptr;
     mq.rank2_target = *mq.rank2_target_ptr;
+}
+
+// Search the source games for the target position, appending the games found to games_found
+void MemoryPositionSearch::SearchSource( std::vector< smart_ptr<ListableGame> > *source, ProgressBar *progress )
+{
     int nbr = source->size();
     {
         AutoTimer at("Search time");
 
-        // Leave only one defined
-        //#define CONSERVATIVE
-        //#define NO_PROMOTIONS_FLAWED
-        #define CORRECT_BEST_PRACTICE
-        for( int i=0; i<nbr; i++ )
+        // Scan the game table rather than the games themselves if possible, it's much more cache friendly
+        search_table = NULL;
+        if( source==&in_memory_game_cache && game_table.IsValid(nbr) )
+            search_table = &game_table;
+
+        // Games loaded from a .pgn file are read into memory on demand, which isn't thread safe,
+        //  so only searches of the in memory (tiny) database are split across threads
+        int nbr_threads = wxThread::GetCPUCount();
+        if( nbr_threads > MPS_MAX_THREADS )
+            nbr_threads = MPS_MAX_THREADS;
+        if( source!=&in_memory_game_cache || nbr_threads<2 || nbr<MPS_MIN_GAMES_PER_THREAD*2 )
+            SearchSlice( source, 0, nbr, games_found, progress, NULL );
+        else
+            DoSearchParallel( source, nbr_threads, progress );
+
+        // Same order as searching the games themselves
+        if( search_table && !search_table->InGamesOrder() )
+            std::sort( games_found.begin(), games_found.end(), predicate_sorts_by_idx );
+        search_table = NULL;
+    }
+}
+
+// Narrowing search. If the previous search was a complete search of the in memory database,
+//  then as the user walks forward through an opening, most of the games with the new position
+//  are games with the previous position. Search only those games for now, giving immediate (but
+//  possibly incomplete) results. CompleteNarrowedSearch() later finds the transpositions from
+//  the rest of the games
+int MemoryPositionSearch::DoSearchNarrowed( const thc::ChessPosition &cp, ProgressBar *progress )
+{
+    if( !IsNarrowingPossible() )
+        return DoSearch( cp, progress );
+    std::vector<DoSearchFoundGame> previous;
+    previous.swap( games_found );
+    search_position = cp;
+    search_position_set = true;
+    search_narrowed = false;
+    narrowed_skip.clear();
+    search_source = &in_memory_game_cache;
+    uint64_t key = CacheKey( cp );
+    if( CacheLookup( cp, key ) )
+        return games_found.size();
+    AutoTimer at("Narrowed search time");
+    SearchTargetInit( cp );
+    int nbr = in_memory_game_cache.size();
+    narrowed_skip.assign( nbr, false );
+    int nbr_previous = previous.size();
+    for( int i=0; i<nbr_previous; i++ )
+    {
+        DoSearchFoundGame dsfg = previous[i];
+        if( dsfg.idx<0 || dsfg.idx>=nbr )
+            continue;
+        narrowed_skip[dsfg.idx] = true;
+        ListableGame *p = in_memory_game_cache[dsfg.idx].get();
+        if( (p->piece_square_signature & target_signature) != target_signature )
+            continue;
+        const char *moves = p->CompressedMoves();
+        bool game_found;
+        if( p->TestPromotion() )
+            game_found = SearchGameOptimisedPromotionAllowed( moves, dsfg.offset_first, dsfg.offset_last );
+        else
+            game_found = SearchGameOptimised( moves, dsfg.offset_first, dsfg.offset_last );
+        if( game_found )
+            games_found.push_back( dsfg );
+        if( progress && (i&0xff)==0 )
+            progress->Perfraction( i, nbr_previous );
+    }
+    search_narrowed = true;
+    return games_found.size();
+}
+
+// Search the games skipped by DoSearchNarrowed(), for transpositions to the target position. If
+//  streaming, only the additional games are handed over. If the stream stops the search early
+//  the results stay narrowed (incomplete), they can't be completed or cached, but the next
+//  search can still be narrowed from them
+int MemoryPositionSearch::CompleteNarrowedSearch( ProgressBar *progress )
+{
+    if( !search_narrowed || narrowed_skip.empty() )
+        return games_found.size();
+    SearchTargetInit( search_position );    // a pattern search might have been done since
+    skip_games = &narrowed_skip;
+    SearchSource( &in_memory_game_cache, progress );
+    skip_games = NULL;
+    narrowed_skip.clear();
+    std::sort( games_found.begin(), games_found.end(), predicate_sorts_by_idx );
+    if( !(stream && stream->kill) )
+    {
+        search_narrowed = false;
+        CacheInsert( search_position, CacheKey(search_position), games_found );
+    }
+    return games_found.size();
+}
+
+void MemoryPositionSearch::ClearResultCache()
+{
+    search_position_set = false;    // the last search results are stale too
+    search_narrowed = false;
+    narrowed_skip.clear();
+    cache_lru.clear();
+    cache_map.clear();
+    cache_bytes = 0;
+}
+
+// Position hash, adjusted so the same position with the other side to move is a different key
+uint64_t MemoryPositionSearch::CacheKey( const thc::ChessPosition &cp )
+{
+    thc::ChessPosition temp = cp;
+    uint64_t key = temp.Hash64Calculate();
+    if( !cp.white )
+        key ^= 0x9e3779b97f4a7c15ULL;
+    return key;
+}
+
+// If the results for this position are cached, copy them to games_found and make them the most
+//  recently used
+bool MemoryPositionSearch::CacheLookup( const thc::ChessPosition &cp, uint64_t key )
+{
+    std::map< uint64_t, std::list<MpsCacheEntry>::iterator >::iterator it = cache_map.find(key);
+    if( it==cache_map.end() || !(it->second->cp==cp) ||
+        it->second->nbr_games!=static_cast<int>(in_memory_game_cache.size()) )
+    {
+        cache_misses++;
+        return false;
+    }
+    cache_hits++;
+    cache_lru.splice( cache_lru.begin(), cache_lru, it->second );
+    games_found = cache_lru.front().games_found;
+    cprintf( "Search result cache hit: %u hits, %u misses, %u results cached, %u bytes\n",
+                cache_hits, cache_misses, (unsigned int)cache_lru.size(), (unsigned int)cache_bytes );
+    return true;
+}
+
+static size_t cache_entry_bytes( size_t nbr_found )
+{
+    const size_t node_overhead = 64;   // approximately, for the std::map and std::list nodes
+    return sizeof(MpsCacheEntry) + node_overhead + nbr_found*sizeof(DoSearchFoundGame);
+}
+
+// Add the games found to the cache as the most recently used results, discarding the least
+//  recently used results if necessary to stay within the memory budget
+void MemoryPositionSearch::CacheInsert( const thc::ChessPosition &cp, uint64_t key, const std::vector<DoSearchFoundGame> &found )
+{
+    std::map< uint64_t, std::list<MpsCacheEntry>::iterator >::iterator it = cache_map.find(key);
+    if( it != cache_map.end() )     // stale or colliding entry
+    {
+        cache_bytes -= cache_entry_bytes( it->second->games_found.size() );
+        cache_lru.erase( it->second );
+        cache_map.erase( it );
+    }
+    size_t bytes = cache_entry_bytes( found.size() );
+    if( bytes > MPS_CACHE_MAX_BYTES/4 )
+        return;     // don't let one huge result (eg the initial position) flush everything else
+    while( !cache_lru.empty() && cache_bytes+bytes > MPS_CACHE_MAX_BYTES )
+    {
+        MpsCacheEntry &oldest = cache_lru.back();
+        cache_bytes -= cache_entry_bytes( oldest.games_found.size() );
+        cache_map.erase( oldest.key );
+        cache_lru.pop_back();
+    }
+    cache_lru.push_front( MpsCacheEntry() );
+    MpsCacheEntry &entry = cache_lru.front();
+    entry.key = key;
+    entry.cp = cp;
+    entry.nbr_games = in_memory_game_cache.size();
+    entry.games_found = found;
+    cache_map[key] = cache_lru.begin();
+    cache_bytes += bytes;
+}
+
+// The indexes identify games by position in the .tdb file, but the in memory database might
+//  have been sorted since it was loaded, so maintain a map from game_nbr to idx and rebuild it
+//  if it turns out to be out of date. Returns -1 if the game isn't there
+int MemoryPositionSearch::IdxFromGameNbr( uint32_t game_nbr, uint32_t top_game_id )
+{
+    int nbr = in_memory_game_cache.size();
+    uint32_t game_id = top_game_id - game_nbr;
+    if( game_nbr >= static_cast<uint32_t>(nbr) )
+        return -1;
+    int idx = game_nbr<idx_by_game_nbr.size() ? idx_by_game_nbr[game_nbr] : -1;
+    if( idx<0 || idx>=nbr || in_memory_game_cache[idx]->game_id!=game_id )
+    {
+        idx_by_game_nbr.assign( nbr, -1 );
+        for( int j=0; j<nbr; j++ )
+        {
+            uint32_t k = top_game_id - in_memory_game_cache[j]->game_id;
+            if( k < static_cast<uint32_t>(nbr) )
+                idx_by_game_nbr[k] = j;
+        }
+        idx = idx_by_game_nbr[game_nbr];
+    }
+    return idx;
+}
+
+// Use the position index instead of playing through the games, return false if it's not possible
+bool MemoryPositionSearch::DoSearchIndexed( const thc::ChessPosition &cp )
+{
+    if( !position_index || !position_index->IsLoaded() )
+        return false;
+    AutoTimer at("Indexed search time");
+    thc::ChessPosition temp = cp;
+    std::vector<PositionIndexPosting> postings;
+    if( !position_index->Lookup( temp.Hash64Calculate(), cp.white, postings ) )
+        return false;
+
+    // The index only has hashes, so check each posting by playing through the game to the
+    //  indexed ply. The postings for each game are in ply order, keep the first that checks out
+    bool game_found = false;
+    for( unsigned int i=0; i<postings.size(); i++ )
+    {
+        uint32_t game_nbr = postings[i].game_nbr;
+        if( i>0 && game_nbr!=postings[i-1].game_nbr )
+            game_found = false;
+        if( game_found )
+            continue;
+        int idx = IdxFromGameNbr( game_nbr, position_index_top_game_id );
+        if( idx < 0 )
+        {
+            games_found.clear();
+            return false;
+        }
+        unsigned short ply = postings[i].ply;
+        const char *blob = in_memory_game_cache[idx]->CompressedMoves();
+        CompressMoves press;
+        int j;
+        for( j=0; j<ply && blob[j]; j++ )
+            press.UncompressMovePositionOnly( blob[j] );
+        if( j<ply || 0!=memcmp(press.cr.squares,cp.squares,64) )
+            continue;   // a hash collision, not the position
+        game_found = true;
+        DoSearchFoundGame dsfg;
+        dsfg.idx = idx;
+        dsfg.game_id = position_index_top_game_id - game_nbr;
+        dsfg.offset_first = ply;
+        dsfg.offset_last  = ply;
+        games_found.push_back( dsfg );
+    }
+
+    // Same order as playing through the games
+    std::sort( games_found.begin(), games_found.end(), predicate_sorts_by_idx );
+    return true;
+}
+
+// A worker thread searches a contiguous slice of the source games, using its
+//  own copy of the search state
+class MpsWorkerThread : public wxThread
+{
+public:
+    MpsWorkerThread() : wxThread(wxTHREAD_JOINABLE), pm(NULL), table(NULL) {}
+    MemoryPositionSearch mps;
+    std::vector< smart_ptr<ListableGame> > *source;
+    int begin;
+    int end;
+    std::vector<DoSearchFoundGame> found;
+    std::atomic<int> nbr_done;
+    bool started;
+    MpsStream slice_stream;     // if streaming, the slice streams to the master through this
+
+    // For pattern searches only
+    const PatternMatch *pm;
+    const GameTable *table;
+    PATTERN_STATS stats;
+
+    // thread execution starts here
+    virtual void *Entry()
+    {
+        if( pm )
+        {
+            mps.PatternSearchSlice( *pm, stats, source, table, begin, end, NULL, &nbr_done );
+            found.swap( mps.GetVectorGamesFound() );
+        }
+        else
+            mps.SearchSlice( source, begin, end, found, NULL, &nbr_done );
+        return NULL;
+    }
+};
+
+// When streaming, each slice of a parallel search streams into its own MpsStream. Forward
+//  what they've found to the master stream in slice order, so that the games arrive in
+//  the same order as in the final (merged) games_found. Slice next is the first that
+//  hasn't yet been completely forwarded
+static void StreamSlices( MpsStream *stream, std::vector<MpsWorkerThread *> &threads, unsigned int &next )
+{
+    std::vector<DoSearchFoundGame> batch;
+    while( next < threads.size() )
+    {
+        MpsWorkerThread *thread = threads[next];
+        bool slice_done = (thread->nbr_done == thread->end-thread->begin);  // check before Pop(), the slice's last Push() precedes this
+        thread->slice_stream.Pop( batch );
+        if( !slice_done )
+            break;
+        next++;
+    }
+    if( batch.size() > 0 )
+        stream->Push( &batch[0], batch.size() );
+    if( stream->kill )
+    {
+        for( unsigned int t=0; t<threads.size(); t++ )
+            threads[t]->slice_stream.kill = true;
+    }
+}
+
+// Copy the primed search state (but not the game cache) from another object
+void MemoryPositionSearch::CloneSearchState( const MemoryPositionSearch &master )
+{
+    search_position = master.search_position;
+    search_position_set = master.search_position_set;
+    search_source = master.search_source;
+    skip_games = master.skip_games;
+    stream = master.stream;
+    target_signature = master.target_signature;
+    search_table = master.search_table;
+    ms = master.ms;
+    msi = master.msi;
+    mq = master.mq;
+    mqi_init = master.mqi_init;
+    mqi = master.mqi;
+    white_home_mask  = master.white_home_mask;
+    white_home_pawns = master.white_home_pawns;
+    black_home_mask  = master.black_home_mask;
+    black_home_pawns = master.black_home_pawns;
+    BindRankPointers();
+}
+
+// Split the source games into one slice per thread, then merge the results in slice
+//  order so that games_found is exactly what a single threaded search would produce
+void MemoryPositionSearch::DoSearchParallel( std::vector< smart_ptr<ListableGame> > *source, int nbr_threads, ProgressBar *progress )
+{
+    int nbr = source->size();
+    std::vector<MpsWorkerThread *> threads;
+    int begin = 0;
+    for( int t=0; t<nbr_threads; t++ )
+    {
+        int end = (t==nbr_threads-1) ? nbr : begin + nbr/nbr_threads;
+        MpsWorkerThread *thread = new MpsWorkerThread;
+        thread->mps.CloneSearchState( *this );
+        if( stream )
+            thread->mps.SetStream( &thread->slice_stream );
+        thread->source = source;
+        thread->begin = begin;
+        thread->end = end;
+        thread->nbr_done = 0;
+        thread->started = false;
+        if( thread->Create() != wxTHREAD_NO_ERROR )
+        {
+            // Search this slice on the current thread instead
+            cprintf( "DoSearchParallel(), cannot create thread %d\n", t );
+            thread->mps.SearchSlice( source, begin, end, thread->found, NULL, &thread->nbr_done );
+        }
+        else if( thread->Run() != wxTHREAD_NO_ERROR )
+        {
+            cprintf( "DoSearchParallel(), cannot run thread %d\n", t );
+            thread->mps.SearchSlice( source, begin, end, thread->found, NULL, &thread->nbr_done );
+        }
+        else
+            thread->started = true;
+        threads.push_back( thread );
+        begin = end;
+    }
+
+    // Only the main thread touches the progress bar, poll the workers for combined progress
+    unsigned int next_to_stream = 0;
+    for(;;)
+    {
+        int total_done = 0;
+        for( unsigned int t=0; t<threads.size(); t++ )
+            total_done += threads[t]->nbr_done;
+        if( total_done >= nbr )
+            break;
+        if( progress )
+            progress->Perfraction( total_done, nbr );
+        if( stream )
+        {
+            StreamSlices( stream, threads, next_to_stream );
+            stream->permill = static_cast<int>( (static_cast<double>(total_done) * 1000.0) / static_cast<double>(nbr) );
+        }
+        wxMilliSleep(10);
+    }
+    if( stream )
+        StreamSlices( stream, threads, next_to_stream );
+    for( unsigned int t=0; t<threads.size(); t++ )
+    {
+        MpsWorkerThread *thread = threads[t];
+        if( thread->started )
+            thread->Wait();     // joinable threads must be waited for, even if already finished
+        games_found.insert( games_found.end(), thread->found.begin(), thread->found.end() );
+        delete thread;
+    }
+}
+
+// Search games [begin,end) of source, appending found games to found. Report progress
+//  either directly to a progress bar, or (on a worker thread) through a counter
+void MemoryPositionSearch::SearchSlice( std::vector< smart_ptr<ListableGame> > *source, int begin, int end,
+                                        std::vector<DoSearchFoundGame> &found, ProgressBar *progress, std::atomic<int> *nbr_done )
+{
+    int nbr = source->size();
+    size_t nbr_streamed = found.size();
+
+    // Leave only one defined
+    //#define CONSERVATIVE
+    //#define NO_PROMOTIONS_FLAWED
+    #define CORRECT_BEST_PRACTICE
+    for( int i=begin; i<end; i++ )
+    {
+        DoSearchFoundGame dsfg;
+        bool promotion_in_game;
+        const char *moves;
+
+        // If there's a game table, i is a row in the table rather than an idx in source
+        if( search_table )
         {
-            smart_ptr<ListableGame> p = (*source)[i];
+            if( search_table->TestPartial(i) )
+                continue;
+            if( (search_table->Signature(i) & target_signature) != target_signature )
+                continue;
+            dsfg.idx = search_table->GamesIdx(i);
+            dsfg.game_id = search_table->GameId(i);
+            promotion_in_game = search_table->TestPromotion(i);
+            moves = search_table->CompressedMoves(i);
+        }
+        else
+        {
+            ListableGame *p = (*source)[i].get();
             const char *fen = p->Fen();
             if( fen && *fen )
                 continue;   // a partial game in the clipboard
-            DoSearchFoundGame dsfg;
+            if( (p->piece_square_signature & target_signature) != target_signature )
+                continue;   // a piece/square combo in the target is never visited in this game
             dsfg.idx = i;
             dsfg.game_id = p->game_id;
-            dsfg.offset_first=0;
-            dsfg.offset_last=0;
-            /* Roster r = in_memory_game_cache[i]->RefRoster();
-            cprintf( "idx=%d, white=%s[%s], black=%s[%s], blob=%s\n",
-                        in_memory_game_cache[i]->game_id,
-                        in_memory_game_cache[i]->White(),  r.white.c_str(),
-                        in_memory_game_cache[i]->Black(),  r.black.c_str(),
-                        in_memory_game_cache[i]->CompressedMoves() ); */
-            bool promotion_in_game = p->TestPromotion();
-            bool game_found;
-            #ifdef CONSERVATIVE
-            game_found = SearchGameSlowPromotionAllowed( std::string(p->CompressedMoves()), dsfg.offset_first, dsfg.offset_last  );
-            #endif
-            #ifdef NO_PROMOTIONS_FLAWED
-            game_found = SearchGameOptimisedNoPromotionAllowed( std::string(p->CompressedMoves()), dsfg.offset_first, dsfg.offset_last  );
-            #endif
-            #ifdef CORRECT_BEST_PRACTICE
-            if( promotion_in_game )
-                game_found = SearchGameSlowPromotionAllowed( std::string(p->CompressedMoves()), dsfg.offset_first, dsfg.offset_last  );
+            promotion_in_game = p->TestPromotion();
+            moves = p->CompressedMoves();
+        }
+        if( skip_games && (*skip_games)[dsfg.idx] )
+            continue;   // already searched, see CompleteNarrowedSearch()
+        dsfg.offset_first=0;
+        dsfg.offset_last=0;
+        /* Roster r = in_memory_game_cache[i]->RefRoster();
+        cprintf( "idx=%d, white=%s[%s], black=%s[%s], blob=%s\n",
+                    in_memory_game_cache[i]->game_id,
+                    in_memory_game_cache[i]->White(),  r.white.c_str(),
+                    in_memory_game_cache[i]->Black(),  r.black.c_str(),
+                    in_memory_game_cache[i]->CompressedMoves() ); */
+        bool game_found;
+        #ifdef CONSERVATIVE
+        game_found = SearchGameSlowPromotionAllowed( moves, dsfg.offset_first, dsfg.offset_last  );
+        #endif
+        #ifdef NO_PROMOTIONS_FLAWED
+        game_found = SearchGameOptimised( moves, dsfg.offset_first, dsfg.offset_last  );
+        #endif
+        #ifdef CORRECT_BEST_PRACTICE
+        if( promotion_in_game )
+            game_found = SearchGameOptimisedPromotionAllowed( moves, dsfg.offset_first, dsfg.offset_last );
+        else
+            game_found = SearchGameOptimised( moves, dsfg.offset_first, dsfg.offset_last );
+        #endif
+        if( game_found )
+        {
+            found.push_back( dsfg );
+        }
+        if( (i&0xff)==0 )
+        {
+            if( progress )
+                progress->Perfraction( i, nbr );
+            if( nbr_done )
+                *nbr_done = i-begin;
+            if( stream && StreamUpdate( found, nbr_streamed, i, nbr, !nbr_done ) )
+                break;
+        }
+    }
+    if( stream )
+        StreamUpdate( found, nbr_streamed, end, nbr, !nbr_done );
+    if( nbr_done )
+        *nbr_done = end-begin;
+}
+
+// Hand over newly found games to the stream, and (unless this is one slice of a parallel search)
+//  report progress. Returns true if the search should stop
+bool MemoryPositionSearch::StreamUpdate( std::vector<DoSearchFoundGame> &found, size_t &nbr_streamed, int done, int total, bool report_progress )
+{
+    if( found.size() > nbr_streamed )
+    {
+        stream->Push( &found[nbr_streamed], found.size()-nbr_streamed );
+        nbr_streamed = found.size();
+    }
+    if( report_progress && total>0 )
+        stream->permill = static_cast<int>( (static_cast<double>(done) * 1000.0) / static_cast<double>(total) );
+    return stream->kill;
+}
+
+// Hash a board for the multi target search hash table
+static inline unsigned int MultiHash( const char *squares, bool white )
+{
+    const uint64_t *p = reinterpret_cast<const uint64_t *>(squares);
+    uint64_t h = white ? 0x9e3779b97f4a7c15ULL : 0;
+    for( int i=0; i<8; i++ )
+    {
+        h ^= p[i];
+        h *= 0xff51afd7ed558ccdULL;
+    }
+    return static_cast<unsigned int>( h ^ (h>>32) );
+}
+
+int MemoryPositionSearch::DoSearchMulti( const std::vector<thc::ChessPosition> &targets, std::vector< std::vector<DoSearchFoundGame> > &found, ProgressBar *progress )
+{
+    return DoSearchMulti(targets,found,progress,&in_memory_game_cache);
+}
+
+int MemoryPositionSearch::DoSearchMulti( const std::vector<thc::ChessPosition> &targets, std::vector< std::vector<DoSearchFoundGame> > &found, ProgressBar *progress,
+                                         std::vector< smart_ptr<ListableGame> > *source )
+{
+    int nbr_targets = targets.size();
+    found.clear();
+    found.resize( nbr_targets );
+    if( nbr_targets == 0 )
+        return 0;
+
+    // Set up the targets, with the same conventions as the single target search
+    multi_targets.resize( nbr_targets );
+    unsigned int table_size = 16;
+    while( table_size < 4*static_cast<unsigned int>(nbr_targets) )
+        table_size *= 2;
+    multi_hash_mask = table_size-1;
+    multi_hash_table.assign( table_size, -1 );
+    uint64_t common_signature = ~static_cast<uint64_t>(0);    // piece/square combos in every target
+    for( int t=0; t<nbr_targets; t++ )
+    {
+        const thc::ChessPosition &cp = targets[t];
+        MpsMultiTarget &mt = multi_targets[t];
+        mt.white = cp.white;
+        mt.nbr_pieces = 0;
+        mt.white_home_pawns = 0;
+        mt.black_home_pawns = 0;
+        mt.signature = PieceSquareSignatureTarget( cp );
+        common_signature &= mt.signature;
+        mt.duplicate_of = -1;
+        for( int i=0; i<64; i++ )
+        {
+            char piece = cp.squares[i];
+            switch( piece )
+            {
+                case 'P': if( 48<=i && i<56 ) mt.white_home_pawns |= (1<<(i-48));
+                          mt.nbr_pieces++;                          break;
+                case 'p': if( 8<=i && i<16 )  mt.black_home_pawns |= (1<<(i-8));
+                          mt.nbr_pieces++;                          break;
+                case 'B': if( is_dark(i) ) piece = 'D';
+                          mt.nbr_pieces++;                          break;
+                case 'b': if( is_dark(i) ) piece = 'd';
+                          mt.nbr_pieces++;                          break;
+                case 'R': case 'N': case 'Q':
+                case 'r': case 'n': case 'q':
+                          mt.nbr_pieces++;                          break;
+                case 'K': case 'k':                                 break;
+                default:  piece = ' ';                              break;
+            }
+            mt.squares[i] = piece;
+        }
+
+        // Only the first of a set of identical targets goes in the hash table
+        unsigned int k = MultiHash(mt.squares,mt.white) & multi_hash_mask;
+        while( multi_hash_table[k] >= 0 )
+        {
+            MpsMultiTarget &other = multi_targets[multi_hash_table[k]];
+            if( other.white==mt.white && BoardEqual(other.squares,mt.squares) )
+            {
+                mt.duplicate_of = multi_hash_table[k];
+                break;
+            }
+            k = (k+1) & multi_hash_mask;
+        }
+        if( mt.duplicate_of < 0 )
+            multi_hash_table[k] = t;
+    }
+
+    int nbr = source->size();
+    {
+        AutoTimer at("Multi search time");
+
+        // Scan the game table rather than the games themselves if possible, as DoSearch() does
+        search_table = NULL;
+        if( source==&in_memory_game_cache && game_table.IsValid(nbr) )
+            search_table = &game_table;
+        for( int i=0; i<nbr; i++ )
+        {
+            if( (i&0xff) == 0 )
+            {
+                if( progress )
+                    progress->Perfraction( i, nbr );
+                if( stream )
+                {
+                    stream->permill = static_cast<int>( (static_cast<double>(i) * 1000.0) / static_cast<double>(nbr) );
+                    if( stream->kill )
+                        break;
+                }
+            }
+            DoSearchFoundGame dsfg;
+            uint64_t signature;
+            const char *moves;
+            if( search_table )
+            {
+                if( search_table->TestPartial(i) )
+                    continue;
+                signature = search_table->Signature(i);
+                dsfg.idx = search_table->GamesIdx(i);
+                dsfg.game_id = search_table->GameId(i);
+                moves = search_table->CompressedMoves(i);
+            }
             else
-                game_found = SearchGameOptimisedNoPromotionAllowed( p->CompressedMoves(), dsfg.offset_first, dsfg.offset_last );
-            #endif
-            if( game_found )
             {
-                games_found.push_back( dsfg );
+                ListableGame *p = (*source)[i].get();
+                const char *fen = p->Fen();
+                if( fen && *fen )
+                    continue;   // a partial game in the clipboard
+                signature = p->piece_square_signature;
+                dsfg.idx = i;
+                dsfg.game_id = p->game_id;
+                moves = p->CompressedMoves();
             }
-            if( (i&0xff)==0 && progress )
-                progress->Perfraction( i, nbr );
+
+            // Only look for targets whose piece/square combos are all visited in this game
+            if( (signature & common_signature) != common_signature )
+                continue;
+            multi_done.assign( nbr_targets, true );
+            bool any = false;
+            for( int t=0; t<nbr_targets; t++ )
+            {
+                const MpsMultiTarget &mt = multi_targets[t];
+                if( mt.duplicate_of<0 && (signature & mt.signature) == mt.signature )
+                {
+                    multi_done[t] = false;
+                    any = true;
+                }
+            }
+            if( any )
+                SearchGameMulti( moves, dsfg, found );
+        }
+
+        // Same order as searching the games themselves
+        if( search_table && !search_table->InGamesOrder() )
+        {
+            for( int t=0; t<nbr_targets; t++ )
+                std::sort( found[t].begin(), found[t].end(), predicate_sorts_by_idx );
         }
+        search_table = NULL;
     }
-    return games_found.size();
+    bool complete = !(stream && stream->kill);
+    int total = 0;
+    for( int t=0; t<nbr_targets; t++ )
+    {
+        if( multi_targets[t].duplicate_of >= 0 )
+            found[t] = found[multi_targets[t].duplicate_of];
+        else if( complete && source==&in_memory_game_cache )
+            CacheInsert( targets[t], CacheKey(targets[t]), found[t] );
+        total += found[t].size();
+    }
+    return total;
+}
+
+// Return index of the target matching the board, or -1
+int MemoryPositionSearch::MultiLookup( const char *squares, bool white )
+{
+    unsigned int k = MultiHash(squares,white) & multi_hash_mask;
+    int t;
+    while( (t=multi_hash_table[k]) >= 0 )
+    {
+        const MpsMultiTarget &mt = multi_targets[t];
+        if( mt.white==white && BoardEqual(mt.squares,squares) )
+            return t;
+        k = (k+1) & multi_hash_mask;
+    }
+    return -1;
+}
+
+// Mark targets that can no longer be reached in this game as done (pieces are never added to the
+//  board and home row pawns never come back), return the number still to look for
+int MemoryPositionSearch::MultiReachable( int nbr_pieces, unsigned int white_home_pawns, unsigned int black_home_pawns )
+{
+    int nbr_targets = multi_targets.size();
+    int nbr_alive = 0;
+    for( int t=0; t<nbr_targets; t++ )
+    {
+        if( multi_done[t] )
+            continue;
+        const MpsMultiTarget &mt = multi_targets[t];
+        if( mt.nbr_pieces > nbr_pieces ||
+            (mt.white_home_pawns & ~white_home_pawns) != 0 ||
+            (mt.black_home_pawns & ~black_home_pawns) != 0 )
+            multi_done[t] = true;
+        else
+            nbr_alive++;
+    }
+    return nbr_alive;
+}
+
+// Play through one game (any game, including games with promotions), recording the first
+//  occurrence of each target that isn't already marked done
+void MemoryPositionSearch::SearchGameMulti( const char *moves_in, DoSearchFoundGame &dsfg, std::vector< std::vector<DoSearchFoundGame> > &found )
+{
+    int nbr_pieces = 30;    // 32 - 2 kings
+    unsigned int white_home_pawns = 0xff;
+    unsigned int black_home_pawns = 0xff;
+    int nbr_alive = MultiReachable( nbr_pieces, white_home_pawns, black_home_pawns );
+    SlowGameInit();
+    for( int i=0; nbr_alive>0; i++ )
+    {
+        int t = MultiLookup( msi.cr.squares, msi.cr.white );
+        if( t>=0 && !multi_done[t] )
+        {
+            multi_done[t] = true;
+            nbr_alive--;
+            dsfg.offset_first = dsfg.offset_last = i;
+            found[t].push_back( dsfg );
+        }
+        char code = moves_in[i];
+        if( code == '\0' || nbr_alive == 0 )
+            break;
+        MpsSide *side  = msi.cr.white ? &msi.sides[0] : &msi.sides[1];
+        MpsSide *other = msi.cr.white ? &msi.sides[1] : &msi.sides[0];
+        thc::Move mv;
+        if( side->fast_mode )
+        {
+            mv = UncompressFastMode(code,side,other);
+        }
+        else if( TryFastMode(side) )
+        {
+            mv = UncompressFastMode(code,side,other);
+        }
+        else
+        {
+            mv = UncompressSlowMode(code);
+            other->fast_mode = false;   // force other side to reset and retry
+        }
+        char mover = msi.cr.squares[mv.src];
+        msi.cr.PlayMove(mv);
+        if( mv.special == thc::SPECIAL_PROMOTION_BISHOP ) // Impose the distinct dark squared bishop = 'd'/'D' convention over the top
+        {
+            if( is_dark(mv.dst) )
+            {
+                char c = msi.cr.squares[mv.dst];
+                if( c == 'B' )
+                    c = 'D';
+                else if( c == 'b' )
+                    c = 'd';
+                msi.cr.squares[mv.dst] = c;
+            }
+        }
+        bool capture = isalpha(mv.capture) != 0;
+        if( capture || mover=='P' || mover=='p' )
+        {
+            if( capture )
+                nbr_pieces--;
+            unsigned int w = 0, b = 0;
+            for( int j=0; j<8; j++ )
+            {
+                if( msi.cr.squares[48+j] == 'P' )
+                    w |= (1<<j);
+                if( msi.cr.squares[8+j] == 'p' )
+                    b |= (1<<j);
+            }
+            white_home_pawns &= w;
+            black_home_pawns &= b;
+            nbr_alive = MultiReachable( nbr_pieces, white_home_pawns, black_home_pawns );
+        }
+    }
+}
+
+// Play through one game looking for the pattern, add it to games_found (and stats) if it's there
+void MemoryPositionSearch::PatternSearchGame( const PatternMatch &pm, PATTERN_STATS &stats, std::vector< smart_ptr<ListableGame> > *source,
+                                              DoSearchFoundGame &dsfg, const char *moves )
+{
+    dsfg.offset_first=0;
+    dsfg.offset_last=0;
+    bool reverse;
+    bool game_found = PatternSearchGameOptimised( pm, reverse, moves, dsfg.offset_first, dsfg.offset_last );
+    if( game_found )
+    {
+        const char *result = (*source)[dsfg.idx]->Result();
+        stats.nbr_games++;
+        if( reverse )
+        {
+            stats.nbr_reversed_games++;
+            if( 0 == strcmp(result,"1-0") )
+                stats.black_wins++;
+            else if( 0 == strcmp(result,"0-1") )
+                stats.white_wins++;
+            else
+                stats.draws++;
+        }
+        else
+        {
+            if( 0 == strcmp(result,"1-0") )
+                stats.white_wins++;
+            else if( 0 == strcmp(result,"0-1") )
+                stats.black_wins++;
+            else
+                stats.draws++;
+        }
+        games_found.push_back( dsfg );
+    }
+}
+
+// Find the games (and the plies within them) with the pawn structure a pattern requires, using
+//  the pawn index. Returns false if there's no pawn index, or the pattern doesn't fix a pawn structure
+bool MemoryPositionSearch::PawnIndexCandidates( const PatternMatch &pm, std::vector<DoSearchFoundGame> &candidates )
+{
+    candidates.clear();
+    std::vector<uint64_t> hashes;
+    if( !pawn_index || !pawn_index->IsLoaded() || !pm.PawnStructureQuery(hashes) )
+        return false;
+
+    // One candidate per game, if several targets (reflections, reversed colours) match a game
+    //  test the plies spanning all of them
+    std::vector<PawnIndexPosting> postings;
+    std::map<int,size_t> candidate_by_idx;
+    for( size_t i=0; i<hashes.size(); i++ )
+    {
+        pawn_index->Lookup( hashes[i], postings );
+        for( size_t j=0; j<postings.size(); j++ )
+        {
+            const PawnIndexPosting &pp = postings[j];
+            int idx = IdxFromGameNbr( pp.game_nbr, pawn_index_top_game_id );
+            if( idx < 0 )
+            {
+                candidates.clear();
+                return false;
+            }
+            std::map<int,size_t>::iterator it = candidate_by_idx.find(idx);
+            if( it == candidate_by_idx.end() )
+            {
+                DoSearchFoundGame dsfg;
+                dsfg.idx = idx;
+                dsfg.game_id = pawn_index_top_game_id - pp.game_nbr;
+                dsfg.offset_first = pp.ply_first;
+                dsfg.offset_last  = pp.ply_last;
+                candidate_by_idx[idx] = candidates.size();
+                candidates.push_back(dsfg);
+            }
+            else
+            {
+                DoSearchFoundGame &dsfg = candidates[it->second];
+                if( pp.ply_first < dsfg.offset_first )
+                    dsfg.offset_first = pp.ply_first;
+                if( pp.ply_last > dsfg.offset_last )
+                    dsfg.offset_last = pp.ply_last;
+            }
+        }
+    }
+
+    // Same order as playing through the games
+    std::sort( candidates.begin(), candidates.end(), predicate_sorts_by_idx );
+    return true;
+}
+
+// Use the pawn index to play through only the games (and plies) with the right pawn structure,
+//  return false if it's not possible
+bool MemoryPositionSearch::DoPatternSearchIndexed( const PatternMatch &pm, PATTERN_STATS &stats )
+{
+    std::vector<DoSearchFoundGame> candidates;
+    if( !PawnIndexCandidates(pm,candidates) )
+        return false;
+    AutoTimer at("Pawn indexed search time");
+    for( size_t i=0; i<candidates.size(); i++ )
+    {
+        DoSearchFoundGame dsfg = candidates[i];
+        ListableGame *p = in_memory_game_cache[dsfg.idx].get();
+        pattern_ply_begin = dsfg.offset_first;
+        pattern_ply_end   = dsfg.offset_last;
+        PatternSearchGame( pm, stats, &in_memory_game_cache, dsfg, p->CompressedMoves() );
+    }
+    pattern_ply_begin = 0;
+    pattern_ply_end   = 0xffff;
+    cprintf( "Pawn index, %lu games with the pawn structure, %lu games found\n",
+                (unsigned long)candidates.size(), (unsigned long)games_found.size() );
+    return true;
+}
+
+// Use a game's material summary (see MaterialSignature.h) to find the plies where its material
+//  can match a material balance search. Sets pattern_ply_begin and pattern_ply_end, returns false
+//  if the material never matches
+bool MemoryPositionSearch::MaterialSearchWindow( const PatternMatch &pm, uint64_t start_signature, const uint16_t *summary, int len )
+{
+    uint64_t signature = start_signature;
+    unsigned int ply = 0;
+    bool found = false;
+    int i = 0;
+    for(;;)
+    {
+        // This signature applies from ply until the next change
+        unsigned int next_ply = (i<len ? MATERIAL_SUMMARY_PLY(summary[i]) : 0x10000);
+        if( pm.TestMaterialSignature(signature) )
+        {
+            if( !found )
+                pattern_ply_begin = static_cast<unsigned short>(ply);
+            pattern_ply_end = static_cast<unsigned short>(next_ply-1);
+            found = true;
+        }
+        if( i >= len )
+            break;
+        ply = next_ply;
+        while( i<len && MATERIAL_SUMMARY_PLY(summary[i])==ply )
+            signature = MaterialSummaryApply( signature, summary[i++] );
+    }
+    return found;
 }
 
 int  MemoryPositionSearch::DoPatternSearch( PatternMatch &pm, ProgressBar *progress, PATTERN_STATS &stats )
@@ -502,6 +1421,8 @@ int  MemoryPositionSearch::DoPatternSearch( PatternMatch &pm, ProgressBar *progr
     games_found.clear();
     search_position = pm.parm.cp;
     search_position_set = true;
+    search_narrowed = false;
+    narrowed_skip.clear();
     search_source = source;
 
     // Set up counts of total pieces, and individual pieces in the target position
@@ -665,7 +1586,7 @@ int  MemoryPositionSearch::DoPatternSearch( PatternMatch &pm, ProgressBar *progr
         }
     }
 
-    // Set up the pattern mask
+    // Set up the pattern mask. After this pm is only read, so it can be shared by search threads
     pm.Prime(&msi.cr);
     mq.rank3_target = *mq.rank3_target_ptr;
     mq.rank4_target = *mq.rank4_target_ptr;
@@ -676,162 +1597,183 @@ int  MemoryPositionSearch::DoPatternSearch( PatternMatch &pm, ProgressBar *progr
     mq.rank1_target = *mq.rank1_target_ptr;
     mq.rank2_target = *mq.rank2_target_ptr;
     int nbr = source->size();
+    if( source==&in_memory_game_cache && DoPatternSearchIndexed(pm,stats) )
+    {
+        if( stream )
+        {
+            size_t nbr_streamed = 0;
+            StreamUpdate( games_found, nbr_streamed, nbr, nbr, true );
+        }
+        return games_found.size();
+    }
     {
         AutoTimer at("Search time");
-        thc::MOVELIST list;
-        for( int i=0; i<nbr; i++ )
+
+        // Scan the game table rather than the games themselves if possible, as for DoSearch()
+        const GameTable *table = NULL;
+        if( source==&in_memory_game_cache && game_table.IsValid(nbr) )
+            table = &game_table;
+
+        // As for DoSearch(), only searches of the in memory (tiny) database are split across threads
+        int nbr_threads = wxThread::GetCPUCount();
+        if( nbr_threads > MPS_MAX_THREADS )
+            nbr_threads = MPS_MAX_THREADS;
+        if( source!=&in_memory_game_cache || nbr_threads<2 || nbr<MPS_MIN_GAMES_PER_THREAD*2 )
+            PatternSearchSlice( pm, stats, source, table, 0, nbr, progress, NULL );
+        else
+            DoPatternSearchParallel( pm, stats, source, table, nbr_threads, progress );
+        if( stream && stream->kill )
+            search_position_set = false;    // stopped early, incomplete
+
+        // Same order as searching the games themselves
+        if( table && !table->InGamesOrder() )
+            std::sort( games_found.begin(), games_found.end(), predicate_sorts_by_idx );
+    }
+    return games_found.size();
+}
+
+// Split the source games into one slice per thread, as for DoSearchParallel(). The primed
+//  PatternMatch is shared by all the threads, each has its own scan state (in its own
+//  MemoryPositionSearch) and its own stats, which are added up at the end
+void MemoryPositionSearch::DoPatternSearchParallel( const PatternMatch &pm, PATTERN_STATS &stats, std::vector< smart_ptr<ListableGame> > *source,
+                                                    const GameTable *table, int nbr_threads, ProgressBar *progress )
+{
+    int nbr = source->size();
+    std::vector<MpsWorkerThread *> threads;
+    int begin = 0;
+    for( int t=0; t<nbr_threads; t++ )
+    {
+        int end = (t==nbr_threads-1) ? nbr : begin + nbr/nbr_threads;
+        MpsWorkerThread *thread = new MpsWorkerThread;
+        thread->mps.CloneSearchState( *this );
+        if( stream )
+            thread->mps.SetStream( &thread->slice_stream );
+        thread->source = source;
+        thread->begin = begin;
+        thread->end = end;
+        thread->nbr_done = 0;
+        thread->started = false;
+        thread->pm = &pm;
+        thread->table = table;
+        if( thread->Create() != wxTHREAD_NO_ERROR )
         {
-            smart_ptr<ListableGame> p = (*source)[i];
+            // Search this slice on the current thread instead
+            cprintf( "DoPatternSearchParallel(), cannot create thread %d\n", t );
+            thread->Entry();
+        }
+        else if( thread->Run() != wxTHREAD_NO_ERROR )
+        {
+            cprintf( "DoPatternSearchParallel(), cannot run thread %d\n", t );
+            thread->Entry();
+        }
+        else
+            thread->started = true;
+        threads.push_back( thread );
+        begin = end;
+    }
 
-            // TEMP TEMP - Find unconverted instances of the "ULTIMATE BLUNDER" players
-            //   consecutively miss mate in one opportunities
-            #if 1
-            thc::ChessRules cr;
-            CompressMoves comp;
-            std::string comp_moves = std::string(p->CompressedMoves());
-            std::vector<thc::Move> v = comp.Uncompress(cr,comp_moves);
-            int prev = -1;
-            bool game_found = false;
-            for( int k=0; k<v.size(); k++ )
-            {
-                thc::Move mv = v[k];
-                cr.PushMove(mv);
-                cr.GenLegalMoveList( &list );
-                for( int j=0; j<list.count; j++ )
-                {
-                    cr.PushMove(list.moves[j]);
-                    thc::TERMINAL score;
-                    cr.Evaluate(score);
-                    cr.PopMove(list.moves[j]);
-                    if( score==thc::TERMINAL_WCHECKMATE || score==thc::TERMINAL_BCHECKMATE )
-                    {
-                        if( prev!=-1 && prev+1==k )
-                        {
-                            game_found = true;
-                            break;
-                        }
-                        prev = k;
-                    }
-                }
-            }
-            if( game_found )
-            {
-                DoSearchFoundGame dsfg;
-                dsfg.idx = i;
-                dsfg.game_id = p->game_id;
-                dsfg.offset_first=prev;
-                dsfg.offset_last=prev+1;
-                stats.nbr_games++;
-                if( 0 == strcmp(p->Result(),"1-0") )
-                    stats.white_wins++;
-                else if( 0 == strcmp(p->Result(),"0-1") )
-                    stats.black_wins++;
-                else
-                    stats.draws++;
-                games_found.push_back( dsfg );
-            }
-            #endif
-            // TEMP TEMP - Find instances of the "ULTIMATE BLUNDER" - the game ends in mate
-            //   the other side could have mated though with their last move
-            #if 0
-            thc::ChessRules cr;
-            CompressMoves comp;
-            std::string comp_moves = std::string(p->CompressedMoves());
-            std::vector<thc::Move> v = comp.Uncompress(cr,comp_moves);
-            for( thc::Move mv: v )
-                cr.PushMove(mv);
-            //cprintf( "Final position is %s\n", cr.ToDebugStr().c_str() );
-            thc::TERMINAL score, find;
-            bool ok = cr.Evaluate(score);
-            bool game_found = false;
-            size_t len = v.size();
-            if( ok && (score == thc::TERMINAL_BCHECKMATE || score == thc::TERMINAL_WCHECKMATE) )
-            {
-                if( score == thc::TERMINAL_BCHECKMATE )
-                    find = thc::TERMINAL_WCHECKMATE;
-                else
-                    find = thc::TERMINAL_BCHECKMATE;
-                if( len >= 2 )
-                {
-                    cr.PopMove(v[len-1]);
-                    cr.PopMove(v[len-2]);
-                    cr.GenLegalMoveList( &list );
-                    for( int j=0; j<list.count; j++ )
-                    {
-                        cr.PushMove(list.moves[j]);
-                        thc::TERMINAL score2;
-                        ok = cr.Evaluate(score2);
-                        cr.PopMove(list.moves[j]);
-                        if( ok && score2==find )
-                            game_found = true;
-                    }
-                }
-            }
-            if( game_found )
-            {
-                DoSearchFoundGame dsfg;
-                dsfg.idx = i;
-                dsfg.game_id = p->game_id;
-                dsfg.offset_first=0;
-                dsfg.offset_last=len-2;
-                stats.nbr_games++;
-                if( 0 == strcmp(p->Result(),"1-0") )
-                    stats.white_wins++;
-                else if( 0 == strcmp(p->Result(),"0-1") )
-                    stats.black_wins++;
-                else
-                    stats.draws++;
-                games_found.push_back( dsfg );
-            }
-            #endif
-            #if 0
-            //if( 0 == strcmp(p->White(),"Gu, Xiaobing") &&  0 == strcmp(p->Black(),"Ryjanova, Julia")  )
-            //    debug_trigger = true;
-            DoSearchFoundGame dsfg;
+    // Only the main thread touches the progress bar, poll the workers for combined progress
+    unsigned int next_to_stream = 0;
+    for(;;)
+    {
+        int total_done = 0;
+        for( unsigned int t=0; t<threads.size(); t++ )
+            total_done += threads[t]->nbr_done;
+        if( total_done >= nbr )
+            break;
+        if( progress )
+            progress->Perfraction( total_done, nbr );
+        if( stream )
+        {
+            StreamSlices( stream, threads, next_to_stream );
+            stream->permill = static_cast<int>( (static_cast<double>(total_done) * 1000.0) / static_cast<double>(nbr) );
+        }
+        wxMilliSleep(10);
+    }
+    if( stream )
+        StreamSlices( stream, threads, next_to_stream );
+
+    // Merge in slice order, and reduce the stats
+    for( unsigned int t=0; t<threads.size(); t++ )
+    {
+        MpsWorkerThread *thread = threads[t];
+        if( thread->started )
+            thread->Wait();     // joinable threads must be waited for, even if already finished
+        games_found.insert( games_found.end(), thread->found.begin(), thread->found.end() );
+        stats.nbr_games          += thread->stats.nbr_games;
+        stats.nbr_reversed_games += thread->stats.nbr_reversed_games;
+        stats.white_wins         += thread->stats.white_wins;
+        stats.black_wins         += thread->stats.black_wins;
+        stats.draws              += thread->stats.draws;
+        delete thread;
+    }
+}
+
+// Pattern search games [begin,end) of source (rows [begin,end) of table if there is one),
+//  appending found games to games_found and adding them to stats. Report progress either
+//  directly to a progress bar, or (on a worker thread) through a counter
+void MemoryPositionSearch::PatternSearchSlice( const PatternMatch &pm, PATTERN_STATS &stats, std::vector< smart_ptr<ListableGame> > *source,
+                                               const GameTable *table, int begin, int end, ProgressBar *progress, std::atomic<int> *nbr_done )
+{
+    int nbr = source->size();
+    size_t nbr_streamed = games_found.size();
+
+    // For material balance searches the table's material summaries let us rule out most games
+    //  without playing through them, and restrict the rest to the plies that can match
+    bool material_summaries = (table && pm.parm.material_balance);
+    uint64_t start_signature = 0;
+    if( material_summaries )
+    {
+        thc::ChessPosition start;
+        start_signature = MaterialSignaturePosition( start.squares );
+    }
+    for( int i=begin; i<end; i++ )
+    {
+        if( (i&0xff)==0 )
+        {
+            if( progress )
+                progress->Perfraction( i, nbr );
+            if( nbr_done )
+                *nbr_done = i-begin;
+            if( stream && StreamUpdate( games_found, nbr_streamed, i, nbr, !nbr_done ) )
+                break;
+        }
+
+        DoSearchFoundGame dsfg;
+        const char *moves;
+        pattern_ply_begin = 0;
+        pattern_ply_end   = 0xffff;
+
+        // If there's a game table, i is a row in the table rather than an idx in source
+        if( table )
+        {
+            if( table->TestPartial(i) )
+                continue;
+            if( material_summaries && table->TestMaterial(i) &&
+                !MaterialSearchWindow( pm, start_signature, table->MaterialSummary(i), table->MaterialSummaryLen(i) ) )
+                continue;   // the material never matches in this game
+            dsfg.idx = table->GamesIdx(i);
+            dsfg.game_id = table->GameId(i);
+            moves = table->CompressedMoves(i);
+        }
+        else
+        {
+            ListableGame *p = (*source)[i].get();
+            const char *fen = p->Fen();
+            if( fen && *fen )
+                continue;   // a partial game in the clipboard
             dsfg.idx = i;
             dsfg.game_id = p->game_id;
-            dsfg.offset_first=0;
-            dsfg.offset_last=0;
-            bool promotion_in_game = p->TestPromotion();
-            bool game_found, reverse;
-            pm.NewGame();
-            if( promotion_in_game )
-                game_found = PatternSearchGameSlowPromotionAllowed( pm, reverse, std::string(p->CompressedMoves()), dsfg.offset_first, dsfg.offset_last  );
-            else
-                game_found = PatternSearchGameOptimisedNoPromotionAllowed( pm, reverse, p->CompressedMoves(), dsfg.offset_first, dsfg.offset_last );
-            if( game_found )
-            {
-                stats.nbr_games++;
-                if( reverse )
-                {
-                    stats.nbr_reversed_games++;
-                    if( 0 == strcmp(p->Result(),"1-0") )
-                        stats.black_wins++;
-                    else if( 0 == strcmp(p->Result(),"0-1") )
-                        stats.white_wins++;
-                    else
-                        stats.draws++;
-                }
-                else
-                {
-                    if( 0 == strcmp(p->Result(),"1-0") )
-                        stats.white_wins++;
-                    else if( 0 == strcmp(p->Result(),"0-1") )
-                        stats.black_wins++;
-                    else
-                        stats.draws++;
-                }
-                games_found.push_back( dsfg );
-            }
-            #endif
-            if( (i&0xff)==0 && progress )
-            {
-                double permill = (static_cast<double>(i) * 1000.0) / static_cast<double>(nbr);
-                progress->Permill( static_cast<int>(permill) );
-            }
+            moves = p->CompressedMoves();
         }
+        PatternSearchGame( pm, stats, source, dsfg, moves );
     }
-    return games_found.size();
+    pattern_ply_begin = 0;
+    pattern_ply_end   = 0xffff;
+    if( stream )
+        StreamUpdate( games_found, nbr_streamed, end, nbr, !nbr_done );
+    if( nbr_done )
+        *nbr_done = end-begin;
 }
 
 thc::Move MemoryPositionSearch::UncompressSlowMode( char code )
@@ -852,31 +1794,7 @@ thc::Move MemoryPositionSearch::UncompressSlowMode( char code )
     temp.wqueen = 1;
     temp.bking = 1;
     temp.bqueen = 1;
-
-    // Generate a list of all legal moves, in string form, sorted
-    std::vector<thc::Move> moves;
-    temp.GenLegalMoveList( moves );
-    std::vector<std::string> moves_alpha;
-
-    // Coding scheme relies on 254 valid codes 0x02-0xff and one error code 0x01,
-    size_t len = moves.size();
-    for( size_t i=0; i<len; i++ )
-    {
-        std::string s = moves[i].TerseOut();
-        moves_alpha.push_back(s);
-    }
-    std::sort( moves_alpha.begin(), moves_alpha.end() );
-
-    // '\xff' (i.e. 255) is first move in list, '\fe' (i.e. 254) is second etc
-    unsigned int ucode = static_cast<size_t>( code );
-    ucode &= 0xff;
-    size_t idx = 255-ucode;  // 255->0, 254->1 etc.
-    if( idx >= len )
-        idx = 0;    // all errors resolve to this - take first move from list
-    std::string the_move = moves_alpha[idx];
-    thc::Move mv;
-    mv.TerseIn( &temp, the_move.c_str() );
-    return mv;
+    return CompressMoves::UncompressSlowMode( temp, code, true );
 }
 
 thc::Move MemoryPositionSearch::UncompressFastMode( char code, MpsSide *side, MpsSide *other )
@@ -1255,7 +2173,42 @@ thc::Move MemoryPositionSearch::UncompressFastMode( char code, MpsSide *side, Mp
 #define SLOW_BLACK_HOME_ROW_TEST ((*ms.slow_rank7_ptr & black_home_mask) == black_home_pawns)
 
 
-bool MemoryPositionSearch::SearchGameOptimisedNoPromotionAllowed( const char *moves_in, unsigned short &offset_first, unsigned short &offset_last )
+// The quick algorithm hands over to the slow algorithm at a promotion, set up the slow
+//  algorithm in the position reached so far
+void MemoryPositionSearch::SlowGameResume( bool white )
+{
+    SlowGameInit();
+    memcpy( msi.cr.squares, mqi.squares, 64 );
+    msi.cr.white = white;
+    msi.cr.enpassant_target = thc::SQUARE_INVALID;  // the next move is a promotion, not an en passant capture
+    msi.cr.wking_square = static_cast<thc::Square>(mqi.side_white.king);
+    msi.cr.bking_square = static_cast<thc::Square>(mqi.side_black.king);
+    msi.sides[0] = mqi.side_white;
+    msi.sides[1] = mqi.side_black;
+}
+
+// Games with promotions are played through with the quick algorithm up to the first promotion,
+//  then the slow algorithm takes over. Until then the quick algorithm mustn't give up because
+//  a piece the target position needs has been captured, it might reappear by promotion
+bool MemoryPositionSearch::SearchGameOptimisedPromotionAllowed( const char *moves_in, unsigned short &offset_first, unsigned short &offset_last )
+{
+    MpsQuick save = mq;
+    mq.white_rook_target = 0;
+    mq.white_knight_target = 0;
+    mq.white_light_bishop_target = 0;
+    mq.white_dark_bishop_target = 0;
+    mq.white_queen_target = 0;
+    mq.black_rook_target = 0;
+    mq.black_knight_target = 0;
+    mq.black_light_bishop_target = 0;
+    mq.black_dark_bishop_target = 0;
+    mq.black_queen_target = 0;
+    bool found = SearchGameOptimised( moves_in, offset_first, offset_last );
+    mq = save;
+    return found;
+}
+
+bool MemoryPositionSearch::SearchGameOptimised( const char *moves_in, unsigned short &offset_first, unsigned short &offset_last )
 {
     unsigned short offset=0;
     bool target_white = search_position.white;  // searching for position with white to move?
@@ -1266,6 +2219,8 @@ bool MemoryPositionSearch::SearchGameOptimisedNoPromotionAllowed( const char *mo
         if(
             target_white &&
             #if 1
+            BoardEqual( mqi.squares, mq.target_squares )
+            #elif 0
             *mq.rank3_ptr == mq.rank3_target &&
             *mq.rank4_ptr == mq.rank4_target &&
             *mq.rank5_ptr == mq.rank5_target &&
@@ -1475,7 +2430,9 @@ bool MemoryPositionSearch::SearchGameOptimisedNoPromotionAllowed( const char *mo
                 {
                     default:
                     {
-                        return false;   // this code doesn't handle promotions
+                        // This code doesn't handle promotions, continue with the slow algorithm
+                        SlowGameResume(true);
+                        return SearchGameSlowContinue( moves_in-1, offset-1, offset_first, offset_last );
                     }
 
                     case P_DOUBLE:
@@ -1619,6 +2576,8 @@ bool MemoryPositionSearch::SearchGameOptimisedNoPromotionAllowed( const char *mo
         if(
             !target_white &&
             #if 1
+            BoardEqual( mqi.squares, mq.target_squares )
+            #elif 0
             *mq.rank3_ptr == mq.rank3_target &&
             *mq.rank4_ptr == mq.rank4_target &&
             *mq.rank5_ptr == mq.rank5_target &&
@@ -1827,7 +2786,9 @@ bool MemoryPositionSearch::SearchGameOptimisedNoPromotionAllowed( const char *mo
                 {
                     default:
                     {
-                        return false;   // this code doesn't handle promotions
+                        // This code doesn't handle promotions, continue with the slow algorithm
+                        SlowGameResume(false);
+                        return SearchGameSlowContinue( moves_in-1, offset-1, offset_first, offset_last );
                     }
 
                     case P_DOUBLE:
@@ -1971,10 +2932,11 @@ bool MemoryPositionSearch::SearchGameOptimisedNoPromotionAllowed( const char *mo
     //return false;     // unreachable
 }
 
-bool MemoryPositionSearch::PatternSearchGameOptimisedNoPromotionAllowed( PatternMatch &pm, bool &reverse, const char *moves_in, unsigned short &offset_first, unsigned short &offset_last )
+bool MemoryPositionSearch::PatternSearchGameOptimised( const PatternMatch &pm, bool &reverse, const char *moves_in, unsigned short &offset_first, unsigned short &offset_last )
 {
     unsigned short offset=0;
     QuickGameInit();
+    pattern_in_a_row = 0;
     int total_count=30;     // 32 - 2 kings
     for(;;)
     {
@@ -1993,7 +2955,7 @@ bool MemoryPositionSearch::PatternSearchGameOptimisedNoPromotionAllowed( Pattern
                 cprintf( "%s\n", buf );
             }
         } */
-        bool match = pm.Test( reverse, &mqi.side_white, &mqi.side_black, true, mqi.squares, false );
+        bool match = offset>=pattern_ply_begin && pm.Test( reverse, &mqi.side_white, &mqi.side_black, true, mqi.squares, false, pattern_in_a_row );
         if( match )
         {
             /*if( debug_trigger )
@@ -2004,6 +2966,8 @@ bool MemoryPositionSearch::PatternSearchGameOptimisedNoPromotionAllowed( Pattern
             offset_last = offset_first = offset;    // later - separate offset_first and offset_last
             return true;
         }
+        if( offset >= pattern_ply_end )
+            return false;
         #define SIMPLE_PATTERN_COUNT_OPTIMISATION
         #ifdef SIMPLE_PATTERN_COUNT_OPTIMISATION
         if( total_count < ms.total_count_target )
@@ -2195,7 +3159,9 @@ bool MemoryPositionSearch::PatternSearchGameOptimisedNoPromotionAllowed( Pattern
                 {
                     default:
                     {
-                        return false;   // this code doesn't handle promotions
+                        // This code doesn't handle promotions, continue with the slow algorithm
+                        SlowGameResume(true);
+                        return PatternSearchGameSlowContinue( pm, reverse, moves_in-1, offset-1, offset_first, offset_last );
                     }
 
                     case P_DOUBLE:
@@ -2333,7 +3299,7 @@ bool MemoryPositionSearch::PatternSearchGameOptimisedNoPromotionAllowed( Pattern
                 cprintf( "%s\n", buf );
             }
         } */
-        match = pm.Test( reverse, &mqi.side_white, &mqi.side_black, false, mqi.squares, false );
+        match = offset>=pattern_ply_begin && pm.Test( reverse, &mqi.side_white, &mqi.side_black, false, mqi.squares, false, pattern_in_a_row );
         if( match )
         {
             /*if( debug_trigger )
@@ -2344,6 +3310,8 @@ bool MemoryPositionSearch::PatternSearchGameOptimisedNoPromotionAllowed( Pattern
             offset_last = offset_first = offset;    // later - separate offset_first and offset_last
             return true;
         }
+        if( offset >= pattern_ply_end )
+            return false;
         #ifdef SIMPLE_PATTERN_COUNT_OPTIMISATION
         if( total_count < ms.total_count_target )
             return false;
@@ -2533,7 +3501,9 @@ bool MemoryPositionSearch::PatternSearchGameOptimisedNoPromotionAllowed( Pattern
                 {
                     default:
                     {
-                        return false;   // this code doesn't handle promotions
+                        // This code doesn't handle promotions, continue with the slow algorithm
+                        SlowGameResume(false);
+                        return PatternSearchGameSlowContinue( pm, reverse, moves_in-1, offset-1, offset_first, offset_last );
                     }
 
                     case P_DOUBLE:
@@ -2662,15 +3632,10 @@ bool MemoryPositionSearch::PatternSearchGameOptimisedNoPromotionAllowed( Pattern
     //return false;     // unreachable
 }
 
-bool MemoryPositionSearch::SearchGameSlowPromotionAllowed( const std::string &moves_in, unsigned short &offset_first, unsigned short &offset_last )          // semi fast
+bool MemoryPositionSearch::SearchGameSlowPromotionAllowed( const char *moves_in, unsigned short &offset_first, unsigned short &offset_last )          // semi fast
 {
     bool target_white = search_position.white;  // searching for position with white to move?
-    int black_count=16;
-    int black_pawn_count=8;
-    int white_count=16;
-    int white_pawn_count=8;
     SlowGameInit();
-    int len = moves_in.size();
     if(
         (msi.cr.white == target_white) &&
         *ms.slow_rank3_ptr == *ms.slow_rank3_target_ptr &&
@@ -2686,11 +3651,36 @@ bool MemoryPositionSearch::SearchGameSlowPromotionAllowed( const std::string &mo
         offset_last = offset_first = 0;    // later - separate offset_first and offset_last
         return true;
     }
-    for( int i=0; i<len; i++ )
+    return SearchGameSlowContinue( moves_in, 0, offset_first, offset_last );
+}
+
+// Play through the rest of a game from the position in msi, offset is the number of moves
+//  already played. Used both from the start of a game and to take over from the quick algorithm
+bool MemoryPositionSearch::SearchGameSlowContinue( const char *moves_in, unsigned short offset, unsigned short &offset_first, unsigned short &offset_last )
+{
+    bool target_white = search_position.white;  // searching for position with white to move?
+    int black_count=0;
+    int black_pawn_count=0;
+    int white_count=0;
+    int white_pawn_count=0;
+    for( int i=0; i<64; i++ )
+    {
+        char c = msi.cr.squares[i];
+        if( c=='P' )
+            white_pawn_count++;
+        else if( c=='p' )
+            black_pawn_count++;
+        if( isupper(c) )
+            white_count++;      // kings included, as always for these counts
+        else if( islower(c) )
+            black_count++;
+    }
+    while( *moves_in )
     {
         MpsSide *side  = msi.cr.white ? &msi.sides[0] : &msi.sides[1];
         MpsSide *other = msi.cr.white ? &msi.sides[1] : &msi.sides[0];
-        char code = moves_in[i];
+        char code = *moves_in++;
+        offset++;
         thc::Move mv;
         if( side->fast_mode )
         {
@@ -2734,7 +3724,7 @@ bool MemoryPositionSearch::SearchGameSlowPromotionAllowed( const std::string &mo
             *ms.slow_rank2_ptr == *ms.slow_rank2_target_ptr
         )
         {
-            offset_last = offset_first = (i+1);    // later - separate offset_first and offset_last
+            offset_last = offset_first = offset;    // later - separate offset_first and offset_last
             return true;
         }
         if( mover=='P' && 48<=mv.src && mv.src<56 && !SLOW_WHITE_HOME_ROW_TEST )
@@ -2783,22 +3773,35 @@ bool MemoryPositionSearch::SearchGameSlowPromotionAllowed( const std::string &mo
     return false;
 }
 
-bool MemoryPositionSearch::PatternSearchGameSlowPromotionAllowed( PatternMatch &pm, bool &reverse, const std::string &moves_in, unsigned short &offset_first, unsigned short &offset_last )          // semi fast
+bool MemoryPositionSearch::PatternSearchGameSlowPromotionAllowed( const PatternMatch &pm, bool &reverse, const char *moves_in, unsigned short &offset_first, unsigned short &offset_last )          // semi fast
 {
-    int total_count=30;     // 32 - 2 kings
     SlowGameInit();
-    int len = moves_in.size();
-    bool match = pm.Test( reverse, &msi.sides[0], &msi.sides[1], msi.cr.white, msi.cr.squares, false );
+    pattern_in_a_row = 0;
+    bool match = pattern_ply_begin==0 && pm.Test( reverse, &msi.sides[0], &msi.sides[1], msi.cr.white, msi.cr.squares, false, pattern_in_a_row );
     if( match )
     {
         offset_last = offset_first = 0;    // later - separate offset_first and offset_last
         return true;
     }
-    for( int i=0; i<len; i++ )
+    return PatternSearchGameSlowContinue( pm, reverse, moves_in, 0, offset_first, offset_last );
+}
+
+// Play through the rest of a game from the position in msi, as for SearchGameSlowContinue()
+bool MemoryPositionSearch::PatternSearchGameSlowContinue( const PatternMatch &pm, bool &reverse, const char *moves_in, unsigned short offset, unsigned short &offset_first, unsigned short &offset_last )
+{
+    int total_count=0;
+    for( int i=0; i<64; i++ )
+    {
+        char c = msi.cr.squares[i];
+        if( isalpha(c) && c!='K' && c!='k' )
+            total_count++;
+    }
+    while( *moves_in && offset<pattern_ply_end )    // no match is possible after pattern_ply_end
     {
         MpsSide *side  = msi.cr.white ? &msi.sides[0] : &msi.sides[1];
         MpsSide *other = msi.cr.white ? &msi.sides[1] : &msi.sides[0];
-        char code = moves_in[i];
+        char code = *moves_in++;
+        offset++;
         thc::Move mv;
         if( side->fast_mode )
         {
@@ -2826,10 +3829,10 @@ bool MemoryPositionSearch::PatternSearchGameSlowPromotionAllowed( PatternMatch &
                 msi.cr.squares[mv.dst] = c;
             }
         }
-        match = pm.Test( reverse, &msi.sides[0], &msi.sides[1], msi.cr.white, msi.cr.squares, true );
+        bool match = offset>=pattern_ply_begin && pm.Test( reverse, &msi.sides[0], &msi.sides[1], msi.cr.white, msi.cr.squares, true, pattern_in_a_row );
         if( match )
         {
-            offset_last = offset_first = (i+1);    // later - separate offset_first and offset_last
+            offset_last = offset_first = offset;    // later - separate offset_first and offset_last
             return true;
         }
         #ifdef SIMPLE_PATTERN_COUNT_OPTIMISATION
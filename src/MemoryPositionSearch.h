@@ -10,12 +10,19 @@
 
 #include <algorithm>
 #include <vector>
+#include <list>
+#include <map>
 #include <string>
+#include <atomic>
 #include "thc.h"
 #include "ProgressBar.h"
 #include "ListableGame.h"
 #include "MemoryPositionSearchSide.h"
 #include "PatternMatch.h"
+#include "PositionIndex.h"
+#include "PawnIndex.h"
+#include "GameTable.h"
+#include "wx/thread.h"
 
 // For standard algorithm, works for any game
 struct MpsSlow
@@ -121,36 +128,138 @@ struct DoSearchFoundGame
     unsigned short offset_last;
 };
 
+// One target position of a multi target search, see DoSearchMulti()
+struct MpsMultiTarget
+{
+    char         squares[64];       // with the D/d dark bishop convention
+    bool         white;
+    int          nbr_pieces;        // not counting kings
+    unsigned int white_home_pawns;  // bit i set if there is a white pawn on square 48+i (rank 2)
+    unsigned int black_home_pawns;  // bit i set if there is a black pawn on square 8+i (rank 7)
+    uint64_t     signature;         // see PieceSquareSignatureTarget()
+    int          duplicate_of;      // -1, or an earlier target with the same position
+};
+
+// Recent search results for the whole in memory database, keyed by position hash. Least
+//  recently used results are discarded first, once the total size exceeds MPS_CACHE_MAX_BYTES
+#define MPS_CACHE_MAX_BYTES     (32*1024*1024)
+struct MpsCacheEntry
+{
+    uint64_t           key;
+    thc::ChessPosition cp;          // hashes can collide, so check the position too
+    int                nbr_games;   // size of the in memory database when searched
+    std::vector<DoSearchFoundGame> games_found;
+};
+
+// A search running on a worker thread hands over the games it finds, in batches, through one
+//  of these. The main thread can also ask the search to stop early
+class MpsStream
+{
+public:
+    MpsStream() { kill=false; finished=false; permill=0; }
+    void Push( const DoSearchFoundGame *batch, int nbr )
+    {
+        wxMutexLocker lock(mutex);
+        pending.insert( pending.end(), batch, batch+nbr );
+    }
+    void Pop( std::vector<DoSearchFoundGame> &batch )   // appends games found since last Pop()
+    {
+        wxMutexLocker lock(mutex);
+        batch.insert( batch.end(), pending.begin(), pending.end() );
+        pending.clear();
+    }
+    std::atomic<bool> kill;     // set by the main thread to stop the search
+    std::atomic<bool> finished; // set by the worker thread when the search is over
+    std::atomic<int>  permill;  // progress
+private:
+    wxMutex mutex;
+    std::vector<DoSearchFoundGame> pending;
+};
+
+// Parallel search of the in memory database, an upper limit on worker threads and a lower
+//  limit on games per thread (below that the threads cost more than they save)
+#define MPS_MAX_THREADS             16
+#define MPS_MIN_GAMES_PER_THREAD    20000
+
 class MemoryPositionSearch
 {
 public:
     MemoryPositionSearch()
     {
+        cache_hits = 0;
+        cache_misses = 0;
         Init();
     }
     void Init();
     bool TryFastMode( MpsSide *side );
-    bool SearchGameOptimisedNoPromotionAllowed( const char *moves_in, unsigned short &offset_first, unsigned short &offset_last  );    // much faster
-    bool SearchGameSlowPromotionAllowed(  const std::string &moves_in, unsigned short &offset_first, unsigned short &offset_last  );          // semi fast
-    bool PatternSearchGameOptimisedNoPromotionAllowed( PatternMatch &pm, bool &reverse, const char *moves_in, unsigned short &offset_first, unsigned short &offset_last  );    // much faster
-    bool PatternSearchGameSlowPromotionAllowed( PatternMatch &pm, bool &reverse, const std::string &moves_in, unsigned short &offset_first, unsigned short &offset_last  );          // semi fast
+    bool SearchGameOptimised( const char *moves_in, unsigned short &offset_first, unsigned short &offset_last  );    // much faster, stops early if pieces are captured
+    bool SearchGameOptimisedPromotionAllowed( const char *moves_in, unsigned short &offset_first, unsigned short &offset_last  );    // faster, for games with promotions
+    bool SearchGameSlowPromotionAllowed(  const char *moves_in, unsigned short &offset_first, unsigned short &offset_last  );          // semi fast
+    bool PatternSearchGameOptimised( const PatternMatch &pm, bool &reverse, const char *moves_in, unsigned short &offset_first, unsigned short &offset_last  );    // much faster, any game
+    bool PatternSearchGameSlowPromotionAllowed( const PatternMatch &pm, bool &reverse, const char *moves_in, unsigned short &offset_first, unsigned short &offset_last  );          // semi fast
     int  GetNbrGamesFound() { return games_found.size(); }
     std::vector< smart_ptr<ListableGame> > *search_source;
     std::vector< smart_ptr<ListableGame> >  &GetVectorSourceGames()   { return *search_source; }
     std::vector<DoSearchFoundGame>          &GetVectorGamesFound() { return games_found; }
     int  DoSearch( const thc::ChessPosition &cp, ProgressBar *progress );
     int  DoSearch( const thc::ChessPosition &cp, ProgressBar *progress, std::vector< smart_ptr<ListableGame> > *source );
+
+    // Search for many positions (eg all the positions one ply after the current position) in
+    //  a single pass, replaying each game once. found[i] are the games that reach targets[i].
+    //  Searches of the whole in memory database are cached, as for DoSearch(). If a stream is
+    //  set it only reports progress (and can stop the search, leaving found incomplete)
+    int  DoSearchMulti( const std::vector<thc::ChessPosition> &targets, std::vector< std::vector<DoSearchFoundGame> > &found, ProgressBar *progress );
+    int  DoSearchMulti( const std::vector<thc::ChessPosition> &targets, std::vector< std::vector<DoSearchFoundGame> > &found, ProgressBar *progress, std::vector< smart_ptr<ListableGame> > *source );
     int  DoPatternSearch( PatternMatch &pm, ProgressBar *progress, PATTERN_STATS &stats );
     int  DoPatternSearch( PatternMatch &pm, ProgressBar *progress, PATTERN_STATS &stats, std::vector< smart_ptr<ListableGame> > *source );
     bool IsThisSearchPosition( const thc::ChessPosition &cp )
-        { return search_position_set && cp==search_position; }
+        { return search_position_set && !search_narrowed && cp==search_position; }
+
+    // Search the games found by the previous search first (for immediate results), then the
+    //  rest of the games later, see DoSearchNarrowed(). The previous results can themselves be
+    //  narrowed (incomplete)
+    int  DoSearchNarrowed( const thc::ChessPosition &cp, ProgressBar *progress );
+    bool IsNarrowingPossible()      // if not, DoSearchNarrowed() is just DoSearch()
+        { return search_position_set && search_source==&in_memory_game_cache &&
+                 !(position_index && position_index->IsLoaded()); }
+    bool IsNarrowedSearch( const thc::ChessPosition &cp )     // CompleteNarrowedSearch() is needed
+        { return search_position_set && search_narrowed && !narrowed_skip.empty() && cp==search_position; }
+    int  CompleteNarrowedSearch( ProgressBar *progress );
+    void SetPositionIndex( PositionIndex *index, uint32_t top_game_id )
+        { position_index=index; position_index_top_game_id=top_game_id; idx_by_game_nbr.clear(); }
+    void SetPawnIndex( PawnIndex *index, uint32_t top_game_id )
+        { pawn_index=index; pawn_index_top_game_id=top_game_id; idx_by_game_nbr.clear(); }
+    void CloneSearchState( const MemoryPositionSearch &master );
+
+    // The cache of search results must be cleared whenever the in memory database is reloaded or
+    //  reordered (the results are indexes into it). Hits and misses are counted for sizing the cache
+    void ClearResultCache();
+
+    // Optionally hand over games to a stream as they are found (see MpsStream). A search
+    //  stopped early has incomplete results, and doesn't count as the last search position
+    void SetStream( MpsStream *s ) { stream = s; }
+    unsigned int GetCacheHits()     { return cache_hits; }
+    unsigned int GetCacheMisses()   { return cache_misses; }
+    void SearchSlice( std::vector< smart_ptr<ListableGame> > *source, int begin, int end,
+                      std::vector<DoSearchFoundGame> &found, ProgressBar *progress, std::atomic<int> *nbr_done );
+    void PatternSearchSlice( const PatternMatch &pm, PATTERN_STATS &stats, std::vector< smart_ptr<ListableGame> > *source,
+                             const GameTable *table, int begin, int end, ProgressBar *progress, std::atomic<int> *nbr_done );
 
 public:
     std::vector< smart_ptr<ListableGame> > in_memory_game_cache;
+    GameTable game_table;   // columnar view of in_memory_game_cache, for searching
 
 private:
     thc::ChessPosition search_position;
     bool search_position_set;
+    bool search_narrowed;                   // games_found is incomplete, see DoSearchNarrowed()
+    std::vector<bool> narrowed_skip;        // per game, searched by DoSearchNarrowed(), empty if
+                                            //  CompleteNarrowedSearch() was stopped early
+    const std::vector<bool> *skip_games;    // if not NULL, SearchSlice() skips these games
+    MpsStream *stream;
+    bool StreamUpdate( std::vector<DoSearchFoundGame> &found, size_t &nbr_streamed, int done, int total, bool report_progress );
+    uint64_t target_signature;
+    const GameTable *search_table;  // set while searching, if the game table is used
     std::vector<DoSearchFoundGame> games_found;
     MpsSlow      ms;
     MpsSlowInit  msi;
@@ -161,6 +270,48 @@ private:
     uint64_t white_home_pawns;
     uint64_t black_home_mask;
     uint64_t black_home_pawns;
+    void BindRankPointers();
+    bool DoSearchIndexed( const thc::ChessPosition &cp );
+    void SearchTargetInit( const thc::ChessPosition &cp );
+    void SearchSource( std::vector< smart_ptr<ListableGame> > *source, ProgressBar *progress );
+    PositionIndex *position_index;
+    uint32_t position_index_top_game_id;
+    std::vector<int> idx_by_game_nbr;
+    int IdxFromGameNbr( uint32_t game_nbr, uint32_t top_game_id );
+    PawnIndex *pawn_index;
+    uint32_t pawn_index_top_game_id;
+    bool PawnIndexCandidates( const PatternMatch &pm, std::vector<DoSearchFoundGame> &candidates );
+    bool DoPatternSearchIndexed( const PatternMatch &pm, PATTERN_STATS &stats );
+    void PatternSearchGame( const PatternMatch &pm, PATTERN_STATS &stats, std::vector< smart_ptr<ListableGame> > *source,
+                            DoSearchFoundGame &dsfg, const char *moves );
+    void DoSearchParallel( std::vector< smart_ptr<ListableGame> > *source, int nbr_threads, ProgressBar *progress );
+    void DoPatternSearchParallel( const PatternMatch &pm, PATTERN_STATS &stats, std::vector< smart_ptr<ListableGame> > *source,
+                                  const GameTable *table, int nbr_threads, ProgressBar *progress );
+    int pattern_in_a_row;   // consecutive plies matching, see PatternMatch::Test()
+
+    // Pattern searches only test plies pattern_ply_begin to pattern_ply_end inclusive
+    unsigned short pattern_ply_begin;
+    unsigned short pattern_ply_end;
+    bool MaterialSearchWindow( const PatternMatch &pm, uint64_t start_signature, const uint16_t *summary, int len );
+
+    // Search result cache, most recently used first in the list
+    std::list<MpsCacheEntry> cache_lru;
+    std::map< uint64_t, std::list<MpsCacheEntry>::iterator > cache_map;
+    size_t       cache_bytes;
+    unsigned int cache_hits;
+    unsigned int cache_misses;
+    uint64_t CacheKey( const thc::ChessPosition &cp );
+    bool CacheLookup( const thc::ChessPosition &cp, uint64_t key );
+    void CacheInsert( const thc::ChessPosition &cp, uint64_t key, const std::vector<DoSearchFoundGame> &found );
+
+    // Multi target search, a small open addressed hash table of target indexes (-1 = empty)
+    std::vector<MpsMultiTarget> multi_targets;
+    std::vector<int>            multi_hash_table;
+    unsigned int                multi_hash_mask;
+    std::vector<bool>           multi_done;     // per game, target found or unreachable
+    int  MultiLookup( const char *squares, bool white );
+    int  MultiReachable( int nbr_pieces, unsigned int white_home_pawns, unsigned int black_home_pawns );
+    void SearchGameMulti( const char *moves_in, DoSearchFoundGame &dsfg, std::vector< std::vector<DoSearchFoundGame> > &found );
     void QuickGameInit()
     {
         mqi = mqi_init;
@@ -174,6 +325,9 @@ private:
         msi.sides[0] = mqi_init.side_white;
         msi.sides[1] = mqi_init.side_black;
     }
+    void SlowGameResume( bool white );
+    bool SearchGameSlowContinue( const char *moves_in, unsigned short offset, unsigned short &offset_first, unsigned short &offset_last );
+    bool PatternSearchGameSlowContinue( const PatternMatch &pm, bool &reverse, const char *moves_in, unsigned short offset, unsigned short &offset_first, unsigned short &offset_last );
     thc::Move UncompressSlowMode( char code );
     thc::Move UncompressFastMode( char code, MpsSide *side, MpsSide *other );
 };
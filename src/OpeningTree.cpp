@@ -0,0 +1,280 @@
+/****************************************************************************
+ * Opening tree - an optional sidecar file for a .tdb database, with move
+ *  statistics for every position in the opening phase of every game
+ *  Author:  Bill Forster
+ *  License: MIT license. Full text of license is in associated file LICENSE
+ *  Copyright 2010-2016, Bill Forster <billforsternz at gmail dot com>
+ ****************************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include "thc.h"
+#include "DebugPrintf.h"
+#include "AutoTimer.h"
+#include "CompressMoves.h"
+#include "OpeningTree.h"
+
+// File format is an OpeningTreeHeader, then OPENING_TREE_NBR_BUCKETS+2 bucket starts (the
+//  last one is padding, so the entries are 8 byte aligned), then the entries
+#define OPENING_TREE_MAGIC      "Tarrasch opening tree"
+#define OPENING_TREE_VERSION    1
+struct OpeningTreeHeader
+{
+    char     magic[32];
+    uint32_t version;
+    uint32_t nbr_games;         // the tree matches a .tdb file with this many games ...
+    uint64_t tdb_len;           // ... and this length
+    uint32_t max_ply;
+    uint32_t pad;
+    uint64_t nbr_entries;
+};
+#define OPENING_TREE_BUCKETS_LEN ((OPENING_TREE_NBR_BUCKETS+2)*sizeof(uint32_t))
+
+// One move in one game while building
+struct OpeningTreeBuildRecord
+{
+    uint64_t       hash;
+    uint32_t       move;        // src | dst<<8 | special<<16
+    unsigned short elo;         // of the player making the move, 0 if unknown
+    char           result;      // 'W', 'B', 'D' or '?'
+    bool operator < (const OpeningTreeBuildRecord &rhs) const
+    {
+        if( hash != rhs.hash )
+            return hash < rhs.hash;
+        return move < rhs.move;
+    }
+};
+
+static bool FileLength( const std::string &filename, uint64_t &len )
+{
+    FILE *f = fopen( filename.c_str(), "rb" );
+    if( !f )
+        return false;
+    fseek( f, 0, SEEK_END );
+    len = ftell(f);
+    fclose(f);
+    return true;
+}
+
+static inline uint32_t Bucket( uint64_t hash )
+{
+    return static_cast<uint32_t>( hash >> (64-OPENING_TREE_BUCKET_BITS) );
+}
+
+static bool predicate_entry_before_hash( const OpeningTreeEntry &e, uint64_t hash )
+{
+    return e.hash < hash;
+}
+
+void OpeningTree::Clear()
+{
+    loaded = false;
+    max_ply = 0;
+    file.Close();
+    buckets = NULL;
+    entries = NULL;
+    nbr_entries = 0;
+}
+
+std::string OpeningTree::SidecarFilename( const std::string &tdb_filename )
+{
+    return tdb_filename + ".tree";
+}
+
+bool OpeningTree::Build( std::vector< smart_ptr<ListableGame> > &games, int max_ply_,
+                         const std::string &tdb_filename, std::string &error_msg, ProgressBar *pb )
+{
+    AutoTimer at("Build opening tree");
+    Clear();
+    uint64_t tdb_len;
+    if( !FileLength(tdb_filename,tdb_len) )
+    {
+        error_msg = "Cannot open database file " + tdb_filename;
+        return false;
+    }
+
+    // Play through the opening of every game, one record for every move
+    std::vector<OpeningTreeBuildRecord> records;
+    int nbr = games.size();
+    for( int i=0; i<nbr; i++ )
+    {
+        if( pb && pb->Perfraction(i,nbr) )
+        {
+            error_msg = "Cancelled";
+            return false;
+        }
+        smart_ptr<ListableGame> p = games[i];
+        const char *fen = p->Fen();
+        if( fen && *fen )
+            continue;   // only games from the standard starting position
+        const char *result = p->Result();
+        char res = '?';
+        if( 0 == strcmp(result,"1-0") )
+            res = 'W';
+        else if( 0 == strcmp(result,"0-1") )
+            res = 'B';
+        else if( 0 == strcmp(result,"1/2-1/2") )
+            res = 'D';
+        int white_elo = atoi( p->WhiteElo() );
+        int black_elo = atoi( p->BlackElo() );
+        std::string blob( p->CompressedMoves() );
+        if( static_cast<int>(blob.length()) > max_ply_ )
+            blob = blob.substr(0,max_ply_);
+        CompressMoves press;
+        std::vector<thc::Move> moves = press.Uncompress( blob );
+        thc::ChessRules cr;
+        for( size_t j=0; j<moves.size(); j++ )
+        {
+            thc::Move mv = moves[j];
+            OpeningTreeBuildRecord r;
+            r.hash   = cr.Hash64Calculate();
+            r.move   = static_cast<uint32_t>(mv.src) | (static_cast<uint32_t>(mv.dst)<<8) | (static_cast<uint32_t>(mv.special)<<16);
+            int elo  = cr.white ? white_elo : black_elo;
+            r.elo    = (0<elo && elo<0xffff) ? static_cast<unsigned short>(elo) : 0;
+            r.result = res;
+            records.push_back(r);
+            cr.PlayMove(mv);
+        }
+    }
+    std::sort( records.begin(), records.end() );
+
+    // Combine the records for each move in each position
+    std::vector<OpeningTreeEntry> tree;
+    for( size_t i=0; i<records.size(); )
+    {
+        OpeningTreeEntry e;
+        memset( &e, 0, sizeof(e) );
+        e.hash    = records[i].hash;
+        e.src     = static_cast<uint8_t>( records[i].move );
+        e.dst     = static_cast<uint8_t>( records[i].move>>8 );
+        e.special = static_cast<uint8_t>( records[i].move>>16 );
+        size_t j;
+        for( j=i; j<records.size() && records[j].hash==records[i].hash && records[j].move==records[i].move; j++ )
+        {
+            e.nbr_games++;
+            switch( records[j].result )
+            {
+                case 'W': e.white_wins++;   break;
+                case 'B': e.black_wins++;   break;
+                case 'D': e.draws++;        break;
+            }
+            if( records[j].elo )
+            {
+                e.elo_total += records[j].elo;
+                e.nbr_elo_games++;
+            }
+        }
+        tree.push_back(e);
+        i = j;
+    }
+    records.clear();
+    records.shrink_to_fit();
+
+    // Bucket starts
+    std::vector<uint32_t> starts( OPENING_TREE_NBR_BUCKETS+2 );
+    size_t idx = 0;
+    for( uint32_t b=0; b<=OPENING_TREE_NBR_BUCKETS; b++ )
+    {
+        while( idx<tree.size() && Bucket(tree[idx].hash)<b )
+            idx++;
+        starts[b] = static_cast<uint32_t>(idx);
+    }
+    starts[OPENING_TREE_NBR_BUCKETS+1] = 0;
+
+    // Write it out
+    std::string filename = SidecarFilename(tdb_filename);
+    FILE *f = fopen( filename.c_str(), "wb" );
+    if( !f )
+    {
+        error_msg = "Cannot create opening tree file " + filename;
+        return false;
+    }
+    OpeningTreeHeader hdr;
+    memset( &hdr, 0, sizeof(hdr) );
+    strcpy( hdr.magic, OPENING_TREE_MAGIC );
+    hdr.version = OPENING_TREE_VERSION;
+    hdr.nbr_games = nbr;
+    hdr.tdb_len = tdb_len;
+    hdr.max_ply = max_ply_;
+    hdr.nbr_entries = tree.size();
+    size_t n = tree.size();
+    bool ok = fwrite( &hdr, sizeof(hdr), 1, f ) == 1 &&
+              fwrite( &starts[0], sizeof(starts[0]), starts.size(), f ) == starts.size() &&
+              ( n==0 || fwrite( &tree[0], sizeof(tree[0]), n, f ) == n );
+    fclose(f);
+    if( !ok )
+    {
+        error_msg = "Error writing opening tree file " + filename;
+        remove( filename.c_str() );
+        return false;
+    }
+    cprintf( "Opening tree built, %d games, %d plies, %lu entries\n", nbr, max_ply_, (unsigned long)n );
+    return Load( tdb_filename, nbr, error_msg );
+}
+
+bool OpeningTree::Load( const std::string &tdb_filename, uint32_t nbr_games_expected, std::string &error_msg )
+{
+    Clear();
+    std::string filename = SidecarFilename(tdb_filename);
+    if( !file.Open(filename.c_str()) )
+    {
+        error_msg = "No opening tree";
+        return false;
+    }
+    uint64_t tdb_len=0;
+    const OpeningTreeHeader *hdr = reinterpret_cast<const OpeningTreeHeader *>( file.Data() );
+    if( file.Size() < sizeof(OpeningTreeHeader)+OPENING_TREE_BUCKETS_LEN ||
+        0!=memcmp(hdr->magic,OPENING_TREE_MAGIC,sizeof(OPENING_TREE_MAGIC)) || hdr->version!=OPENING_TREE_VERSION ||
+        file.Size() != sizeof(OpeningTreeHeader)+OPENING_TREE_BUCKETS_LEN+hdr->nbr_entries*sizeof(OpeningTreeEntry) )
+        error_msg = "Opening tree file " + filename + " is not valid";
+    else if( !FileLength(tdb_filename,tdb_len) || tdb_len!=hdr->tdb_len || hdr->nbr_games!=nbr_games_expected )
+        error_msg = "Opening tree file " + filename + " is out of date";
+    else
+    {
+        max_ply = hdr->max_ply;
+        nbr_entries = hdr->nbr_entries;
+        buckets = reinterpret_cast<const uint32_t *>( file.Data() + sizeof(OpeningTreeHeader) );
+        entries = reinterpret_cast<const OpeningTreeEntry *>( file.Data() + sizeof(OpeningTreeHeader) + OPENING_TREE_BUCKETS_LEN );
+        loaded = true;
+    }
+    if( !loaded )
+        Clear();
+    return loaded;
+}
+
+bool OpeningTree::Lookup( thc::ChessRules &cr, std::vector<OpeningTreeMove> &moves )
+{
+    moves.clear();
+    if( !loaded )
+        return false;
+    uint64_t hash = cr.Hash64Calculate();
+    uint32_t b = Bucket(hash);
+    const OpeningTreeEntry *end   = entries + buckets[b+1];
+    const OpeningTreeEntry *begin = std::lower_bound( entries + buckets[b], end, hash, predicate_entry_before_hash );
+
+    // Check the moves are legal, in case of a hash collision
+    std::vector<thc::Move> legal;
+    cr.GenLegalMoveList( legal );
+    for( const OpeningTreeEntry *e=begin; e<end && e->hash==hash; e++ )
+    {
+        for( size_t i=0; i<legal.size(); i++ )
+        {
+            thc::Move mv = legal[i];
+            if( mv.src==e->src && mv.dst==e->dst && mv.special==e->special )
+            {
+                OpeningTreeMove otm;
+                otm.mv = mv;
+                otm.nbr_games  = e->nbr_games;
+                otm.white_wins = e->white_wins;
+                otm.black_wins = e->black_wins;
+                otm.draws      = e->draws;
+                otm.average_elo = e->nbr_elo_games ? static_cast<int>(e->elo_total/e->nbr_elo_games) : 0;
+                moves.push_back(otm);
+                break;
+            }
+        }
+    }
+    std::sort( moves.rbegin(), moves.rend() );
+    return moves.size() > 0;
+}
@@ -0,0 +1,88 @@
+/****************************************************************************
+ * Opening tree - an optional sidecar file for a .tdb database, with move
+ *  statistics for every position in the opening phase of every game
+ *  Author:  Bill Forster
+ *  License: MIT license. Full text of license is in associated file LICENSE
+ *  Copyright 2010-2016, Bill Forster <billforsternz at gmail dot com>
+ ****************************************************************************/
+#ifndef OPENING_TREE_H
+#define OPENING_TREE_H
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include "thc.h"
+#include "ProgressBar.h"
+#include "ListableGame.h"
+#include "MappedFile.h"
+
+// Default for the number of plies (half moves) from each game included in the tree
+#define OPENING_TREE_DEFAULT_MAX_PLY    30
+
+// The file is a sorted hash table, entries are sorted by position hash (then move), and
+//  a bucket table, indexed by the top bits of the hash, gives the first entry for each
+//  bucket. So the file can be used directly from a memory mapping
+#define OPENING_TREE_BUCKET_BITS        16
+#define OPENING_TREE_NBR_BUCKETS        (1<<OPENING_TREE_BUCKET_BITS)
+
+// One move in one position, exactly as stored in the file
+struct OpeningTreeEntry
+{
+    uint64_t hash;              // of the position before the move, see Hash64Calculate()
+    uint64_t elo_total;         // sum of the Elo of the player making the move ...
+    uint32_t nbr_elo_games;     // ... over this many games
+    uint32_t nbr_games;
+    uint32_t white_wins;
+    uint32_t black_wins;
+    uint32_t draws;
+    uint8_t  src;               // the move, as thc::Move src, dst and special
+    uint8_t  dst;
+    uint8_t  special;
+    uint8_t  pad;
+};
+
+// Statistics for one move in a position, as returned by Lookup()
+struct OpeningTreeMove
+{
+    thc::Move mv;
+    int nbr_games;
+    int white_wins;
+    int black_wins;
+    int draws;
+    int average_elo;            // 0 if unknown
+
+    // Sort according to number of games
+    bool operator < (const OpeningTreeMove &rhs) const { return nbr_games < rhs.nbr_games; }
+};
+
+class OpeningTree
+{
+public:
+    OpeningTree() { Clear(); }
+    void Clear();
+    bool IsLoaded() { return loaded; }
+    int  MaxPly()   { return max_ply; }
+
+    // The sidecar file lives alongside the .tdb file
+    static std::string SidecarFilename( const std::string &tdb_filename );
+
+    // Build the tree from loaded games (positions up to max_ply only) and write it out
+    bool Build( std::vector< smart_ptr<ListableGame> > &games, int max_ply,
+                const std::string &tdb_filename, std::string &error_msg, ProgressBar *pb=NULL );
+
+    // Map the tree, returns false if there is no tree, or it doesn't match the .tdb file
+    bool Load( const std::string &tdb_filename, uint32_t nbr_games, std::string &error_msg );
+
+    // Get the statistics for each move played in a position, most popular first. Returns
+    //  false if the position isn't in the tree
+    bool Lookup( thc::ChessRules &cr, std::vector<OpeningTreeMove> &moves );
+
+private:
+    bool     loaded;
+    int      max_ply;
+    MappedFile file;
+    const uint32_t         *buckets;    // OPENING_TREE_NBR_BUCKETS+1 entry indexes
+    const OpeningTreeEntry *entries;
+    uint64_t nbr_entries;
+};
+
+#endif  // OPENING_TREE_H
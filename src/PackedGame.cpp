@@ -255,7 +255,7 @@ void PackedGame::Unpack( CompactGame &pact )
     std::string blob;
     Unpack( pact.r, blob );
     CompressMoves press( pact.GetStartPosition() );
-    pact.moves = press.Uncompress( blob );
+    press.Uncompress( blob, pact.moves );
 }
 
 
@@ -7,6 +7,7 @@
 #include <vector>
 #include <map>
 #include <string>
+#include <string.h>
 #include "CompressMoves.h"
 #include "BinDb.h"
 #include "BinaryBlock.h"
@@ -60,6 +61,7 @@ bool PackedGameBinDb::RequestRecycle( int cb_idx )
         cb.players.clear();
         cb.events.clear();
         cb.sites.clear();
+        cb.mapped_file.reset();
         bin_db_control_block_used[cb_idx] = false;
         in_range = true;
     }
@@ -71,6 +73,30 @@ PackedGameBinDbControlBlock& PackedGameBinDb::GetControlBlock( int cb_idx )
     return bin_db_control_blocks[cb_idx];
 }
 
+const MappedFile *PackedGameBinDb::GetMappedFile( int cb_idx )
+{
+    if( cb_idx >= (int)bin_db_control_blocks.size() )
+        return NULL;
+    return bin_db_control_blocks[cb_idx].mapped_file.get();
+}
+
+// All the games using the control block must have been Unmap()ed first
+void PackedGameBinDb::ReleaseMappedFile( int cb_idx )
+{
+    if( cb_idx < (int)bin_db_control_blocks.size() )
+        bin_db_control_blocks[cb_idx].mapped_file.reset();
+}
+
+void PackedGameBinDb::Unmap()
+{
+    if( mapped )
+    {
+        int sz = bin_db_control_blocks[cb_idx].bb.FrozenSize();
+        fields = std::string( mapped, sz + strlen(mapped+sz) );
+        mapped = NULL;
+    }
+}
+
 // Create a PackedGameBinDb from game data
 PackedGameBinDb::PackedGameBinDb(
     uint8_t     cb_idx,
@@ -134,6 +160,7 @@ PackedGameBinDb::PackedGameBinDb(
     fields2 += compressed_moves;
     this->cb_idx=cb_idx;
     this->fields=fields2;
+    this->mapped=NULL;
 }
 
 
@@ -155,7 +182,7 @@ void PackedGameBinDb::Unpack( CompactGame &pact )
     std::string blob;
     Unpack( pact.r, blob );
     CompressMoves press( pact.GetStartPosition() );
-    pact.moves = press.Uncompress( blob );
+    press.Uncompress( blob, pact.moves );
 }
 
 
@@ -168,22 +195,25 @@ void PackedGameBinDb::Unpack( Roster &r, std::string &blob )
 void PackedGameBinDb::Unpack( std::string &blob )
 {
     PackedGameBinDbControlBlock *cb = &bin_db_control_blocks[cb_idx];
-    blob = fields.substr( cb->bb.Size() );
+    if( mapped )
+        blob = std::string( mapped + cb->bb.Size() );
+    else
+        blob = fields.substr( cb->bb.Size() );
 }
 
 void PackedGameBinDb::Unpack( Roster &r )
 {
     PackedGameBinDbControlBlock *cb = &bin_db_control_blocks[cb_idx];
-    int ievent = cb->bb.Read(0,&fields[0]);       // Event
-    int isite  = cb->bb.Read(1,&fields[0]);       // Site
-    int iwhite = cb->bb.Read(2,&fields[0]);       // White
-    int iblack = cb->bb.Read(3,&fields[0]);       // Black
-    uint32_t date = cb->bb.Read(4,&fields[0]);    // Date 19 bits, format yyyyyyyyyymmmmddddd, (year values have 1500 offset)
-    int round = cb->bb.Read(5,&fields[0]);        // Round for now 16 bits -> rrrrrrbbbbbbbbbb   rr=round (0-63), bb=board(0-1023)
-    int eco = cb->bb.Read(6,&fields[0]);          // ECO For now 500 codes (9 bits) (A..E)(00..99)
-    int result = cb->bb.Read(7,&fields[0]);       // Result (2 bits)
-    int white_elo = cb->bb.Read(8,&fields[0]);    // WhiteElo 12 bits (range 0..4095)
-    int black_elo = cb->bb.Read(9,&fields[0]);    // BlackElo 12 bits (range 0..4095)
+    int ievent = cb->bb.Read(0,Ptr());       // Event
+    int isite  = cb->bb.Read(1,Ptr());       // Site
+    int iwhite = cb->bb.Read(2,Ptr());       // White
+    int iblack = cb->bb.Read(3,Ptr());       // Black
+    uint32_t date = cb->bb.Read(4,Ptr());    // Date 19 bits, format yyyyyyyyyymmmmddddd, (year values have 1500 offset)
+    int round = cb->bb.Read(5,Ptr());        // Round for now 16 bits -> rrrrrrbbbbbbbbbb   rr=round (0-63), bb=board(0-1023)
+    int eco = cb->bb.Read(6,Ptr());          // ECO For now 500 codes (9 bits) (A..E)(00..99)
+    int result = cb->bb.Read(7,Ptr());       // Result (2 bits)
+    int white_elo = cb->bb.Read(8,Ptr());    // WhiteElo 12 bits (range 0..4095)
+    int black_elo = cb->bb.Read(9,Ptr());    // BlackElo 12 bits (range 0..4095)
     std::string sdate;
     std::string sround;
     std::string seco;
@@ -211,28 +241,28 @@ void PackedGameBinDb::Unpack( Roster &r )
 const char *PackedGameBinDb::Event()
 {
     PackedGameBinDbControlBlock *cb = &bin_db_control_blocks[cb_idx];
-    int i = cb->bb.Read(0,&fields[0]);
+    int i = cb->bb.Read(0,Ptr());
     return cb->events[i].c_str();
 }
 
 const char *PackedGameBinDb::Site()
 {
     PackedGameBinDbControlBlock *cb = &bin_db_control_blocks[cb_idx];
-    int i = cb->bb.Read(1,&fields[0]);
+    int i = cb->bb.Read(1,Ptr());
     return cb->sites[i].c_str();
 }
 
 const char *PackedGameBinDb::White()
 {
     PackedGameBinDbControlBlock *cb = &bin_db_control_blocks[cb_idx];
-    int i = cb->bb.Read(2,&fields[0]);
+    int i = cb->bb.Read(2,Ptr());
     return cb->players[i].c_str();
 }
 
 const char *PackedGameBinDb::Black()
 {
     PackedGameBinDbControlBlock *cb = &bin_db_control_blocks[cb_idx];
-    int i = cb->bb.Read(3,&fields[0]);
+    int i = cb->bb.Read(3,Ptr());
     return cb->players[i].c_str();
 }
 
@@ -241,7 +271,7 @@ const char *PackedGameBinDb::Result()
     PackedGameBinDbControlBlock *cb = &bin_db_control_blocks[cb_idx];
     std::string& sresult = pool[pool_idx++];
     pool_idx &= (POOL_SIZE-1);
-    int result = cb->bb.Read(7,&fields[0]);       // Result (2 bits)
+    int result = cb->bb.Read(7,Ptr());       // Result (2 bits)
     Bin2Result(result,sresult);
     return sresult.c_str();
 }
@@ -251,7 +281,7 @@ const char *PackedGameBinDb::Round()
     PackedGameBinDbControlBlock *cb = &bin_db_control_blocks[cb_idx];
     std::string& sround = pool[pool_idx++];
     pool_idx &= (POOL_SIZE-1);
-    int round = cb->bb.Read(5,&fields[0]);        // Round for now 16 bits -> rrrrrrbbbbbbbbbb   rr=round (0-63), cb->bb=board(0-1023)
+    int round = cb->bb.Read(5,Ptr());        // Round for now 16 bits -> rrrrrrbbbbbbbbbb   rr=round (0-63), cb->bb=board(0-1023)
     Bin2Round (round,sround);
     return sround.c_str();
 }
@@ -261,7 +291,7 @@ const char *PackedGameBinDb::Date()
     PackedGameBinDbControlBlock *cb = &bin_db_control_blocks[cb_idx];
     std::string& sdate = pool[pool_idx++];
     pool_idx &= (POOL_SIZE-1);
-    uint32_t date = cb->bb.Read(4,&fields[0]);    // Date 19 bits, format yyyyyyyyyymmmmddddd, (year values have 1500 offset)
+    uint32_t date = cb->bb.Read(4,Ptr());    // Date 19 bits, format yyyyyyyyyymmmmddddd, (year values have 1500 offset)
     Bin2Date  (date,sdate);
     return sdate.c_str();
 }
@@ -271,7 +301,7 @@ const char *PackedGameBinDb::Eco()
     PackedGameBinDbControlBlock *cb = &bin_db_control_blocks[cb_idx];
     std::string& seco = pool[pool_idx++];
     pool_idx &= (POOL_SIZE-1);
-    int eco = cb->bb.Read(6,&fields[0]);          // ECO For now 500 codes (9 bits) (A..E)(00..99)
+    int eco = cb->bb.Read(6,Ptr());          // ECO For now 500 codes (9 bits) (A..E)(00..99)
     Bin2Eco   (eco,seco);
     return seco.c_str();
 }
@@ -279,7 +309,7 @@ const char *PackedGameBinDb::Eco()
 const char *PackedGameBinDb::WhiteElo()
 {
     PackedGameBinDbControlBlock *cb = &bin_db_control_blocks[cb_idx];
-    int white_elo = cb->bb.Read(8,&fields[0]);    // WhiteElo 12 bits (range 0..4095)
+    int white_elo = cb->bb.Read(8,Ptr());    // WhiteElo 12 bits (range 0..4095)
     std::string& swhite_elo = pool[pool_idx++];
     pool_idx &= (POOL_SIZE-1);
     Bin2Elo   (white_elo,swhite_elo);
@@ -289,7 +319,7 @@ const char *PackedGameBinDb::WhiteElo()
 const char *PackedGameBinDb::BlackElo()
 {
     PackedGameBinDbControlBlock *cb = &bin_db_control_blocks[cb_idx];
-    int black_elo = cb->bb.Read(9,&fields[0]);    // BlackElo 12 bits (range 0..4095)
+    int black_elo = cb->bb.Read(9,Ptr());    // BlackElo 12 bits (range 0..4095)
     std::string& sblack_elo = pool[pool_idx++];
     pool_idx &= (POOL_SIZE-1);
     Bin2Elo   (black_elo,sblack_elo);
@@ -9,12 +9,15 @@
 
 #include <vector>
 #include <map>
+#include <memory>
 #include "CompactGame.h"
 #include "BinaryBlock.h"
+#include "MappedFile.h"
 
 struct PackedGameBinDbControlBlock
 {
     BinaryBlock bb;
+    std::shared_ptr<MappedFile> mapped_file;   // if games were loaded without copying, they point in here
     std::vector<std::string> players;
     std::vector<std::string> events;
     std::vector<std::string> sites;
@@ -30,18 +33,28 @@ class PackedGameBinDb
 private:
     uint8_t     cb_idx;     // control block idx
     std::string fields;
+    const char *mapped;     // if not NULL, fields are in the control block's mapped file instead
+    const char *Ptr() const { return mapped ? mapped : fields.c_str(); }
 
 public:
     uint8_t     GetControlBlockIdx() { return cb_idx; }
     static int  AllocateNewControlBlock();
     static bool RequestRecycle( int cb_idx );
     static PackedGameBinDbControlBlock& GetControlBlock(int cb_idx);
+    static const MappedFile *GetMappedFile( int cb_idx );   // NULL if none (or out of range)
+    static void ReleaseMappedFile( int cb_idx );
 
-    bool Empty() { return fields.size() == 0; }
-    PackedGameBinDb() {}
+    bool Empty() { return !mapped && fields.size()==0; }
+    PackedGameBinDb() { mapped=NULL; }
 
     // Create a PackedGameBinDb from binary data read from a .tdb file
-    PackedGameBinDb( uint8_t cb_idx, std::string fields ) { this->cb_idx=cb_idx; this->fields=fields; }
+    PackedGameBinDb( uint8_t cb_idx, std::string fields ) { this->cb_idx=cb_idx; this->fields=fields; mapped=NULL; }
+
+    // Create a PackedGameBinDb that points at a game in a memory mapped .tdb file, no copying
+    PackedGameBinDb( uint8_t cb_idx, const char *mapped_fields ) { this->cb_idx=cb_idx; mapped=mapped_fields; }
+
+    // Copy the fields out of the memory mapped file, so that the mapping can be released
+    void Unmap();
 
     // Create a PackedGameBinDb from game data
     PackedGameBinDb(
@@ -80,18 +93,18 @@ public:
     {
         PackedGameBinDbControlBlock *cb = &bin_db_control_blocks[cb_idx];
         int sz = cb->bb.FrozenSize();
-        return fields.c_str() + sz;
+        return Ptr() + sz;
     }
-    int EventBin()    { return bin_db_control_blocks[cb_idx].bb.Read(0,&fields[0]); }
-    int SiteBin()     { return bin_db_control_blocks[cb_idx].bb.Read(1,&fields[0]); }
-    int WhiteBin()    { return bin_db_control_blocks[cb_idx].bb.Read(2,&fields[0]); }
-    int BlackBin()    { return bin_db_control_blocks[cb_idx].bb.Read(3,&fields[0]); }
-    int DateBin()     { return bin_db_control_blocks[cb_idx].bb.Read(4,&fields[0]); }
-    int RoundBin()    { return bin_db_control_blocks[cb_idx].bb.Read(5,&fields[0]); }
-    int EcoBin()      { return bin_db_control_blocks[cb_idx].bb.Read(6,&fields[0]); }
-    int ResultBin()   { return bin_db_control_blocks[cb_idx].bb.Read(7,&fields[0]); }
-    int WhiteEloBin() { return bin_db_control_blocks[cb_idx].bb.Read(8,&fields[0]); }
-    int BlackEloBin() { return bin_db_control_blocks[cb_idx].bb.Read(9,&fields[0]); }
+    int EventBin()    { return bin_db_control_blocks[cb_idx].bb.Read(0,Ptr()); }
+    int SiteBin()     { return bin_db_control_blocks[cb_idx].bb.Read(1,Ptr()); }
+    int WhiteBin()    { return bin_db_control_blocks[cb_idx].bb.Read(2,Ptr()); }
+    int BlackBin()    { return bin_db_control_blocks[cb_idx].bb.Read(3,Ptr()); }
+    int DateBin()     { return bin_db_control_blocks[cb_idx].bb.Read(4,Ptr()); }
+    int RoundBin()    { return bin_db_control_blocks[cb_idx].bb.Read(5,Ptr()); }
+    int EcoBin()      { return bin_db_control_blocks[cb_idx].bb.Read(6,Ptr()); }
+    int ResultBin()   { return bin_db_control_blocks[cb_idx].bb.Read(7,Ptr()); }
+    int WhiteEloBin() { return bin_db_control_blocks[cb_idx].bb.Read(8,Ptr()); }
+    int BlackEloBin() { return bin_db_control_blocks[cb_idx].bb.Read(9,Ptr()); }
 };
 
 #endif // PACKED_GAME_BIN_DB_H
@@ -7,18 +7,19 @@
 #include "thc.h"
 #include "DebugPrintf.h"
 #include "PatternMatch.h"
+#include "MaterialSignature.h"
+#include "PawnIndex.h"
 
 // Constructor
 PatternMatch::PatternMatch()
 {
     ready = false;
+    use_avx2 = false;
 }
 
 // Prepare for series of calls to Test()
 void PatternMatch::PrimePattern( const thc::ChessPosition *rover )
 {
-    in_a_row = 0;
-
     // Calculate number of positions to test each time (note that 3 is actually
     //  used to indicate 2 tests -
     //     reflect and not reverse = 2
@@ -237,17 +238,66 @@ void PatternMatch::PrimePattern( const thc::ChessPosition *rover )
                 }
             }
         }
+
+        // Pack the target for BoardCompareMaskedAvx2()
+        memcpy( &board_masks[i*64],    &target->rank8_mask, 8 );
+        memcpy( &board_masks[i*64+8],  &target->rank7_mask, 8 );
+        memcpy( &board_masks[i*64+16], &target->rank6_mask, 8 );
+        memcpy( &board_masks[i*64+24], &target->rank5_mask, 8 );
+        memcpy( &board_masks[i*64+32], &target->rank4_mask, 8 );
+        memcpy( &board_masks[i*64+40], &target->rank3_mask, 8 );
+        memcpy( &board_masks[i*64+48], &target->rank2_mask, 8 );
+        memcpy( &board_masks[i*64+56], &target->rank1_mask, 8 );
+        memcpy( &board_targets[i*64], target->cp.squares, 64 );
+    }
+
+    // Which targets to test, in order normal, mirror, reverse, reverse mirror
+    unsigned int targets_tested;
+    switch( reflect_and_reverse )
+    {
+        default:
+        case 1: targets_tested = 1;   break;
+        case 2: targets_tested = 3;   break;
+        case 3: targets_tested = 5;   break;   // reflect_and_reverse==3 means do target 0 and target 2
+        case 4: targets_tested = 15;  break;
     }
+    nbr_board_targets = (reflect_and_reverse==3 ? 3 : reflect_and_reverse);
+    white_to_move_targets = 0;
+    black_to_move_targets = 0;
+    for( int i=0; i<4; i++ )
+    {
+        const PatternParameters &p = (i<2 ? target_n.parm : target_r.parm);
+        if( p.either_to_move || p.white_to_move )
+            white_to_move_targets |= (1<<i);
+        if( p.either_to_move || !p.white_to_move )
+            black_to_move_targets |= (1<<i);
+    }
+    white_to_move_targets &= targets_tested;
+    black_to_move_targets &= targets_tested;
+    use_avx2 = BoardCompareAvx2Available();
+    cprintf( "Pattern match, %s\n", use_avx2 ? "AVX2 compare" : "scalar compare" );
 }
 
 // Test against criteria
-bool PatternMatch::TestPattern( bool &reverse, bool white, const char *squares_rover )
+bool PatternMatch::TestPattern( bool &reverse, bool white, const char *squares_rover ) const
 {
+    // With AVX2 test all targets in one pass, first match (in order normal, mirror, reverse,
+    //  reverse mirror) wins
+    if( use_avx2 )
+    {
+        unsigned int bits = BoardCompareMaskedAvx2( squares_rover, board_masks, board_targets, nbr_board_targets );
+        bits &= (white ? white_to_move_targets : black_to_move_targets);
+        if( bits == 0 )
+            return false;
+        reverse = ((bits&3) == 0);
+        return true;
+    }
+
     //static bool debug;
     bool match=false;
     for( int i=0; !match && i<reflect_and_reverse; i++ )
     {
-        PatternMatchTarget *target;
+        const PatternMatchTarget *target;
         switch(i)
         {
             default:
@@ -329,7 +379,7 @@ void PatternMatch::PrimeMaterialBalance()
 {
 }
 
-void PatternMatch::InitSide( MpsSide *side, bool white, const char *squares_rover )
+void PatternMatch::InitSide( MpsSide *side, bool white, const char *squares_rover ) const
 {
     memset(side,0,sizeof(*side));
     side->white = white;
@@ -379,7 +429,7 @@ void PatternMatch::InitSide( MpsSide *side, bool white, const char *squares_rove
     }
 }
 
-bool PatternMatch::TestMaterialBalance( bool &reverse, MpsSide *ws, MpsSide *bs, const char *squares_rover, bool may_need_to_rebuild_side )
+bool PatternMatch::TestMaterialBalance( bool &reverse, MpsSide *ws, MpsSide *bs, const char *squares_rover, bool may_need_to_rebuild_side, int &in_a_row ) const
 {
     bool match = TestMaterialBalanceInner(reverse,ws,bs,squares_rover,may_need_to_rebuild_side);
     if( !match )
@@ -395,16 +445,17 @@ bool PatternMatch::TestMaterialBalance( bool &reverse, MpsSide *ws, MpsSide *bs,
     return match;
 }
 
-bool PatternMatch::TestMaterialBalanceInner( bool &reverse, MpsSide *ws, MpsSide *bs, const char *squares_rover, bool may_need_to_rebuild_side )
+bool PatternMatch::TestMaterialBalanceInner( bool &reverse, MpsSide *ws, MpsSide *bs, const char *squares_rover, bool may_need_to_rebuild_side ) const
 {
     bool match=false;
     if( may_need_to_rebuild_side && !ws->fast_mode  )
         InitSide( ws, true, squares_rover );
     if( may_need_to_rebuild_side && !bs->fast_mode  )
         InitSide( bs, false, squares_rover );
+    unsigned int bits = use_avx2 ? BoardCompareMaskedAvx2(squares_rover,board_masks,board_targets,nbr_board_targets) : 0;
     for( int test=0; !match && test<reflect_and_reverse; test++ )
     {
-        PatternMatchTarget *target;
+        const PatternMatchTarget *target;
         switch(test)
         {
             default:
@@ -418,6 +469,9 @@ bool PatternMatch::TestMaterialBalanceInner( bool &reverse, MpsSide *ws, MpsSide
         //if( !parm.lockdown_any )
         //    match = true;
         //else
+        if( use_avx2 )
+            match = ((bits>>test) & 1) != 0;
+        else
         {
             match =
             (*reinterpret_cast<const uint64_t *>(&squares_rover[40]) & target->rank3_mask) == *target->rank3_target_ptr &&
@@ -430,86 +484,7 @@ bool PatternMatch::TestMaterialBalanceInner( bool &reverse, MpsSide *ws, MpsSide
             (*reinterpret_cast<const uint64_t *>(&squares_rover[48]) & target->rank2_mask) == *target->rank2_target_ptr;
         }
         if( match )
-        {
-            match =
-            (
-                (target->parm.more_pieces_wp ?
-                ws->nbr_pawns   >= target->side_w.nbr_pawns  :
-                ws->nbr_pawns   == target->side_w.nbr_pawns)   &&
-                (target->parm.more_pieces_wr ?
-                ws->nbr_rooks   >= target->side_w.nbr_rooks  :
-                ws->nbr_rooks   == target->side_w.nbr_rooks)   &&
-                (target->parm.more_pieces_wn ?
-                ws->nbr_knights >= target->side_w.nbr_knights :
-                ws->nbr_knights == target->side_w.nbr_knights) &&
-                (target->parm.more_pieces_wq ?
-                ws->nbr_queens  >= target->side_w.nbr_queens  :
-                ws->nbr_queens  == target->side_w.nbr_queens)  &&
-                (target->parm.more_pieces_bp ?
-                bs->nbr_pawns   >= target->side_b.nbr_pawns  :
-                bs->nbr_pawns   == target->side_b.nbr_pawns)   &&
-                (target->parm.more_pieces_br ?
-                bs->nbr_rooks   >= target->side_b.nbr_rooks  :
-                bs->nbr_rooks   == target->side_b.nbr_rooks)   &&
-                (target->parm.more_pieces_bn ?
-                bs->nbr_knights >= target->side_b.nbr_knights  :
-                bs->nbr_knights == target->side_b.nbr_knights) &&
-                (target->parm.more_pieces_bq ?
-                bs->nbr_queens  >= target->side_b.nbr_queens  :
-                bs->nbr_queens  == target->side_b.nbr_queens)
-            );
-        }
-        if( match )
-        {
-            if( target->parm.bishops_must_be_same_colour )
-            {
-                match =
-                (
-                    (target->parm.more_pieces_wb ?
-                    ws->nbr_light_bishops >= target->side_w.nbr_light_bishops :
-                    ws->nbr_light_bishops == target->side_w.nbr_light_bishops) &&
-                    (target->parm.more_pieces_wb ?
-                    ws->nbr_dark_bishops  >= target->side_w.nbr_dark_bishops :
-                    ws->nbr_dark_bishops  == target->side_w.nbr_dark_bishops)  &&
-                    (target->parm.more_pieces_bb ?
-                    bs->nbr_light_bishops >= target->side_b.nbr_light_bishops :
-                    bs->nbr_light_bishops == target->side_b.nbr_light_bishops) &&
-                    (target->parm.more_pieces_bb ?
-                    bs->nbr_dark_bishops  >= target->side_b.nbr_dark_bishops :
-                    bs->nbr_dark_bishops  == target->side_b.nbr_dark_bishops)
-                );
-            }
-            else
-            {
-                match =
-                (
-                    (target->parm.more_pieces_wb ?
-                        (ws->nbr_light_bishops +
-                            ws->nbr_dark_bishops)
-                                                >=
-                                            (target->side_w.nbr_light_bishops +
-                                                target->side_w.nbr_dark_bishops)  :
-                        (ws->nbr_light_bishops +
-                            ws->nbr_dark_bishops)
-                                                ==
-                                            (target->side_w.nbr_light_bishops +
-                                                target->side_w.nbr_dark_bishops)
-                    )                                                             &&
-                    (target->parm.more_pieces_bb ?
-                        (bs->nbr_light_bishops +
-                            bs->nbr_dark_bishops)
-                                                >=
-                                            (target->side_b.nbr_light_bishops +
-                                                target->side_b.nbr_dark_bishops)  :
-                        (bs->nbr_light_bishops +
-                            bs->nbr_dark_bishops)
-                                                ==
-                                            (target->side_b.nbr_light_bishops +
-                                                target->side_b.nbr_dark_bishops)
-                    )
-                );
-            }
-        }
+            match = MaterialCountsMatch( target, ws, bs );
 
         if( match && target->parm.pawns_must_be_on_same_files )
         {
@@ -561,3 +536,183 @@ bool PatternMatch::TestMaterialBalanceInner( bool &reverse, MpsSide *ws, MpsSide
     }
     return match;
 }
+
+// Compare piece counts (but not pawn files) for a material balance search
+bool PatternMatch::MaterialCountsMatch( const PatternMatchTarget *target, const MpsSide *ws, const MpsSide *bs ) const
+{
+    bool match =
+    (
+        (target->parm.more_pieces_wp ?
+        ws->nbr_pawns   >= target->side_w.nbr_pawns  :
+        ws->nbr_pawns   == target->side_w.nbr_pawns)   &&
+        (target->parm.more_pieces_wr ?
+        ws->nbr_rooks   >= target->side_w.nbr_rooks  :
+        ws->nbr_rooks   == target->side_w.nbr_rooks)   &&
+        (target->parm.more_pieces_wn ?
+        ws->nbr_knights >= target->side_w.nbr_knights :
+        ws->nbr_knights == target->side_w.nbr_knights) &&
+        (target->parm.more_pieces_wq ?
+        ws->nbr_queens  >= target->side_w.nbr_queens  :
+        ws->nbr_queens  == target->side_w.nbr_queens)  &&
+        (target->parm.more_pieces_bp ?
+        bs->nbr_pawns   >= target->side_b.nbr_pawns  :
+        bs->nbr_pawns   == target->side_b.nbr_pawns)   &&
+        (target->parm.more_pieces_br ?
+        bs->nbr_rooks   >= target->side_b.nbr_rooks  :
+        bs->nbr_rooks   == target->side_b.nbr_rooks)   &&
+        (target->parm.more_pieces_bn ?
+        bs->nbr_knights >= target->side_b.nbr_knights  :
+        bs->nbr_knights == target->side_b.nbr_knights) &&
+        (target->parm.more_pieces_bq ?
+        bs->nbr_queens  >= target->side_b.nbr_queens  :
+        bs->nbr_queens  == target->side_b.nbr_queens)
+    );
+    if( match )
+    {
+        if( target->parm.bishops_must_be_same_colour )
+        {
+            match =
+            (
+                (target->parm.more_pieces_wb ?
+                ws->nbr_light_bishops >= target->side_w.nbr_light_bishops :
+                ws->nbr_light_bishops == target->side_w.nbr_light_bishops) &&
+                (target->parm.more_pieces_wb ?
+                ws->nbr_dark_bishops  >= target->side_w.nbr_dark_bishops :
+                ws->nbr_dark_bishops  == target->side_w.nbr_dark_bishops)  &&
+                (target->parm.more_pieces_bb ?
+                bs->nbr_light_bishops >= target->side_b.nbr_light_bishops :
+                bs->nbr_light_bishops == target->side_b.nbr_light_bishops) &&
+                (target->parm.more_pieces_bb ?
+                bs->nbr_dark_bishops  >= target->side_b.nbr_dark_bishops :
+                bs->nbr_dark_bishops  == target->side_b.nbr_dark_bishops)
+            );
+        }
+        else
+        {
+            match =
+            (
+                (target->parm.more_pieces_wb ?
+                    (ws->nbr_light_bishops +
+                        ws->nbr_dark_bishops)
+                                            >=
+                                        (target->side_w.nbr_light_bishops +
+                                            target->side_w.nbr_dark_bishops)  :
+                    (ws->nbr_light_bishops +
+                        ws->nbr_dark_bishops)
+                                            ==
+                                        (target->side_w.nbr_light_bishops +
+                                            target->side_w.nbr_dark_bishops)
+                )                                                             &&
+                (target->parm.more_pieces_bb ?
+                    (bs->nbr_light_bishops +
+                        bs->nbr_dark_bishops)
+                                            >=
+                                        (target->side_b.nbr_light_bishops +
+                                            target->side_b.nbr_dark_bishops)  :
+                    (bs->nbr_light_bishops +
+                        bs->nbr_dark_bishops)
+                                            ==
+                                        (target->side_b.nbr_light_bishops +
+                                            target->side_b.nbr_dark_bishops)
+                )
+            );
+        }
+    }
+    return match;
+}
+
+// Can a position with this material signature (see MaterialSignature.h) match a material
+//  balance search? Used to rule out games (and plies) without playing through them
+bool PatternMatch::TestMaterialSignature( uint64_t signature ) const
+{
+    MpsSide ws, bs;
+    ws.nbr_pawns         = MaterialSignatureCount( signature, MS_WP );
+    ws.nbr_knights       = MaterialSignatureCount( signature, MS_WN );
+    ws.nbr_light_bishops = MaterialSignatureCount( signature, MS_WLB );
+    ws.nbr_dark_bishops  = MaterialSignatureCount( signature, MS_WDB );
+    ws.nbr_rooks         = MaterialSignatureCount( signature, MS_WR );
+    ws.nbr_queens        = MaterialSignatureCount( signature, MS_WQ );
+    bs.nbr_pawns         = MaterialSignatureCount( signature, MS_BP );
+    bs.nbr_knights       = MaterialSignatureCount( signature, MS_BN );
+    bs.nbr_light_bishops = MaterialSignatureCount( signature, MS_BLB );
+    bs.nbr_dark_bishops  = MaterialSignatureCount( signature, MS_BDB );
+    bs.nbr_rooks         = MaterialSignatureCount( signature, MS_BR );
+    bs.nbr_queens        = MaterialSignatureCount( signature, MS_BQ );
+    if( ws.nbr_pawns > 8 )
+        ws.nbr_pawns = 8;   // as for InitSide()
+    if( bs.nbr_pawns > 8 )
+        bs.nbr_pawns = 8;
+    bool match = false;
+    for( int test=0; !match && test<reflect_and_reverse; test++ )
+    {
+        const PatternMatchTarget *target;
+        switch(test)
+        {
+            default:
+            case 0: target = &target_n;   break;
+            case 1: target = &target_m;   break;
+            case 2: target = &target_r;   break;
+            case 3: target = &target_rm;  break;
+        }
+        if( reflect_and_reverse==3 && test==1 )    // reflect_and_reverse==3 means do i==0 and i==2
+            continue;
+        match = MaterialCountsMatch( target, &ws, &bs );
+    }
+    return match;
+}
+
+// Pawn structure hashes (see PawnIndex.h) that any match must have, one per target
+//  tested. Returns false if some target doesn't fix the pawns of at least one side
+bool PatternMatch::PawnStructureQuery( std::vector<uint64_t> &hashes ) const
+{
+    hashes.clear();
+    for( int test=0; test<reflect_and_reverse; test++ )
+    {
+        const PatternMatchTarget *target;
+        switch(test)
+        {
+            default:
+            case 0: target = &target_n;   break;
+            case 1: target = &target_m;   break;
+            case 2: target = &target_r;   break;
+            case 3: target = &target_rm;  break;
+        }
+        if( reflect_and_reverse==3 && test==1 )    // reflect_and_reverse==3 means do i==0 and i==2
+            continue;
+
+        // A pattern with no extra pieces allowed fixes everything. A material balance
+        //  search fixes a side's pawns if they are all locked down and no extra pawns
+        //  are allowed (after PrimePattern() only locked down squares remain in
+        //  the target)
+        bool white_fixed = target->parm.dont_allow_more_pieces;
+        bool black_fixed = target->parm.dont_allow_more_pieces;
+        if( target->parm.material_balance )
+        {
+            int nbr_white_locked=0, nbr_black_locked=0;
+            for( int i=0; i<64; i++ )
+            {
+                char c = target->cp.squares[i];
+                if( c == 'P' )
+                    nbr_white_locked++;
+                else if( c == 'p' )
+                    nbr_black_locked++;
+            }
+            white_fixed = (!target->parm.more_pieces_wp && nbr_white_locked==target->side_w.nbr_pawns);
+            black_fixed = (!target->parm.more_pieces_bp && nbr_black_locked==target->side_b.nbr_pawns);
+        }
+        PawnHashes pawn_hashes;
+        PawnHashCalculate( target->cp.squares, pawn_hashes );
+        if( white_fixed && black_fixed )
+            hashes.push_back( pawn_hashes.both );
+        else if( white_fixed )
+            hashes.push_back( pawn_hashes.white );
+        else if( black_fixed )
+            hashes.push_back( pawn_hashes.black );
+        else
+        {
+            hashes.clear();
+            return false;
+        }
+    }
+    return true;
+}
@@ -6,8 +6,10 @@
  ****************************************************************************/
 #ifndef PATTERN_MATCH_H
 #define PATTERN_MATCH_H
+#include <vector>
 #include "thc.h"
 #include "MemoryPositionSearchSide.h"
+#include "BoardCompare.h"
 
 struct PATTERN_STATS
 {
@@ -130,33 +132,40 @@ public:
         PrimeMaterialBalance();
     }
 
-    // Start of game
-    void NewGame() { in_a_row=0; }
-
     // Search Complete ?
     void NowReady() { ready = true; }
     bool IsReady()  { return ready; }
 
-    // Test for pattern
-    bool Test( bool &reverse, MpsSide *ws, MpsSide *bs, bool white, const char *squares_rover, bool may_need_to_rebuild_side )
+    // Test for pattern. Once primed a PatternMatch isn't changed by testing, so one object can be
+    //  shared by several search threads. Each thread has its own sides (ws and bs) and in_a_row,
+    //  a count of consecutive matching plies (set it to zero at the start of each game)
+    bool Test( bool &reverse, MpsSide *ws, MpsSide *bs, bool white, const char *squares_rover, bool may_need_to_rebuild_side, int &in_a_row ) const
     {
         if( parm.material_balance )
-            return TestMaterialBalance( reverse, ws, bs, squares_rover, may_need_to_rebuild_side );
+            return TestMaterialBalance( reverse, ws, bs, squares_rover, may_need_to_rebuild_side, in_a_row );
         else
             return TestPattern( reverse, white, squares_rover );
     }
 
+    // Test a material signature (piece counts only) against a material balance search
+    bool TestMaterialSignature( uint64_t signature ) const;
+
+    // Pawn structure hashes (see PawnIndex.h) that any match must have, one per target
+    //  tested. Returns false if some target doesn't fix the pawns of at least one side
+    bool PawnStructureQuery( std::vector<uint64_t> &hashes ) const;
+
 private:
 
     // Prime
     void PrimePattern( const thc::ChessPosition *rover );
     void PrimeMaterialBalance();
-    void InitSide( MpsSide *side, bool white, const char *squares_rover );
+    void InitSide( MpsSide *side, bool white, const char *squares_rover ) const;
 
     // Test against criteria
-    bool TestPattern( bool &reverse, bool white, const char *squares_rover );
-    bool TestMaterialBalance( bool &reverse, MpsSide *ws, MpsSide *bs, const char *squares_rover, bool may_need_to_rebuild_side );
-    bool TestMaterialBalanceInner( bool &reverse, MpsSide *ws, MpsSide *bs, const char *squares_rover, bool may_need_to_rebuild_side );
+    bool TestPattern( bool &reverse, bool white, const char *squares_rover ) const;
+    bool TestMaterialBalance( bool &reverse, MpsSide *ws, MpsSide *bs, const char *squares_rover, bool may_need_to_rebuild_side, int &in_a_row ) const;
+    bool TestMaterialBalanceInner( bool &reverse, MpsSide *ws, MpsSide *bs, const char *squares_rover, bool may_need_to_rebuild_side ) const;
+    bool MaterialCountsMatch( const PatternMatchTarget *target, const MpsSide *ws, const MpsSide *bs ) const;
 
     // Working positions
     PatternMatchTarget target_n;    // normal
@@ -164,6 +173,14 @@ private:
     PatternMatchTarget target_r;    // reverse colours
     PatternMatchTarget target_rm;   // reverse colours mirror image
 
+    // The four targets' masks and (masked) squares, packed for BoardCompareMaskedAvx2()
+    bool use_avx2;
+    char board_masks[BOARD_COMPARE_MAX_TARGETS*64];
+    char board_targets[BOARD_COMPARE_MAX_TARGETS*64];
+    int  nbr_board_targets;
+    unsigned int white_to_move_targets;     // bit i set if target i is tested in positions with white to move
+    unsigned int black_to_move_targets;     // bit i set if target i is tested in positions with black to move
+
     const uint64_t *rank8_ptr;
     const uint64_t *rank7_ptr;
     const uint64_t *rank6_ptr;
@@ -175,7 +192,6 @@ private:
 
     // Reflection and Reversal loop controller
     int reflect_and_reverse;
-    int in_a_row;
     bool ready;
 };
 
@@ -0,0 +1,304 @@
+/****************************************************************************
+ * Pawn index - an optional sidecar file for a .tdb database, mapping pawn
+ *  structure hashes to the games (and ranges of plies) with those structures
+ *  Author:  Bill Forster
+ *  License: MIT license. Full text of license is in associated file LICENSE
+ *  Copyright 2010-2016, Bill Forster <billforsternz at gmail dot com>
+ ****************************************************************************/
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+#include "thc.h"
+#include "DebugPrintf.h"
+#include "AutoTimer.h"
+#include "CompressMoves.h"
+#include "PawnIndex.h"
+
+// File format is a PawnIndexHeader, then the hashes, then the game numbers, then the first
+//  plies, then the last plies
+#define PAWN_INDEX_MAGIC    "Tarrasch pawn index"
+#define PAWN_INDEX_VERSION  1
+struct PawnIndexHeader
+{
+    char     magic[32];
+    uint32_t version;
+    uint32_t nbr_games;         // the index matches a .tdb file with this many games ...
+    uint64_t tdb_len;           // ... and this length
+    uint64_t nbr_postings;
+};
+
+// One entry while building
+struct PawnIndexEntry
+{
+    uint64_t       hash;
+    uint32_t       game_nbr;
+    unsigned short ply_first;
+    unsigned short ply_last;
+    bool operator < (const PawnIndexEntry &rhs) const
+    {
+        if( hash != rhs.hash )
+            return hash < rhs.hash;
+        if( game_nbr != rhs.game_nbr )
+            return game_nbr < rhs.game_nbr;
+        return ply_first < rhs.ply_first;
+    }
+};
+
+// Zobrist keys for white and black pawns, and salts for the single side hashes
+struct PawnKeys
+{
+    uint64_t white[64];
+    uint64_t black[64];
+    uint64_t white_salt;
+    uint64_t black_salt;
+    PawnKeys()
+    {
+        uint64_t seed = 0x5041574e53ULL;    // "PAWNS"
+        for( int i=0; i<64; i++ )
+            white[i] = Next(seed);
+        for( int i=0; i<64; i++ )
+            black[i] = Next(seed);
+        white_salt = Next(seed);
+        black_salt = Next(seed);
+    }
+    static uint64_t Next( uint64_t &seed )  // splitmix64
+    {
+        uint64_t z = (seed += 0x9e3779b97f4a7c15ULL);
+        z = (z ^ (z>>30)) * 0xbf58476d1ce4e5b9ULL;
+        z = (z ^ (z>>27)) * 0x94d049bb133111ebULL;
+        return z ^ (z>>31);
+    }
+};
+static const PawnKeys pawn_keys;
+
+void PawnHashCalculate( const char *squares, PawnHashes &hashes )
+{
+    uint64_t white = 0;
+    uint64_t black = 0;
+    for( int sq=8; sq<56; sq++ )    // pawns are never on the first or last rank
+    {
+        char c = squares[sq];
+        if( c == 'P' )
+            white ^= pawn_keys.white[sq];
+        else if( c == 'p' )
+            black ^= pawn_keys.black[sq];
+    }
+    hashes.white = white ^ pawn_keys.white_salt;
+    hashes.black = black ^ pawn_keys.black_salt;
+    hashes.both  = white ^ black;
+}
+
+static bool FileLength( const std::string &filename, uint64_t &len )
+{
+    FILE *f = fopen( filename.c_str(), "rb" );
+    if( !f )
+        return false;
+    fseek( f, 0, SEEK_END );
+    len = ftell(f);
+    fclose(f);
+    return true;
+}
+
+void PawnIndex::Clear()
+{
+    loaded = false;
+    nbr_games = 0;
+    hashes.clear();
+    game_nbrs.clear();
+    plies_first.clear();
+    plies_last.clear();
+    hashes.shrink_to_fit();
+    game_nbrs.shrink_to_fit();
+    plies_first.shrink_to_fit();
+    plies_last.shrink_to_fit();
+}
+
+std::string PawnIndex::SidecarFilename( const std::string &tdb_filename )
+{
+    return tdb_filename + ".pawn";
+}
+
+bool PawnIndex::Build( std::vector< smart_ptr<ListableGame> > &games, uint32_t top_game_id,
+                       const std::string &tdb_filename, std::string &error_msg, ProgressBar *pb )
+{
+    AutoTimer at("Build pawn index");
+    Clear();
+    uint64_t tdb_len;
+    if( !FileLength(tdb_filename,tdb_len) )
+    {
+        error_msg = "Cannot open database file " + tdb_filename;
+        return false;
+    }
+
+    // Play through every game, one entry for each white, black and combined pawn structure
+    std::vector<PawnIndexEntry> entries;
+    int nbr = games.size();
+    for( int i=0; i<nbr; i++ )
+    {
+        if( pb && pb->Perfraction(i,nbr) )
+        {
+            error_msg = "Cancelled";
+            return false;
+        }
+        smart_ptr<ListableGame> p = games[i];
+        const char *fen = p->Fen();
+        if( fen && *fen )
+            continue;   // only games from the standard starting position
+        PawnIndexEntry w, b, wb;
+        w.game_nbr = b.game_nbr = wb.game_nbr = top_game_id - p->game_id;
+        w.ply_first = b.ply_first = wb.ply_first = 0;
+        CompressMoves press;
+        PawnHashes hashes;
+        PawnHashCalculate( press.cr.squares, hashes );
+        w.hash  = hashes.white;
+        b.hash  = hashes.black;
+        wb.hash = hashes.both;
+        unsigned short ply = 0;
+        const char *blob = p->CompressedMoves();
+        while( *blob && ply<0xffff )
+        {
+            thc::Move mv = press.UncompressMovePositionOnly( *blob++ );
+            ply++;
+
+            // Only a pawn move (including a promotion) or a capture can change the pawn structure
+            bool pawn_move = ( (press.cr.squares[mv.dst]&0xdf) == 'P' ||
+                               (mv.special>=thc::SPECIAL_PROMOTION_QUEEN && mv.special<=thc::SPECIAL_PROMOTION_KNIGHT) );
+            if( !pawn_move && mv.capture==' ' )
+                continue;
+            PawnHashCalculate( press.cr.squares, hashes );
+            if( hashes.white != w.hash )
+            {
+                w.ply_last = ply-1;
+                entries.push_back(w);
+                w.hash = hashes.white;
+                w.ply_first = ply;
+            }
+            if( hashes.black != b.hash )
+            {
+                b.ply_last = ply-1;
+                entries.push_back(b);
+                b.hash = hashes.black;
+                b.ply_first = ply;
+            }
+            if( hashes.both != wb.hash )
+            {
+                wb.ply_last = ply-1;
+                entries.push_back(wb);
+                wb.hash = hashes.both;
+                wb.ply_first = ply;
+            }
+        }
+        w.ply_last = b.ply_last = wb.ply_last = ply;
+        entries.push_back(w);
+        entries.push_back(b);
+        entries.push_back(wb);
+    }
+    std::sort( entries.begin(), entries.end() );
+
+    // Write it out
+    std::string filename = SidecarFilename(tdb_filename);
+    FILE *f = fopen( filename.c_str(), "wb" );
+    if( !f )
+    {
+        error_msg = "Cannot create pawn index file " + filename;
+        return false;
+    }
+    PawnIndexHeader hdr;
+    memset( &hdr, 0, sizeof(hdr) );
+    strcpy( hdr.magic, PAWN_INDEX_MAGIC );
+    hdr.version = PAWN_INDEX_VERSION;
+    hdr.nbr_games = nbr;
+    hdr.tdb_len = tdb_len;
+    hdr.nbr_postings = entries.size();
+    fwrite( &hdr, sizeof(hdr), 1, f );
+    size_t n = entries.size();
+    hashes.resize(n);
+    game_nbrs.resize(n);
+    plies_first.resize(n);
+    plies_last.resize(n);
+    for( size_t i=0; i<n; i++ )
+    {
+        hashes[i]      = entries[i].hash;
+        game_nbrs[i]   = entries[i].game_nbr;
+        plies_first[i] = entries[i].ply_first;
+        plies_last[i]  = entries[i].ply_last;
+    }
+    bool ok = (n==0) ||
+              ( fwrite( &hashes[0],      sizeof(hashes[0]),      n, f ) == n &&
+                fwrite( &game_nbrs[0],   sizeof(game_nbrs[0]),   n, f ) == n &&
+                fwrite( &plies_first[0], sizeof(plies_first[0]), n, f ) == n &&
+                fwrite( &plies_last[0],  sizeof(plies_last[0]),  n, f ) == n
+              );
+    fclose(f);
+    if( !ok )
+    {
+        error_msg = "Error writing pawn index file " + filename;
+        Clear();
+        return false;
+    }
+    nbr_games = nbr;
+    loaded = true;
+    cprintf( "Pawn index built, %d games, %lu pawn structures\n", nbr, (unsigned long)n );
+    return true;
+}
+
+bool PawnIndex::Load( const std::string &tdb_filename, uint32_t nbr_games_expected, std::string &error_msg )
+{
+    Clear();
+    std::string filename = SidecarFilename(tdb_filename);
+    FILE *f = fopen( filename.c_str(), "rb" );
+    if( !f )
+    {
+        error_msg = "No pawn index";
+        return false;
+    }
+    PawnIndexHeader hdr;
+    uint64_t tdb_len=0;
+    bool ok = ( 1 == fread( &hdr, sizeof(hdr), 1, f ) );
+    if( !ok || 0!=memcmp(hdr.magic,PAWN_INDEX_MAGIC,sizeof(PAWN_INDEX_MAGIC)) || hdr.version!=PAWN_INDEX_VERSION )
+        error_msg = "Pawn index file " + filename + " is not valid";
+    else if( !FileLength(tdb_filename,tdb_len) || tdb_len!=hdr.tdb_len || hdr.nbr_games!=nbr_games_expected )
+        error_msg = "Pawn index file " + filename + " is out of date";
+    else
+    {
+        size_t n = static_cast<size_t>(hdr.nbr_postings);
+        hashes.resize(n);
+        game_nbrs.resize(n);
+        plies_first.resize(n);
+        plies_last.resize(n);
+        ok = (n==0) ||
+             ( fread( &hashes[0],      sizeof(hashes[0]),      n, f ) == n &&
+               fread( &game_nbrs[0],   sizeof(game_nbrs[0]),   n, f ) == n &&
+               fread( &plies_first[0], sizeof(plies_first[0]), n, f ) == n &&
+               fread( &plies_last[0],  sizeof(plies_last[0]),  n, f ) == n
+             );
+        if( !ok )
+            error_msg = "Error reading pawn index file " + filename;
+        else
+        {
+            nbr_games = hdr.nbr_games;
+            loaded = true;
+        }
+    }
+    fclose(f);
+    if( !loaded )
+        Clear();
+    return loaded;
+}
+
+void PawnIndex::Lookup( uint64_t hash, std::vector<PawnIndexPosting> &postings )
+{
+    postings.clear();
+    if( !loaded )
+        return;
+    std::vector<uint64_t>::iterator lo = std::lower_bound( hashes.begin(), hashes.end(), hash );
+    size_t n = hashes.size();
+    for( size_t i=lo-hashes.begin(); i<n && hashes[i]==hash; i++ )
+    {
+        PawnIndexPosting pp;
+        pp.game_nbr  = game_nbrs[i];
+        pp.ply_first = plies_first[i];
+        pp.ply_last  = plies_last[i];
+        postings.push_back(pp);
+    }
+}
@@ -0,0 +1,69 @@
+/****************************************************************************
+ * Pawn index - an optional sidecar file for a .tdb database, mapping pawn
+ *  structure hashes to the games (and ranges of plies) with those structures
+ *  Author:  Bill Forster
+ *  License: MIT license. Full text of license is in associated file LICENSE
+ *  Copyright 2010-2016, Bill Forster <billforsternz at gmail dot com>
+ ****************************************************************************/
+#ifndef PAWN_INDEX_H
+#define PAWN_INDEX_H
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include "thc.h"
+#include "ProgressBar.h"
+#include "ListableGame.h"
+
+// Pawn structure hashes are Zobrist hashes of the pawns only. There's a hash of the white
+//  pawns, a hash of the black pawns and a hash of both. The three are kept distinct, so that
+//  all of them can share one index
+struct PawnHashes
+{
+    uint64_t white;
+    uint64_t black;
+    uint64_t both;
+};
+void PawnHashCalculate( const char *squares, PawnHashes &hashes );
+
+// Pawn moves and pawn captures can't be undone, so each pawn structure in a game occupies
+//  a single range of plies. Games are identified by their position in the .tdb file
+//  (game_nbr=0 for the first game in the file), as for the position index
+struct PawnIndexPosting
+{
+    uint32_t       game_nbr;
+    unsigned short ply_first;
+    unsigned short ply_last;
+};
+
+class PawnIndex
+{
+public:
+    PawnIndex() { Clear(); }
+    void Clear();
+    bool IsLoaded() { return loaded; }
+
+    // The sidecar file lives alongside the .tdb file
+    static std::string SidecarFilename( const std::string &tdb_filename );
+
+    // Build the index from loaded games and write it out, top_game_id is the game_id of game_nbr 0
+    bool Build( std::vector< smart_ptr<ListableGame> > &games, uint32_t top_game_id,
+                const std::string &tdb_filename, std::string &error_msg, ProgressBar *pb=NULL );
+
+    // Load the index, returns false if there is no index, or it doesn't match the .tdb file
+    bool Load( const std::string &tdb_filename, uint32_t nbr_games, std::string &error_msg );
+
+    // Find the games (and plies) with a pawn structure, hash is one of the PawnHashes
+    void Lookup( uint64_t hash, std::vector<PawnIndexPosting> &postings );
+
+private:
+    bool     loaded;
+    uint32_t nbr_games;
+
+    // Sorted by hash then game_nbr, four arrays to avoid padding
+    std::vector<uint64_t>       hashes;
+    std::vector<uint32_t>       game_nbrs;
+    std::vector<unsigned short> plies_first;
+    std::vector<unsigned short> plies_last;
+};
+
+#endif  // PAWN_INDEX_H
@@ -199,14 +199,37 @@ bool PgnRead::Process( FILE *infile )
     return false;
 }
 
+// Process one game that the caller has already split off from the .pgn file, its
+//  tag lines ('\n' terminated) and its moves. Returns true if aborted
+bool PgnRead::ProcessGame( const std::string &tags, std::string &moves )
+{
+    char buf[2048];
+    GameBegin();
+    size_t len = tags.length();
+    size_t begin = 0;
+    while( begin < len )
+    {
+        size_t end = tags.find( '\n', begin );
+        if( end == std::string::npos )
+            end = len;
+        size_t n = end-begin;
+        if( n > sizeof(buf)-1 )
+            n = sizeof(buf)-1;
+        memcpy( buf, tags.c_str()+begin, n );
+        buf[n] = '\0';
+        Header( buf );
+        begin = end+1;
+    }
+    GameParse(moves);
+    return GameOver();
+}
+
 
 void PgnRead::GameParse( std::string &str )
 {
     char buf[FIELD_BUFLEN+10];
-    static char comment_buf[10000];
     int ch, comment_ch=0, previous_ch=0, push_back=0, len=0, move_number=0;
     STATE state=MOVE_NUMBER, old_state, save_state=MOVE_NUMBER;
-    static int nag_value;
     int input_len = str.length();
     int idx = 0;
     if( idx < input_len )
@@ -1098,7 +1121,7 @@ bool PgnRead::GameOver()
         STACK_ELEMENT *s;
         s = &stack_array[0];
         const char *pfen = (fen_flag && fen[0]) ? fen : NULL;
-        aborted = hook_gameover( callback_code, pfen, event, site, date, round, white, black, result, white_elo, black_elo, eco, s->nbr_moves, s->big_move_array, s->big_hash_array  );
+        aborted = GameOverHook( pfen, event, site, date, round, white, black, result, white_elo, black_elo, eco, s->nbr_moves, s->big_move_array, s->big_hash_array  );
         stack_idx = 0;
         thc::ChessRules temp;
         chess_rules = temp;    // init
@@ -1110,6 +1133,13 @@ bool PgnRead::GameOver()
 
 
 
+bool PgnRead::GameOverHook( const char *fen, const char *event, const char *site, const char *date, const char *round,
+                   const char *white, const char *black, const char *result, const char *white_elo, const char *black_elo, const char *eco,
+                   int nbr_moves, thc::Move *moves, uint64_t *hashes )
+{
+    return hook_gameover( callback_code, fen, event, site, date, round, white, black, result, white_elo, black_elo, eco, nbr_moves, moves, hashes );
+}
+
 PgnRead::STATE PgnRead::Push( PgnRead::STATE in )
 {
     STACK_ELEMENT *s, *n;
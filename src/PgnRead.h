@@ -25,8 +25,17 @@ public:
 
     // Constructor
     PgnRead( char callback_code, ProgressBar *pb=0 );
+    virtual ~PgnRead() {}
 
     bool Process( FILE *infile );
+    bool ProcessGame( const std::string &tags, std::string &moves );
+
+protected:
+
+    // Called at the end of each game, by default calls hook_gameover()
+    virtual bool GameOverHook( const char *fen, const char *event, const char *site, const char *date, const char *round,
+                   const char *white, const char *black, const char *result, const char *white_elo, const char *black_elo, const char *eco,
+                   int nbr_moves, thc::Move *moves, uint64_t *hashes );
 
 private:
     char callback_code;
@@ -61,6 +70,8 @@ private:
     FILE *file_inc;
     thc::ChessRules chess_rules;
     uint64_t hash;
+    char comment_buf[10000];    // GameParse() working storage, not static so that
+    int nag_value;              //  each thread can have its own PgnRead
 
     // Object state
     enum STATE
@@ -0,0 +1,225 @@
+/****************************************************************************
+ * Pgn scanner - split a .pgn file into lines and classify them (tag lines,
+ *  moves, game boundaries etc.), reading the file in large blocks
+ *  Author:  Bill Forster
+ *  License: MIT license. Full text of license is in associated file LICENSE
+ *  Copyright 2010-2016, Bill Forster <billforsternz at gmail dot com>
+ ****************************************************************************/
+#include <string.h>
+#include "PgnScanner.h"
+
+int PgnLineClassifier::Classify( const char *line )
+{
+    int typ = ' ';  // no-op
+    const char *p = line;
+    while( *p==' ' || *p=='\t' )
+        p++;
+    bool blank   = (*p=='\n'||*p=='\r');
+    bool tagline = (*p=='[');
+
+    // Check that it really is a tagline
+    if( tagline )
+    {
+        tagline = false;  // unless all checks pass
+
+        // Skip '['
+        p++;
+
+        // Skip whitespace
+        while( *p==' ' || *p=='\t' )
+            p++;
+
+        // Is there a tag before a leading " ?
+        bool tag=false;
+        while( *p && *p!=']' && *p!=' ' && *p!='\t' && *p!='\"' )
+        {
+            tag = true;    // at least 1 non-whitespace
+            p++;
+        }
+        if( tag )
+        {
+
+            // Make sure there is whitespace, but skip it
+            tag = false;
+            while( *p==' ' || *p=='\t' )
+            {
+                tag = true;  // at least 1 whitespace
+                p++;
+            }
+        }
+
+        // If there is a tag, then whitespace, then a leading "
+        if( tag && *p=='\"')
+        {
+            p++;
+
+            // Skip to 2nd " or end of string
+            while( *p && *p!='\"' )
+                p++;
+
+            // If we have a 2nd " then we have a tag and a val, i.e. a header
+            if( *p == '\"' )
+            {
+                tagline = true;
+            }
+        }
+    }
+    switch( state )
+    {
+        case INIT:
+        case SEARCH:
+        {
+            if( tagline )
+            {
+                state = TAGLINES;
+                typ = 'T';   // first tagline
+            }
+            else if( !blank )
+            {
+                state = PREFIX;
+                typ = 'P';  // first prefix line
+            }
+            break;
+        }
+        case PREFIX:
+        {
+            if( tagline )
+            {
+                state = TAGLINES;
+                typ = 'T';   // first tagline
+            }
+            else
+            {
+                typ = 'p';  // next prefix line
+            }
+            break;
+        }
+        case TAGLINES:
+        {
+            if( tagline )
+            {
+                typ = 't';   // next tagline
+            }
+            else if( blank )
+            {
+                state = PRE_MOVES;
+            }
+            else
+            {
+                state = MOVES;
+                typ = 'M';    // first line of moves, (a pity there wasn't a blank line before them)
+            }
+            break;
+        }
+        case PRE_MOVES:
+        {
+            if( !blank )
+            {
+                state = MOVES;
+                typ = 'M';  // first line of moves, after one or more blank lines
+            }
+            break;
+        }
+        case MOVES:
+        {
+            if( blank )
+            {
+                state = SEARCH;
+                typ = 'G';  // completed game
+            }
+            else
+            {
+                typ = 'm';  // next line of moves
+            }
+            break;
+        }
+    }
+    return typ;
+}
+
+int PgnLineClassifier::Eof()
+{
+    return state==MOVES ? 'G' : ' ';   // 'G' = completed game
+}
+
+PgnScanner::PgnScanner( FILE *pgn_file )
+{
+    this->pgn_file = pgn_file;
+    buf.resize( PGN_SCANNER_BLOCK_LEN + 1 );
+    begin = 0;
+    end   = 0;
+    block_posn = ftell(pgn_file);
+    eof = false;
+    line = NULL;
+    terminator_idx = 0;
+    terminator_saved = '\0';
+    terminator_active = false;
+}
+
+bool PgnScanner::Next( int &typ )
+{
+    bool done = false;
+    line = NextLine();
+    if( !line )
+    {
+        done = true;
+        typ = classifier.Eof();
+    }
+    else
+        typ = classifier.Classify( line );
+    return done;
+}
+
+char *PgnScanner::NextLine()
+{
+    if( terminator_active )
+    {
+        buf[terminator_idx] = terminator_saved;
+        terminator_active = false;
+    }
+    size_t line_end;
+    for(;;)
+    {
+        const char *nl = begin<end ? static_cast<const char *>( memchr(&buf[begin],'\n',end-begin) ) : NULL;
+        if( nl )
+        {
+            line_end = (nl - &buf[0]) + 1;
+            break;
+        }
+        if( eof )
+        {
+            if( begin == end )
+                return NULL;
+            line_end = end;     // last line, no '\n'
+            break;
+        }
+
+        // Move the partial line to the start of the buffer and read another block after it,
+        //  making the buffer bigger if need be for a very long line
+        size_t remaining = end-begin;
+        if( remaining > 0 )
+            memmove( &buf[0], &buf[begin], remaining );
+        block_posn += static_cast<long>(begin);
+        begin = 0;
+        end = remaining;
+        size_t capacity = buf.size()-1;
+        if( capacity-end < PGN_SCANNER_BLOCK_LEN/2 )
+        {
+            buf.resize( capacity*2 + 1 );
+            capacity = buf.size()-1;
+        }
+        size_t nbr_read = fread( &buf[end], 1, capacity-end, pgn_file );
+        if( nbr_read == 0 )
+            eof = true;
+        end += nbr_read;
+    }
+
+    // Temporarily terminate the line (the spare byte means line_end is always in range)
+    char *ret = &buf[begin];
+    terminator_idx   = line_end;
+    terminator_saved = buf[line_end];
+    terminator_active = true;
+    buf[line_end] = '\0';
+    begin = line_end;
+    return ret;
+}
@@ -0,0 +1,63 @@
+/****************************************************************************
+ * Pgn scanner - split a .pgn file into lines and classify them (tag lines,
+ *  moves, game boundaries etc.), reading the file in large blocks
+ *  Author:  Bill Forster
+ *  License: MIT license. Full text of license is in associated file LICENSE
+ *  Copyright 2010-2016, Bill Forster <billforsternz at gmail dot com>
+ ****************************************************************************/
+#ifndef PGN_SCANNER_H
+#define PGN_SCANNER_H
+#include <stdio.h>
+#include <vector>
+
+// Classify .pgn lines one at a time. Line types (typ) are;
+//  'P' first prefix line, 'p' next prefix line, 'T' first tag line, 't' next tag line,
+//  'M' first line of moves, 'm' next line of moves, 'G' completed game, ' ' nothing of interest
+class PgnLineClassifier
+{
+public:
+    PgnLineClassifier() { Init(); }
+    void Init() { state = INIT; }
+    int Classify( const char *line );
+    int Eof();              // typ at end of file ('G' if there's an unfinished game)
+
+private:
+    enum {INIT,PREFIX,TAGLINES,PRE_MOVES,MOVES,SEARCH} state;
+};
+
+// Produces the same events as PgnStateMachine(), but reads the file a large block at a time
+//  rather than a line at a time, finding the line ends with memchr() (which is vectorised on
+//  all our platforms). Lines are never split, however long they are. Once a PgnScanner is
+//  reading a FILE, nothing else should read it
+#define PGN_SCANNER_BLOCK_LEN 1048576
+
+class PgnScanner
+{
+public:
+    PgnScanner( FILE *pgn_file );   // scanning starts at the current position of pgn_file
+
+    // Returns true when done (like PgnStateMachine())
+    bool Next( int &typ );
+
+    // The current line, '\0' terminated and including its '\n' (if any), valid until Next() is called again
+    char *Line()    { return line; }
+
+    // The file position of the start of the next line, like ftell() after fgets() (binary mode files only)
+    long Posn()     { return block_posn + static_cast<long>(begin); }
+
+private:
+    FILE *pgn_file;
+    PgnLineClassifier classifier;
+    std::vector<char> buf;  // one spare byte at the end for a terminator
+    size_t begin;           // unread data is buf[begin] to buf[end-1]
+    size_t end;
+    long   block_posn;      // file position of buf[0]
+    bool   eof;
+    char  *line;
+    size_t terminator_idx;  // we temporarily overwrite buf[terminator_idx] with '\0'
+    char   terminator_saved;
+    bool   terminator_active;
+    char  *NextLine();
+};
+
+#endif  // PGN_SCANNER_H
@@ -0,0 +1,92 @@
+/****************************************************************************
+ * Piece square signature - a per game bitmap of "ever visited" piece/square
+ *  combos, used to rule out games before searching them for a position
+ *  Author:  Bill Forster
+ *  License: MIT license. Full text of license is in associated file LICENSE
+ *  Copyright 2010-2016, Bill Forster <billforsternz at gmail dot com>
+ ****************************************************************************/
+#include <string.h>
+#include "thc.h"
+#include "CompressMoves.h"
+#include "PieceSquareSignature.h"
+
+// The 64 combos. These were chosen by the "Piece square signature statistics" maintenance
+//  command (see db_maintenance_piece_square_statistics()), which prints a replacement for
+//  this table. Combos are ranked by effectiveness E = S*(1-H), S = how often the combo appears
+//  in positions people search for, H = proportion of games in which it's hit at some point
+const char *piece_square_signature_combos[64] =
+{
+    "Nf3", "Nc3", "Nd2", "Ne2", "Pe4", "Pd4", "Pc4", "Pf4",
+    "Pe3", "Pd3", "Pc3", "Pg3", "Pb3", "Ph3", "Pa3", "Pa4",
+    "Bg2", "Be2", "Bd3", "Bb5", "Bc4", "Bg5", "Bf4", "Be3",
+    "Bb2", "Kg1", "Rf1", "Re1", "Rd1", "Qe2", "Qc2", "Qd2",
+    "nf6", "nc6", "nd7", "ne7", "pe5", "pd5", "pc5", "pf5",
+    "pe6", "pd6", "pc6", "pg6", "pb6", "ph6", "pa6", "pa5",
+    "bg7", "be7", "bd6", "bb4", "bc5", "bg4", "bf5", "be6",
+    "bb7", "kg8", "rf8", "re8", "rd8", "qe7", "qc7", "qd7"
+};
+
+// Lookup the signature bit for a piece landing on a square, indexed by piece character
+//  and square. Built once, at static initialisation time (so no threading issues)
+class PieceSquareSignatureLookup
+{
+public:
+    uint64_t bits[128][64];
+    PieceSquareSignatureLookup()
+    {
+        memset( bits, 0, sizeof(bits) );
+        thc::ChessPosition start;
+        for( int i=0; i<64; i++ )
+        {
+            const char *combo = piece_square_signature_combos[i];
+            char piece = combo[0];
+            int file = combo[1]-'a';
+            int rank = combo[2]-'1';
+            if( file<0 || file>7 || rank<0 || rank>7 )
+                continue;
+            int sq = (7-rank)*8 + file;     // thc::a8 = 0 convention
+            if( start.squares[sq] == piece )
+                continue;                   // not safe, piece needn't land on its start square
+            bits[piece&0x7f][sq] |= (1ULL<<i);
+        }
+    }
+};
+static PieceSquareSignatureLookup lookup;
+
+// Calculate the signature of a game from its ('\0' terminated) compressed moves (standard start position only)
+uint64_t PieceSquareSignatureGame( const char *compressed_moves )
+{
+    uint64_t signature = 0;
+    CompressMoves press;
+    while( *compressed_moves )
+    {
+        thc::Move mv = press.UncompressMovePositionOnly( *compressed_moves++ );
+
+        // The piece is on its destination square after the move, this takes care of promotions
+        char piece = press.cr.squares[mv.dst];
+        signature |= lookup.bits[piece&0x7f][mv.dst];
+
+        // The castling rook lands on a square too
+        switch( mv.special )
+        {
+            default: break;
+            case thc::SPECIAL_WK_CASTLING:  signature |= lookup.bits['R'][thc::f1];  break;
+            case thc::SPECIAL_WQ_CASTLING:  signature |= lookup.bits['R'][thc::d1];  break;
+            case thc::SPECIAL_BK_CASTLING:  signature |= lookup.bits['r'][thc::f8];  break;
+            case thc::SPECIAL_BQ_CASTLING:  signature |= lookup.bits['r'][thc::d8];  break;
+        }
+    }
+    return signature;
+}
+
+// Calculate the signature of a target position
+uint64_t PieceSquareSignatureTarget( const thc::ChessPosition &cp )
+{
+    uint64_t signature = 0;
+    for( int sq=0; sq<64; sq++ )
+    {
+        char piece = cp.squares[sq];
+        signature |= lookup.bits[piece&0x7f][sq];
+    }
+    return signature;
+}
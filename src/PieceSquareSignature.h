@@ -0,0 +1,30 @@
+/****************************************************************************
+ * Piece square signature - a per game bitmap of "ever visited" piece/square
+ *  combos, used to rule out games before searching them for a position
+ *  Author:  Bill Forster
+ *  License: MIT license. Full text of license is in associated file LICENSE
+ *  Copyright 2010-2016, Bill Forster <billforsternz at gmail dot com>
+ ****************************************************************************/
+#ifndef PIECE_SQUARE_SIGNATURE_H
+#define PIECE_SQUARE_SIGNATURE_H
+#include <string>
+#include "thc.h"
+
+// A game's signature has bit n set if at any point in the game a piece lands on the
+//  square of piece/square combo n (eg "Nf3", a white knight lands on f3). A target
+//  position's signature has bit n set if the target has that piece on that square.
+//  The game can only reach the target if all the target's bits are set in the game's
+//  signature. None of the combos are present in the standard starting position, so
+//  a piece/square combo in a position implies the piece landed on the square.
+#define PIECE_SQUARE_SIGNATURE_ALL 0xffffffffffffffffULL   // a game that can't be ruled out
+
+// Calculate the signature of a game from its ('\0' terminated) compressed moves (standard start position only)
+uint64_t PieceSquareSignatureGame( const char *compressed_moves );
+
+// Calculate the signature of a target position
+uint64_t PieceSquareSignatureTarget( const thc::ChessPosition &cp );
+
+// The combos, in "Nf3" (white knight on f3), "nf6" (black knight on f6) format
+extern const char *piece_square_signature_combos[64];
+
+#endif  // PIECE_SQUARE_SIGNATURE_H
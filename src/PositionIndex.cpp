@@ -0,0 +1,451 @@
+/****************************************************************************
+ * Position index - an optional sidecar file for a .tdb database, mapping
+ *  position hashes to the games (and plies) where the positions occur
+ *  Author:  Bill Forster
+ *  License: MIT license. Full text of license is in associated file LICENSE
+ *  Copyright 2010-2016, Bill Forster <billforsternz at gmail dot com>
+ ****************************************************************************/
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+#include "Portability.h"
+#include "thc.h"
+#include "DebugPrintf.h"
+#include "AutoTimer.h"
+#include "CompressMoves.h"
+#include "PositionIndex.h"
+
+// File format is a PositionIndexHeader, then the partition directory (see PositionIndex), then
+//  the partitions in order. Each partition is its hashes, then its game numbers, then its plies,
+//  and within a partition the postings are sorted by hash then game_nbr then ply
+#define POSITION_INDEX_MAGIC    "Tarrasch position index"
+#define POSITION_INDEX_VERSION  2
+#define POSITION_INDEX_POSTING_LEN  (sizeof(uint64_t)+sizeof(uint32_t)+sizeof(unsigned short))
+struct PositionIndexHeader
+{
+    char     magic[32];
+    uint32_t version;
+    uint32_t nbr_games;         // the index matches a .tdb file with this many games ...
+    uint64_t tdb_len;           // ... and this length
+    uint64_t nbr_postings;
+    uint32_t partition_bits;
+    uint32_t reserved;
+};
+
+// Enough partitions that a partition averages this many postings or less
+#define POSITION_INDEX_PARTITION_TARGET 1024
+#define POSITION_INDEX_MAX_PARTITION_BITS 24
+
+// Build() sorts the postings one bucket at a time, a bucket averages no more than this many
+//  entries (16 bytes each). Buckets are spilled to temporary files until they are sorted
+#define POSITION_INDEX_BUCKET_TARGET    (4*1024*1024)
+#define POSITION_INDEX_MAX_BUCKET_BITS  8
+#define POSITION_INDEX_SPILL            16384   // entries buffered per bucket before writing
+
+// One entry while building
+struct PositionIndexEntry
+{
+    uint64_t       hash;
+    uint32_t       game_nbr;
+    unsigned short ply;
+    bool operator < (const PositionIndexEntry &rhs) const
+    {
+        if( hash != rhs.hash )
+            return hash < rhs.hash;
+        if( game_nbr != rhs.game_nbr )
+            return game_nbr < rhs.game_nbr;
+        return ply < rhs.ply;
+    }
+};
+
+// The index file (and the .tdb file) can be bigger than 2GB, beyond the reach of fseek() and
+//  ftell() in 32 bit builds
+static bool Seek64( FILE *f, uint64_t offset, int origin=SEEK_SET )
+{
+#ifdef THC_WINDOWS
+    return 0 == _fseeki64( f, static_cast<__int64>(offset), origin );
+#else
+    return 0 == fseeko( f, static_cast<off_t>(offset), origin );
+#endif
+}
+
+static uint64_t Tell64( FILE *f )
+{
+#ifdef THC_WINDOWS
+    return static_cast<uint64_t>( _ftelli64(f) );
+#else
+    return static_cast<uint64_t>( ftello(f) );
+#endif
+}
+
+static bool ReadAt( FILE *f, uint64_t offset, void *buf, size_t len )
+{
+    return Seek64(f,offset) && 1==fread(buf,len,1,f);
+}
+
+static bool FileLength( const std::string &filename, uint64_t &len )
+{
+    FILE *f = fopen( filename.c_str(), "rb" );
+    if( !f )
+        return false;
+    Seek64( f, 0, SEEK_END );
+    len = Tell64(f);
+    fclose(f);
+    return true;
+}
+
+// Partition (or bucket) of a hash, the top bits
+static uint32_t HashPartition( uint64_t hash, int bits )
+{
+    return bits==0 ? 0 : static_cast<uint32_t>( hash >> (64-bits) );
+}
+
+void PositionIndex::Clear()
+{
+    loaded = false;
+    nbr_games = 0;
+    if( file )
+        fclose( file );
+    file = NULL;
+    partition_bits = 0;
+    nbr_postings = 0;
+    data_offset = 0;
+    std::vector<uint64_t> empty;
+    partition_starts.swap( empty );
+}
+
+std::string PositionIndex::SidecarFilename( const std::string &tdb_filename )
+{
+    return tdb_filename + ".pos";
+}
+
+// The temporary files Build() spills buckets into
+static std::string BucketFilename( const std::string &filename, uint32_t bucket )
+{
+    char buf[20];
+    sprintf( buf, ".tmp%u", bucket );
+    return filename + buf;
+}
+
+static void BucketsCleanup( const std::string &filename, std::vector<FILE *> &bucket_files )
+{
+    for( uint32_t b=0; b<bucket_files.size(); b++ )
+    {
+        if( bucket_files[b] )
+        {
+            fclose( bucket_files[b] );
+            bucket_files[b] = NULL;
+            remove( BucketFilename(filename,b).c_str() );
+        }
+    }
+}
+
+// Write the buffered entries of a bucket to its temporary file
+static bool BucketSpill( const std::string &filename, std::vector<FILE *> &bucket_files, uint32_t bucket,
+                         std::vector<PositionIndexEntry> &buffer )
+{
+    if( buffer.size() == 0 )
+        return true;
+    if( !bucket_files[bucket] )
+    {
+        bucket_files[bucket] = fopen( BucketFilename(filename,bucket).c_str(), "w+b" );
+        if( !bucket_files[bucket] )
+            return false;
+    }
+    bool ok = ( buffer.size() == fwrite( &buffer[0], sizeof(buffer[0]), buffer.size(), bucket_files[bucket] ) );
+    buffer.clear();
+    return ok;
+}
+
+// The number of positions in a game, including the start position, as indexed
+static uint64_t GamePositions( ListableGame *p )
+{
+    size_t len = strlen( p->CompressedMoves() );
+    return (len<0xffff ? len : 0xffff) + 1;
+}
+
+bool PositionIndex::Build( std::vector< smart_ptr<ListableGame> > &games, uint32_t top_game_id,
+                           const std::string &tdb_filename, std::string &error_msg, ProgressBar *pb )
+{
+    AutoTimer at("Build position index");
+    Clear();
+    uint64_t tdb_len;
+    if( !FileLength(tdb_filename,tdb_len) )
+    {
+        error_msg = "Cannot open database file " + tdb_filename;
+        return false;
+    }
+
+    // One entry for every position of every game. There can be far too many to sort in memory at
+    //  once, so they are split into buckets by the top bits of their hashes and each bucket is
+    //  sorted separately. The buckets are in hash order, so the sorted buckets are written out
+    //  one after another. The partitions Lookup() uses are never bigger than the buckets
+    int nbr = games.size();
+    uint64_t n = 0;
+    for( int i=0; i<nbr; i++ )
+    {
+        ListableGame *p = games[i].get();
+        const char *fen = p->Fen();
+        if( !fen || !*fen )
+            n += GamePositions(p);
+    }
+    int bucket_bits = 0;
+    while( (n>>bucket_bits) > POSITION_INDEX_BUCKET_TARGET && bucket_bits<POSITION_INDEX_MAX_BUCKET_BITS )
+        bucket_bits++;
+    int bits = bucket_bits;
+    while( (n>>bits) > POSITION_INDEX_PARTITION_TARGET && bits<POSITION_INDEX_MAX_PARTITION_BITS )
+        bits++;
+    uint32_t nbr_buckets = 1<<bucket_bits;
+    uint32_t nbr_partitions = 1<<bits;
+    std::string filename = SidecarFilename(tdb_filename);
+    std::vector<FILE *> bucket_files( nbr_buckets, (FILE *)NULL );
+    std::vector< std::vector<PositionIndexEntry> > buffers( nbr_buckets );
+
+    // Play through every game. With only one bucket everything stays in memory
+    for( int i=0; i<nbr; i++ )
+    {
+        if( pb && pb->Perfraction(i,2*nbr) )
+        {
+            BucketsCleanup( filename, bucket_files );
+            error_msg = "Cancelled";
+            return false;
+        }
+        ListableGame *p = games[i].get();
+        const char *fen = p->Fen();
+        if( fen && *fen )
+            continue;   // only games from the standard starting position
+        PositionIndexEntry e;
+        e.game_nbr = top_game_id - p->game_id;
+        e.ply = 0;
+        CompressMoves press;
+        const char *blob = p->CompressedMoves();
+        for(;;)
+        {
+            e.hash = press.cr.Hash64Calculate();
+            uint32_t b = HashPartition( e.hash, bucket_bits );
+            buffers[b].push_back(e);
+            if( nbr_buckets>1 && buffers[b].size()>=POSITION_INDEX_SPILL && !BucketSpill(filename,bucket_files,b,buffers[b]) )
+            {
+                BucketsCleanup( filename, bucket_files );
+                error_msg = "Cannot write temporary file for position index " + filename;
+                return false;
+            }
+            if( !*blob || e.ply>=0xffff )
+                break;
+            press.UncompressMovePositionOnly( *blob++ );
+            e.ply++;
+        }
+    }
+
+    // Write it out, the partition directory is filled in at the end
+    FILE *f = fopen( filename.c_str(), "wb" );
+    if( !f )
+    {
+        BucketsCleanup( filename, bucket_files );
+        error_msg = "Cannot create position index file " + filename;
+        return false;
+    }
+    PositionIndexHeader hdr;
+    memset( &hdr, 0, sizeof(hdr) );
+    strcpy( hdr.magic, POSITION_INDEX_MAGIC );
+    hdr.version = POSITION_INDEX_VERSION;
+    hdr.nbr_games = nbr;
+    hdr.tdb_len = tdb_len;
+    hdr.nbr_postings = n;
+    hdr.partition_bits = bits;
+    std::vector<uint64_t> starts( nbr_partitions+1, 0 );
+    bool ok = ( 1 == fwrite( &hdr, sizeof(hdr), 1, f ) ) &&
+              ( starts.size() == fwrite( &starts[0], sizeof(starts[0]), starts.size(), f ) );
+    uint64_t nbr_written = 0;
+    uint32_t q = 0;     // next partition
+    std::vector<uint64_t>       block_hashes;
+    std::vector<uint32_t>       block_game_nbrs;
+    std::vector<unsigned short> block_plies;
+    for( uint32_t b=0; ok && b<nbr_buckets; b++ )
+    {
+        if( pb && pb->Perfraction(nbr+static_cast<int>((b*static_cast<uint64_t>(nbr))/nbr_buckets),2*nbr) )
+        {
+            ok = false;
+            error_msg = "Cancelled";
+            break;
+        }
+
+        // Gather the bucket (from its temporary file, if it was spilled) and sort it
+        std::vector<PositionIndexEntry> entries;
+        entries.swap( buffers[b] );
+        FILE *tf = bucket_files[b];
+        if( tf )
+        {
+            size_t nbr_in_memory = entries.size();
+            Seek64( tf, 0, SEEK_END );
+            size_t nbr_spilled = static_cast<size_t>( Tell64(tf) / sizeof(PositionIndexEntry) );
+            entries.resize( nbr_in_memory + nbr_spilled );
+            ok = Seek64(tf,0) && nbr_spilled==fread( &entries[nbr_in_memory], sizeof(PositionIndexEntry), nbr_spilled, tf );
+            fclose( tf );
+            bucket_files[b] = NULL;
+            remove( BucketFilename(filename,b).c_str() );
+            if( !ok )
+            {
+                error_msg = "Cannot read temporary file for position index " + filename;
+                break;
+            }
+        }
+        std::sort( entries.begin(), entries.end() );
+
+        // Write the bucket's partitions
+        size_t j = 0;
+        uint32_t q_end = (b+1) << (bits-bucket_bits);
+        for( ; ok && q<q_end; q++ )
+        {
+            starts[q] = nbr_written;
+            block_hashes.clear();
+            block_game_nbrs.clear();
+            block_plies.clear();
+            for( ; j<entries.size() && HashPartition(entries[j].hash,bits)==q; j++ )
+            {
+                block_hashes.push_back( entries[j].hash );
+                block_game_nbrs.push_back( entries[j].game_nbr );
+                block_plies.push_back( entries[j].ply );
+            }
+            size_t c = block_hashes.size();
+            ok = (c==0) ||
+                 ( fwrite( &block_hashes[0],    sizeof(block_hashes[0]),    c, f ) == c &&
+                   fwrite( &block_game_nbrs[0], sizeof(block_game_nbrs[0]), c, f ) == c &&
+                   fwrite( &block_plies[0],     sizeof(block_plies[0]),     c, f ) == c
+                 );
+            nbr_written += c;
+        }
+    }
+    starts[nbr_partitions] = nbr_written;
+    if( ok )
+    {
+        ok = ( nbr_written == n ) && Seek64( f, sizeof(hdr) ) &&
+             ( starts.size() == fwrite( &starts[0], sizeof(starts[0]), starts.size(), f ) );
+    }
+    ok = ( 0 == fclose(f) ) && ok;
+    BucketsCleanup( filename, bucket_files );
+    if( !ok )
+    {
+        remove( filename.c_str() );     // don't leave a partial index behind
+        if( error_msg == "" )
+            error_msg = "Error writing position index file " + filename;
+        return false;
+    }
+    cprintf( "Position index built, %d games, %lu positions, %d buckets, %d partitions\n",
+                nbr, (unsigned long)n, nbr_buckets, nbr_partitions );
+
+    // Use it the same way as an index that was there already
+    return Load( tdb_filename, nbr, error_msg );
+}
+
+bool PositionIndex::Load( const std::string &tdb_filename, uint32_t nbr_games_expected, std::string &error_msg )
+{
+    Clear();
+    std::string filename = SidecarFilename(tdb_filename);
+    uint64_t file_len=0;
+    if( !FileLength(filename,file_len) || NULL==(file=fopen(filename.c_str(),"rb")) )
+    {
+        error_msg = "No position index";
+        return false;
+    }
+    PositionIndexHeader hdr;
+    uint64_t tdb_len=0;
+    bool ok = ( 1 == fread( &hdr, sizeof(hdr), 1, file ) );
+    if( !ok || 0!=memcmp(hdr.magic,POSITION_INDEX_MAGIC,sizeof(POSITION_INDEX_MAGIC)) || hdr.version!=POSITION_INDEX_VERSION ||
+        hdr.partition_bits>POSITION_INDEX_MAX_PARTITION_BITS )
+        error_msg = "Position index file " + filename + " is not valid";
+    else if( !FileLength(tdb_filename,tdb_len) || tdb_len!=hdr.tdb_len || hdr.nbr_games!=nbr_games_expected )
+        error_msg = "Position index file " + filename + " is out of date";
+    else
+    {
+        // Just the directory, the partitions are read as they are needed
+        size_t nbr_partitions = static_cast<size_t>(1) << hdr.partition_bits;
+        partition_starts.resize( nbr_partitions+1 );
+        data_offset = sizeof(hdr) + partition_starts.size()*sizeof(uint64_t);
+        ok = ( file_len == data_offset + hdr.nbr_postings*POSITION_INDEX_POSTING_LEN ) &&
+             ( partition_starts.size() == fread( &partition_starts[0], sizeof(uint64_t), partition_starts.size(), file ) ) &&
+             ( partition_starts[0]==0 && partition_starts[nbr_partitions]==hdr.nbr_postings );
+        for( size_t i=0; ok && i<nbr_partitions; i++ )
+            ok = ( partition_starts[i] <= partition_starts[i+1] );
+        if( !ok )
+            error_msg = "Error reading position index file " + filename;
+        else
+        {
+            partition_bits = hdr.partition_bits;
+            nbr_postings = hdr.nbr_postings;
+            nbr_games = hdr.nbr_games;
+            loaded = true;
+        }
+    }
+    if( !loaded )
+        Clear();
+    return loaded;
+}
+
+bool PositionIndex::Lookup( uint64_t hash, bool white, std::vector<PositionIndexPosting> &postings )
+{
+    postings.clear();
+    if( !loaded )
+        return false;
+
+    // The partition is its hashes, then its game numbers, then its plies
+    uint32_t q = HashPartition( hash, partition_bits );
+    uint64_t begin = partition_starts[q];
+    uint64_t count = partition_starts[q+1] - begin;
+    uint64_t hashes_offset    = data_offset + begin*POSITION_INDEX_POSTING_LEN;
+    uint64_t game_nbrs_offset = hashes_offset + count*sizeof(uint64_t);
+    uint64_t plies_offset     = game_nbrs_offset + count*sizeof(uint32_t);
+
+    // Binary search the partition's hashes in the file for the first match
+    uint64_t lo=0, hi=count;
+    while( lo < hi )
+    {
+        uint64_t mid = lo + (hi-lo)/2;
+        uint64_t h;
+        if( !ReadAt(file,hashes_offset+mid*sizeof(uint64_t),&h,sizeof(h)) )
+            return false;
+        if( h < hash )
+            lo = mid+1;
+        else
+            hi = mid;
+    }
+
+    // Count the matches
+    uint64_t nbr_matches = 0;
+    std::vector<uint64_t> buf;
+    bool more = true;
+    while( more && lo+nbr_matches<count )
+    {
+        size_t chunk = static_cast<size_t>( std::min( static_cast<uint64_t>(4096), count-lo-nbr_matches ) );
+        buf.resize( chunk );
+        if( !ReadAt(file,hashes_offset+(lo+nbr_matches)*sizeof(uint64_t),&buf[0],chunk*sizeof(uint64_t)) )
+            return false;
+        for( size_t k=0; more && k<chunk; k++ )
+        {
+            if( buf[k] == hash )
+                nbr_matches++;
+            else
+                more = false;
+        }
+    }
+    if( nbr_matches == 0 )
+        return true;
+    size_t m = static_cast<size_t>(nbr_matches);
+    std::vector<uint32_t>       game_nbrs(m);
+    std::vector<unsigned short> plies(m);
+    if( !ReadAt(file,game_nbrs_offset+lo*sizeof(uint32_t),&game_nbrs[0],m*sizeof(uint32_t)) ||
+        !ReadAt(file,plies_offset+lo*sizeof(unsigned short),&plies[0],m*sizeof(unsigned short)) )
+        return false;
+    for( size_t i=0; i<m; i++ )
+    {
+        // Even plies are white to move (standard start position only)
+        unsigned short ply = plies[i];
+        if( ((ply&1)==0) != white )
+            continue;
+        PositionIndexPosting pp;
+        pp.game_nbr = game_nbrs[i];
+        pp.ply = ply;
+        postings.push_back(pp);
+    }
+    return true;
+}
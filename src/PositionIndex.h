@@ -0,0 +1,64 @@
+/****************************************************************************
+ * Position index - an optional sidecar file for a .tdb database, mapping
+ *  position hashes to the games (and plies) where the positions occur
+ *  Author:  Bill Forster
+ *  License: MIT license. Full text of license is in associated file LICENSE
+ *  Copyright 2010-2016, Bill Forster <billforsternz at gmail dot com>
+ ****************************************************************************/
+#ifndef POSITION_INDEX_H
+#define POSITION_INDEX_H
+#include <stdio.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include "thc.h"
+#include "ProgressBar.h"
+#include "ListableGame.h"
+
+// Games are identified by their position in the .tdb file (game_nbr=0 for the first
+//  game in the file), because game_ids are allocated afresh each time a file is loaded
+struct PositionIndexPosting
+{
+    uint32_t       game_nbr;
+    unsigned short ply;
+};
+
+class PositionIndex
+{
+public:
+    PositionIndex() { file=NULL; Clear(); }
+    ~PositionIndex() { Clear(); }
+    void Clear();
+    bool IsLoaded() { return loaded; }
+
+    // The sidecar file lives alongside the .tdb file
+    static std::string SidecarFilename( const std::string &tdb_filename );
+
+    // Build the index from loaded games and write it out, top_game_id is the game_id of game_nbr 0
+    bool Build( std::vector< smart_ptr<ListableGame> > &games, uint32_t top_game_id,
+                const std::string &tdb_filename, std::string &error_msg, ProgressBar *pb=NULL );
+
+    // Load the index, returns false if there is no index, or it doesn't match the .tdb file.
+    //  Only the partition directory is read, the file stays open for Lookup()
+    bool Load( const std::string &tdb_filename, uint32_t nbr_games, std::string &error_msg );
+
+    // Find the plies (with the right side to move) in each game that reach a position with
+    //  this hash, in game_nbr then ply order. Different positions can have the same hash,
+    //  so the caller must check the position at each ply. Returns false if the file can't be read
+    bool Lookup( uint64_t hash, bool white, std::vector<PositionIndexPosting> &postings );
+
+private:
+    bool     loaded;
+    uint32_t nbr_games;
+    FILE    *file;
+
+    // The postings are partitioned by the top partition_bits bits of their hashes, Lookup()
+    //  reads one partition. partition_starts[i] is the first posting of partition i, with
+    //  an extra entry at the end
+    int      partition_bits;
+    uint64_t nbr_postings;
+    uint64_t data_offset;       // in the file, of the first partition
+    std::vector<uint64_t> partition_starts;
+};
+
+#endif  // POSITION_INDEX_H
@@ -16,6 +16,7 @@
         HashLookup.h
         ChessPosition.cpp
         ChessRules.cpp
+        ChessRulesBitboard.cpp
         ChessEvaluation.cpp
         Move.cpp
         PrivateChessDefs.cpp
@@ -2107,6 +2108,9 @@ uint64_t ChessPosition::Hash64Update( uint64_t hash_in, Move move )
  *  Copyright 2010-2020, Bill Forster <billforsternz at gmail dot com>
  ****************************************************************************/
 
+//-- preferences
+#define USE_BITBOARD_MOVE_GENERATOR     // see ChessRulesBitboard.cpp below
+
 // Table indexed by Square, gives mask for DETAIL_CASTLING, such that a move
 //  to (or from) that square results in castling being prohibited, eg a move
 //  to e8 means that subsequently black kingside and black queenside castling
@@ -2349,6 +2353,19 @@ void ChessRules::GenLegalMoveList( vector<Move>  &moves,
  * Create a list of all legal moves in this position
  ****************************************************************************/
 void ChessRules::GenLegalMoveList( MOVELIST *list )
+{
+#ifdef USE_BITBOARD_MOVE_GENERATOR
+    if( GenLegalMoveListBitboard(list) )
+        return;     // else an unusual position, use the original generator
+#endif
+    GenLegalMoveListMailbox( list );
+}
+
+/****************************************************************************
+ * Create a list of all legal moves in this position, the original way;
+ *  generate all moves, then weed out those that leave the king in check
+ ****************************************************************************/
+void ChessRules::GenLegalMoveListMailbox( MOVELIST *list )
 {
     int i, j;
     bool okay;
@@ -3337,6 +3354,66 @@ void ChessRules::PopMove( Move& m )
 }
 
 
+/****************************************************************************
+ * Is a candidate move legal ? The move must be a move the piece can make
+ *  (eg a knight move to an empty square or enemy piece), this checks the
+ *  move doesn't leave the king in check, and checks the castling rules.
+ *  Much cheaper than generating a list of legal moves.
+ ****************************************************************************/
+bool ChessRules::CandidateMoveLegal( Move mv )
+{
+    char piece = squares[mv.src];
+    if( white ? !IsWhite(piece) : !IsBlack(piece) )
+        return false;
+    switch( mv.special )
+    {
+        case SPECIAL_WK_CASTLING:
+            return( piece=='K' && mv.src==e1 && wking && squares[h1]=='R' &&
+                    squares[f1]==' ' && squares[g1]==' ' &&
+                    !AttackedSquare(e1,false) && !AttackedSquare(f1,false) && !AttackedSquare(g1,false) );
+        case SPECIAL_WQ_CASTLING:
+            return( piece=='K' && mv.src==e1 && wqueen && squares[a1]=='R' &&
+                    squares[b1]==' ' && squares[c1]==' ' && squares[d1]==' ' &&
+                    !AttackedSquare(e1,false) && !AttackedSquare(d1,false) && !AttackedSquare(c1,false) );
+        case SPECIAL_BK_CASTLING:
+            return( piece=='k' && mv.src==e8 && bking && squares[h8]=='r' &&
+                    squares[f8]==' ' && squares[g8]==' ' &&
+                    !AttackedSquare(e8,true) && !AttackedSquare(f8,true) && !AttackedSquare(g8,true) );
+        case SPECIAL_BQ_CASTLING:
+            return( piece=='k' && mv.src==e8 && bqueen && squares[a8]=='r' &&
+                    squares[b8]==' ' && squares[c8]==' ' && squares[d8]==' ' &&
+                    !AttackedSquare(e8,true) && !AttackedSquare(d8,true) && !AttackedSquare(c8,true) );
+        default:
+            break;
+    }
+
+    // Temporarily make the move, then see whether the king is attacked
+    Square king = (Square)( white ? wking_square : bking_square );
+    if( mv.special == SPECIAL_KING_MOVE )
+        king = mv.dst;
+    Square ep_square = SQUARE_INVALID;
+    if( mv.special == SPECIAL_WEN_PASSANT )
+        ep_square = SOUTH(mv.dst);
+    else if( mv.special == SPECIAL_BEN_PASSANT )
+        ep_square = NORTH(mv.dst);
+    char target = squares[mv.dst];
+    char ep_target = ' ';
+    squares[mv.dst] = piece;
+    squares[mv.src] = ' ';
+    if( ep_square != SQUARE_INVALID )
+    {
+        ep_target = squares[ep_square];
+        squares[ep_square] = ' ';
+    }
+    bool legal = !AttackedSquare( king, !white );
+    if( ep_square != SQUARE_INVALID )
+        squares[ep_square] = ep_target;
+    squares[mv.src] = piece;
+    squares[mv.dst] = target;
+    return legal;
+}
+
+
 /****************************************************************************
  * Determine if an occupied square is attacked
  ****************************************************************************/
@@ -3687,6 +3764,484 @@ bool ChessRules::IsLegal( ILLEGAL_REASON& reason )
     return( legal );
 }
 
+/****************************************************************************
+ * ChessRulesBitboard.cpp Chess classes - Legal move generation with bitboards
+ *  Author:  Bill Forster
+ *  License: MIT license. Full text of license is in associated file LICENSE
+ *  Copyright 2010-2020, Bill Forster <billforsternz at gmail dot com>
+ ****************************************************************************/
+
+/*
+    Bit n of a bitboard represents Square n, so a8 is bit 0 and h1 is bit 63.
+
+    Rather than generate all moves then play each one to see whether it leaves
+    the king in check, we work out the checking pieces and pinned pieces first,
+    and only generate legal moves. Sliding piece attacks are calculated one ray
+    at a time (the first blocker on a ray is found with a bit scan). There are
+    faster ways to do this (magic bitboards etc.) but this way needs only small
+    tables, doesn't depend on 64 bit hardware, and lets us generate the moves in
+    exactly the same order as GenLegalMoveListMailbox() does. Some code relies
+    on that order, for example the compressed move formats used in databases
+    store the index of a move in the legal move list.
+ */
+
+// Ray directions. Rays with a negative delta run towards a8 (bit 0), so the
+//  nearest blocker on those rays is the most significant bit
+enum RAY_DIRECTION { RAY_N, RAY_S, RAY_E, RAY_W, RAY_NE, RAY_NW, RAY_SE, RAY_SW, NBR_RAYS };
+static const int ray_delta[NBR_RAYS]       = { -8, 8, 1, -1, -7, -9, 9, 7 };
+static const int ray_file_delta[NBR_RAYS]  = {  0, 0, 1, -1,  1, -1, 1, -1 };
+static const int ray_rank_delta[NBR_RAYS]  = { -1, 1, 0,  0, -1, -1, 1,  1 };
+#define IsOrthogonal(dir) ((dir)<=RAY_W)
+
+static inline uint64_t BitboardSquare( int sq )
+{
+    return 1ULL << sq;
+}
+
+// De Bruijn sequence lookup, for compilers without a bit scan intrinsic
+#if !defined(__GNUC__)
+static const int debruijn_lookup[32] =
+{
+     0,  1, 28,  2, 29, 14, 24,  3, 30, 22, 20, 15, 25, 17,  4,  8,
+    31, 27, 13, 23, 21, 19, 16,  7, 26, 12, 18,  6, 11,  5, 10,  9
+};
+#endif
+
+// Index of least significant set bit (bb must be non zero)
+static inline int BitScanLow( uint64_t bb )
+{
+#if defined(__GNUC__)
+    return __builtin_ctzll(bb);
+#else
+    unsigned int lo = (unsigned int)bb;
+    int base = 0;
+    if( lo == 0 )
+    {
+        lo = (unsigned int)(bb>>32);
+        base = 32;
+    }
+    return base + debruijn_lookup[ ((lo & (0u-lo)) * 0x077CB531u) >> 27 ];
+#endif
+}
+
+// Index of most significant set bit (bb must be non zero)
+static inline int BitScanHigh( uint64_t bb )
+{
+#if defined(__GNUC__)
+    return 63 - __builtin_clzll(bb);
+#else
+    unsigned int hi = (unsigned int)(bb>>32);
+    int base = 32;
+    if( hi == 0 )
+    {
+        hi = (unsigned int)bb;
+        base = 0;
+    }
+    hi |= hi>>1;    // smear the top bit down, then isolate it
+    hi |= hi>>2;
+    hi |= hi>>4;
+    hi |= hi>>8;
+    hi |= hi>>16;
+    hi -= (hi>>1);
+    return base + debruijn_lookup[ (hi * 0x077CB531u) >> 27 ];
+#endif
+}
+
+// Tables calculated once at startup
+struct BitboardTables
+{
+    uint64_t rays[NBR_RAYS][64];        // squares along a ray, not including the start square
+    uint64_t between[64][64];           // squares strictly between two squares on a common ray
+    uint64_t knight_attacks[64];
+    uint64_t king_attacks[64];
+    uint64_t pawn_attacks[2][64];       // [0] = attacks of a white pawn on the square, [1] = black
+
+    // The ray directions for the sliding pieces on each square, in the same order
+    //  as the mailbox lookup tables, first element is the number of directions
+    unsigned char bishop_rays[64][5];
+    unsigned char rook_rays[64][5];
+    unsigned char queen_rays[64][9];
+
+    BitboardTables();
+    void RaysFromLookup( unsigned char *rays, const lte *ptr, int sq );
+};
+
+BitboardTables::BitboardTables()
+{
+    memset( between, 0, sizeof(between) );
+    for( int sq=0; sq<64; sq++ )
+    {
+        int file = sq&7;
+        int rank = sq>>3;   // 0 is rank 8
+        for( int dir=0; dir<NBR_RAYS; dir++ )
+        {
+            uint64_t ray = 0;
+            int f = file + ray_file_delta[dir];
+            int r = rank + ray_rank_delta[dir];
+            while( 0<=f && f<8 && 0<=r && r<8 )
+            {
+                int dst = r*8 + f;
+                between[sq][dst] = ray;
+                ray |= BitboardSquare(dst);
+                f += ray_file_delta[dir];
+                r += ray_rank_delta[dir];
+            }
+            rays[dir][sq] = ray;
+        }
+        static const int knight_file_delta[8] = { 1, 2, 2, 1, -1, -2, -2, -1 };
+        static const int knight_rank_delta[8] = { -2, -1, 1, 2, 2, 1, -1, -2 };
+        knight_attacks[sq] = 0;
+        king_attacks[sq] = 0;
+        for( int i=0; i<8; i++ )
+        {
+            int f = file + knight_file_delta[i];
+            int r = rank + knight_rank_delta[i];
+            if( 0<=f && f<8 && 0<=r && r<8 )
+                knight_attacks[sq] |= BitboardSquare(r*8+f);
+            f = file + ray_file_delta[i];
+            r = rank + ray_rank_delta[i];
+            if( 0<=f && f<8 && 0<=r && r<8 )
+                king_attacks[sq] |= BitboardSquare(r*8+f);
+        }
+        pawn_attacks[0][sq] = 0;
+        pawn_attacks[1][sq] = 0;
+        if( rank > 0 )
+        {
+            if( file > 0 )
+                pawn_attacks[0][sq] |= BitboardSquare(NW(sq));
+            if( file < 7 )
+                pawn_attacks[0][sq] |= BitboardSquare(NE(sq));
+        }
+        if( rank < 7 )
+        {
+            if( file > 0 )
+                pawn_attacks[1][sq] |= BitboardSquare(SW(sq));
+            if( file < 7 )
+                pawn_attacks[1][sq] |= BitboardSquare(SE(sq));
+        }
+        RaysFromLookup( bishop_rays[sq], bishop_lookup[sq], sq );
+        RaysFromLookup( rook_rays[sq],   rook_lookup[sq],   sq );
+        RaysFromLookup( queen_rays[sq],  queen_lookup[sq],  sq );
+    }
+}
+
+// Identify the direction of each ray in a mailbox lookup table entry by its first square
+void BitboardTables::RaysFromLookup( unsigned char *rays_out, const lte *ptr, int sq )
+{
+    int n = 0;
+    lte nbr_rays = *ptr++;
+    while( nbr_rays-- )
+    {
+        lte ray_len = *ptr++;
+        if( ray_len > 0 )
+        {
+            int delta = (int)ptr[0] - sq;
+            for( int dir=0; dir<NBR_RAYS; dir++ )
+            {
+                if( delta == ray_delta[dir] )
+                    rays_out[1+n++] = (unsigned char)dir;
+            }
+        }
+        ptr += ray_len;
+    }
+    rays_out[0] = (unsigned char)n;
+}
+
+static const BitboardTables bitboard_tables;
+
+// Squares attacked along one ray, up to and including the first blocker
+static inline uint64_t RayAttacks( int dir, int sq, uint64_t occupied )
+{
+    uint64_t attacks  = bitboard_tables.rays[dir][sq];
+    uint64_t blockers = attacks & occupied;
+    if( blockers )
+    {
+        int blocker = ray_delta[dir]>0 ? BitScanLow(blockers) : BitScanHigh(blockers);
+        attacks &= ~bitboard_tables.rays[dir][blocker];
+    }
+    return attacks;
+}
+
+// The position as bitboards
+struct BitboardPosition
+{
+    uint64_t colour[2];     // [0] = white, [1] = black
+    uint64_t occupied;
+    uint64_t pawns;
+    uint64_t knights;
+    uint64_t bishops;       // bishops and queens
+    uint64_t rooks;         // rooks and queens
+    uint64_t kings;
+
+    // Pieces of side 'by' attacking a square, given an occupancy. Pieces not in the occupancy
+    //  (eg a pawn captured en passant) don't count
+    uint64_t Attackers( int sq, int by, uint64_t occ ) const
+    {
+        const BitboardTables &t = bitboard_tables;
+        uint64_t attackers = (t.pawn_attacks[1-by][sq] & pawns) |
+                             (t.knight_attacks[sq] & knights)   |
+                             (t.king_attacks[sq] & kings);
+        uint64_t sliders = colour[by] & occ;
+        if( bishops & sliders )
+        {
+            attackers |= bishops & ( RayAttacks(RAY_NE,sq,occ) | RayAttacks(RAY_NW,sq,occ) |
+                                     RayAttacks(RAY_SE,sq,occ) | RayAttacks(RAY_SW,sq,occ) );
+        }
+        if( rooks & sliders )
+        {
+            attackers |= rooks & ( RayAttacks(RAY_N,sq,occ) | RayAttacks(RAY_S,sq,occ) |
+                                   RayAttacks(RAY_E,sq,occ) | RayAttacks(RAY_W,sq,occ) );
+        }
+        return attackers & colour[by] & occ;
+    }
+};
+
+// Add a move to the list
+static inline void BitboardAddMove( MOVELIST *list, int src, int dst, SPECIAL special, char capture )
+{
+    Move *m = &list->moves[list->count++];
+    m->src     = (Square)src;
+    m->dst     = (Square)dst;
+    m->special = special;
+    m->capture = capture;
+}
+
+// Add a pawn move, or all four promotions (in the same order as the mailbox generator)
+static inline void BitboardAddPawnMove( MOVELIST *list, int src, int dst, SPECIAL special, char capture, bool promotion )
+{
+    if( !promotion )
+        BitboardAddMove( list, src, dst, special, capture );
+    else
+    {
+        BitboardAddMove( list, src, dst, SPECIAL_PROMOTION_QUEEN,  capture );
+        BitboardAddMove( list, src, dst, SPECIAL_PROMOTION_KNIGHT, capture );
+        BitboardAddMove( list, src, dst, SPECIAL_PROMOTION_BISHOP, capture );
+        BitboardAddMove( list, src, dst, SPECIAL_PROMOTION_ROOK,   capture );
+    }
+}
+
+/****************************************************************************
+ * Create a list of all legal moves in this position using bitboards. Returns
+ *  false, without generating any moves, for unusual positions (eg missing
+ *  kings, pawns on the first or last rank) that are left to the mailbox
+ *  generator
+ ****************************************************************************/
+bool ChessRules::GenLegalMoveListBitboard( MOVELIST *list )
+{
+    const BitboardTables &t = bitboard_tables;
+    BitboardPosition bp;
+    memset( &bp, 0, sizeof(bp) );
+    for( int sq=0; sq<64; sq++ )
+    {
+        uint64_t bit = BitboardSquare(sq);
+        switch( squares[sq] )
+        {
+            case ' ':                                       break;
+            case 'P': bp.colour[0] |= bit; bp.pawns   |= bit; break;
+            case 'N': bp.colour[0] |= bit; bp.knights |= bit; break;
+            case 'B': bp.colour[0] |= bit; bp.bishops |= bit; break;
+            case 'R': bp.colour[0] |= bit; bp.rooks   |= bit; break;
+            case 'Q': bp.colour[0] |= bit; bp.bishops |= bit; bp.rooks |= bit; break;
+            case 'K': bp.colour[0] |= bit; bp.kings   |= bit; break;
+            case 'p': bp.colour[1] |= bit; bp.pawns   |= bit; break;
+            case 'n': bp.colour[1] |= bit; bp.knights |= bit; break;
+            case 'b': bp.colour[1] |= bit; bp.bishops |= bit; break;
+            case 'r': bp.colour[1] |= bit; bp.rooks   |= bit; break;
+            case 'q': bp.colour[1] |= bit; bp.bishops |= bit; bp.rooks |= bit; break;
+            case 'k': bp.colour[1] |= bit; bp.kings   |= bit; break;
+            default:  return false;
+        }
+    }
+    bp.occupied = bp.colour[0] | bp.colour[1];
+
+    // Check the position is one we handle
+    if( (bp.kings & bp.colour[0]) != BitboardSquare(wking_square) ||
+        (bp.kings & bp.colour[1]) != BitboardSquare(bking_square) ||
+        squares[e1]=='k' || squares[e8]=='K' )  // the mailbox generator would try castling
+        return false;
+    const uint64_t first_and_last_ranks = 0xff000000000000ffULL;
+    if( bp.pawns & first_and_last_ranks )
+        return false;
+    int ep = enpassant_target;
+    if( ep != SQUARE_INVALID )
+    {
+        bool ok = white ? ( a6<=ep && ep<=h6 && squares[ep]==' ' && squares[SOUTH(ep)]=='p' )
+                        : ( a3<=ep && ep<=h3 && squares[ep]==' ' && squares[NORTH(ep)]=='P' );
+        if( !ok )
+            return false;
+    }
+
+    // Checking pieces. In double check only king moves can be legal
+    int us   = white ? 0 : 1;
+    int them = 1 - us;
+    uint64_t own = bp.colour[us];
+    uint64_t occ = bp.occupied;
+    int king = white ? wking_square : bking_square;
+    uint64_t checkers = bp.Attackers( king, them, occ );
+    uint64_t check_mask = ~0ULL;
+    if( checkers )
+    {
+        if( checkers & (checkers-1) )
+            check_mask = 0;
+        else
+            check_mask = checkers | t.between[king][BitScanLow(checkers)];
+    }
+
+    // Pinned pieces can only move along the ray between king and pinner
+    uint64_t pinned = 0;
+    uint64_t pin_mask[64];
+    for( int dir=0; dir<NBR_RAYS; dir++ )
+    {
+        uint64_t pinners = (IsOrthogonal(dir) ? bp.rooks : bp.bishops) & bp.colour[them];
+        if( 0 == (pinners & t.rays[dir][king]) )
+            continue;
+        uint64_t blocker = RayAttacks(dir,king,occ) & own;
+        if( blocker )
+        {
+            uint64_t beyond = RayAttacks( dir, king, occ^blocker );
+            if( beyond & pinners )
+            {
+                pinned |= blocker;
+                pin_mask[BitScanLow(blocker)] = beyond;
+            }
+        }
+    }
+
+    // Generate moves, looping through our pieces in the same order as the mailbox generator
+    list->count = 0;
+    uint64_t todo = own;
+    while( todo )
+    {
+        int src = BitScanLow(todo);
+        todo &= (todo-1);
+        uint64_t legal = ~own & check_mask;
+        if( pinned & BitboardSquare(src) )
+            legal &= pin_mask[src];
+        const lte *ptr;
+        lte n;
+        switch( squares[src] )
+        {
+            case 'P':
+            case 'p':
+            {
+                bool promotion = white ? RANK(src)=='7' : RANK(src)=='2';
+                ptr = white ? pawn_white_lookup[src] : pawn_black_lookup[src];
+
+                // Captures, including en passant
+                n = *ptr++;
+                while( n-- )
+                {
+                    int dst = *ptr++;
+                    if( dst == ep )
+                    {
+                        int captured = white ? SOUTH(dst) : NORTH(dst);
+                        uint64_t occ_after = (occ ^ BitboardSquare(src) ^ BitboardSquare(captured)) | BitboardSquare(dst);
+                        if( !bp.Attackers(king,them,occ_after) )
+                            BitboardAddMove( list, src, dst, white?SPECIAL_WEN_PASSANT:SPECIAL_BEN_PASSANT, white?'p':'P' );
+                    }
+                    else if( (bp.colour[them] & legal & BitboardSquare(dst)) )
+                        BitboardAddPawnMove( list, src, dst, NOT_SPECIAL, squares[dst], promotion );
+                }
+
+                // Advances, one or two squares
+                n = *ptr++;
+                for( int i=0; i<n; i++ )
+                {
+                    int dst = *ptr++;
+                    if( occ & BitboardSquare(dst) )
+                        break;
+                    if( legal & BitboardSquare(dst) )
+                        BitboardAddPawnMove( list, src, dst, i==0 ? NOT_SPECIAL : (white?SPECIAL_WPAWN_2SQUARES:SPECIAL_BPAWN_2SQUARES), ' ', promotion );
+                }
+                break;
+            }
+
+            case 'N':
+            case 'n':
+            {
+                ptr = knight_lookup[src];
+                n = *ptr++;
+                while( n-- )
+                {
+                    int dst = *ptr++;
+                    if( legal & BitboardSquare(dst) )
+                        BitboardAddMove( list, src, dst, NOT_SPECIAL, squares[dst] );
+                }
+                break;
+            }
+
+            case 'B':
+            case 'b':
+            case 'R':
+            case 'r':
+            case 'Q':
+            case 'q':
+            {
+                char piece = squares[src] & 0xdf;   // upper case
+                const unsigned char *rays = piece=='B' ? t.bishop_rays[src] : (piece=='R' ? t.rook_rays[src] : t.queen_rays[src]);
+                int nbr_rays = *rays++;
+                while( nbr_rays-- )
+                {
+                    int dir = *rays++;
+                    uint64_t targets = RayAttacks(dir,src,occ) & legal;
+                    while( targets )
+                    {
+                        int dst = ray_delta[dir]>0 ? BitScanLow(targets) : BitScanHigh(targets);
+                        targets &= ~BitboardSquare(dst);
+                        BitboardAddMove( list, src, dst, NOT_SPECIAL, squares[dst] );
+                    }
+                }
+                break;
+            }
+
+            case 'K':
+            case 'k':
+            {
+                uint64_t occ_without_king = occ ^ BitboardSquare(src);
+                ptr = king_lookup[src];
+                n = *ptr++;
+                while( n-- )
+                {
+                    int dst = *ptr++;
+                    if( !(own & BitboardSquare(dst)) && !bp.Attackers(dst,them,occ_without_king) )
+                        BitboardAddMove( list, src, dst, SPECIAL_KING_MOVE, squares[dst] );
+                }
+
+                // Castling, same conditions as KingMoves(), the final test that the king
+                //  isn't in check after castling corresponds to the test in GenLegalMoveListMailbox()
+                if( src==e1 && !checkers )
+                {
+                    if( wking && squares[f1]==' ' && squares[g1]==' ' && squares[h1]=='R' &&
+                        !bp.Attackers(f1,them,occ) && !bp.Attackers(g1,them,occ) &&
+                        !bp.Attackers( g1, them, (occ ^ BitboardSquare(e1) ^ BitboardSquare(h1)) | BitboardSquare(f1) | BitboardSquare(g1) )
+                      )
+                        BitboardAddMove( list, e1, g1, SPECIAL_WK_CASTLING, ' ' );
+                    if( wqueen && squares[d1]==' ' && squares[c1]==' ' && squares[b1]==' ' && squares[a1]=='R' &&
+                        !bp.Attackers(d1,them,occ) && !bp.Attackers(c1,them,occ) &&
+                        !bp.Attackers( c1, them, (occ ^ BitboardSquare(e1) ^ BitboardSquare(a1)) | BitboardSquare(d1) | BitboardSquare(c1) )
+                      )
+                        BitboardAddMove( list, e1, c1, SPECIAL_WQ_CASTLING, ' ' );
+                }
+                else if( src==e8 && !checkers )
+                {
+                    if( bking && squares[f8]==' ' && squares[g8]==' ' && squares[h8]=='r' &&
+                        !bp.Attackers(f8,them,occ) && !bp.Attackers(g8,them,occ) &&
+                        !bp.Attackers( g8, them, (occ ^ BitboardSquare(e8) ^ BitboardSquare(h8)) | BitboardSquare(f8) | BitboardSquare(g8) )
+                      )
+                        BitboardAddMove( list, e8, g8, SPECIAL_BK_CASTLING, ' ' );
+                    if( bqueen && squares[d8]==' ' && squares[c8]==' ' && squares[b8]==' ' && squares[a8]=='r' &&
+                        !bp.Attackers(d8,them,occ) && !bp.Attackers(c8,them,occ) &&
+                        !bp.Attackers( c8, them, (occ ^ BitboardSquare(e8) ^ BitboardSquare(a8)) | BitboardSquare(d8) | BitboardSquare(c8) )
+                      )
+                        BitboardAddMove( list, e8, c8, SPECIAL_BQ_CASTLING, ' ' );
+                }
+                break;
+            }
+        }
+    }
+    return true;
+}
+
 /****************************************************************************
  * ChessEvaluation.cpp Chess classes - Simple chess AI, leaf scoring function for position
  *  Author:  Bill Forster
@@ -6133,12 +6688,17 @@ bool Move::NaturalIn( ChessRules *cr, const char *natural_in )
 /****************************************************************************
  * Read natural string move eg "Nf3"
  *  return bool okay
- * Fast alternative for known good input
+ * Fast alternative for standard notation, finds the piece(s) that can make
+ *  the move and tests only them for legality, rather than generating all
+ *  legal moves. Anything else is passed on to NaturalIn(), so the result is
+ *  always the same as NaturalIn()
  ****************************************************************************/
 bool Move::NaturalInFast( ChessRules *cr, const char *natural_in )
 {
+    const char *natural_in_original = natural_in;
     bool err = false;
     bool found = false;
+    bool legality_tested = false;
     bool capture_ = false;
     Move mv;
 
@@ -6241,7 +6801,7 @@ bool Move::NaturalInFast( ChessRules *cr, const char *natural_in )
             else // if ( r == 'x' )
             {
                 char g = *natural_in++;
-                if( 'a'<=g && g<='h' )
+                if( 'a'<=g && g<='h' && (g==f-1 || g==f+1) )
                 {
                     r = *natural_in++;
 
@@ -6362,6 +6922,8 @@ bool Move::NaturalInFast( ChessRules *cr, const char *natural_in )
                             mv.special = SPECIAL_KING_MOVE;
                             mv.capture = cr->squares[mv.dst];
                             found = ( capture_ ? IsBlack(mv.capture) : IsEmptySquare(mv.capture) );
+                            if( abs(IFILE(mv.src)-IFILE(mv.dst))>1 || abs(IRANK(mv.src)-IRANK(mv.dst))>1 )
+                                found = false;  // eg "Kg1" for castling, leave it to NaturalIn()
                         }
                     }
                     break;
@@ -6432,7 +6994,8 @@ bool Move::NaturalInFast( ChessRules *cr, const char *natural_in )
                                 mv.capture = cr->squares[mv.dst];
                                 if( piece == 'N' )
                                 {
-                                    int count=0;
+                                    int count=0, nbr_legal=0;
+                                    Square legal_src=a8;
                                     for( int probe=0; !found && probe<2; probe++ )
                                     {
                                         const lte *ptr = knight_lookup[mv.dst];
@@ -6449,26 +7012,31 @@ bool Move::NaturalInFast( ChessRules *cr, const char *natural_in )
                                                     mv.src = src_;
                                                     if( probe == 0 )
                                                         count++;
-                                                    else // probe==1 means disambiguate by testing whether move is legal, found will be set if
-                                                        // we are not exposing white king to check.
+                                                    else // probe==1 means disambiguate by testing whether move is legal, if exactly
+                                                         // one candidate is legal that's the move (else the move is ambiguous)
                                                     {
-                                                        char temp = cr->squares[mv.dst];
-                                                        cr->squares[mv.dst] = 'N';  // temporarily make move
-                                                        cr->squares[src_] = ' ';
-                                                        found = !cr->AttackedSquare( cr->wking_square, false ); //bool AttackedSquare( Square square, bool enemy_is_white );
-                                                        cr->squares[mv.dst] = temp;  // now undo move
-                                                        cr->squares[src_] = 'N';
+                                                        if( cr->CandidateMoveLegal(mv) )
+                                                        {
+                                                            nbr_legal++;
+                                                            legal_src = src_;
+                                                        }
                                                     }
                                                 }
                                             }
                                         }
                                         if( probe==0 && count==1 )
                                             found = true; // done, no need for disambiguation by check
+                                        else if( probe==1 && nbr_legal==1 )
+                                        {
+                                            mv.src = legal_src;
+                                            found = legality_tested = true;
+                                        }
                                     }
                                 }
                                 else // if( rook, bishop, queen )
                                 {
-                                    int count = 0;
+                                    int count=0, nbr_legal=0;
+                                    Square legal_src=a8;
                                     for( int probe=0; !found && probe<2; probe++ )
                                     {
                                         const lte *ptr = ray_lookup[mv.dst];
@@ -6493,15 +7061,14 @@ bool Move::NaturalInFast( ChessRules *cr, const char *natural_in )
                                                             mv.src = src_;
                                                             if( probe == 0 )
                                                                 count++;
-                                                            else // probe==1 means disambiguate by testing whether move is legal, found will be set if
-                                                                // we are not exposing white king to check.
+                                                            else // probe==1 means disambiguate by testing whether move is legal, if exactly
+                                                                 // one candidate is legal that's the move (else the move is ambiguous)
                                                             {
-                                                                char temp = cr->squares[mv.dst];
-                                                                cr->squares[mv.dst] = piece;  // temporarily make move
-                                                                cr->squares[mv.src] = ' ';
-                                                                found = !cr->AttackedSquare( cr->wking_square, false ); //bool AttackedSquare( Square square, bool enemy_is_white );
-                                                                cr->squares[mv.dst] = temp;  // now undo move
-                                                                cr->squares[mv.src] = piece;
+                                                                if( cr->CandidateMoveLegal(mv) )
+                                                                {
+                                                                    nbr_legal++;
+                                                                    legal_src = src_;
+                                                                }
                                                             }
                                                         }
                                                     }
@@ -6510,6 +7077,11 @@ bool Move::NaturalInFast( ChessRules *cr, const char *natural_in )
                                         }
                                         if( probe==0 && count==1 )
                                             found = true; // done, no need for disambiguation by check
+                                        else if( probe==1 && nbr_legal==1 )
+                                        {
+                                            mv.src = legal_src;
+                                            found = legality_tested = true;
+                                        }
                                     }
                                 }
                             }
@@ -6595,7 +7167,7 @@ bool Move::NaturalInFast( ChessRules *cr, const char *natural_in )
             else // if ( r == 'x' )
             {
                 char g = *natural_in++;
-                if( 'a'<=g && g<='h' )
+                if( 'a'<=g && g<='h' && (g==f-1 || g==f+1) )
                 {
                     r = *natural_in++;
 
@@ -6716,6 +7288,8 @@ bool Move::NaturalInFast( ChessRules *cr, const char *natural_in )
                             mv.special = SPECIAL_KING_MOVE;
                             mv.capture = cr->squares[mv.dst];
                             found = ( capture_ ? IsWhite(mv.capture) : IsEmptySquare(mv.capture) );
+                            if( abs(IFILE(mv.src)-IFILE(mv.dst))>1 || abs(IRANK(mv.src)-IRANK(mv.dst))>1 )
+                                found = false;  // eg "Kg1" for castling, leave it to NaturalIn()
                         }
                     }
                     break;
@@ -6786,7 +7360,8 @@ bool Move::NaturalInFast( ChessRules *cr, const char *natural_in )
                                 mv.capture = cr->squares[mv.dst];
                                 if( piece == 'n' )
                                 {
-                                    int count=0;
+                                    int count=0, nbr_legal=0;
+                                    Square legal_src=a8;
                                     for( int probe=0; !found && probe<2; probe++ )
                                     {
                                         const lte *ptr = knight_lookup[mv.dst];
@@ -6803,26 +7378,31 @@ bool Move::NaturalInFast( ChessRules *cr, const char *natural_in )
                                                     mv.src = src_;
                                                     if( probe == 0 )
                                                         count++;
-                                                    else // probe==1 means disambiguate by testing whether move is legal, found will be set if
-                                                        // we are not exposing black king to check.
+                                                    else // probe==1 means disambiguate by testing whether move is legal, if exactly
+                                                         // one candidate is legal that's the move (else the move is ambiguous)
                                                     {
-                                                        char temp = cr->squares[mv.dst];
-                                                        cr->squares[mv.dst] = 'n';  // temporarily make move
-                                                        cr->squares[mv.src] = ' ';
-                                                        found = !cr->AttackedSquare( cr->bking_square, true ); //bool AttackedSquare( Square square, bool enemy_is_white );
-                                                        cr->squares[mv.dst] = temp;  // now undo move
-                                                        cr->squares[mv.src] = 'n';
+                                                        if( cr->CandidateMoveLegal(mv) )
+                                                        {
+                                                            nbr_legal++;
+                                                            legal_src = src_;
+                                                        }
                                                     }
                                                 }
                                             }
                                         }
                                         if( probe==0 && count==1 )
                                             found = true; // done, no need for disambiguation by check
+                                        else if( probe==1 && nbr_legal==1 )
+                                        {
+                                            mv.src = legal_src;
+                                            found = legality_tested = true;
+                                        }
                                     }
                                 }
                                 else // if( rook, bishop, queen )
                                 {
-                                    int count = 0;
+                                    int count=0, nbr_legal=0;
+                                    Square legal_src=a8;
                                     for( int probe=0; !found && probe<2; probe++ )
                                     {
                                         const lte *ptr = ray_lookup[mv.dst];
@@ -6847,15 +7427,14 @@ bool Move::NaturalInFast( ChessRules *cr, const char *natural_in )
                                                             mv.src = src_;
                                                             if( probe == 0 )
                                                                 count++;
-                                                            else // probe==1 means disambiguate by testing whether move is legal, found will be set if
-                                                                // we are not exposing black king to check.
+                                                            else // probe==1 means disambiguate by testing whether move is legal, if exactly
+                                                                 // one candidate is legal that's the move (else the move is ambiguous)
                                                             {
-                                                                char temp = cr->squares[mv.dst];
-                                                                cr->squares[mv.dst] = piece;  // temporarily make move
-                                                                cr->squares[mv.src] = ' ';
-                                                                found = !cr->AttackedSquare( cr->bking_square, true ); //bool AttackedSquare( Square square, bool enemy_is_white );
-                                                                cr->squares[mv.dst] = temp;  // now undo move
-                                                                cr->squares[mv.src] = piece;
+                                                                if( cr->CandidateMoveLegal(mv) )
+                                                                {
+                                                                    nbr_legal++;
+                                                                    legal_src = src_;
+                                                                }
                                                             }
                                                         }
                                                     }
@@ -6864,6 +7443,11 @@ bool Move::NaturalInFast( ChessRules *cr, const char *natural_in )
                                         }
                                         if( probe==0 && count==1 )
                                             found = true; // done, no need for disambiguation by check
+                                        else if( probe==1 && nbr_legal==1 )
+                                        {
+                                            mv.src = legal_src;
+                                            found = legality_tested = true;
+                                        }
                                     }
                                 }
                             }
@@ -6875,13 +7459,24 @@ bool Move::NaturalInFast( ChessRules *cr, const char *natural_in )
     }
     if( found )
     {
+        // Allow check, mate and annotation suffixes only (and no longer than NaturalIn() allows)
+        while( *natural_in=='+' || *natural_in=='#' || *natural_in=='!' || *natural_in=='?' )
+            natural_in++;
         char c = *natural_in;
-        bool problem = (isascii(c) && isalnum(c));
+        bool problem = !(c=='\0' || c==' ' || c=='\t' || c=='\r' || c=='\n') ||
+                       natural_in-natural_in_original >= 10;
         if( problem )
             found = false;
-        else
+        else if( !legality_tested )
+            found = cr->CandidateMoveLegal(mv);
+        if( found )
             *this = mv;
     }
+
+    // If we can't find the move quickly (unusual notation, or an illegal or ambiguous move)
+    //  use the slow and forgiving NaturalIn(), so we always get the same result
+    if( !found )
+        found = NaturalIn( cr, natural_in_original );
     return found;
 }
 
@@ -216,7 +216,7 @@ public:
 
     // Read natural string move eg "Nf3"
     //  return bool okay
-    // Fast alternative for known good input
+    // Fast alternative, same result as NaturalIn() but much faster for standard notation
     bool NaturalInFast( ChessRules *cr, const char *natural_in );
 
     // Read terse string move eg "g1f3"
@@ -582,6 +582,10 @@ public:
     // Determine if an occupied square is attacked
     bool AttackedPiece( Square square );
 
+    // Is a move, that the piece can make, legal ? (it doesn't leave the king in
+    //  check, castling is allowed)
+    bool CandidateMoveLegal( Move mv );
+
     // Transform a position with W to move into an equivalent with B to move and vice-versa
     void Transform();
 
@@ -600,6 +604,10 @@ public:
     // Create a list of all legal moves in this position
     void GenLegalMoveList( MOVELIST *list );
 
+    // Create a list of all legal moves in this position, using the original (slower)
+    //  generator, which handles any position
+    void GenLegalMoveListMailbox( MOVELIST *list );
+
     // Create a list of all legal moves in this position, with extra info
     void GenLegalMoveList( MOVELIST *list, bool check[MAXMOVES],
                                            bool mate[MAXMOVES],
@@ -621,6 +629,10 @@ protected:
     //  illegally "moving into check")
     void GenMoveList( MOVELIST *l );
 
+    // Create a list of all legal moves in this position using bitboards, returns
+    //  false (generating no moves) for unusual positions, see thc.cpp
+    bool GenLegalMoveListBitboard( MOVELIST *list );
+
     // Generate moves for pieces that move along multi-move rays (B,R,Q)
     void LongMoves( MOVELIST *l, Square square, const lte *ptr );
 
@@ -0,0 +1,293 @@
+/****************************************************************************
+ * perft.cpp Count the leaf nodes of the move tree for standard test positions,
+ *  to check and time the thc move generator. Needs only thc.cpp, no wxWidgets,
+ *  build with "make perft" in the top level directory
+ *  Author:  Bill Forster
+ *  License: MIT license. Full text of license is in associated file LICENSE
+ *  Copyright 2010-2020, Bill Forster <billforsternz at gmail dot com>
+ ****************************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <chrono>
+#include "thc.h"
+using namespace thc;
+
+// Standard test positions and their expected node counts (from the chess programming wiki)
+#define MAX_DEPTH 6
+struct PerftPosition
+{
+    const char *name;
+    const char *fen;
+    int         depth;                  // default depth for the suite
+    uint64_t    expected[MAX_DEPTH+1];  // expected[d] is the node count at depth d, 0 if unknown
+};
+
+static const PerftPosition positions[] =
+{
+    { "Initial position",
+      "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1", 5,
+      { 1, 20, 400, 8902, 197281, 4865609, 119060324ULL } },
+    { "Kiwipete",
+      "r3k2r/p1ppqpb1/bn2pnp1/3PN3/1p2P3/2N2Q1p/PPPBBPPP/R3K2R w KQkq - 0 1", 4,
+      { 1, 48, 2039, 97862, 4085603, 193690690ULL, 8031647685ULL } },
+    { "Position 3 (en passant and pins)",
+      "8/2p5/3p4/KP5r/1R3p1k/8/4P1P1/8 w - - 0 1", 5,
+      { 1, 14, 191, 2812, 43238, 674624, 11030083 } },
+    { "Position 4 (promotions and castling)",
+      "r3k2r/Pppp1ppp/1b3nbN/nP6/BBP1P3/q4N2/Pp1P2PP/R2Q1RK1 w kq - 0 1", 4,
+      { 1, 6, 264, 9467, 422333, 15833292, 706045033ULL } },
+    { "Position 4 mirrored",
+      "r2q1rk1/pP1p2pp/Q4n2/bbp1p3/Np6/1B3NBn/pPPP1PPP/R3K2R b KQ - 0 1", 4,
+      { 1, 6, 264, 9467, 422333, 15833292, 706045033ULL } },
+    { "Position 5",
+      "rnbq1k1r/pp1Pbppp/2p5/8/2B5/8/PPP1NnPP/RNBQK2R w KQ - 1 8", 4,
+      { 1, 44, 1486, 62379, 2103487, 89941194ULL, 0 } },
+    { "Position 6",
+      "r4rk1/1pp1qppp/p1np1n2/2b1p1B1/2B1P1b1/P1NP1N2/1PP1QPPP/R4RK1 w - - 0 10", 4,
+      { 1, 46, 2079, 89890, 3894594, 164075551ULL, 6923051137ULL } }
+};
+
+static bool use_mailbox;        // use the original move generator
+static bool validate;           // cross check generators and hashes at every node
+static uint64_t validate_errors;
+
+static void Generate( ChessRules &cr, MOVELIST *list )
+{
+    if( use_mailbox )
+        cr.GenLegalMoveListMailbox( list );
+    else
+        cr.GenLegalMoveList( list );
+}
+
+// Check the bitboard generator agrees with the mailbox generator, move for move and
+//  in the same order, returns bool okay
+static bool TestLegalMoveList( ChessRules &cr )
+{
+    MOVELIST list1, list2;
+    cr.GenLegalMoveList( &list1 );
+    cr.GenLegalMoveListMailbox( &list2 );
+    if( list1.count != list2.count )
+        return false;
+    for( int i=0; i<list1.count; i++ )
+    {
+        if( list1.moves[i] != list2.moves[i] )
+            return false;
+    }
+    return true;
+}
+
+// Move generation speed; make and unmake moves, but count the leaves without playing them
+static uint64_t PerftBulk( ChessRules &cr, int depth )
+{
+    if( validate && !TestLegalMoveList(cr) )
+    {
+        validate_errors++;
+        printf( "Move generators disagree: %s\n", cr.ForsythPublish().c_str() );
+    }
+    MOVELIST list;
+    Generate( cr, &list );
+    if( depth <= 1 )
+        return depth==1 ? list.count : 1;
+    uint64_t nodes = 0;
+    for( int i=0; i<list.count; i++ )
+    {
+        cr.PushMove( list.moves[i] );
+        nodes += PerftBulk( cr, depth-1 );
+        cr.PopMove( list.moves[i] );
+    }
+    return nodes;
+}
+
+// PushMove() and PopMove() speed; play every move, including moves to the leaves
+static uint64_t PerftPushPop( ChessRules &cr, int depth )
+{
+    if( depth == 0 )
+        return 1;
+    MOVELIST list;
+    Generate( cr, &list );
+    uint64_t nodes = 0;
+    for( int i=0; i<list.count; i++ )
+    {
+        cr.PushMove( list.moves[i] );
+        nodes += PerftPushPop( cr, depth-1 );
+        cr.PopMove( list.moves[i] );
+    }
+    return nodes;
+}
+
+// PlayMove() speed; play every move on a copy of the position
+static uint64_t PerftPlayMove( ChessRules &cr, int depth )
+{
+    if( depth == 0 )
+        return 1;
+    MOVELIST list;
+    Generate( cr, &list );
+    uint64_t nodes = 0;
+    for( int i=0; i<list.count; i++ )
+    {
+        ChessRules child = cr;
+        child.PlayMove( list.moves[i] );
+        nodes += PerftPlayMove( child, depth-1 );
+    }
+    return nodes;
+}
+
+// Hash64Update() speed; update the hash for every move, including moves to the leaves
+static uint64_t hash_check;     // so the hash calculations can't be optimised away
+static uint64_t PerftHash( ChessRules &cr, int depth, uint64_t hash )
+{
+    if( depth == 0 )
+    {
+        hash_check ^= hash;
+        return 1;
+    }
+    MOVELIST list;
+    Generate( cr, &list );
+    uint64_t nodes = 0;
+    for( int i=0; i<list.count; i++ )
+    {
+        uint64_t hash_after = cr.Hash64Update( hash, list.moves[i] );
+        cr.PushMove( list.moves[i] );
+        if( validate && hash_after != cr.Hash64Calculate() )
+        {
+            validate_errors++;
+            printf( "Hash64Update() error: %s\n", cr.ForsythPublish().c_str() );
+        }
+        nodes += PerftHash( cr, depth-1, hash_after );
+        cr.PopMove( list.moves[i] );
+    }
+    return nodes;
+}
+
+// Perft split by first move, to help track down a wrong count
+static void Divide( ChessRules &cr, int depth )
+{
+    MOVELIST list;
+    Generate( cr, &list );
+    uint64_t total = 0;
+    for( int i=0; i<list.count; i++ )
+    {
+        std::string s = list.moves[i].TerseOut();
+        cr.PushMove( list.moves[i] );
+        uint64_t nodes = PerftBulk( cr, depth-1 );
+        cr.PopMove( list.moves[i] );
+        printf( "%s: %llu\n", s.c_str(), (unsigned long long)nodes );
+        total += nodes;
+    }
+    printf( "Moves: %d\nNodes: %llu\n", list.count, (unsigned long long)total );
+}
+
+enum PERFT_TYPE { PERFT_BULK, PERFT_PUSH_POP, PERFT_PLAY_MOVE, PERFT_HASH, NBR_PERFT_TYPES };
+static const char *perft_type_names[NBR_PERFT_TYPES] =
+{
+    "GenLegalMoveList()",
+    "PushMove()/PopMove()",
+    "PlayMove()",
+    "Hash64Update()"
+};
+
+// Run one kind of perft on one position, returns bool okay
+static bool Run( const PerftPosition &pos, int depth, PERFT_TYPE type, uint64_t &total_nodes, double &total_secs )
+{
+    ChessRules cr;
+    cr.Forsyth( pos.fen );
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    uint64_t nodes=0;
+    switch( type )
+    {
+        case PERFT_BULK:        nodes = PerftBulk( cr, depth );                         break;
+        case PERFT_PUSH_POP:    nodes = PerftPushPop( cr, depth );                      break;
+        case PERFT_PLAY_MOVE:   nodes = PerftPlayMove( cr, depth );                     break;
+        default:                nodes = PerftHash( cr, depth, cr.Hash64Calculate() );   break;
+    }
+    std::chrono::steady_clock::time_point end = std::chrono::steady_clock::now();
+    double secs = std::chrono::duration<double>(end-start).count();
+    total_nodes += nodes;
+    total_secs  += secs;
+    uint64_t expected = depth<=MAX_DEPTH ? pos.expected[depth] : 0;
+    bool ok = (expected==0 || nodes==expected);
+    printf( "  %-36s depth %d %12llu nodes %s\n", pos.name, depth, (unsigned long long)nodes,
+                expected==0 ? "(no expected count)" : (ok ? "ok" : "WRONG") );
+    if( !ok )
+        printf( "  Expected %llu nodes\n", (unsigned long long)expected );
+    return ok;
+}
+
+static void Usage()
+{
+    printf(
+        "Usage: perft [options]\n"
+        "       perft [options] -fen \"<fen>\" <depth>\n"
+        "Options:\n"
+        " -depth <n>  adjust suite depths by n (eg -depth -1 for a quick run)\n"
+        " -mailbox    use the original (mailbox) move generator\n"
+        " -validate   check the move generators agree, and Hash64Update() against\n"
+        "             Hash64Calculate(), at every node (slow, don't trust the timings)\n"
+        "With -fen, print the node count for each move in the position (perft divide)\n"
+    );
+}
+
+int main( int argc, char *argv[] )
+{
+    int depth_adjust = 0;
+    const char *fen = NULL;
+    int fen_depth = 0;
+    for( int i=1; i<argc; i++ )
+    {
+        if( 0 == strcmp(argv[i],"-mailbox") )
+            use_mailbox = true;
+        else if( 0 == strcmp(argv[i],"-validate") )
+            validate = true;
+        else if( 0 == strcmp(argv[i],"-depth") && i+1<argc )
+            depth_adjust = atoi(argv[++i]);
+        else if( 0 == strcmp(argv[i],"-fen") && i+2<argc )
+        {
+            fen = argv[++i];
+            fen_depth = atoi(argv[++i]);
+        }
+        else
+        {
+            Usage();
+            return -1;
+        }
+    }
+
+    // Divide a single position
+    if( fen )
+    {
+        ChessRules cr;
+        if( !cr.Forsyth(fen) || fen_depth<1 )
+        {
+            Usage();
+            return -1;
+        }
+        Divide( cr, fen_depth );
+        return validate_errors ? -1 : 0;
+    }
+
+    // Or the standard suite, once for each of the things we time
+    bool ok = true;
+    if( use_mailbox )
+        printf( "Using the mailbox move generator\n" );
+    for( int type=0; type<NBR_PERFT_TYPES; type++ )
+    {
+        printf( "%s\n", perft_type_names[type] );
+        uint64_t total_nodes = 0;
+        double   total_secs  = 0.0;
+        for( unsigned int i=0; i<sizeof(positions)/sizeof(positions[0]); i++ )
+        {
+            int depth = positions[i].depth + depth_adjust;
+            if( depth < 1 )
+                depth = 1;
+            if( !Run( positions[i], depth, (PERFT_TYPE)type, total_nodes, total_secs ) )
+                ok = false;
+        }
+        printf( "  %llu nodes in %.3f secs, %.2f million nodes/sec\n", (unsigned long long)total_nodes,
+                    total_secs, total_secs>0.0 ? total_nodes/total_secs/1000000.0 : 0.0 );
+    }
+    if( validate )
+        printf( "Validation errors: %llu\n", (unsigned long long)validate_errors );
+    printf( "%s\n", ok && !validate_errors ? "All node counts correct" : "ERRORS" );
+    return ok && !validate_errors ? 0 : -1;
+}